@@ -7,7 +7,31 @@ function unsignedToSigned16bit(value)
     end
 end
 
--- Define a function to parse payload and decode sensor data
+-- Define a function to build a signed 32-bit integer from 4 little endian bytes
+function bytesToSigned32bitLE(b0, b1, b2, b3)
+    local value = b0 + b1 * 256 + b2 * 65536 + b3 * 16777216
+    if value >= 2147483648 then
+        return value - 4294967296
+    else
+        return value
+    end
+end
+
+-- Define a function to decode a TCS34725 channel: 12-bit mantissa x 2^(4-bit exponent), in counts per ms per gain x 256
+function unpackLight(value)
+    local mantissa = value % 4096
+    local exponent = (value - mantissa) / 4096
+    return tonumber(string.format("%.3f", mantissa * 2 ^ exponent / 256))
+end
+
+-- Define a function to test a flag of a byte (no bitwise operators in this Lua)
+function hasFlag(value, flag)
+    return (value % (flag * 2)) >= flag
+end
+
+-- Define a function to parse payload and decode sensor data. Byte 1 tells which sensors the node was
+-- built with (0x01 accelerometer, 0x02 Si7021, 0x04 analog, 0x08 TCS34725, 0x10 GPS), byte 2 is the
+-- status, then each sensor present has its block, in that order
 function parsePayload(appeui, deveui, payloadIn)
     -- Decode the payload into individual variables
     payload, Error = resiot_hexdecode(payloadIn)
@@ -18,176 +42,216 @@ function parsePayload(appeui, deveui, payloadIn)
         -- value read correctly
         --resiot_debug(ArrByte)
     end
+    local presence = payload[1]
+  	local status = payload[2]  -- 0x01 live fix, 0x02 last known position, 0x04 position included, 0x08 fence entered, 0x10 fence left, 0x20 Si7021 failed
+    local pos = 3
+    local worked, err
+
   	-- ACCELEROMETER --
-  	local ax_array = {payload[1], payload[2]}
-  	local ax_16bit = resiot_ba2intLE16(ax_array)
-    ax_16bit = unsignedToSigned16bit(ax_16bit) -- Convert to signed
-    local ax = (ax_16bit / 4095) * 9.81
-	ax = tonumber(string.format("%.2f", ax))
-  
-    local ay_array = {payload[3], payload[4]}
-  	local ay_16bit = resiot_ba2intLE16(ay_array)
-    ay_16bit = unsignedToSigned16bit(ay_16bit)
-  	local ay = (ay_16bit / 4095) * 9.81
-  	ay = tonumber(string.format("%.2f", ay))
-  
-    local az_array = {payload[5], payload[6]}
-  	local az_16bit = resiot_ba2intLE16(az_array)
-  	az_16bit = unsignedToSigned16bit(az_16bit)
-  	local az = (az_16bit / 4095) * 9.81
-  	az = tonumber(string.format("%.2f", az))
+    if hasFlag(presence, 1) then
+        local names = {"ax", "ay", "az"}
+        for i = 1, 3 do
+            local value = unsignedToSigned16bit(resiot_ba2intLE16({payload[pos], payload[pos + 1]}))
+            worked, err = resiot_setnodevalue(appeui, deveui, names[i], tonumber(string.format("%.2f", (value / 4095) * 9.81)))
+            if not worked then
+                --resiot_debug(string.format("Error setting %s: %s", names[i], err))
+            end
+            pos = pos + 2
+        end
+
+	    -- VIBRATION (MMA8451Q FIFO statistics since the previous uplink, X/Y/Z, 14-bit counts) --
+  	    local axes = {"x", "y", "z"}
+  	    local vibration = {}
+  	    for i = 1, 3 do
+  		    vibration["rms_" .. axes[i]] = tonumber(string.format("%.3f", (resiot_ba2intLE16({payload[pos], payload[pos + 1]}) / 4095) * 9.81))
+  		    vibration["peak_" .. axes[i]] = tonumber(string.format("%.3f", (resiot_ba2intLE16({payload[pos + 2], payload[pos + 3]}) / 4095) * 9.81))
+  		    vibration["p2p_" .. axes[i]] = tonumber(string.format("%.3f", (resiot_ba2intLE16({payload[pos + 4], payload[pos + 5]}) / 4095) * 9.81))
+            pos = pos + 6
+  	    end
+
+        for name, value in pairs(vibration) do  -- rms_x, peak_x, p2p_x... in m/s2
+            worked, err = resiot_setnodevalue(appeui, deveui, name, value)
+            if not worked then
+                --resiot_debug(string.format("Error setting %s: %s", name, err))
+            end
+        end
+    end
 
   	-- Si7021 --
-    local temperature_array = {payload[7], payload[8]}
-  	local temperature_16bit = resiot_ba2intLE16(temperature_array)
-  	local temperature = ((175.72 * temperature_16bit) / 65536) - 46.85
-  	temperature = tonumber(string.format("%.2f", temperature))
-  
-    local humidity_array = {payload[9], payload[10]}
- 	local humidity_16bit = resiot_ba2intLE16(humidity_array)
-  	local humidity = ((125 * humidity_16bit) / 65536) - 6
-  	humidity = tonumber(string.format("%.2f", humidity))
-  
-  	-- RAW ANALOGIC SENSORS --
-    local moisture_array = {payload[11], payload[12]}
- 	local moisture_16bit = resiot_ba2intLE16(moisture_array)
-  	local moisture = (moisture_16bit / 65535) * 100
-  	moisture = tonumber(string.format("%.2f", moisture))
-  
-    local light_array = {payload[13], payload[14]}
- 	local light_16bit = resiot_ba2intLE16(light_array)
-  	local light = (light_16bit / 65535) * 100
-  	light = tonumber(string.format("%.2f", light))
-  
-	-- TCS34725 --
-  	local red_array = {payload[15], payload[16]}
- 	local red = resiot_ba2intLE16(red_array)
-  
-  	local green_array = {payload[17], payload[18]}
- 	local green = resiot_ba2intLE16(green_array)
-  
-  	local blue_array = {payload[19], payload[20]}
- 	local blue = resiot_ba2intLE16(blue_array)
-  
-  	local clear = red + green + blue  -- Clear channel is the sum of the RGB channels. Calculated in ResIOT to make the TX_BUFFER smaller
-  
-	-- GPS --
-  	local Latitude_array = {payload[21], payload[22], payload[23], payload[24]}
- 	local Latitude = resiot_ba2float32LE(Latitude_array)
-  
-  	local Longitude_array = {payload[25], payload[26], payload[27], payload[28]}
- 	local Longitude = resiot_ba2float32LE(Longitude_array)
-
-  	-- Log payload bytes
-    --for i = 1, #payload do
-        -- Print each byte in decimal and hexadecimal formats
-        --resiot_debug(string.format("Hex %d = 0x%02X", i, payload[i]))
-    --end
-  
-    -- Log decoded values
-    --resiot_debug(string.format("Decoded Values: Ax=%d, Ay=%d, Az=%d, Temp=%d, Humidity=%d, Moist=%d, Light=%d, C=%d, R=%d, G=%d, B=%d, Lat=%.6f, Lon=%.6f", ax_16bit, ay_16bit, az_16bit, temperature_16bit, humidity_16bit, moisture_16bit, light_16bit, clear, red, green, blue, Latitude, Longitude))
+    if hasFlag(presence, 2) then
+  	    local temperature = ((175.72 * resiot_ba2intLE16({payload[pos], payload[pos + 1]})) / 65536) - 46.85
+ 	    local humidity = ((125 * resiot_ba2intLE16({payload[pos + 2], payload[pos + 3]})) / 65536) - 6
+        pos = pos + 4
 
-      -- Log processed values
-    --resiot_debug(string.format("Processed Values: Ax=%.2f, Ay=%.2f, Az=%.2f, Temp=%.2f, Humidity=%.2f, Moist=%d, Light=%d, C=%d, R=%d, G=%d, B=%d, Lat=%.6f, Lon=%.6f", ax, ay, az, temperature, humidity, moisture, light, clear, red, green, blue, Latitude, Longitude))
-  
-    -- Set values to ResIOT tags
-    local worked, err
+        if not hasFlag(status, 32) then  -- A failed reading is flagged, not sent as -46.85 C
+            worked, err = resiot_setnodevalue(appeui, deveui, "temperature", tonumber(string.format("%.2f", temperature)))
+            if not worked then
+                --resiot_debug(string.format("Error setting temperature: %s", err))
+            end
 
-  -- ---------------------------------------------------------------------------------------
-  
-    worked, err = resiot_setnodevalue(appeui, deveui, "ax", ax)
-    if not worked then
-        --resiot_debug(string.format("Error setting ax: %s", err))
-    end
-  
-    worked, err = resiot_setnodevalue(appeui, deveui, "ay", ay)
-    if not worked then
-        --resiot_debug(string.format("Error setting ay: %s", err))
-    end
-  
-    worked, err = resiot_setnodevalue(appeui, deveui, "az", az)
-    if not worked then
-        --resiot_debug(string.format("Error setting az: %s", err))
+            worked, err = resiot_setnodevalue(appeui, deveui, "humidity", tonumber(string.format("%.2f", humidity)))
+            if not worked then
+                --resiot_debug(string.format("Error setting humidity: %s", err))
+            end
+        end
     end
 
--- ---------------------------------------------------------------------------------------
-  
-    worked, err = resiot_setnodevalue(appeui, deveui, "temperature", temperature)
-    if not worked then
-        --resiot_debug(string.format("Error setting temperature: %s", err))
-    end
+  	-- RAW ANALOGIC SENSORS --
+    if hasFlag(presence, 4) then
+  	    local moisture = (resiot_ba2intLE16({payload[pos], payload[pos + 1]}) / 65535) * 100
+  	    local light = (resiot_ba2intLE16({payload[pos + 2], payload[pos + 3]}) / 65535) * 100
+        pos = pos + 4
 
-    worked, err = resiot_setnodevalue(appeui, deveui, "humidity", humidity)
-    if not worked then
-        --resiot_debug(string.format("Error setting humidity: %s", err))
-    end
-  
--- ---------------------------------------------------------------------------------------
-  
-    worked, err = resiot_setnodevalue(appeui, deveui, "moisture", moisture)
-    if not worked then
-        --resiot_debug(string.format("Error setting moisture: %s", err))
+        worked, err = resiot_setnodevalue(appeui, deveui, "moisture", tonumber(string.format("%.2f", moisture)))
+        if not worked then
+            --resiot_debug(string.format("Error setting moisture: %s", err))
+        end
+
+        worked, err = resiot_setnodevalue(appeui, deveui, "light", tonumber(string.format("%.2f", light)))
+        if not worked then
+            --resiot_debug(string.format("Error setting light: %s", err))
+        end
     end
-  
-    worked, err = resiot_setnodevalue(appeui, deveui, "light", light)
-    if not worked then
-        --resiot_debug(string.format("Error setting light: %s", err))
+
+	-- TCS34725 (normalised by the gain and integration time picked by the autorange) --
+    if hasFlag(presence, 8) then
+        local channels = {"clear", "red", "green", "blue"}
+        for i = 1, 4 do
+            worked, err = resiot_setnodevalue(appeui, deveui, channels[i], unpackLight(resiot_ba2intLE16({payload[pos], payload[pos + 1]})))
+            if not worked then
+                --resiot_debug(string.format("Error setting %s: %s", channels[i], err))
+            end
+            pos = pos + 2
+        end
     end
-  
--- ---------------------------------------------------------------------------------------
- 
-    worked, err = resiot_setnodevalue(appeui, deveui, "clear", clear)
-    if not worked then
-        --resiot_debug(string.format("Error setting clear: %s", err))
+
+	-- GPS --
+    if hasFlag(presence, 16) then
+        worked, err = resiot_setnodevalue(appeui, deveui, "GPSFlags", status % 32)
+        if not worked then
+            --resiot_debug(string.format("Error setting GPSFlags: %s", err))
+        end
+
+        worked, err = resiot_setnodevalue(appeui, deveui, "FenceEnter", hasFlag(status, 8))
+        if not worked then
+            --resiot_debug(string.format("Error setting FenceEnter: %s", err))
+        end
+
+        worked, err = resiot_setnodevalue(appeui, deveui, "FenceExit", hasFlag(status, 16))
+        if not worked then
+            --resiot_debug(string.format("Error setting FenceExit: %s", err))
+        end
+
+        if hasFlag(status, 4) then  -- Only sent on a geofence event or after moving, otherwise the tags keep the last position received
+  		    local Latitude_e7 = bytesToSigned32bitLE(payload[pos], payload[pos + 1], payload[pos + 2], payload[pos + 3])  -- Degrees x 1e7 (fixed point)
+  		    local Longitude_e7 = bytesToSigned32bitLE(payload[pos + 4], payload[pos + 5], payload[pos + 6], payload[pos + 7])
+            local GPSAge = payload[pos + 8]  -- Minutes since the position was taken, 254 = that long or more, 255 = unknown (before the last reset)
+            pos = pos + 9
+
+            worked, err = resiot_setnodevalue(appeui, deveui, "Latitude", Latitude_e7 / 10000000)
+            if not worked then
+                --resiot_debug(string.format("Error setting Latitude: %s", err))
+            end
+
+            worked, err = resiot_setnodevalue(appeui, deveui, "Longitude", Longitude_e7 / 10000000)
+            if not worked then
+                --resiot_debug(string.format("Error setting Longitude: %s", err))
+            end
+
+            worked, err = resiot_setnodevalue(appeui, deveui, "GPSAge", GPSAge)
+            if not worked then
+                --resiot_debug(string.format("Error setting GPSAge: %s", err))
+            end
+        end
     end
-  
-    worked, err = resiot_setnodevalue(appeui, deveui, "red", red)
+
+    --resiot_debug("All values successfully processed.")
+end
+
+-- Define a function to decode the event uplinks (EVENT_PORT, 6 bytes) sent on motion, transient or light band detection
+function parseEvent(appeui, deveui, payload)
+    local worked, err
+
+    worked, err = resiot_setnodevalue(appeui, deveui, "EventCount", payload[1])  -- Detections merged in this uplink
     if not worked then
-        --resiot_debug(string.format("Error setting red: %s", err))
+        --resiot_debug(string.format("Error setting EventCount: %s", err))
     end
 
-    worked, err = resiot_setnodevalue(appeui, deveui, "green", green)
+    worked, err = resiot_setnodevalue(appeui, deveui, "MotionSource", payload[2])  -- MMA8451Q FF_MT_SRC
     if not worked then
-        --resiot_debug(string.format("Error setting green: %s", err))
+        --resiot_debug(string.format("Error setting MotionSource: %s", err))
     end
 
-    worked, err = resiot_setnodevalue(appeui, deveui, "blue", blue)
+    worked, err = resiot_setnodevalue(appeui, deveui, "TransientSource", payload[3])  -- MMA8451Q TRANSIENT_SRC
     if not worked then
-        --resiot_debug(string.format("Error setting blue: %s", err))
+        --resiot_debug(string.format("Error setting TransientSource: %s", err))
     end
-  
--- ---------------------------------------------------------------------------------------
 
-    worked, err = resiot_setnodevalue(appeui, deveui, "Latitude", Latitude)
-    if not worked then
-        --resiot_debug(string.format("Error setting Latitude: %s", err))
+    if payload[4] ~= 0 then  -- 1 back in the band, 2 dark, 3 direct light
+        worked, err = resiot_setnodevalue(appeui, deveui, "LightState", payload[4])
+        if not worked then
+            --resiot_debug(string.format("Error setting LightState: %s", err))
+        end
+
+        worked, err = resiot_setnodevalue(appeui, deveui, "LightClear", payload[5] + payload[6] * 256)  -- Raw clear counts at 4x, 24 ms
+        if not worked then
+            --resiot_debug(string.format("Error setting LightClear: %s", err))
+        end
     end
+end
+
+-- Define a function to decode the vibration spectrum uplinks (SPECTRUM_PORT, 18 bytes): points as log2,
+-- MMA8451Q data rate code, axis and the 5 strongest bins (bin, amplitude in 1/4096 g little endian)
+function parseSpectrum(appeui, deveui, payload)
+    local worked, err
+    local odrHz = {800, 400, 200, 100, 50, 12.5, 6.25, 1.5625}     -- Indexed by the CTRL_REG1 DR value + 1
+    local points = 2 ^ payload[1]
+    local odr = odrHz[(payload[2] % 8) + 1]
 
-    worked, err = resiot_setnodevalue(appeui, deveui, "Longitude", Longitude)
+    worked, err = resiot_setnodevalue(appeui, deveui, "SpectrumAxis", payload[3])  -- 0 = X, 1 = Y, 2 = Z
     if not worked then
-        --resiot_debug(string.format("Error setting Longitude: %s", err))
+        --resiot_debug(string.format("Error setting SpectrumAxis: %s", err))
     end
-  
 
-    --resiot_debug("All values successfully processed.")
+    for i = 1, 5 do
+        local bin = payload[3 + (i - 1) * 3 + 1]
+        local amplitude = payload[3 + (i - 1) * 3 + 2] + payload[3 + (i - 1) * 3 + 3] * 256
+
+        worked, err = resiot_setnodevalue(appeui, deveui, "PeakFreq" .. i, bin * odr / points)  -- Hz
+        if not worked then
+            --resiot_debug(string.format("Error setting PeakFreq%d: %s", i, err))
+        end
+
+        worked, err = resiot_setnodevalue(appeui, deveui, "PeakAmp" .. i, (amplitude / 4096) * 9.81)  -- m/s^2
+        if not worked then
+            --resiot_debug(string.format("Error setting PeakAmp%d: %s", i, err))
+        end
+    end
 end
 
+-- FPorts of the uplinks (lora.app-port, event-port and spectrum-port of mbed_app.json)
+AppPort = 15
+EventPort = 11
+SpectrumPort = 12
+
 -- Main script execution
 Origin = resiot_startfrom() -- Scene process starts here
 
 if Origin == "Manual" then -- Manual script execution for testing
     -- Generate a random payload
     math.randomseed(os.time())
-    payload = ""
-    for i = 1, 28 do
+    payload = "1F04"  -- Every sensor, position included
+    for i = 1, 49 do
         payload = payload .. string.format("%02X", math.random(0, 255))
     end
   
     appeui = "70b3d57ed000ac4a"
     deveui = "8639323559379194"
+    port = AppPort
 else -- Normal execution, get payload received from device
     appeui = resiot_comm_getparam("appeui")
     deveui = resiot_comm_getparam("deveui")
+    port = tonumber(resiot_comm_getparam("port"))
     payload, err = resiot_getlastpayload(appeui, deveui)
     if not payload then
         --resiot_debug(string.format("Error getting payload: %s", err))
@@ -195,5 +259,12 @@ else -- Normal execution, get payload received from device
     end
 end
 
--- Process the payload
-parsePayload(appeui, deveui, payload)
+-- Process the payload, the FPort tells the uplinks apart: a periodic uplink can have any length
+local bytes = resiot_hexdecode(payload)
+if port == EventPort and bytes ~= nil and #bytes == 6 then
+    parseEvent(appeui, deveui, bytes)
+elseif port == SpectrumPort and bytes ~= nil and #bytes == 18 then
+    parseSpectrum(appeui, deveui, bytes)
+elseif port == AppPort then
+    parsePayload(appeui, deveui, payload)
+end
@@ -0,0 +1,342 @@
+/* File for the geofencing engine definitions */
+
+// LIBRARIES ---------------------------------------------------------------------------
+#include "mbed.h"
+#include "geofence.h"
+#include "kvstore_global_api.h"
+#include <string.h>
+
+// CONSTRUCTOR -------------------------------------------------------------------------
+Geofence::Geofence() : _pending(0), _sent(false) {
+    memset(&_config, 0, sizeof(_config));
+    memset(&_last_sent, 0, sizeof(_last_sent));
+    _config.move_distance_m = GEOFENCE_MOVE_DISTANCE_M;
+}
+
+// =====================================================================================
+// PUBLIC FUNCTIONS
+// =====================================================================================
+bool Geofence::add_circle(uint8_t id, geo_point_t centre, uint16_t radius_m){
+    if (radius_m == 0 || !valid_point(centre)) {                      // Before slot(): a new id takes a fence
+        return false;
+    }
+
+    geofence_t *fence = slot(id);
+
+    if (fence == NULL) {
+        return false;
+    }
+
+    int32_t radius_e7 = (int32_t)radius_m * GEOFENCE_E7_PER_M_X100 / 100;
+
+    memset(fence, 0, sizeof(*fence));
+    fence->id = id;
+    fence->shape = GEOFENCE_CIRCLE;
+    fence->vertices[0] = centre;
+    fence->radius2_e7 = (int64_t)radius_e7 * radius_e7;
+    fence->lon_scale_q15 = cos_q15(centre.latitude_e7);
+
+    int64_t radius_lon_e7 = ((int64_t)radius_e7 << 15) / fence->lon_scale_q15;   // Wider in longitude away from the equator
+
+    int64_t min_lon_e7 = (int64_t)centre.longitude_e7 - radius_lon_e7;
+    int64_t max_lon_e7 = (int64_t)centre.longitude_e7 + radius_lon_e7;
+
+    fence->min_lat_e7 = centre.latitude_e7 - radius_e7;                // |lat| <= 90 deg (valid_point), no overflow possible
+    fence->max_lat_e7 = centre.latitude_e7 + radius_e7;
+    fence->min_lon_e7 = min_lon_e7 < -GEOFENCE_MAX_LON_E7 ? -GEOFENCE_MAX_LON_E7 : (int32_t)min_lon_e7;   // Clamped near the poles
+    fence->max_lon_e7 = max_lon_e7 > GEOFENCE_MAX_LON_E7 ? GEOFENCE_MAX_LON_E7 : (int32_t)max_lon_e7;
+    return true;
+}
+
+bool Geofence::add_polygon(uint8_t id, const geo_point_t *vertices, uint8_t count){
+    if (count < 3 || count > GEOFENCE_MAX_VERTICES) {
+        return false;
+    }
+    for (uint8_t i = 0; i < count; i++) {
+        if (!valid_point(vertices[i])) {
+            return false;
+        }
+    }
+
+    geofence_t *fence = slot(id);
+
+    if (fence == NULL) {
+        return false;
+    }
+
+    memset(fence, 0, sizeof(*fence));
+    fence->id = id;
+    fence->shape = GEOFENCE_POLYGON;
+    fence->vertex_count = count;
+    fence->min_lat_e7 = fence->max_lat_e7 = vertices[0].latitude_e7;
+    fence->min_lon_e7 = fence->max_lon_e7 = vertices[0].longitude_e7;
+
+    for (uint8_t i = 0; i < count; i++) {
+        fence->vertices[i] = vertices[i];
+        fence->min_lat_e7 = vertices[i].latitude_e7 < fence->min_lat_e7 ? vertices[i].latitude_e7 : fence->min_lat_e7;
+        fence->max_lat_e7 = vertices[i].latitude_e7 > fence->max_lat_e7 ? vertices[i].latitude_e7 : fence->max_lat_e7;
+        fence->min_lon_e7 = vertices[i].longitude_e7 < fence->min_lon_e7 ? vertices[i].longitude_e7 : fence->min_lon_e7;
+        fence->max_lon_e7 = vertices[i].longitude_e7 > fence->max_lon_e7 ? vertices[i].longitude_e7 : fence->max_lon_e7;
+    }
+
+    fence->lon_scale_q15 = cos_q15(fence->min_lat_e7 / 2 + fence->max_lat_e7 / 2);
+    return true;
+}
+
+bool Geofence::remove(uint8_t id){
+    int8_t index = find(id);
+
+    if (index < 0) {
+        return false;
+    }
+
+    _config.count--;
+    memmove(&_config.fences[index], &_config.fences[index + 1], (_config.count - index) * sizeof(geofence_t));   // Keep the fences packed
+    return true;
+}
+
+void Geofence::clear(){
+    _config.count = 0;
+}
+
+void Geofence::set_move_distance(uint16_t metres){
+    _config.move_distance_m = metres;
+}
+
+// Decode one GEOFENCE_OP_* downlink. A flash write takes tens of ms, so saving the result is
+// left to the caller, from a thread that can afford it
+bool Geofence::handle_downlink(const uint8_t *data, size_t length){
+    bool done = false;
+
+    if (length == 0) {
+        return false;
+    }
+
+    switch (data[0]) {
+        case GEOFENCE_OP_CLEAR:
+            clear();
+            done = true;
+            break;
+
+        case GEOFENCE_OP_CIRCLE:
+            if (length == 12) {
+                geo_point_t centre = {read_le32(&data[2]), read_le32(&data[6])};
+                done = add_circle(data[1], centre, data[10] | (data[11] << 8));
+            }
+            break;
+
+        case GEOFENCE_OP_POLYGON:
+            if (length >= 3 && data[2] <= GEOFENCE_MAX_VERTICES && length == 3 + (size_t)data[2] * 8) {
+                geo_point_t vertices[GEOFENCE_MAX_VERTICES];
+
+                for (uint8_t i = 0; i < data[2]; i++) {
+                    vertices[i].latitude_e7 = read_le32(&data[3 + i * 8]);
+                    vertices[i].longitude_e7 = read_le32(&data[7 + i * 8]);
+                }
+                done = add_polygon(data[1], vertices, data[2]);
+            }
+            break;
+
+        case GEOFENCE_OP_REMOVE:
+            if (length == 2) {
+                done = remove(data[1]);
+            }
+            break;
+
+        case GEOFENCE_OP_MOVE_DISTANCE:
+            if (length == 3) {
+                set_move_distance(data[1] | (data[2] << 8));
+                done = true;
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    return done;
+}
+
+void Geofence::snapshot(geofence_config_t *config) const {
+    memcpy(config, &_config, sizeof(_config));
+}
+
+bool Geofence::save(const geofence_config_t &config){
+    return kv_set(GEOFENCE_KV_KEY, &config, sizeof(config), 0) == MBED_SUCCESS;
+}
+
+bool Geofence::restore(){
+    size_t actual_size = 0;
+
+    if (kv_get(GEOFENCE_KV_KEY, &_config, sizeof(_config), &actual_size) != MBED_SUCCESS
+        || actual_size != sizeof(_config) || _config.count > GEOFENCE_MAX_FENCES) {
+        memset(&_config, 0, sizeof(_config));                         // Nothing saved (or another layout), start without fences
+        _config.move_distance_m = GEOFENCE_MOVE_DISTANCE_M;
+        return false;
+    }
+
+    for (uint8_t i = 0; i < _config.count; i++) {
+        _config.fences[i].state = GEOFENCE_UNKNOWN;                    // Saved before the reset, the position may have changed since
+    }
+    return true;
+}
+
+uint8_t Geofence::evaluate(geo_point_t position) const {
+    uint32_t inside;
+
+    return events_at(position, &inside);
+}
+
+// Check every fence against a new position and keep the result until the position is sent
+uint8_t Geofence::update(geo_point_t position){
+    uint32_t inside;
+
+    _pending = events_at(position, &inside);
+    for (uint8_t i = 0; i < _config.count; i++) {
+        _config.fences[i].state = (inside & (1UL << i)) ? GEOFENCE_INSIDE : GEOFENCE_OUTSIDE;
+    }
+    return _pending;
+}
+
+void Geofence::position_sent(geo_point_t position){
+    _last_sent = position;
+    _sent = true;
+    _pending = 0;
+}
+
+uint32_t Geofence::inside_mask() const {
+    uint32_t mask = 0;
+
+    for (uint8_t i = 0; i < _config.count; i++) {
+        if (_config.fences[i].state == GEOFENCE_INSIDE) {
+            mask |= 1UL << i;
+        }
+    }
+    return mask;
+}
+
+uint8_t Geofence::count() const {
+    return _config.count;
+}
+// PUBLIC FUNCTIONS END ================================================================
+
+// =====================================================================================
+// PRIVATE FUNCTIONS
+// =====================================================================================
+int8_t Geofence::find(uint8_t id) const {
+    for (uint8_t i = 0; i < _config.count; i++) {
+        if (_config.fences[i].id == id) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Pending events plus those of the position. Transitions out of GEOFENCE_UNKNOWN are not
+// events: they only tell where the node is when a fence has just been loaded
+uint8_t Geofence::events_at(geo_point_t position, uint32_t *inside) const {
+    uint8_t events = _pending;
+
+    *inside = 0;
+    for (uint8_t i = 0; i < _config.count; i++) {
+        const geofence_t &fence = _config.fences[i];
+        bool in = contains(fence, position);
+
+        if (fence.state == GEOFENCE_OUTSIDE && in) {
+            events |= GEOFENCE_EVENT_ENTER;
+        } else if (fence.state == GEOFENCE_INSIDE && !in) {
+            events |= GEOFENCE_EVENT_EXIT;
+        }
+        *inside |= in ? (1UL << i) : 0;
+    }
+
+    if (!_sent) {
+        events |= GEOFENCE_EVENT_FIRST;
+    } else {
+        int64_t move_e7 = (int64_t)_config.move_distance_m * GEOFENCE_E7_PER_M_X100 / 100;
+
+        if (distance2_e7(position, _last_sent, cos_q15(position.latitude_e7)) > move_e7 * move_e7) {
+            events |= GEOFENCE_EVENT_MOVED;
+        }
+    }
+    return events;
+}
+
+geofence_t *Geofence::slot(uint8_t id){
+    int8_t index = find(id);
+
+    if (index >= 0) {
+        return &_config.fences[index];
+    }
+    if (_config.count >= GEOFENCE_MAX_FENCES) {
+        return NULL;
+    }
+    return &_config.fences[_config.count++];
+}
+
+bool Geofence::valid_point(geo_point_t p){
+    return p.latitude_e7 >= -GEOFENCE_MAX_LAT_E7 && p.latitude_e7 <= GEOFENCE_MAX_LAT_E7
+        && p.longitude_e7 >= -GEOFENCE_MAX_LON_E7 && p.longitude_e7 <= GEOFENCE_MAX_LON_E7;
+}
+
+bool Geofence::contains(const geofence_t &fence, geo_point_t p) const {
+    if (p.latitude_e7 < fence.min_lat_e7 || p.latitude_e7 > fence.max_lat_e7
+        || p.longitude_e7 < fence.min_lon_e7 || p.longitude_e7 > fence.max_lon_e7) {
+        return false;
+    }
+
+    if (fence.shape == GEOFENCE_CIRCLE) {
+        return distance2_e7(p, fence.vertices[0], fence.lon_scale_q15) <= fence.radius2_e7;
+    }
+    return in_polygon(fence, p);
+}
+
+// Even-odd ray casting towards East. The edge crossing test is cross-multiplied instead of
+// divided, so it stays exact in 64-bit integers
+bool Geofence::in_polygon(const geofence_t &fence, geo_point_t p){
+    bool inside = false;
+
+    for (uint8_t i = 0, j = fence.vertex_count - 1; i < fence.vertex_count; j = i++) {
+        const geo_point_t &a = fence.vertices[i];
+        const geo_point_t &b = fence.vertices[j];
+
+        if ((a.latitude_e7 > p.latitude_e7) != (b.latitude_e7 > p.latitude_e7)) {
+            int64_t lhs = ((int64_t)p.longitude_e7 - b.longitude_e7) * ((int64_t)a.latitude_e7 - b.latitude_e7);
+            int64_t rhs = ((int64_t)a.longitude_e7 - b.longitude_e7) * ((int64_t)p.latitude_e7 - b.latitude_e7);
+
+            if ((a.latitude_e7 > b.latitude_e7) ? (lhs < rhs) : (lhs > rhs)) {   // Crossing is East of the point
+                inside = !inside;
+            }
+        }
+    }
+    return inside;
+}
+
+// Squared distance in (1e-7 deg of latitude)^2 on a flat projection around the points
+int64_t Geofence::distance2_e7(geo_point_t a, geo_point_t b, uint16_t lon_scale_q15){
+    int64_t dlat = (int64_t)a.latitude_e7 - b.latitude_e7;
+    int64_t dlon = (((int64_t)a.longitude_e7 - b.longitude_e7) * lon_scale_q15) >> 15;
+
+    return dlat * dlat + dlon * dlon;
+}
+
+// Bhaskara I approximation, cos(x) = sin(90 - x) = 4y(180 - y) / (40500 - y(180 - y)) with
+// y = 90 - |x| in degrees, here in millidegrees. Within 0.002 of the real value, and never 0
+// so the longitude scale can be divided by
+uint16_t Geofence::cos_q15(int32_t latitude_e7){
+    int64_t y = 90000 - (latitude_e7 < 0 ? -(int64_t)latitude_e7 : latitude_e7) / 10000;
+
+    if (y < 1) {
+        y = 1;
+    }
+
+    int64_t p = y * (180000 - y);
+    int64_t cos_q15 = (4 * p << 15) / (40500000000LL - p);
+
+    return cos_q15 > 32767 ? 32767 : (cos_q15 < 1 ? 1 : (uint16_t)cos_q15);
+}
+
+int32_t Geofence::read_le32(const uint8_t *data){
+    return (int32_t)((uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24));
+}
+// PRIVATE FUNCTIONS END ===============================================================
@@ -0,0 +1,133 @@
+/* File for the geofencing engine declarations and macros */
+
+// LIBRARIES ------------------------------------------------------------------------------------
+#include "mbed.h"
+
+// LIBRARY GUARD --------------------------------------------------------------------------------
+#ifndef GEOFENCE_H
+#define GEOFENCE_H
+
+// ==============================================================================================
+// MACROS
+// ==============================================================================================
+#define GEOFENCE_MAX_FENCES        16                 // Fits the inside/outside state in one mask
+#define GEOFENCE_MAX_VERTICES      6                  // Largest polygon that fits in one 51-byte downlink
+#define GEOFENCE_KV_KEY            "/kv/geofence"     // Fences survive a reset
+
+#ifdef MBED_CONF_APP_GEOFENCE_PORT
+#define GEOFENCE_PORT              MBED_CONF_APP_GEOFENCE_PORT
+#else
+#define GEOFENCE_PORT              10
+#endif
+
+#ifdef MBED_CONF_APP_GEOFENCE_MOVE_DISTANCE_M
+#define GEOFENCE_MOVE_DISTANCE_M   MBED_CONF_APP_GEOFENCE_MOVE_DISTANCE_M
+#else
+#define GEOFENCE_MOVE_DISTANCE_M   50
+#endif
+
+#define GEOFENCE_E7_PER_M_X100     8983               // 1 m along a meridian is 89.83 x 1e-7 degrees
+#define GEOFENCE_MAX_LAT_E7        900000000          // Points outside +-90 deg latitude, +-180 deg longitude are refused
+#define GEOFENCE_MAX_LON_E7        1800000000
+
+// Downlink opcodes (first byte on GEOFENCE_PORT), multi-byte fields are little endian
+#define GEOFENCE_OP_CLEAR          0x01               // Remove every fence
+#define GEOFENCE_OP_CIRCLE         0x02               // id, lat e7 (4), lon e7 (4), radius in m (2)
+#define GEOFENCE_OP_POLYGON        0x03               // id, vertex count, count x (lat e7 (4), lon e7 (4))
+#define GEOFENCE_OP_REMOVE         0x04               // id
+#define GEOFENCE_OP_MOVE_DISTANCE  0x05               // Distance in m (2) that triggers a position uplink
+
+// Events returned by update(), kept until position_sent()
+#define GEOFENCE_EVENT_ENTER       (1 << 0)           // Entered at least one fence
+#define GEOFENCE_EVENT_EXIT        (1 << 1)           // Left at least one fence
+#define GEOFENCE_EVENT_MOVED       (1 << 2)           // Further than the move distance from the last position sent
+#define GEOFENCE_EVENT_FIRST       (1 << 3)           // No position sent yet
+// MACROS END ===================================================================================
+
+// ==============================================================================================
+// TYPES
+// ==============================================================================================
+typedef enum {
+    GEOFENCE_CIRCLE = 0,
+    GEOFENCE_POLYGON
+} geofence_shape_t;
+
+typedef enum {
+    GEOFENCE_UNKNOWN = 0,                     // Not evaluated since it was loaded, the first result is not an event
+    GEOFENCE_OUTSIDE,
+    GEOFENCE_INSIDE
+} geofence_state_t;
+
+typedef struct {
+    int32_t latitude_e7;                      // Degrees x 1e7, negative for South
+    int32_t longitude_e7;                     // Degrees x 1e7, negative for West
+} geo_point_t;
+
+typedef struct {
+    uint8_t id;                               // Given by the server, used to replace or remove the fence
+    uint8_t shape;                            // geofence_shape_t
+    uint8_t vertex_count;                     // Polygon only
+    uint8_t state;                            // geofence_state_t, reset when the fence is loaded
+    geo_point_t vertices[GEOFENCE_MAX_VERTICES];  // vertices[0] is the centre of a circle
+    int64_t radius2_e7;                       // Circle only: squared radius in (1e-7 deg of latitude)^2
+    uint16_t lon_scale_q15;                   // cos(latitude) in Q15, turns longitude differences into latitude ones
+    int32_t min_lat_e7, max_lat_e7;           // Bounding box, most points are rejected here
+    int32_t min_lon_e7, max_lon_e7;
+} geofence_t;
+
+typedef struct {
+    uint8_t count;                            // Fences in use, packed at the start of the array
+    uint16_t move_distance_m;
+    geofence_t fences[GEOFENCE_MAX_FENCES];
+} geofence_config_t;                          // Everything loaded by downlink, saved to KVStore as one value
+// TYPES END ====================================================================================
+
+// ==============================================================================================
+// GEOFENCE CLASS
+// ==============================================================================================
+// Fixed point only: coordinates are degrees x 1e7 and distances use a local flat projection
+// (longitude scaled by cos(latitude) computed once per fence), accurate to well under a
+// percent for fences up to a few km. Fences must not cross the antimeridian.
+class Geofence {
+public:
+    // Constructor ------------------------------------------------------------------------------
+    Geofence();
+
+    // Public functions -------------------------------------------------------------------------
+    bool add_circle(uint8_t id, geo_point_t centre, uint16_t radius_m);  // Replaces a fence with the same id
+    bool add_polygon(uint8_t id, const geo_point_t *vertices, uint8_t count);
+    bool remove(uint8_t id);
+    void clear();
+    void set_move_distance(uint16_t metres);
+    bool handle_downlink(const uint8_t *data, size_t length);     // GEOFENCE_OP_* message, true if valid (the caller saves the result)
+    void snapshot(geofence_config_t *config) const;               // Copy of everything save() writes
+    static bool save(const geofence_config_t &config);            // KVStore write of a snapshot, slow: keep it off the event queue
+    bool restore();
+
+    uint8_t evaluate(geo_point_t position) const;                 // GEOFENCE_EVENT_* that update() would return, nothing changes
+    uint8_t update(geo_point_t position);                         // Evaluate the fences, returns the GEOFENCE_EVENT_* pending since the last position sent
+    void position_sent(geo_point_t position);                     // The position reached the server, clears the pending events
+    uint32_t inside_mask() const;                                 // Bit i set if inside the i-th fence
+    uint8_t count() const;
+
+private:
+    // Private functions ------------------------------------------------------------------------
+    int8_t find(uint8_t id) const;
+    uint8_t events_at(geo_point_t position, uint32_t *inside) const;
+    geofence_t *slot(uint8_t id);                                 // Fence with this id, or a free one (counted from then on)
+    static bool valid_point(geo_point_t p);                       // Within +-90 deg latitude and +-180 deg longitude
+    bool contains(const geofence_t &fence, geo_point_t p) const;
+    static bool in_polygon(const geofence_t &fence, geo_point_t p);
+    static int64_t distance2_e7(geo_point_t a, geo_point_t b, uint16_t lon_scale_q15);
+    static uint16_t cos_q15(int32_t latitude_e7);
+    static int32_t read_le32(const uint8_t *data);
+
+    // Fences and uplink state ------------------------------------------------------------------
+    geofence_config_t _config;
+    uint8_t _pending;                                             // Events not sent yet
+    geo_point_t _last_sent;
+    bool _sent;
+};
+// GEOFENCE CLASS END ===========================================================================
+
+#endif
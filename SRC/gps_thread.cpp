@@ -3,42 +3,123 @@
 // LIBRARIES ---------------------------------------------------------------------------
 #include "mbed.h"
 #include "gps_thread.h"
-#include <string.h>
+#include "nmea_parser.h"
+#include "seqlock.h"
+#include "kvstore_global_api.h"
+#include <stdarg.h>
+#include <stdlib.h>
+
+#if GPS_ENABLED
 
 // CONSTRUCTORS ------------------------------------------------------------------------
-BufferedSerial gps(GPS_TX, GPS_RX, GPS_BAUD_RATE);                    // GPS Serial interface (Adjust TX, RX pins for your board)
+UnbufferedSerial gps(GPS_TX, GPS_RX, GPS_BAUD_RATE);                  // GPS Serial interface (Adjust TX, RX pins for your board)
+static EventFlags gps_flags;                                          // Wakes the GPS thread up when a full sentence is waiting in the ring
 
 // GLOBAL VARIABLES --------------------------------------------------------------------
-// Variables to parse the GPGGA sentence buffer
-static char buffer[GPS_BUFFER_SIZE];                                  // GPS sentence buffer
-static int bufferIndex = 0;
+// Variables to parse the GGA sentences
+static CircularBuffer<char, GPS_RX_RING_SIZE> rx_ring;                // Bytes received by the RX interrupt, drained by the GPS thread
+static NMEAParser parser(GPS_ACCEPTED_TALKERS);                       // Parses the bytes as they are drained, no sentence buffer needed
+
+// Last fix, published as a whole so readers never mix fields of two sentences
+static SeqLock<gps_snapshot_t> gps_snapshot;
+
+// Last position with a fix, in RAM for the sender and in KVStore for the next boot
+typedef struct {
+    int32_t latitude_e7;
+    int32_t longitude_e7;
+} gps_lkg_record_t;                                                   // What is written to flash
+
+static SeqLock<gps_position_t> last_known;
+static gps_lkg_record_t stored_record;                                // Copy of the KVStore entry
+static bool record_stored = false;                                    // stored_record is valid
+static bool written_this_run = false;
+static Kernel::Clock::time_point last_write;
 
-// Variables to store GPS fields
-volatile uint8_t fix_status = 0;
-volatile float latitude = 0.0f, longitude = 0.0f;
+// Last $PMTK001 received, checked by wait_for_ack()
+static nmea_ack_t last_ack;
+static bool ack_received = false;
+
+// Power management
+typedef enum {
+    GPS_ACQUIRING,                                                    // Receiver on, waiting for a fix
+    GPS_STANDBY                                                       // Receiver in $PMTK161 standby until GPS_WAKE_LEAD before next_uplink
+} gps_power_state_t;
+
+static gps_power_state_t power_state = GPS_ACQUIRING;
+static Kernel::Clock::time_point wake_time;                           // Start of the current acquisition
+static Kernel::Clock::time_point fix_time;                            // First fix of the current acquisition
+static Kernel::Clock::time_point fix_deadline;                        // Back to standby at this point even without fix
+static Kernel::Clock::time_point next_uplink;                         // Expected time of the next uplink
+static bool fix_acquired = false;
+static bool ever_fixed = false;                                       // A fix was acquired since boot, later acquisitions are hot starts
+static gps_power_stats_t power_stats = {};
+static SeqLock<gps_power_stats_t> power_stats_shared;                 // Copy of power_stats for other threads
 
 // FUNCTION PROTOTYPES -----------------------------------------------------------------
 static void settingFrequency();
-static void enableGettingStatusFromAntenna();
+static void settingNMEAOutput();
+static void settingAntennaStatus();
 static void initializesSerialPort();
-static bool parse_GPS_data(char *nmea_data);
+static void negotiateBaudRate();
+static bool switchBaudRate(int baud);
+static void send_command(const char *format, ...);
+static bool wait_for_ack(uint16_t command);
+static void gps_rx_isr();
+static void parse_GPS_data(const nmea_gga_t &gga);
 static void read_GPS();
-uint8_t get_fix_status();
-float get_latitude();
-float get_longitude();
+static void wakeUp();
+static void enterStandby();
+static void loadLastKnown();
+static void storeLastKnown(const gps_snapshot_t &snapshot);
 
 // =====================================================================================
 // GPS MAIN FUNCTION
 // =====================================================================================
 void gps_th_routine(){
     // Initialization routine 
+    loadLastKnown();                                                  // A position is available to the sender before the first fix
     initializesSerialPort();
-    enableGettingStatusFromAntenna();
+    negotiateBaudRate();
+    settingAntennaStatus();
+    settingNMEAOutput();
     settingFrequency();
 
+    next_uplink = Kernel::Clock::now() + GPS_CYCLE_PERIOD;
+    wakeUp();                                                         // Boot counts as the first (cold start) acquisition
+
     while (true) {
+        uint32_t flags;
+
+        // Sleep until the RX interrupt has seen a '\n', an uplink was sent or the power state has to change
+        if (!GPS_POWER_SAVE) {
+            flags = gps_flags.wait_any(GPS_FLAG_SENTENCE | GPS_FLAG_UPLINK);
+        } else if (power_state == GPS_STANDBY) {
+            flags = gps_flags.wait_any_until(GPS_FLAG_SENTENCE | GPS_FLAG_UPLINK, next_uplink - GPS_WAKE_LEAD);
+        } else {
+            flags = gps_flags.wait_any_until(GPS_FLAG_SENTENCE | GPS_FLAG_UPLINK, fix_deadline);
+        }
+
+        if (flags & osFlagsError) {                                   // Timeout, nothing to read
+            flags = 0;
+        }
+
+        if ((flags & GPS_FLAG_UPLINK) && Kernel::Clock::now() >= next_uplink - GPS_WAKE_LEAD) {
+            next_uplink = Kernel::Clock::now() + GPS_CYCLE_PERIOD;    // The uplink this cycle woke up for has been sent, align the next cycle on it
+        }
+
         read_GPS();                                                   // Read and process GPS data
-        ThisThread::sleep_for(GPS_THREAD_SLEEP);
+
+        if (!GPS_POWER_SAVE) {
+            continue;
+        }
+
+        Kernel::Clock::time_point now = Kernel::Clock::now();
+
+        if (power_state == GPS_ACQUIRING && (fix_acquired || now >= fix_deadline)) {
+            enterStandby();
+        } else if (power_state == GPS_STANDBY && now >= next_uplink - GPS_WAKE_LEAD) {
+            wakeUp();
+        }
     }
 }
 // GPS MAIN FUNCTION END ===============================================================
@@ -46,112 +127,279 @@ void gps_th_routine(){
 // Initializes UART 9600 8N1
 static void initializesSerialPort(){
     // Initializes serial port 9600 bauds (8N1)
-    gps.set_baud(9600);
-    gps.set_format(
+    gps.baud(GPS_BAUD_RATE);
+    gps.format(
         /* bits */     8,
-        /* parity */   BufferedSerial::None,
+        /* parity */   SerialBase::None,
         /* stop bit */ 1
     );
+    gps.attach(gps_rx_isr, SerialBase::RxIrq);                        // Bytes are moved to the ring as they arrive, no polling needed
 }
 
-// Enable trace to see the antena status
-static void enableGettingStatusFromAntenna(){
-    gps.write(ENABLE_STATUS_ANTENA, sizeof(ENABLE_STATUS_ANTENA));
+// RX interrupt: store the byte and only wake the thread at the end of a sentence
+static void gps_rx_isr(){
+    char c;
+
+    while (gps.readable()) {
+        gps.read(&c, 1);
+        rx_ring.push(c);                                              // If the thread falls behind, the oldest bytes are overwritten
+
+        if (c == '\n') {
+            gps_flags.set(GPS_FLAG_SENTENCE);
+        }
+    }
 }
 
-// Set GPS measuring frequencies
-static void settingFrequency(){
-    gps.write(SET_UPDATING_NMEA_1HZ_RATE, sizeof(SET_UPDATING_NMEA_1HZ_RATE));  // Setting 1HZ of internal freq (updating NMEA traces frecuency at 1Hz)
-    gps.write(SET_SAMPLE_1HZ, sizeof(SET_SAMPLE_1HZ));                // Setting receptor sampling at 1Hz
+// Move the link to GPS_TARGET_BAUD_RATE, staying at GPS_BAUD_RATE if the receiver does not follow
+static void negotiateBaudRate(){
+    if (GPS_TARGET_BAUD_RATE == GPS_BAUD_RATE) {
+        return;
+    }
+
+    send_command(TEST_PACKET);
+    if (!wait_for_ack(PMTK_TEST)) {                                   // Silent at 9600: the MCU may have been reset while the receiver kept the higher rate
+        gps.baud(GPS_TARGET_BAUD_RATE);
+        send_command(TEST_PACKET);
+        if (wait_for_ack(PMTK_TEST)) {
+            return;
+        }
+        gps.baud(GPS_BAUD_RATE);
+    }
+
+    if (!switchBaudRate(GPS_TARGET_BAUD_RATE)) {
+        switchBaudRate(GPS_BAUD_RATE);                                // Fall back, in case the receiver switched but the ACK got lost
+    }
 }
 
-// Function to parse and extract lat, lon and alt from GPGGA sentence ------------------
-static bool parse_GPS_data(char *nmea_data){
-    bool ret = false;
+// Ask the receiver for a new baud rate, follow it and check that the link still works
+static bool switchBaudRate(int baud){
+    send_command(SET_BAUD_RATE, baud);
+    ThisThread::sleep_for(GPS_BAUD_SWITCH_DELAY);                     // $PMTK251 is not acknowledged, the receiver just switches
 
-    if(strncmp(nmea_data, "$GPGGA", 6) == 0){                         // Check if it's a GPGGA sentence
-        char *token = strtok(nmea_data, ",");
-        int field = 0;
+    gps.baud(baud);
+    rx_ring.reset();                                                  // Whatever arrived during the switch is garbage
+    parser.reset();
 
-        ret = true;
+    send_command(TEST_PACKET);
+    return wait_for_ack(PMTK_TEST);
+}
 
-        while(token != NULL){
-            field++;
+// Send a command body framed as "$<body>*<checksum>\r\n", the body is a printf format
+static void send_command(const char *format, ...){
+    char body[GPS_COMMAND_SIZE];
+    char command[GPS_COMMAND_SIZE];
+    uint8_t checksum = 0;
+    va_list args;
 
-            // Field 7: GPS Fix status (0 = no fix, 1 = GPS fix, 2 = DGPS fix)
-            if(field == 7){
-                fix_status = atoi(token);                             // Convert to integer
-            }
+    va_start(args, format);
+    int body_len = vsnprintf(body, sizeof(body), format, args);
+    va_end(args);
 
-            // Field 3: Latitude
-            if(field == 3 && strlen(token) > 0){
-                float raw_latitude = atof(token);
-                int degrees = (int)(raw_latitude / 100);
-                float minutes = raw_latitude - (degrees * 100);
-                
-                latitude = degrees + minutes / 60.0f;
-            }
+    if (body_len < 0 || body_len >= (int)sizeof(body)) {
+        return;
+    }
 
-            // Field 4: Latitude hemisphere (N/S)
-            if(field == 4 && *token == 'S'){
-                latitude = -latitude;                                 // Southern hemisphere
-            }
+    for (const char *c = body; *c != '\0'; c++) {
+        checksum ^= *c;
+    }
 
-            // Field 5: Longitude
-            if(field == 5 && strlen(token) > 0){
-                float raw_longitude = atof(token);
-                int degrees = (int)(raw_longitude / 100);
-                float minutes = raw_longitude - (degrees * 100);
-                
-                longitude = degrees + minutes / 60.0f;
-            }
+    int len = snprintf(command, sizeof(command), "$%s*%02X\r\n", body, checksum);
+    if (len > 0 && len < (int)sizeof(command)) {
+        gps.write(command, len);
+    }
+}
 
-            // Field 6: Longitude hemisphere (E/W)
-            if(field == 6 && *token == 'W'){
-                longitude = -longitude;                               // Western hemisphere
-            }
+// Process incoming sentences until $PMTK001 for 'command' arrives, true if it reports success
+static bool wait_for_ack(uint16_t command){
+    Kernel::Clock::time_point deadline = Kernel::Clock::now() + GPS_ACK_TIMEOUT;
 
-            token = strtok(NULL, ",");
+    ack_received = false;
+
+    while (Kernel::Clock::now() < deadline) {
+        gps_flags.wait_any_until(GPS_FLAG_SENTENCE, deadline);
+        read_GPS();
+
+        if (ack_received && last_ack.command == command) {
+            return last_ack.flag == PMTK_ACK_SUCCESS;
         }
     }
 
-    return ret;
+    return false;
+}
+
+// Enable or disable the trace to see the antena status
+static void settingAntennaStatus(){
+    send_command(GPS_ANTENNA_STATUS ? ENABLE_STATUS_ANTENA : DISABLE_STATUS_ANTENA);
+}
+
+// Only ask for the sentences that are parsed, the rest would just load the 9600-baud link
+static void settingNMEAOutput(){
+    send_command(SET_NMEA_OUTPUT GPS_NMEA_OUTPUT);
+}
+
+// Set GPS measuring frequencies, back to 1 Hz if the receiver refuses the configured rate
+static void settingFrequency(){
+    int interval_ms = 1000 / GPS_FIX_RATE_HZ;
+
+    send_command(SET_UPDATING_NMEA_RATE, interval_ms);                // Setting the internal fix rate
+    send_command(SET_SAMPLE_RATE, interval_ms);                       // Setting the NMEA output rate
+
+    if (interval_ms != 1000 && !wait_for_ack(PMTK_SET_NMEA_UPDATERATE)) {
+        send_command(SET_UPDATING_NMEA_RATE, 1000);
+        send_command(SET_SAMPLE_RATE, 1000);
+    }
+}
+
+// Start an acquisition: any byte wakes the receiver up from standby -------------------
+static void wakeUp(){
+    wake_time = Kernel::Clock::now();
+    fix_deadline = wake_time + (ever_fixed ? GPS_FIX_DEADLINE : GPS_COLD_START_DEADLINE);
+    fix_acquired = false;
+    power_state = GPS_ACQUIRING;
+
+    send_command(TEST_PACKET);
+
+    power_stats.cycles++;
+    power_stats_shared.write(power_stats);
+}
+
+// End an acquisition and put the receiver in standby until the next uplink -------------
+static void enterStandby(){
+    Kernel::Clock::time_point now = Kernel::Clock::now();
+
+    if (fix_acquired) {
+        power_stats.last_time_to_fix_ms = (fix_time - wake_time).count();
+    } else {
+        power_stats.timeouts++;
+    }
+    power_stats.last_on_time_ms = (now - wake_time).count();
+    power_stats.total_on_time_ms += power_stats.last_on_time_ms;
+    power_stats_shared.write(power_stats);
+
+    while (next_uplink - GPS_WAKE_LEAD <= now) {                      // Uplink missed or too close: aim at the following one
+        next_uplink += GPS_CYCLE_PERIOD;
+    }
+
+    send_command(SET_STANDBY_MODE);
+    power_state = GPS_STANDBY;
+}
+
+// Function to publish the fix of a validated GGA sentence ----------------------------
+static void parse_GPS_data(const nmea_gga_t &gga){
+    gps_snapshot_t snapshot;
+
+    snapshot.fix = gga.fix;
+    snapshot.satellites = gga.satellites;
+    snapshot.hdop_x100 = gga.hdop_x100;
+    snapshot.latitude_e7 = gga.latitude_e7;                           // Position fields are empty (0) while there is no fix
+    snapshot.longitude_e7 = gga.longitude_e7;
+    snapshot.timestamp = Kernel::Clock::now();
+
+    gps_snapshot.write(snapshot);                                     // Never blocks, readers retry instead
+
+    if (gga.fix > 0) {
+        storeLastKnown(snapshot);
+    }
+
+    if (gga.fix > 0 && !fix_acquired) {
+        fix_time = snapshot.timestamp;
+        fix_acquired = true;
+        ever_fixed = true;
+    }
+}
+
+// Restore the position saved by a previous run ----------------------------------------
+static void loadLastKnown(){
+    size_t actual_size = 0;
+
+    if (kv_get(GPS_LKG_KEY, &stored_record, sizeof(stored_record), &actual_size) != MBED_SUCCESS || actual_size != sizeof(stored_record)) {
+        return;                                                       // Never saved (or different layout), wait for a fix
+    }
+
+    gps_position_t position;
+    position.latitude_e7 = stored_record.latitude_e7;
+    position.longitude_e7 = stored_record.longitude_e7;
+    position.timestamp = Kernel::Clock::now();
+    position.from_flash = true;
+
+    last_known.write(position);
+    record_stored = true;
+}
+
+// Keep the last fixed position, writing it to flash only when it is worth it ----------
+static void storeLastKnown(const gps_snapshot_t &snapshot){
+    gps_position_t position;
+    position.latitude_e7 = snapshot.latitude_e7;
+    position.longitude_e7 = snapshot.longitude_e7;
+    position.timestamp = snapshot.timestamp;
+    position.from_flash = false;
+
+    last_known.write(position);
+
+    // In 64 bits: two longitudes of opposite sign can be up to 3.6e9 apart, more than an int32 holds
+    if (record_stored && llabs((int64_t)snapshot.latitude_e7 - stored_record.latitude_e7) < GPS_LKG_MIN_MOVE_E7
+                      && llabs((int64_t)snapshot.longitude_e7 - stored_record.longitude_e7) < GPS_LKG_MIN_MOVE_E7) {
+        return;                                                       // Not moved, flash is already up to date
+    }
+
+    if (written_this_run && snapshot.timestamp - last_write < GPS_LKG_WRITE_PERIOD) {
+        return;                                                       // Limit flash wear on moving assets
+    }
+
+    gps_lkg_record_t record;
+    record.latitude_e7 = snapshot.latitude_e7;
+    record.longitude_e7 = snapshot.longitude_e7;
+
+    if (kv_set(GPS_LKG_KEY, &record, sizeof(record), 0) == MBED_SUCCESS) {
+        stored_record = record;
+        record_stored = true;
+        written_this_run = true;
+        last_write = snapshot.timestamp;
+    }
 }
 
 // Function to read and process GPS data -----------------------------------------------
 static void read_GPS(){
-    char c;
-    
-    // Read from GPS serial until a complete NMEA sentence is received
-    while (gps.read(&c, 1)) {
-        if (c == '\n') {
-            buffer[bufferIndex] = '\0';                               // Null-terminate the string
-            bufferIndex = 0;
+    char chunk[GPS_RX_CHUNK];
+    size_t len;
 
-            parse_GPS_data(buffer);                                   // Parse GPS data if it's a GPGGA sentence
-        } else {
-            buffer[bufferIndex++] = c;
-            if (bufferIndex >= sizeof(buffer) - 1) {
-                bufferIndex = 0;                                      // Prevent buffer overflow
+    // Drain the ring in bulk and feed the parser byte by byte
+    while ((len = rx_ring.pop(chunk, sizeof(chunk))) > 0) {
+        for (size_t i = 0; i < len; i++) {
+            switch (parser.feed(chunk[i])) {                          // Only complete sentences with a valid checksum are reported
+                case NMEA_GGA:
+                    parse_GPS_data(parser.gga());
+                    break;
+                case NMEA_PMTK_ACK:
+                    last_ack = parser.ack();
+                    ack_received = true;
+                    break;
+                default:
+                    break;
             }
         }
     }
 }
 
-uint8_t get_fix_status() {
-    uint8_t fix;
-    fix = fix_status;
-    return fix;
+// Getters ----------------------------------------------------------------------------
+bool get_gps_snapshot(gps_snapshot_t *snapshot) {
+    return gps_snapshot.read(*snapshot) != 0;
+}
+
+Kernel::Clock::duration get_gps_fix_age(const gps_snapshot_t &snapshot) {
+    return Kernel::Clock::now() - snapshot.timestamp;
+}
+
+bool get_gps_last_known(gps_position_t *position) {
+    return last_known.read(*position) != 0;
 }
 
-float get_latitude() {
-    float lat;
-    lat = latitude;
-    return lat;
+void get_gps_power_stats(gps_power_stats_t *stats) {
+    power_stats_shared.read(*stats);
 }
 
-float get_longitude() {
-    float lon;
-    lon = longitude;
-    return lon;
+// Called by the sender, wakes the GPS thread up so the next cycle is aligned with the uplinks
+void gps_uplink_sent() {
+    gps_flags.set(GPS_FLAG_UPLINK);
 }
+#endif
@@ -10,27 +10,167 @@
 // ==============================================================================================
 // MACROS
 // ==============================================================================================
+// GPS receiver compiled in (mbed_app.json sensor-gps), this whole module is left out otherwise
+#ifdef MBED_CONF_APP_SENSOR_GPS
+#define GPS_ENABLED                MBED_CONF_APP_SENSOR_GPS
+#else
+#define GPS_ENABLED                1
+#endif
+
 // Thread macros
-#define GPS_THREAD_SLEEP   500ms              // GPS measuring every 500 ms
+#define GPS_FLAG_SENTENCE  (1UL << 0)         // Set by the RX interrupt when a sentence terminator ('\n') has been received
+#define GPS_FLAG_UPLINK    (1UL << 1)         // Set by gps_uplink_sent(), the next position is needed one cycle later
+
+// Power management: after a fix the receiver is put in standby until GPS_WAKE_LEAD before the
+// next uplink, then it has GPS_FIX_DEADLINE to get a (hot start) fix before going back to sleep.
+// Until the first fix since boot it has no ephemeris to start from, so GPS_COLD_START_DEADLINE applies
+#ifdef MBED_CONF_APP_GPS_POWER_SAVE
+#define GPS_POWER_SAVE             MBED_CONF_APP_GPS_POWER_SAVE
+#else
+#define GPS_POWER_SAVE             false
+#endif
+
+#ifdef MBED_CONF_APP_GPS_CYCLE_PERIOD_MS
+#define GPS_CYCLE_PERIOD           std::chrono::milliseconds(MBED_CONF_APP_GPS_CYCLE_PERIOD_MS)  // Expected time between two uplinks
+#else
+#define GPS_CYCLE_PERIOD           60s
+#endif
+
+#ifdef MBED_CONF_APP_GPS_WAKE_LEAD_MS
+#define GPS_WAKE_LEAD              std::chrono::milliseconds(MBED_CONF_APP_GPS_WAKE_LEAD_MS)
+#else
+#define GPS_WAKE_LEAD              5s
+#endif
+
+#ifdef MBED_CONF_APP_GPS_FIX_DEADLINE_MS
+#define GPS_FIX_DEADLINE           std::chrono::milliseconds(MBED_CONF_APP_GPS_FIX_DEADLINE_MS)
+#else
+#define GPS_FIX_DEADLINE           30s
+#endif
+
+#ifdef MBED_CONF_APP_GPS_COLD_START_DEADLINE_MS
+#define GPS_COLD_START_DEADLINE    std::chrono::milliseconds(MBED_CONF_APP_GPS_COLD_START_DEADLINE_MS)
+#else
+#define GPS_COLD_START_DEADLINE    120s
+#endif
+
+// Age after which a snapshot no longer describes the current position
+#if GPS_POWER_SAVE
+#define GPS_FIX_VALIDITY           (GPS_CYCLE_PERIOD + GPS_FIX_DEADLINE)  // The last fix of a cycle has to last until the next one
+#else
+#define GPS_FIX_VALIDITY           5s                             // The receiver outputs one per second
+#endif
+
+// Last-known-good position, kept in KVStore so it survives a reboot
+#define GPS_LKG_KEY                "/kv/gps_lkg"
+#define GPS_LKG_MIN_MOVE_E7        1000                           // ~11 m, smaller moves are not worth a flash write
+#define GPS_LKG_WRITE_PERIOD       10min                          // At most one flash write per period (the first fix of a run is always written)
+
+// Position flags byte of the uplink
+#define GPS_POS_LIVE_FIX           0x01                           // Position comes from a current fix
+#define GPS_POS_CACHED             0x02                           // No current fix, last known position
+#define GPS_POS_INCLUDED           0x04                           // Position and age follow (geofence or distance event)
+#define GPS_POS_FENCE_ENTER        0x08                           // Entered a geofence since the last position sent
+#define GPS_POS_FENCE_EXIT         0x10                           // Left a geofence since the last position sent
+#define GPS_AGE_UNKNOWN            0xFF                           // Age field (one byte, minutes) when the position is from a previous run, 254 means 254 min or older
 
 // UART macros
 #define GPS_TX           PA_9
 #define GPS_RX           PA_10
-#define GPS_BAUD_RATE    9600
-#define GPS_BUFFER_SIZE  256
+#define GPS_BAUD_RATE    9600                 // Power-on baud rate of the MTK receiver, always used first
+#define GPS_RX_RING_SIZE 512                  // Bytes buffered by the RX interrupt until the thread drains them (two sentences worth at least)
+#define GPS_RX_CHUNK     64                   // Bytes moved out of the ring per bulk read
+
+#define GPS_COMMAND_SIZE 96                   // Longest command sent to the receiver, '$', checksum and CRLF included
+#define GPS_ACK_TIMEOUT  500ms                // Time allowed for a $PMTK001 answer
+#define GPS_BAUD_SWITCH_DELAY 20ms            // Time for the receiver to apply $PMTK251 before talking at the new rate
+
+// Baud rate negotiated at init ($PMTK251), the receiver stays at GPS_BAUD_RATE if it does not answer
+#ifdef MBED_CONF_APP_GPS_BAUD_RATE
+#define GPS_TARGET_BAUD_RATE       MBED_CONF_APP_GPS_BAUD_RATE
+#else
+#define GPS_TARGET_BAUD_RATE       GPS_BAUD_RATE
+#endif
 
-// Commands to send (RX)
-#define ENABLE_STATUS_ANTENA       "$PGCMD,33,1*6C\r\n"
-#define SET_UPDATING_NMEA_1HZ_RATE "$PMTK300,1000,0,0,0,0*2C\r\n"
-#define SET_SAMPLE_1HZ             "$PMTK220,1000*1F\r\n"
+// Fix (and NMEA output) rate: 1, 5 or 10 Hz
+#ifdef MBED_CONF_APP_GPS_FIX_RATE_HZ
+#define GPS_FIX_RATE_HZ            MBED_CONF_APP_GPS_FIX_RATE_HZ
+#else
+#define GPS_FIX_RATE_HZ            1
+#endif
+
+#if GPS_FIX_RATE_HZ != 1 && GPS_FIX_RATE_HZ != 5 && GPS_FIX_RATE_HZ != 10
+#error "gps-fix-rate-hz must be 1, 5 or 10"
+#endif
+
+// Commands to send (RX) - only the body, '$', checksum and CRLF are added when sending
+#define ENABLE_STATUS_ANTENA       "PGCMD,33,1"
+#define DISABLE_STATUS_ANTENA      "PGCMD,33,0"
+#define TEST_PACKET                "PMTK000"                      // Only answers $PMTK001,0,3, used to check the link (and to wake from standby)
+#define SET_STANDBY_MODE           "PMTK161,0"                    // Standby, any byte on RX wakes the receiver up with a hot start
+#define SET_BAUD_RATE              "PMTK251,%d"                   // Baud rate
+#define SET_UPDATING_NMEA_RATE     "PMTK300,%d,0,0,0,0"           // Fix interval in ms
+#define SET_SAMPLE_RATE            "PMTK220,%d"                   // NMEA output interval in ms
+#define SET_NMEA_OUTPUT            "PMTK314,"                     // Followed by GPS_NMEA_OUTPUT
+
+// Command numbers, as echoed in $PMTK001
+#define PMTK_TEST                  0
+#define PMTK_SET_NMEA_UPDATERATE   220
+
+// Sentence output profile: how often (in fixes) each sentence is sent. Field order is
+// GLL,RMC,VTG,GGA,GSA,GSV,6 reserved,ZDA,MCHN. Only GGA is parsed, so only GGA is enabled
+#ifdef MBED_CONF_APP_GPS_NMEA_OUTPUT
+#define GPS_NMEA_OUTPUT            MBED_CONF_APP_GPS_NMEA_OUTPUT
+#else
+#define GPS_NMEA_OUTPUT            "0,0,0,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0"
+#endif
+
+#ifdef MBED_CONF_APP_GPS_ANTENNA_STATUS
+#define GPS_ANTENNA_STATUS         MBED_CONF_APP_GPS_ANTENNA_STATUS  // $PGTOP antenna sentences, not parsed
+#else
+#define GPS_ANTENNA_STATUS         false
+#endif
+
+// GGA talkers accepted by the parser (GPS, multi-GNSS, GLONASS, Galileo)
+#define GPS_ACCEPTED_TALKERS       (NMEA_TALKER_GP | NMEA_TALKER_GN | NMEA_TALKER_GL | NMEA_TALKER_GA)
 // MACROS END ===================================================================================
 
+// ==============================================================================================
+// TYPES
+// ==============================================================================================
+typedef struct {
+    uint8_t fix;                              // 0 = no fix, 1 = GPS fix, 2 = DGPS fix
+    uint8_t satellites;                       // Satellites used in the solution
+    uint16_t hdop_x100;                       // Horizontal dilution of precision x 100
+    int32_t latitude_e7;                      // Degrees x 1e7, negative for South
+    int32_t longitude_e7;                     // Degrees x 1e7, negative for West
+    Kernel::Clock::time_point timestamp;      // Monotonic time at which the sentence was parsed
+} gps_snapshot_t;
+
+typedef struct {
+    int32_t latitude_e7;                      // Degrees x 1e7, negative for South
+    int32_t longitude_e7;                     // Degrees x 1e7, negative for West
+    Kernel::Clock::time_point timestamp;      // Monotonic time of the fix, meaningless if from_flash
+    bool from_flash;                          // Restored at boot from a previous run, age unknown
+} gps_position_t;
+
+typedef struct {
+    uint32_t cycles;                          // Wake-ups since boot (boot included)
+    uint32_t timeouts;                        // Cycles that reached GPS_FIX_DEADLINE without a fix
+    uint32_t last_time_to_fix_ms;             // Wake-up to first fix of the last successful cycle
+    uint32_t last_on_time_ms;                 // Time the receiver was awake in the last cycle
+    uint32_t total_on_time_ms;                // Time the receiver was awake since boot (completed cycles)
+} gps_power_stats_t;
+// TYPES END ====================================================================================
+
 // ==============================================================================================
 // PROTOTYPES
 // ==============================================================================================
-uint8_t get_fix_status();                     // Getter for the fix
-float get_latitude();                         // Getter for the lat
-float get_longitude();                        // Getter for the lon
+bool get_gps_snapshot(gps_snapshot_t *snapshot);                  // Consistent copy of the last GGA sentence, false if none was received yet
+Kernel::Clock::duration get_gps_fix_age(const gps_snapshot_t &snapshot);  // Time elapsed since the snapshot was captured
+bool get_gps_last_known(gps_position_t *position);                // Last position with a fix (this run or a previous one), false if there never was one
+void get_gps_power_stats(gps_power_stats_t *stats);               // Time to fix and GPS-on time counters
+void gps_uplink_sent();                                           // Tell the power manager a position has just been used
 void gps_th_routine();                        // GPS loop
 // PROTOTYPES END ===============================================================================
 
@@ -27,11 +27,15 @@
 
 // Self-crafted libraries
 #include "gps_thread.h"
+#include "geofence.h"
+#include "spectrum.h"
+#include "seqlock.h"
+#include "sensor_registry.h"
+#include "sensors/i2c_scheduler.h"
 #include "sensors/mma8451.h"
 #include "sensors/si7021.h"
 #include "sensors/tcs34725.h"
-#include "sensors/soilmoisture.h"
-#include "sensors/phototrans.h"
+#include "sensors/analog_sampler.h"
 
 // NAMESPACE ----------------------------------------------------------------------------------
 using namespace events;
@@ -40,8 +44,57 @@ using namespace std::chrono_literals;
 // MACROS -------------------------------------------------------------------------------------
 // LoRa related
 #define TX_TIMER                    20s                                      // Sets up an application dependent transmission timer in ms. Used only when Duty Cycling is off for testing
-#define MAX_NUMBER_OF_EVENTS        10                                       // Maximum number of events for the event queue. 10 is the safe number for the stack events, however, if application also uses the queue for whatever purposes, this number should be increased.
+#define MAX_NUMBER_OF_EVENTS        16                                       // Maximum number of events for the event queue. 10 is the safe number for the stack events, however, if application also uses the queue for whatever purposes, this number should be increased.
 #define CONFIRMED_MSG_RETRY_COUNTER 3                                        // Maximum number of retries for CONFIRMED messages before giving up
+#define QUEUE_PROBE_PERIOD          100ms                                    // How often the lateness of the stack event queue is measured
+
+// Per-uplink diagnostics (mbed_app.json diagnostics): acquisition time, stack queue lateness and I2C counters
+#ifdef MBED_CONF_APP_DIAGNOSTICS
+#define DIAGNOSTICS                 MBED_CONF_APP_DIAGNOSTICS
+#else
+#define DIAGNOSTICS                 0
+#endif
+
+// Sensors compiled in (mbed_app.json sensor-*), a disabled one leaves neither code nor payload block
+#ifdef MBED_CONF_APP_SENSOR_ACCEL
+#define SENSOR_ACCEL                MBED_CONF_APP_SENSOR_ACCEL               // MMA8451Q: window statistics, events and spectrum
+#else
+#define SENSOR_ACCEL                1
+#endif
+#ifdef MBED_CONF_APP_SENSOR_CLIMATE
+#define SENSOR_CLIMATE              MBED_CONF_APP_SENSOR_CLIMATE             // Si7021: temperature and humidity
+#else
+#define SENSOR_CLIMATE              1
+#endif
+#ifdef MBED_CONF_APP_SENSOR_ANALOG
+#define SENSOR_ANALOG               MBED_CONF_APP_SENSOR_ANALOG              // Soil moisture and phototransistor
+#else
+#define SENSOR_ANALOG               1
+#endif
+#ifdef MBED_CONF_APP_SENSOR_COLOUR
+#define SENSOR_COLOUR               MBED_CONF_APP_SENSOR_COLOUR              // TCS34725 and white LED: colour and light events
+#else
+#define SENSOR_COLOUR               1
+#endif
+#define SENSOR_GPS                  GPS_ENABLED                              // Also compiles the GPS thread out, see gps_thread.h
+#define SENSOR_I2C                  (SENSOR_ACCEL || SENSOR_CLIMATE || SENSOR_COLOUR)
+#define SENSOR_EVENTS               (SENSOR_ACCEL || SENSOR_COLOUR)          // Event uplink
+
+// Presence byte, the first of the periodic uplink: one bit per sensor block that follows
+#define PRESENCE_ACCEL              0x01
+#define PRESENCE_CLIMATE            0x02
+#define PRESENCE_ANALOG             0x04
+#define PRESENCE_COLOUR             0x08
+#define PRESENCE_GPS                0x10
+
+// Sensor thread
+#define SENSOR_QUEUE_EVENTS         16                                       // Sensor interrupts, polling and acquisition steps, posted with their arguments
+#define SENSOR_THREAD_STACK_SIZE    2048                                     // printf and the spectrum analysis
+
+// Storage thread, flash writes that must not hold up the event queue
+#define STORAGE_QUEUE_EVENTS        4
+#define STORAGE_THREAD_STACK_SIZE   2048                                     // KVStore writes
+#define GEOFENCE_SAVE_RETRY         50ms                                     // Wait for the copy being written to be released
 
 // Pins for sensors
 #define RGB_RED_PIN    PH_0                                                  // Pin connected to the RGB red
@@ -52,31 +105,237 @@ using namespace std::chrono_literals;
 #define LED_PIN        PH_1                                                  // White LED connected to PA_5 (adjust if necessary)
 #define MOISTURE_PIN   PA_0
 #define PHTRANS_PIN    PA_4
+#ifdef MBED_CONF_APP_ACCEL_INT1_PIN
+#define ACCEL_INT1_PIN MBED_CONF_APP_ACCEL_INT1_PIN                          // MMA8451Q INT1 (FIFO watermark), NC if not wired
+#else
+#define ACCEL_INT1_PIN NC
+#endif
+#ifdef MBED_CONF_APP_ACCEL_INT2_PIN
+#define ACCEL_INT2_PIN MBED_CONF_APP_ACCEL_INT2_PIN                          // MMA8451Q INT2 (motion and transient detectors), NC if not wired
+#else
+#define ACCEL_INT2_PIN NC
+#endif
+
+// Accelerometer FIFO
+#define ACCEL_DATA_RATE      MMA8451_ODR_50HZ
+#define ACCEL_FIFO_WATERMARK 25                                              // Drain every 0.5 s at 50 Hz, 7 samples of margin before the FIFO is full
+#define ACCEL_DRAIN_PERIOD   500ms                                           // Polling period when no interrupt pin is wired, one watermark worth of samples
+
+// Accelerometer events (thresholds in 0.063 g, debounce in samples at ACCEL_DATA_RATE)
+#define ACCEL_MOTION_THRESHOLD    24                                         // 1.5 g on any axis, gravity included
+#define ACCEL_MOTION_COUNT        5                                          // 100 ms
+#define ACCEL_FREEFALL            false                                      // FF_MT detector in freefall (all axes below the threshold) instead of motion mode
+#define ACCEL_TRANSIENT_THRESHOLD 4                                          // 0.25 g change, gravity filtered out
+#define ACCEL_TRANSIENT_COUNT     2                                          // 40 ms
+#define EVENT_HOLDOFF             30s                                        // Minimum time between two event uplinks, events in between are merged
+#define EVENT_PAYLOAD_SIZE        6
+#ifdef MBED_CONF_APP_EVENT_PORT
+#define EVENT_PORT                MBED_CONF_APP_EVENT_PORT
+#else
+#define EVENT_PORT                11
+#endif
+
+// Si7021
+#define SI7021_RESOLUTION         SI7021_RES_RH12_T14                        // SI7021_RES_RH8_T12 converts about 3 times faster
+#define STATUS_SI7021_FAILED      0x20                                       // Temperature and humidity not valid, shares the byte with the GPS_POS_* flags
+
+// Acquisition: every conversion is started by send_message() and collected as it finishes
+#define ACQ_POLL_PERIOD           2ms                                        // Between checks of the conversions still running
+
+// Light events (TCS34725 sampling on its own, clear counts at 4x and 24 ms, full scale 10240)
+#ifdef MBED_CONF_APP_LIGHT_INT_PIN
+#define LIGHT_INT_PIN             MBED_CONF_APP_LIGHT_INT_PIN                // TCS34725 INT (open drain, active low), NC if not wired
+#else
+#define LIGHT_INT_PIN             NC
+#endif
+#define LIGHT_AGAIN               0x01                                       // 4x
+#define LIGHT_ATIME               0xF6                                       // 24ms
+#define LIGHT_WTIME               0x00                                       // With WLONG: one integration every 7.4 s
+#define LIGHT_PERSISTENCE         2                                          // 2 cycles out of the band, about 15 s
+#define LIGHT_LOW_THRESHOLD       200                                        // Below: dark
+#define LIGHT_HIGH_THRESHOLD      8000                                       // Above: direct light
+#define LIGHT_POLL_PERIOD         5s                                         // STATUS polling when no interrupt pin is wired
+#define LIGHT_IN_BAND             1                                          // Light states sent in the event uplink, 0 = no light event
+#define LIGHT_BELOW               2
+#define LIGHT_ABOVE               3
+
+// Vibration spectrum (captured from the FIFO at ACCEL_DATA_RATE, so bin k is k * ODR / SPECTRUM_POINTS Hz)
+#define SPECTRUM_POINTS           128                                        // 2.56 s at 50 Hz, 0.39 Hz per bin
+#define SPECTRUM_AXIS             2                                          // Z, normal to the mounting surface
+#define SPECTRUM_TOP_BINS         5
+#define SPECTRUM_PERIOD           10min
+#define SPECTRUM_PAYLOAD_SIZE     (3 + 3 * SPECTRUM_TOP_BINS)
+#ifdef MBED_CONF_APP_SPECTRUM_PORT
+#define SPECTRUM_PORT             MBED_CONF_APP_SPECTRUM_PORT
+#else
+#define SPECTRUM_PORT             12
+#endif
+
+// TYPES --------------------------------------------------------------------------------------
+typedef struct {
+    int16_t accel[3];                                                        // Window means, or one sample if the FIFO is not working
+    mma8451_window_t vibration;
+    uint16_t temperature;                                                    // Si7021 codes, 0 if it failed
+    uint16_t humidity;
+    bool si7021_failed;
+    uint16_t soil_moisture;                                                  // ADC, oversampled to 16 bit
+    uint16_t light;
+    uint32_t soil_moisture_variance;                                         // Over the burst, in counts^2
+    uint32_t light_variance;
+    tcs34725_light_t colour;
+    uint16_t si7021_ms;                                                      // From the start of the acquisition to the result
+    uint16_t tcs34725_ms;
+    uint16_t acquisition_ms;                                                 // The slowest of them, plus the polling granularity
+} sensor_sample_t;
+
+typedef struct {
+    uint8_t count;
+    spectrum_peak_t peaks[SPECTRUM_TOP_BINS];                                // Strongest first
+} spectrum_result_t;
 
 // CONSTRUCTORS -------------------------------------------------------------------------------
 // Sensor related
+#if SENSOR_I2C
 I2C i2c(SDA_PIN, SCL_PIN);                                                   // I2C communication
-Si7021 si7021(i2c);                                                          // Constructor for the Si7021
-MMA8451Q mma8451q(i2c);                                                      // Constructor for the MMA8451Q
-TCS34725 tcs34725(i2c);                                                      // Constructor for the TCS34725
-static BusOut myRGB(RGB_RED_PIN, RGB_GREEN_PIN, RGB_BLUE_PIN);               // BusOut to control the RGB LED with just an object
+I2CScheduler i2c_bus(i2c);                                                   // Transactions of every I2C sensor, served in turn
+#endif
+#if SENSOR_CLIMATE
+Si7021 si7021(i2c_bus);                                                      // Constructor for the Si7021
+#endif
+#if SENSOR_ACCEL
+MMA8451Q mma8451q(i2c_bus);                                                  // Constructor for the MMA8451Q
+#endif
+#if SENSOR_COLOUR
+TCS34725 tcs34725(i2c_bus);                                                  // Constructor for the TCS34725
 static DigitalOut whiteLED(LED_PIN);                                         // DigitalOut for builtin white LED control
-static AnalogIn moistureIn(MOISTURE_PIN);                                    // Analog pin corresponding to Arduino's A0
-static AnalogIn lightIn(PHTRANS_PIN);                                        // Analog pin corresponding to Arduino's A2
+#endif
+#if SENSOR_ANALOG
+static AnalogSampler analog(MOISTURE_PIN, PHTRANS_PIN);                      // Arduino's A0 and A2, oversampled in bursts
+#endif
+static BusOut myRGB(RGB_RED_PIN, RGB_GREEN_PIN, RGB_BLUE_PIN);               // BusOut to control the RGB LED with just an object
 
 // LoRa related
 static EventQueue ev_queue(MAX_NUMBER_OF_EVENTS *EVENTS_EVENT_SIZE);         // This event queue is the global event queue for both the application and stack. To conserve memory, the stack is designed to run in the same thread as the application and the application is responsible for providing an event queue to the stack that will be used for ISR deferment as well as application information event queuing.
 static void lora_event_handler(lorawan_event_t event);                       // Event handler. This will be passed to the LoRaWAN stack to queue events for the application which in turn drive the application.
+#if SENSOR_ACCEL
+static void accel_int_handler();                                             // Drains the accelerometer FIFO and collects its events, deferred to the sensor thread from the INT1/INT2 ISRs
+static void queue_accel_event(mma8451_events_t events);                      // Merges accelerometer events into the next event uplink
+#endif
+#if SENSOR_COLOUR
+static void light_int_handler();                                             // Checks the TCS34725 threshold interrupt, moves the band and queues a light event
+static void queue_light_event(uint8_t state, uint16_t clear);
+#endif
+#if SENSOR_EVENTS
+static void schedule_event();                                                // Counts an event and schedules its uplink, within EVENT_HOLDOFF of the last one
+static void send_event();                                                    // Event uplink on EVENT_PORT, sent as soon as possible after a motion, transient or light change
+#endif
+#if SENSOR_ACCEL
+static void start_spectrum();                                                // Asks the sensor thread for a capture, unless the last spectrum is still on its way
+static void capture_spectrum();                                              // Starts a capture of SPECTRUM_POINTS samples, analysed once drained from the FIFO
+static void send_spectrum_result(spectrum_result_t result);                  // Keeps an analysed spectrum for send_spectrum()
+static void send_spectrum();                                                 // Spectrum uplink on SPECTRUM_PORT with the strongest bins
+#endif
+#if SENSOR_COLOUR
+static uint16_t pack_light(uint32_t value);                                  // 4-bit exponent, 12-bit mantissa
+#endif
+static void start_acquisition();                                             // Starts every conversion at once
+static void collect_measurements();                                          // Reads every conversion that is done, publishes the sample once none is left
+static uint16_t acquisition_elapsed_ms(Kernel::Clock::time_point now);
+static void build_message();                                                 // Encodes and sends the last sample published, no sensor I/O
+#if DIAGNOSTICS
+static void queue_probe();                                                   // Measures how late the stack event queue runs
+#endif
+#if SENSOR_GPS
+static void save_geofence();                                                 // Copies the fences for the storage thread after a downlink changed them
+static void write_geofence();                                                // Writes that copy to KVStore, in the storage thread
+#endif
 static LoRaWANInterface lorawan(radio);                                      // Constructing Mbed LoRaWANInterface and passing it the radio object from lora_radio_helper.
 static lorawan_app_callbacks_t callbacks;                                    // Application specific callbacks
 
+// Sensor related, every access to the sensors is made from this thread so the LoRaWAN stack
+// events never wait for the I2C bus. Same priority as the event queue thread, as the SeqLock
+// readers require; it sleeps on the bus and on the conversions most of the time
+static EventQueue sensor_queue(SENSOR_QUEUE_EVENTS *EVENTS_EVENT_SIZE);
+static Thread sensor_th(osPriorityNormal, SENSOR_THREAD_STACK_SIZE);
+
+#if SENSOR_GPS
 // GPS related
-static Thread gps_th(osPriorityNormal, 1024);                                // Thread for the measurements of the GPS
+static Thread gps_th(osPriorityNormal, 2048);                                // Thread for the measurements of the GPS (KVStore writes need the extra stack)
+
+// Geofence, only used from the event queue (uplinks and downlinks)
+static Geofence geofence;
+
+// Storage related, below every other thread: a KVStore write erases and programs flash for tens
+// of ms, which would delay the LoRaWAN stack if it ran on the event queue
+static EventQueue storage_queue(STORAGE_QUEUE_EVENTS *EVENTS_EVENT_SIZE);
+static Thread storage_th(osPriorityBelowNormal, STORAGE_THREAD_STACK_SIZE);
+#endif
 
 // GLOBAL VARIABLES ---------------------------------------------------------------------------
+#if SENSOR_EVENTS
+// Accelerometer and light events, only used from the event queue
+static mma8451_events_t pending_events;                                      // Detector sources merged since the last event uplink
+static uint8_t pending_event_count = 0;
+static uint8_t in_flight_event_count = 0;                                    // Event uplink waiting for TX_DONE, 0 if the last uplink was a periodic one
+static mma8451_events_t in_flight_events;
+static uint8_t pending_light = 0;                                            // LIGHT_* state after the last light event, 0 if none
+static uint16_t pending_clear = 0;
+static uint8_t in_flight_light = 0;
+static uint16_t in_flight_clear = 0;
+static bool event_scheduled = false;
+static bool event_sent = false;
+static Kernel::Clock::time_point last_event_time;
+#endif
+
+#if SENSOR_ACCEL
+// Vibration spectrum, capture and analysis in the sensor thread
+static Spectrum spectrum;
+static int16_t spectrum_samples[SPECTRUM_POINTS];
+static bool spectrum_capturing = false;
+
+// Vibration spectrum uplink, only used from the event queue
+static spectrum_result_t spectrum_result;
+static bool spectrum_scheduled = false;                                      // Analysed, waiting for send_spectrum()
+static bool spectrum_in_flight = false;                                      // Spectrum uplink waiting for TX_DONE
+#endif
+
+// Acquisition started by send_message(), only used from the sensor thread
+static uint32_t acquisition_pending = 0;                                     // One bit per sensor of the registry not collected yet
+static Kernel::Clock::time_point acquisition_start;
+static sensor_sample_t acquisition;                                          // Filled as the conversions finish
+#if SENSOR_CLIMATE
+static Kernel::Clock::time_point si7021_deadline;
+#endif
+#if SENSOR_COLOUR
+static Kernel::Clock::time_point tcs34725_deadline;
+#endif
+
+// Last complete sample: written by the sensor thread, read by build_message() on the event queue
+static SeqLock<sensor_sample_t> sensor_sample;
+
+#if SENSOR_GPS
+// Position of the last uplink encoded, only used from the event queue
+static geo_point_t position_here;
+static bool position_known = false;                                          // Live fix or last known position, evaluated against the fences
+static bool position_included = false;
+#endif
+
+#if SENSOR_GPS
+// Copy of the fences handed to the storage thread, the event queue never waits for the mutex
+static Mutex geofence_save_mutex;
+static geofence_config_t geofence_save_config;
+static bool geofence_save_pending = false;                                   // A write is queued, it will pick up the latest copy
+#endif
+
+// Stack event queue lateness, only used from the event queue
+#if DIAGNOSTICS
+static Kernel::Clock::time_point queue_probe_last;
+static uint16_t queue_late_max_ms = 0;                                       // Worst since the last uplink
+#endif
+
 // LoRa buffers
-static constexpr size_t TX_BUFFER_SIZE = 30;                                 // Max payload size can be LORAMAC_PHY_MAXPAYLOAD. This example only communicates with much shorter messages (<30 bytes). If longer messages are used, these buffers must be changed accordingly.
-static constexpr size_t RX_BUFFER_SIZE = 30;
+static constexpr size_t TX_BUFFER_SIZE = 51;                                 // Max payload size can be LORAMAC_PHY_MAXPAYLOAD. 51 bytes is the limit at the slowest EU868 data rates, so messages never get truncated.
+static constexpr size_t RX_BUFFER_SIZE = 51;                                 // Largest downlink: a geofence polygon
 uint8_t tx_buffer[TX_BUFFER_SIZE];
 uint8_t rx_buffer[RX_BUFFER_SIZE];
 
@@ -86,16 +345,377 @@ static uint8_t DEV_EUI[] = {0x86, 0x39, 0x32, 0x35, 0x59, 0x37, 0x91, 0x94};
 static uint8_t APP_EUI[] = {0x70, 0xb3, 0xd5, 0x7e, 0xd0, 0x00, 0xac, 0x4a};
 static uint8_t APP_KEY[] = {0x86, 0x39, 0x32, 0x35, 0x59, 0x37, 0x91, 0x94, 0x86, 0x39, 0x32, 0x35, 0x59, 0x37, 0x91, 0x94};
 
+// ============================================================================================
+// SENSORS
+// ============================================================================================
+// One struct of hooks per sensor (see sensor_registry.h), listed in Sensors below. start() and
+// collect() run in the sensor thread, encode() and sent() on the event queue from the sample
+// published in between. A sensor disabled in mbed_app.json is a NoSensor in the list
+#if SENSOR_ACCEL
+// MMA8451Q, window statistics of every sample since the last uplink sent: means, then RMS, peak
+// and peak to peak of each axis. The window stays open until sent(), so an uplink retried after
+// WOULD_BLOCK reports the whole period instead of the last few seconds
+struct AccelSensor {
+    static constexpr uint8_t PRESENCE = PRESENCE_ACCEL;
+    static constexpr size_t MAX_SIZE = 6 + 18;
+
+    static void init(){
+        mma8451q.init_mma8451();                                             // Initialize the MMA8451Q
+        mma8451q.set_data_rate(ACCEL_DATA_RATE);
+        mma8451q.init_fifo(F_MODE_CIRCULAR, ACCEL_FIFO_WATERMARK, true);     // Every sample between uplinks ends up in the window statistics
+        mma8451q.init_motion(ACCEL_MOTION_THRESHOLD, ACCEL_MOTION_COUNT, ACCEL_FREEFALL, false);
+        mma8451q.init_transient(ACCEL_TRANSIENT_THRESHOLD, ACCEL_TRANSIENT_COUNT, false);
+    }
+
+    static void start(sensor_sample_t &){
+    }
+
+    static bool collect(sensor_sample_t &sample, Kernel::Clock::time_point){
+        mma8451q.drain_fifo();                                               // Samples still below the watermark
+        mma8451q.get_window(&sample.vibration);                              // Closed by sent()
+
+        if(sample.vibration.samples > 0){
+            sample.accel[0] = sample.vibration.mean[0];
+            sample.accel[1] = sample.vibration.mean[1];
+            sample.accel[2] = sample.vibration.mean[2];
+        } else {                                                             // FIFO not working, fall back to one sample
+            mma8451_xyz_t accel = {0, 0, 0};
+            mma8451q.read_xyz(&accel);
+            sample.accel[0] = accel.x;
+            sample.accel[1] = accel.y;
+            sample.accel[2] = accel.z;
+        }
+        return true;
+    }
+
+    static size_t encode(const sensor_sample_t &sample, uint8_t *buffer, uint8_t &){
+        const mma8451_window_t &vibration = sample.vibration;
+        size_t pos = 0;
+
+        for(uint8_t axis = 0; axis < 3; axis++){                             // 14 bit, X, Y, Z
+            buffer[pos++] = sample.accel[axis] & 0xff;
+            buffer[pos++] = (sample.accel[axis] >> 8) & 0xff;
+        }
+        for(uint8_t axis = 0; axis < 3; axis++){
+            buffer[pos++] = vibration.rms[axis] & 0xff;
+            buffer[pos++] = (vibration.rms[axis] >> 8) & 0xff;
+            buffer[pos++] = vibration.peak[axis] & 0xff;
+            buffer[pos++] = (vibration.peak[axis] >> 8) & 0xff;
+            buffer[pos++] = vibration.peak_to_peak[axis] & 0xff;
+            buffer[pos++] = (vibration.peak_to_peak[axis] >> 8) & 0xff;
+        }
+
+        printf("Ax: %d, Ay: %d, Az: %d (%u samples%s)\n\r", sample.accel[0], sample.accel[1], sample.accel[2], vibration.samples, vibration.overflow ? ", overflow" : "");
+        printf("RMS: %u/%u/%u, peak: %u/%u/%u, p2p: %u/%u/%u\n\r", vibration.rms[0], vibration.rms[1], vibration.rms[2],
+               vibration.peak[0], vibration.peak[1], vibration.peak[2], vibration.peak_to_peak[0], vibration.peak_to_peak[1], vibration.peak_to_peak[2]);
+        return pos;
+    }
+
+    static void sent(){
+        sensor_queue.call(callback(&mma8451q, &MMA8451Q::close_window));      // After the collect() of this uplink, before the next one
+    }
+};
+#else
+typedef NoSensor AccelSensor;
+#endif
+
+#if SENSOR_CLIMATE
+// Si7021 no-hold conversion, the sensor NACKs until it is done. Failures are flagged in the
+// status byte and sent as zeros
+struct ClimateSensor {
+    static constexpr uint8_t PRESENCE = PRESENCE_CLIMATE;
+    static constexpr size_t MAX_SIZE = 4;
+
+    static void init(){
+        si7021.set_resolution(SI7021_RESOLUTION);
+    }
+
+    static void start(sensor_sample_t &){
+        si7021.start_measurement();
+        si7021_deadline = acquisition_start + 2 * si7021.conversion_time();
+    }
+
+    static bool collect(sensor_sample_t &sample, Kernel::Clock::time_point now){
+        if(now < acquisition_start + si7021.conversion_time() / 2){          // No point polling a conversion just started
+            return false;
+        }
+        bool ready = si7021.read_measurement(&sample.humidity, &sample.temperature);
+
+        if(!ready && now < si7021_deadline){
+            return false;
+        }
+        if(!ready){                                                          // Not answering or CRC error
+            sample.humidity = 0;
+            sample.temperature = 0;
+        }
+        sample.si7021_failed = !ready;
+        sample.si7021_ms = acquisition_elapsed_ms(now);
+        return true;
+    }
+
+    static size_t encode(const sensor_sample_t &sample, uint8_t *buffer, uint8_t &status){
+        size_t pos = 0;
+
+        buffer[pos++] = sample.temperature & 0xff;
+        buffer[pos++] = (sample.temperature >> 8) & 0xff;
+        buffer[pos++] = sample.humidity & 0xff;
+        buffer[pos++] = (sample.humidity >> 8) & 0xff;
+        status |= sample.si7021_failed ? STATUS_SI7021_FAILED : 0;
+
+        printf("T: %d, RH: %d (%u ms%s)\n\r", sample.temperature, sample.humidity, sample.si7021_ms, sample.si7021_failed ? ", failed" : "");
+        return pos;
+    }
+
+    static void sent(){
+    }
+};
+#else
+typedef NoSensor ClimateSensor;
+#endif
+
+#if SENSOR_ANALOG
+// Soil moisture and phototransistor burst - 12 bit, oversampled to 16 bit. Timer and DMA driven,
+// but start() waits for it (a few ms, asleep): the white LED of the colour sensor, next in the
+// list, must not light the phototransistor
+struct AnalogSensor {
+    static constexpr uint8_t PRESENCE = PRESENCE_ANALOG;
+    static constexpr size_t MAX_SIZE = 4;
+
+    static void init(){
+        if(!analog.init()){                                                  // Calibrates the ADC
+            printf("\r\n Analog sampler initialization failed! \r\n");
+        }
+    }
+
+    static void start(sensor_sample_t &sample){
+        analog_reading_t readings[ANALOG_CHANNELS];
+        Kernel::Clock::time_point deadline = Kernel::Clock::now() + std::chrono::duration_cast<Kernel::Clock::duration>(2 * analog.burst_time()) + ACQ_POLL_PERIOD;
+
+        analog.start_burst();                                                // Already done on return without DMA
+        while(!analog.burst_ready() && Kernel::Clock::now() < deadline){
+            ThisThread::sleep_for(1ms);
+        }
+        analog.read(readings);                                               // Zero if the burst did not complete
+        sample.soil_moisture = readings[0].mean;
+        sample.soil_moisture_variance = readings[0].variance;
+        sample.light = readings[1].mean;
+        sample.light_variance = readings[1].variance;
+    }
+
+    static bool collect(sensor_sample_t &, Kernel::Clock::time_point){
+        return true;
+    }
+
+    static size_t encode(const sensor_sample_t &sample, uint8_t *buffer, uint8_t &){
+        size_t pos = 0;
+
+        buffer[pos++] = sample.soil_moisture & 0xff;
+        buffer[pos++] = (sample.soil_moisture >> 8) & 0xff;
+        buffer[pos++] = sample.light & 0xff;
+        buffer[pos++] = (sample.light >> 8) & 0xff;
+
+        printf("Moisture: %d (variance %lu), light = %d (variance %lu)\n\r", sample.soil_moisture, (unsigned long)sample.soil_moisture_variance,
+               sample.light, (unsigned long)sample.light_variance);
+        return pos;
+    }
+
+    static void sent(){
+    }
+};
+#else
+typedef NoSensor AnalogSensor;
+#endif
+
+#if SENSOR_COLOUR
+// Colour sensor TCS34725, one integration fully lit by the white LED. Normalised values, packed
+// with pack_light(): clear, red, green, blue
+struct ColourSensor {
+    static constexpr uint8_t PRESENCE = PRESENCE_COLOUR;
+    static constexpr size_t MAX_SIZE = 8;
+
+    static void init(){
+        tcs34725.tcs34725_init();                                            // Initialize the TCS34725 sensor
+        tcs34725.set_autorange(true);                                        // Gain and integration time follow the previous reading
+    }
+
+    static void start(sensor_sample_t &){
+        light_int_handler();                                                 // Light event first, the on-demand read clears the interrupt
+        whiteLED = 1;                                                        // Turn on the white LED before taking a measurement
+        tcs34725.start_measurement();                                        // New integration cycle
+        std::chrono::microseconds integration = tcs34725.integration_time();
+        tcs34725_deadline = Kernel::Clock::now() + std::chrono::duration_cast<Kernel::Clock::duration>(integration + integration / 2);
+    }
+
+    static bool collect(sensor_sample_t &sample, Kernel::Clock::time_point now){
+        std::chrono::microseconds integration = tcs34725.integration_time();
+        if(now < tcs34725_deadline - std::chrono::duration_cast<Kernel::Clock::duration>(integration / 2)){   // Not before the end of the integration
+            return false;
+        }
+        bool ready = tcs34725.measurement_ready();                           // AVALID
+
+        if(!ready && now < tcs34725_deadline){
+            return false;
+        }
+        if(!ready || !tcs34725.read_normalised(&sample.colour)){
+            memset(&sample.colour, 0, sizeof(sample.colour));
+        }
+        whiteLED = 0;                                                        // Turn off the white LED after the measurement
+        tcs34725.finish_measurement();                                       // Back to autonomous sampling (or powered down)
+        sample.tcs34725_ms = acquisition_elapsed_ms(now);
+        return true;
+    }
+
+    static size_t encode(const sensor_sample_t &sample, uint8_t *buffer, uint8_t &){
+        const tcs34725_light_t &colour = sample.colour;
+        uint16_t packed[4] = {pack_light(colour.clear), pack_light(colour.red), pack_light(colour.green), pack_light(colour.blue)};  // Counts per ms per gain, independent of the range
+        size_t pos = 0;
+
+        for(uint8_t i = 0; i < 4; i++){
+            buffer[pos++] = packed[i] & 0xff;
+            buffer[pos++] = (packed[i] >> 8) & 0xff;
+        }
+
+        printf("C: %lu, R: %lu, G: %lu, B: %lu (/256 per ms per gain, %ux, ATIME 0x%02x%s, %u ms)\n\r", (unsigned long)colour.clear, (unsigned long)colour.red, (unsigned long)colour.green,
+               (unsigned long)colour.blue, colour.gain, colour.atime, colour.saturated ? ", saturated" : "", sample.tcs34725_ms);
+        return pos;
+    }
+
+    static void sent(){
+    }
+};
+#else
+typedef NoSensor ColourSensor;
+#endif
+
+#if SENSOR_GPS
+// GPS, read from the snapshot of the GPS thread. The GPS_POS_* flags always go in the status
+// byte, the position and its age only when the geofence asks for it
+struct PositionSensor {
+    static constexpr uint8_t PRESENCE = PRESENCE_GPS;
+    static constexpr size_t MAX_SIZE = 9;
+
+    static void init(){
+        gps_th.start(gps_th_routine);                                        // Start GPS thread
+        geofence.restore();                                                  // Fences loaded by downlink before the last reset
+    }
+
+    static void start(sensor_sample_t &){
+    }
+
+    static bool collect(sensor_sample_t &, Kernel::Clock::time_point){
+        return true;
+    }
+
+    static size_t encode(const sensor_sample_t &, uint8_t *buffer, uint8_t &status){
+        gps_snapshot_t gps_fix;
+        gps_position_t gps_last;
+        gps_power_stats_t gps_power;
+        uint8_t position_flags = 0;
+        uint8_t gps_age_min = 0;
+        size_t pos = 0;
+
+        // One consistent snapshot, stale ones count as no fix
+        if(!get_gps_snapshot(&gps_fix) || get_gps_fix_age(gps_fix) > GPS_FIX_VALIDITY){
+            gps_fix.fix = 0;
+        }
+        get_gps_power_stats(&gps_power);
+
+        int32_t current_lat = gps_fix.latitude_e7;                           // Degrees x 1e7, no float anywhere from the NMEA sentence to the payload
+        int32_t current_lon = gps_fix.longitude_e7;
+
+        if(gps_fix.fix != 0){
+            position_flags |= GPS_POS_LIVE_FIX;
+        } else if(get_gps_last_known(&gps_last)){                            // No fix now, send the last known position and how old it is
+            current_lat = gps_last.latitude_e7;
+            current_lon = gps_last.longitude_e7;
+            position_flags |= GPS_POS_CACHED;
+
+            if(gps_last.from_flash){
+                gps_age_min = GPS_AGE_UNKNOWN;                               // Saved before the last reset, there is no clock to tell its age
+            } else {
+                auto age = std::chrono::duration_cast<std::chrono::minutes>(Kernel::Clock::now() - gps_last.timestamp).count();
+                gps_age_min = age < GPS_AGE_UNKNOWN ? age : GPS_AGE_UNKNOWN - 1;
+            }
+        } else {                                                             // Never had a fix
+            current_lat = 0;
+            current_lon = 0;
+        }
+
+        // Geofence - the position is only sent when it tells the server something new. The fence
+        // states only move on in sent(): an uplink that does not go out is encoded again the same
+        position_here = {current_lat, current_lon};
+        position_known = position_flags != 0;                                // Never had a fix: nothing to evaluate nor send
+        uint8_t fence_events = position_known ? geofence.evaluate(position_here) : 0;
+
+        if(fence_events != 0){
+            position_flags |= GPS_POS_INCLUDED;
+        }
+        if(fence_events & GEOFENCE_EVENT_ENTER){
+            position_flags |= GPS_POS_FENCE_ENTER;
+        }
+        if(fence_events & GEOFENCE_EVENT_EXIT){
+            position_flags |= GPS_POS_FENCE_EXIT;
+        }
+        status |= position_flags;
+        position_included = (position_flags & GPS_POS_INCLUDED) != 0;
+
+        if(position_included){
+            uint32_t lat_u32 = (uint32_t) current_lat;                       // Two's complement, decoded as a signed 32-bit integer in LUA
+            uint32_t lon_u32 = (uint32_t) current_lon;
+
+            buffer[pos++] = lat_u32 & 0xff;
+            buffer[pos++] = (lat_u32 >> 8) & 0xff;
+            buffer[pos++] = (lat_u32 >> 16) & 0xff;
+            buffer[pos++] = (lat_u32 >> 24) & 0xff;
+
+            buffer[pos++] = lon_u32 & 0xff;
+            buffer[pos++] = (lon_u32 >> 8) & 0xff;
+            buffer[pos++] = (lon_u32 >> 16) & 0xff;
+            buffer[pos++] = (lon_u32 >> 24) & 0xff;
+
+            buffer[pos++] = gps_age_min;
+        }
+
+        printf("FS: %d, flags: 0x%02x, age: %u min, Lat: %s%ld.%07ld, Lon: %s%ld.%07ld\n\r", gps_fix.fix, position_flags, gps_age_min,
+               current_lat < 0 ? "-" : "", labs(current_lat) / 10000000, labs(current_lat) % 10000000,
+               current_lon < 0 ? "-" : "", labs(current_lon) / 10000000, labs(current_lon) % 10000000);
+        printf("GPS cycles: %lu, timeouts: %lu, TTF: %lu ms, on: %lu ms (total %lu ms)\n\r", (unsigned long)gps_power.cycles, (unsigned long)gps_power.timeouts,
+               (unsigned long)gps_power.last_time_to_fix_ms, (unsigned long)gps_power.last_on_time_ms, (unsigned long)gps_power.total_on_time_ms);
+        return pos;
+    }
+
+    static void sent(){
+        gps_uplink_sent();                                                   // Lets the GPS sleep until shortly before the next uplink
+        if(position_known){
+            geofence.update(position_here);                                  // The fence states the uplink reported
+        }
+        if(position_included){
+            geofence.position_sent(position_here);                           // Following uplinks only carry the position again on a fence or distance event
+        }
+    }
+};
+#else
+typedef NoSensor PositionSensor;
+#endif
+
+// Acquisition and payload order. The analog burst has to come before the colour sensor, whose
+// white LED would light the phototransistor
+typedef SensorRegistry<sensor_sample_t, AccelSensor, ClimateSensor, AnalogSensor, ColourSensor, PositionSensor> Sensors;
+
+static_assert(2 + Sensors::MAX_SIZE <= TX_BUFFER_SIZE, "Periodic uplink larger than the 51-byte limit");  // Presence and status bytes, then the blocks
+// SENSORS END ================================================================================
+
 // ============================================================================================
 // MAIN
 // ============================================================================================
 int main(void){
     // Setup threads --------------------------------------------------------------------------
-    gps_th.start(gps_th_routine);                                            // Start GPS thread
+#if SENSOR_I2C
+    i2c_bus.start();                                                         // Start the I2C bus thread, before any sensor is touched
+#endif
 
-    // Setup sensors --------------------------------------------------------------------------
-    mma8451q.init_mma8451();                                                 // Initialize the MMA8451Q
-    tcs34725.tcs34725_init();                                                // Initialize the TCS34725 sensor
+    // Setup sensors (and the GPS thread and geofence) ----------------------------------------
+    Sensors::init();
 
     // Setup RGB LED --------------------------------------------------------------------------
     myRGB = 0b111;                                                           // Ensure RGB LED is OFF
@@ -166,6 +786,43 @@ int main(void){
 
     printf("\r\n Connection - In Progress ...\r\n");
 
+#if SENSOR_ACCEL
+    // Accelerometer interrupts, handled from the sensor thread, never from the ISR (I2C) --
+    if(ACCEL_INT1_PIN != NC){
+        static InterruptIn accel_int1(ACCEL_INT1_PIN);
+        accel_int1.rise(sensor_queue.event(accel_int_handler));
+    }
+    if(ACCEL_INT2_PIN != NC){
+        static InterruptIn accel_int2(ACCEL_INT2_PIN);
+        accel_int2.rise(sensor_queue.event(accel_int_handler));
+    }
+    if(ACCEL_INT1_PIN == NC || ACCEL_INT2_PIN == NC){                        // INT_SOURCE is read on every call, so polling also catches the unwired pin's events
+        sensor_queue.call_every(ACCEL_DRAIN_PERIOD, accel_int_handler);
+    }
+    ev_queue.call_every(SPECTRUM_PERIOD, start_spectrum);
+#endif
+
+#if SENSOR_COLOUR
+    // Light band, the TCS34725 samples on its own and only wakes the MCU when it is left ------
+    tcs34725.set_thresholds(LIGHT_LOW_THRESHOLD, LIGHT_HIGH_THRESHOLD);
+    tcs34725.start_autonomous(LIGHT_AGAIN, LIGHT_ATIME, LIGHT_WTIME, true, LIGHT_PERSISTENCE);
+    if(LIGHT_INT_PIN != NC){
+        static InterruptIn light_int(LIGHT_INT_PIN, PullUp);
+        light_int.fall(sensor_queue.event(light_int_handler));
+    } else {
+        sensor_queue.call_every(LIGHT_POLL_PERIOD, light_int_handler);
+    }
+#endif
+
+    // Sensor thread, after the sensor setup above --------------------------------------------
+    sensor_th.start(callback(&sensor_queue, &EventQueue::dispatch_forever));
+#if SENSOR_GPS
+    storage_th.start(callback(&storage_queue, &EventQueue::dispatch_forever));
+#endif
+#if DIAGNOSTICS
+    ev_queue.call_every(QUEUE_PROBE_PERIOD, queue_probe);                    // Keeps the MCU out of deep sleep 10 times a second
+#endif
+
     // Make your event queue dispatching events forever ---------------------------------------
     ev_queue.dispatch_forever();
 
@@ -173,96 +830,272 @@ int main(void){
 }
 // MAIN END ===================================================================================
 
+#if SENSOR_ACCEL
 // --------------------------------------------------------------------------------------------
-// SEND MESSAGE
+// ACCELEROMETER INTERRUPTS
 // --------------------------------------------------------------------------------------------
-static void send_message(){
-    int16_t retcode;
-    
-    int16_t raw_ax, raw_ay, raw_az;
-    uint8_t current_fix;
-    uint16_t raw_clear, raw_red, raw_green, raw_blue, raw_temperature, raw_humidity, raw_soilMoist, raw_light;
+// Sensor thread: the bus traffic and the spectrum analysis stay here, only the results are
+// handed to the event queue
+static void accel_int_handler(){
+    mma8451_events_t events;
 
-    float current_lat, current_lon;
+    mma8451q.read_events(&events);                                           // Clears the latched motion/transient events
+    mma8451q.drain_fifo();                                                   // Burst read of the FIFO, also clears the watermark interrupt
 
-    size_t pos = 0;                                                          // Variable that stores the current array byte of TX_BUFFER
+    if(spectrum_capturing && mma8451q.capture_complete()){
+        Kernel::Clock::time_point start = Kernel::Clock::now();
+        spectrum_result_t result;
 
-    // Accelometer MMA8451 raw measurements - 14 bit ------------------------------------------
-    raw_ax = mma8451q.read_axis(OUT_X_MSB);                                           // Remember, only the MSB is passed, but the function adds one to the register to get the LSB part
-    raw_ay = mma8451q.read_axis(OUT_Y_MSB);
-    raw_az = mma8451q.read_axis(OUT_Z_MSB);
-    
-    // Si7021 raw measurements - 16 bit -------------------------------------------------------
-    raw_temperature = si7021.read_register_si7021(CMD_MEASURE_TEMP);
-    raw_humidity = si7021.read_register_si7021(CMD_MEASURE_HUMIDITY);
+        spectrum_capturing = false;
+        result.count = spectrum.analyse(spectrum_samples, SPECTRUM_POINTS, result.peaks, SPECTRUM_TOP_BINS);
+        printf("\r\nSpectrum: %u peaks in %d ms, %u capture(s) lost to a FIFO overflow\r\n", result.count,
+               (int)std::chrono::duration_cast<std::chrono::milliseconds>(Kernel::Clock::now() - start).count(), mma8451q.capture_restarts());
+        ev_queue.call(send_spectrum_result, result);
+    }
 
-    // Soil moisture and Ambient light measurements - 12 bit ----------------------------------
-    raw_soilMoist = moistureIn.read_u16();
-    raw_light = lightIn.read_u16();
-    
-    // Colour sensor TCS34725 measurements ----------------------------------------------------
-    whiteLED = 1;                                                            // Turn on the white LED before taking a measurement
-    ThisThread::sleep_for(30ms);                                             // Wait for the integration time (24ms) + small extra time for stable readings
+    if(events.ff_mt_src == 0 && events.transient_src == 0){
+        return;
+    }
+    ev_queue.call(queue_accel_event, events);
+}
 
-    raw_red   = tcs34725.read_channel(TCS34725_RDATAL);
-    raw_green = tcs34725.read_channel(TCS34725_GDATAL);
-    raw_blue  = tcs34725.read_channel(TCS34725_BDATAL);
-    raw_clear = raw_red + raw_green + raw_blue;
+static void queue_accel_event(mma8451_events_t events){
+    pending_events.ff_mt_src |= events.ff_mt_src;
+    pending_events.transient_src |= events.transient_src;
+    schedule_event();
+}
+// ACCELEROMETER INTERRUPTS END ---------------------------------------------------------------
+#endif
 
-    whiteLED = 0;                                                            // Turn off the white LED after the measurement
+#if SENSOR_COLOUR
+// --------------------------------------------------------------------------------------------
+// LIGHT INTERRUPTS
+// --------------------------------------------------------------------------------------------
+static void light_int_handler(){
+    uint16_t clear;
+    uint8_t state;
 
-    // GPS measurements - TRICK TO DECOMPOSE IT
-    current_fix = get_fix_status();
-    current_lat = get_latitude();
-    current_lon = get_longitude();
+    if(!tcs34725.interrupt_pending() || !tcs34725.read_clear(&clear)){       // Polling, or already handled before an on-demand read
+        return;
+    }
 
-    if(current_fix == 0){                                                    // Mock location while there is no GPS fix
-        current_lat = 43.563644;
-        current_lon = -5.937019;
+    if(clear > LIGHT_HIGH_THRESHOLD){                                        // New band around the current level, so only its end is the next event
+        state = LIGHT_ABOVE;
+        tcs34725.set_thresholds(LIGHT_HIGH_THRESHOLD, UINT16_MAX);
+    } else if(clear < LIGHT_LOW_THRESHOLD){
+        state = LIGHT_BELOW;
+        tcs34725.set_thresholds(0, LIGHT_LOW_THRESHOLD);
+    } else {
+        state = LIGHT_IN_BAND;
+        tcs34725.set_thresholds(LIGHT_LOW_THRESHOLD, LIGHT_HIGH_THRESHOLD);
     }
+    tcs34725.clear_interrupt();
+    ev_queue.call(queue_light_event, state, clear);
+}
 
-    uint32_t lat_u32 = *(uint32_t *) &current_lat;
-    uint32_t lon_u32 = *(uint32_t *) &current_lon;
+static void queue_light_event(uint8_t state, uint16_t clear){
+    pending_light = state;
+    pending_clear = clear;
+    schedule_event();
+}
+// LIGHT INTERRUPTS END -----------------------------------------------------------------------
+#endif
 
-    tx_buffer[pos++] = raw_ax & 0xff;                                        // In LUA -> payload, 1
-    tx_buffer[pos++] = (raw_ax >> 8) & 0xff;                                 // In LUA -> payload, 2
-    tx_buffer[pos++] = raw_ay & 0xff;
-    tx_buffer[pos++] = (raw_ay >> 8) & 0xff;
-    tx_buffer[pos++] = raw_az & 0xff;
-    tx_buffer[pos++] = (raw_az >> 8) & 0xff;
+#if SENSOR_EVENTS
+// --------------------------------------------------------------------------------------------
+// SEND EVENT
+// --------------------------------------------------------------------------------------------
+static void schedule_event(){
+    if(pending_event_count < UINT8_MAX){
+        pending_event_count++;
+    }
 
-    tx_buffer[pos++] = raw_temperature & 0xff;
-    tx_buffer[pos++] = (raw_temperature >> 8) & 0xff;
-    tx_buffer[pos++] = raw_humidity & 0xff;
-    tx_buffer[pos++] = (raw_humidity >> 8) & 0xff;
-    
-    tx_buffer[pos++] = raw_soilMoist & 0xff;
-    tx_buffer[pos++] = (raw_soilMoist >> 8) & 0xff;
-    tx_buffer[pos++] = raw_light & 0xff;
-    tx_buffer[pos++] = (raw_light >> 8) & 0xff;
-
-    tx_buffer[pos++] = raw_red & 0xff;
-    tx_buffer[pos++] = (raw_red >> 8) & 0xff;
-    tx_buffer[pos++] = raw_green & 0xff;
-    tx_buffer[pos++] = (raw_green >> 8) & 0xff;
-    tx_buffer[pos++] = raw_blue & 0xff;
-    tx_buffer[pos++] = (raw_blue >> 8) & 0xff;
-
-    tx_buffer[pos++] = lat_u32 & 0xff;
-    tx_buffer[pos++] = (lat_u32 >> 8) & 0xff;
-    tx_buffer[pos++] = (lat_u32 >> 16) & 0xff;
-    tx_buffer[pos++] = (lat_u32 >> 24) & 0xff;
-
-    tx_buffer[pos++] = lon_u32 & 0xff;
-    tx_buffer[pos++] = (lon_u32 >> 8) & 0xff;
-    tx_buffer[pos++] = (lon_u32 >> 16) & 0xff;
-    tx_buffer[pos++] = (lon_u32 >> 24) & 0xff;                               // In LUA -> payload, 28
-
-    printf("Ax: %d, Ay: %d, Az: %d\n\r", raw_ax, raw_ay, raw_az);
-    printf("T: %d, RH: %d\n\r", raw_temperature, raw_humidity);
-    printf("Moisture: %d, light = %d\n\r", raw_soilMoist, raw_light);
-    printf("C: %d, R: %d, G: %d, B: %d\n\r", raw_clear, raw_red, raw_green, raw_blue);
-    printf("FS: %d, Lat: %.6f, Lon: %.6f\n\r", current_fix, current_lat, current_lon);
+    if(event_scheduled){                                                     // Merged into the uplink already waiting
+        return;
+    }
+    event_scheduled = true;
+
+    auto elapsed = Kernel::Clock::now() - last_event_time;
+    if(event_sent && elapsed < EVENT_HOLDOFF){
+        ev_queue.call_in(std::chrono::duration_cast<std::chrono::milliseconds>(EVENT_HOLDOFF - elapsed), send_event);
+    } else {
+        ev_queue.call(send_event);
+    }
+}
+
+static void send_event(){
+    uint8_t event_buffer[EVENT_PAYLOAD_SIZE];
+    size_t pos = 0;
+
+    event_buffer[pos++] = pending_event_count;                               // Events merged in this uplink
+    event_buffer[pos++] = pending_events.ff_mt_src;                          // Axes and directions involved, as in the MMA8451Q registers
+    event_buffer[pos++] = pending_events.transient_src;
+    event_buffer[pos++] = pending_light;                                     // Last light state, 0 if the light did not change
+    event_buffer[pos++] = pending_clear & 0xff;                              // Clear counts when it changed
+    event_buffer[pos++] = (pending_clear >> 8) & 0xff;
+
+    int16_t retcode = lorawan.send(EVENT_PORT, event_buffer, pos, MSG_UNCONFIRMED_FLAG);
+
+    if(retcode < 0){
+        if(retcode == LORAWAN_STATUS_WOULD_BLOCK){                           // Periodic uplink in flight or duty cycle, keep merging and retry
+            ev_queue.call_in(3s, send_event);
+        } else {
+            printf("\r\n send_event() - Error code %d \r\n", retcode);
+            event_scheduled = false;                                         // Sent with the next event
+        }
+        return;
+    }
+
+    printf("\r\nEvent uplink: %u events, FF_MT 0x%02x, transient 0x%02x, light %u (%u)\r\n", pending_event_count, pending_events.ff_mt_src, pending_events.transient_src, pending_light, pending_clear);
+
+    in_flight_events = pending_events;
+    in_flight_event_count = pending_event_count;
+    in_flight_light = pending_light;
+    in_flight_clear = pending_clear;
+    memset(&pending_events, 0, sizeof(pending_events));
+    pending_event_count = 0;
+    pending_light = 0;
+    pending_clear = 0;
+    event_scheduled = false;
+    event_sent = true;
+    last_event_time = Kernel::Clock::now();
+}
+// SEND EVENT END -----------------------------------------------------------------------------
+#endif
+
+#if SENSOR_ACCEL
+// --------------------------------------------------------------------------------------------
+// VIBRATION SPECTRUM
+// --------------------------------------------------------------------------------------------
+static void start_spectrum(){
+    if(spectrum_scheduled || spectrum_in_flight){                            // Last one not sent yet, skip this period
+        return;
+    }
+    sensor_queue.call(capture_spectrum);
+}
+
+static void capture_spectrum(){
+    if(spectrum_capturing){
+        return;
+    }
+    mma8451q.start_capture(spectrum_samples, SPECTRUM_POINTS, SPECTRUM_AXIS);
+    spectrum_capturing = true;
+}
+
+static void send_spectrum_result(spectrum_result_t result){
+    if(spectrum_scheduled || spectrum_in_flight){                            // Captured before the last one was sent, drop it
+        return;
+    }
+    spectrum_result = result;
+    spectrum_scheduled = true;
+    send_spectrum();
+}
+
+static void send_spectrum(){
+    uint8_t spectrum_buffer[SPECTRUM_PAYLOAD_SIZE];
+    size_t pos = 0;
+    uint8_t log2_points = 0;
+
+    while((1U << log2_points) < SPECTRUM_POINTS){
+        log2_points++;
+    }
+
+    spectrum_buffer[pos++] = log2_points;                                    // The server gets the bin width from these two
+    spectrum_buffer[pos++] = ACCEL_DATA_RATE;                                // CTRL_REG1 DR value
+    spectrum_buffer[pos++] = SPECTRUM_AXIS;
+    for(uint8_t i = 0; i < SPECTRUM_TOP_BINS; i++){                          // Strongest first, bin 0 if fewer peaks were found
+        spectrum_peak_t peak = (i < spectrum_result.count) ? spectrum_result.peaks[i] : spectrum_peak_t{0, 0};
+
+        spectrum_buffer[pos++] = peak.bin;
+        spectrum_buffer[pos++] = peak.amplitude & 0xFF;                      // Amplitude in counts (1/4096 g), little endian
+        spectrum_buffer[pos++] = peak.amplitude >> 8;
+    }
+
+    int16_t retcode = lorawan.send(SPECTRUM_PORT, spectrum_buffer, pos, MSG_UNCONFIRMED_FLAG);
+
+    if(retcode < 0){
+        if(retcode == LORAWAN_STATUS_WOULD_BLOCK){                           // Another uplink in flight or duty cycle
+            ev_queue.call_in(3s, send_spectrum);
+        } else {
+            printf("\r\n send_spectrum() - Error code %d \r\n", retcode);
+            spectrum_scheduled = false;                                      // Dropped, the next period captures a new one
+        }
+        return;
+    }
+
+    printf("\r\nSpectrum uplink: strongest bin %u, amplitude %u\r\n", spectrum_result.peaks[0].bin, spectrum_result.peaks[0].amplitude);
+
+    spectrum_scheduled = false;
+    spectrum_in_flight = true;
+}
+// VIBRATION SPECTRUM END ---------------------------------------------------------------------
+#endif
+
+// --------------------------------------------------------------------------------------------
+// SEND MESSAGE
+// --------------------------------------------------------------------------------------------
+// The sensors are read by the sensor thread, which publishes a complete sample and hands it to
+// build_message(): the LoRaWAN event queue only encodes and sends
+static void send_message(){
+    sensor_queue.call(start_acquisition);
+}
+
+// Starts every conversion at once and comes back to collect them, so the acquisition takes as
+// long as the slowest sensor instead of the sum of all of them, and the bus stays free for the
+// accelerometer in the meantime
+static void start_acquisition(){
+    if(acquisition_pending != 0){                                            // Already on its way
+        return;
+    }
+    acquisition_start = Kernel::Clock::now();
+    Sensors::start(acquisition);
+    acquisition_pending = Sensors::ALL;
+    sensor_queue.call_in(ACQ_POLL_PERIOD, collect_measurements);
+}
+
+static void collect_measurements(){
+    Kernel::Clock::time_point now = Kernel::Clock::now();
+
+    Sensors::collect(acquisition, now, acquisition_pending);
+    if(acquisition_pending != 0){
+        sensor_queue.call_in(ACQ_POLL_PERIOD, collect_measurements);
+        return;
+    }
+    acquisition.acquisition_ms = acquisition_elapsed_ms(now);
+    sensor_sample.write(acquisition);
+    ev_queue.call(build_message);
+}
+
+static uint16_t acquisition_elapsed_ms(Kernel::Clock::time_point now){
+    return std::chrono::duration_cast<std::chrono::milliseconds>(now - acquisition_start).count();
+}
+
+// Payload: the presence byte (PRESENCE_* of the sensors compiled in), the status byte (GPS_POS_*
+// and STATUS_* flags), then the block of each sensor in the order of Sensors
+static void build_message(){
+    int16_t retcode;
+    sensor_sample_t sample;
+    uint8_t status = 0;
+    size_t pos = 0;                                                          // Variable that stores the current array byte of TX_BUFFER
+
+    sensor_sample.read(sample);                                              // One consistent sample from the sensor thread
+
+    tx_buffer[pos++] = Sensors::PRESENCE;                                    // In LUA -> payload, 1
+    pos++;                                                                   // Status, known once every block is encoded
+    pos += Sensors::encode(sample, &tx_buffer[pos], status);
+    tx_buffer[1] = status;                                                   // In LUA -> payload, 2
+
+#if DIAGNOSTICS
+    printf("Acquisition: %u ms, stack queue late by %u ms at worst\n\r", sample.acquisition_ms, queue_late_max_ms);
+    queue_late_max_ms = 0;
+#if SENSOR_I2C
+    i2c_stats_t bus_stats;
+    for (uint8_t client = 0; i2c_bus.get_stats(client, &bus_stats); client++) {   // In construction order of the I2C sensors compiled in
+        printf("I2C %u: %lu transactions, %lu errors, %lu retries, wait max %lu us\n\r", client, (unsigned long)bus_stats.transactions,
+               (unsigned long)bus_stats.errors, (unsigned long)bus_stats.retries, (unsigned long)bus_stats.wait_us_max);
+    }
+#endif
+#endif
 
     retcode = lorawan.send(MBED_CONF_LORA_APP_PORT, tx_buffer, pos, MSG_UNCONFIRMED_FLAG);
 
@@ -278,9 +1111,41 @@ static void send_message(){
         return;
     }
 
+    Sensors::sent();
+
     printf("\r\n%d bytes scheduled for transmission\r\n", retcode);
     memset(tx_buffer, 0, sizeof(tx_buffer));
 }
+
+#if SENSOR_COLOUR
+// Normalised light values span more than 16 bits (1x gain in sunlight to 60x in the dark), so
+// they are sent as mantissa x 2^exponent: value = (packed % 4096) << (packed / 4096)
+static uint16_t pack_light(uint32_t value){
+    uint8_t exponent = 0;
+
+    while(value >= 4096 && exponent < 15){
+        value >>= 1;
+        exponent++;
+    }
+    return (exponent << 12) | (value & 0x0FFF);
+}
+#endif
+
+#if DIAGNOSTICS
+// Runs every QUEUE_PROBE_PERIOD: anything later than that was spent waiting behind other events
+static void queue_probe(){
+    Kernel::Clock::time_point now = Kernel::Clock::now();
+
+    if(queue_probe_last != Kernel::Clock::time_point()){
+        auto late = std::chrono::duration_cast<std::chrono::milliseconds>(now - queue_probe_last - QUEUE_PROBE_PERIOD).count();
+
+        if(late > queue_late_max_ms){
+            queue_late_max_ms = (late < UINT16_MAX) ? late : UINT16_MAX;
+        }
+    }
+    queue_probe_last = now;
+}
+#endif
 // SEND MESSAGE END ---------------------------------------------------------------------------
 
 // --------------------------------------------------------------------------------------------
@@ -302,6 +1167,20 @@ static void receive_message(){
     }
     printf("\r\n");
 
+#if SENSOR_GPS
+    // Geofence configuration
+    if (port == GEOFENCE_PORT) {
+        if (geofence.handle_downlink(rx_buffer, retcode)) {
+            printf("Geofence updated, %u fences\r\n", geofence.count());
+            save_geofence();
+        } else {
+            printf("Invalid geofence command\r\n");
+        }
+        memset(rx_buffer, 0, sizeof(rx_buffer));
+        return;
+    }
+#endif
+
     // Check for specific messages
     if (retcode == 3 && rx_buffer[0] == 'O' && rx_buffer[1] == 'F' && rx_buffer[2] == 'F') {
         myRGB = 0b111;
@@ -316,6 +1195,33 @@ static void receive_message(){
     
     memset(rx_buffer, 0, sizeof(rx_buffer));
 }
+#if SENSOR_GPS
+// Event queue: takes a copy only if the storage thread is not writing the previous one, otherwise
+// tries again later. Several downlinks in a row end up in a single write of the last copy
+static void save_geofence(){
+    if(!geofence_save_mutex.trylock()){
+        ev_queue.call_in(GEOFENCE_SAVE_RETRY, save_geofence);
+        return;
+    }
+    geofence.snapshot(&geofence_save_config);
+    if(!geofence_save_pending){
+        geofence_save_pending = storage_queue.call(write_geofence) != 0;
+    }
+    geofence_save_mutex.unlock();
+}
+
+// Storage thread
+static void write_geofence(){
+    geofence_save_mutex.lock();
+    geofence_save_pending = false;
+    bool saved = Geofence::save(geofence_save_config);
+    geofence_save_mutex.unlock();
+
+    if(!saved){
+        printf("Geofence not saved\r\n");
+    }
+}
+#endif
 // RECEIVE MESSAGE END ------------------------------------------------------------------------
 
 // --------------------------------------------------------------------------------------------
@@ -338,6 +1244,18 @@ static void lora_event_handler(lorawan_event_t event){
             break;
         case TX_DONE:
             printf("\r\nMessage Sent to Network Server\r\n");
+#if SENSOR_EVENTS
+            if (in_flight_event_count != 0) {                                 // The periodic uplinks are still retrying on their own
+                in_flight_event_count = 0;
+                break;
+            }
+#endif
+#if SENSOR_ACCEL
+            if (spectrum_in_flight) {
+                spectrum_in_flight = false;
+                break;
+            }
+#endif
             if (MBED_CONF_LORA_DUTY_CYCLE_ON) {
                 send_message();
             }
@@ -347,6 +1265,29 @@ static void lora_event_handler(lorawan_event_t event){
         case TX_CRYPTO_ERROR:
         case TX_SCHEDULING_ERROR:
             printf("\r\nTransmission Error - EventCode = %d\r\n", event);
+#if SENSOR_EVENTS
+            if (in_flight_event_count != 0) {                                 // Put the events back for the next event uplink
+                pending_events.ff_mt_src |= in_flight_events.ff_mt_src;
+                pending_events.transient_src |= in_flight_events.transient_src;
+                if (pending_light == 0) {                                      // A newer light state wins
+                    pending_light = in_flight_light;
+                    pending_clear = in_flight_clear;
+                }
+                pending_event_count = (pending_event_count + in_flight_event_count > UINT8_MAX) ? UINT8_MAX : pending_event_count + in_flight_event_count;
+                in_flight_event_count = 0;
+                if (!event_scheduled) {
+                    event_scheduled = true;
+                    ev_queue.call_in(3s, send_event);
+                }
+                break;
+            }
+#endif
+#if SENSOR_ACCEL
+            if (spectrum_in_flight) {                                         // Not worth the airtime of a retry, the next period sends a new one
+                spectrum_in_flight = false;
+                break;
+            }
+#endif
             // try again
             if (MBED_CONF_LORA_DUTY_CYCLE_ON) {
                 send_message();
@@ -0,0 +1,292 @@
+/* File for the NMEA parser class definitions */
+
+// LIBRARIES ---------------------------------------------------------------------------
+#include "mbed.h"
+#include "nmea_parser.h"
+#include <string.h>
+
+// CONSTRUCTOR -------------------------------------------------------------------------
+NMEAParser::NMEAParser(uint8_t talkers) : _talkers(talkers), _checksum_errors(0) {
+    memset(&_gga, 0, sizeof(_gga));
+    memset(&_ack, 0, sizeof(_ack));
+    reset();
+}
+
+// =====================================================================================
+// PUBLIC FUNCTIONS
+// =====================================================================================
+// Feed one byte of the serial stream. The sentence is never stored: every field is
+// converted while its characters arrive and the result only becomes visible through
+// gga()/ack() once the '*hh' checksum has been verified
+nmea_sentence_t NMEAParser::feed(char c){
+    if (c == '$') {                                                   // A '$' always starts a new sentence, even in the middle of a broken one
+        reset();
+        _state = ADDRESS;
+        return NMEA_NONE;
+    }
+
+    if (_state == WAIT_START) {
+        return NMEA_NONE;
+    }
+
+    if (++_length > NMEA_MAX_SENTENCE) {                              // Lost the terminator, drop it
+        reset();
+        return NMEA_NONE;
+    }
+
+    switch (_state) {
+        case ADDRESS:
+            if (c == ',') {
+                _address[_address_length] = '\0';
+                _sentence = sentence_type();
+                if (_sentence == NMEA_NONE) {                         // Not a sentence we use, wait for the next '$'
+                    reset();
+                    return NMEA_NONE;
+                }
+                _checksum ^= c;
+                _state = FIELDS;
+                _field = 1;
+                start_field();
+            } else if (_address_length < NMEA_ADDRESS_LENGTH && c > ' ' && c != '*') {
+                _checksum ^= c;
+                _address[_address_length++] = c;
+            } else {
+                reset();
+            }
+            return NMEA_NONE;
+
+        case FIELDS:
+            if (c == '*') {
+                end_field();
+                _state = CHECKSUM_HI;
+            } else if (c == ',') {
+                _checksum ^= c;
+                end_field();
+                _field++;
+                start_field();
+            } else if (c == '\r' || c == '\n') {                      // Sentence without checksum, it cannot be trusted
+                _checksum_errors++;
+                reset();
+            } else {
+                _checksum ^= c;
+                accumulate(c);
+            }
+            return NMEA_NONE;
+
+        case CHECKSUM_HI:
+        case CHECKSUM_LO: {
+            int8_t value = hex_value(c);
+
+            if (value < 0) {
+                _checksum_errors++;
+                reset();
+                return NMEA_NONE;
+            }
+
+            _received_checksum = (_received_checksum << 4) | value;
+            _state = (_state == CHECKSUM_HI) ? CHECKSUM_LO : WAIT_END;
+            return NMEA_NONE;
+        }
+
+        case WAIT_END:
+            if (c == '\r' || c == '\n') {
+                return end_sentence();
+            }
+            _checksum_errors++;
+            reset();
+            return NMEA_NONE;
+
+        default:
+            reset();
+            return NMEA_NONE;
+    }
+}
+
+const nmea_gga_t &NMEAParser::gga() const {
+    return _gga;
+}
+
+const nmea_ack_t &NMEAParser::ack() const {
+    return _ack;
+}
+
+uint32_t NMEAParser::checksum_errors() const {
+    return _checksum_errors;
+}
+
+void NMEAParser::reset(){
+    _state = WAIT_START;
+    _length = 0;
+    _checksum = 0;
+    _received_checksum = 0;
+    _address_length = 0;
+    _field = 0;
+    _sentence = NMEA_NONE;
+    memset(&_staging, 0, sizeof(_staging));
+    memset(&_staging_ack, 0, sizeof(_staging_ack));
+    start_field();
+}
+
+// ddmm.mmmmmm to degrees x 1e7 with integer arithmetic only: 1e-7 deg = 6e-6 min
+int32_t NMEAParser::coordinate_e7(uint32_t ddmm, uint32_t frac, uint8_t frac_digits){
+    uint32_t degrees = ddmm / 100;
+    uint32_t minutes_e6 = (ddmm % 100) * 1000000UL + scale_fraction(frac, frac_digits, 6);
+
+    return (int32_t)(degrees * 10000000UL + (minutes_e6 + 3) / 6);   // Rounded to the nearest 1e-7 deg
+}
+
+// Bring a fraction with frac_digits decimals to exactly 'digits' decimals
+uint32_t NMEAParser::scale_fraction(uint32_t frac, uint8_t frac_digits, uint8_t digits){
+    while (frac_digits < digits) {
+        frac *= 10;
+        frac_digits++;
+    }
+    while (frac_digits > digits) {
+        frac /= 10;
+        frac_digits--;
+    }
+    return frac;
+}
+// PUBLIC FUNCTIONS END ================================================================
+
+// =====================================================================================
+// PRIVATE FUNCTIONS
+// =====================================================================================
+void NMEAParser::start_field(){
+    _int_part = 0;
+    _frac_part = 0;
+    _frac_digits = 0;
+    _field_length = 0;
+    _in_fraction = false;
+    _negative = false;
+    _first_char = '\0';
+}
+
+// Numbers are built digit by digit, so no atof/atoi and no float is ever needed
+void NMEAParser::accumulate(char c){
+    if (_field_length++ == 0) {
+        _first_char = c;
+    }
+
+    if (c >= '0' && c <= '9') {
+        if (_in_fraction) {
+            if (_frac_digits < NMEA_COORD_DECIMALS) {                 // Extra decimals are below the receiver accuracy anyway
+                _frac_part = _frac_part * 10 + (c - '0');
+                _frac_digits++;
+            }
+        } else if (_int_part < 100000000) {                           // Longest integer part is dddmm, guard against garbage
+            _int_part = _int_part * 10 + (c - '0');
+        }
+    } else if (c == '.') {
+        _in_fraction = true;
+    } else if (c == '-') {
+        _negative = true;
+    }
+}
+
+// Store the field that has just finished in the staging fix (or acknowledge)
+void NMEAParser::end_field(){
+    if (_field_length == 0) {                                         // Empty field, e.g. no position without fix
+        return;
+    }
+
+    if (_sentence == NMEA_PMTK_ACK) {
+        if (_field == 1) {                                            // Command being acknowledged
+            _staging_ack.command = _int_part;
+        } else if (_field == 2) {                                     // Result flag
+            _staging_ack.flag = _int_part;
+        }
+        return;
+    }
+
+    switch (_field) {
+        case 1:                                                       // UTC time hhmmss.sss
+            _staging.time_ms = (_int_part / 10000) * 3600000UL
+                             + ((_int_part / 100) % 100) * 60000UL
+                             + (_int_part % 100) * 1000UL
+                             + scale_fraction(_frac_part, _frac_digits, 3);
+            break;
+        case 2:                                                       // Latitude ddmm.mmmm
+            _staging.latitude_e7 = coordinate_e7(_int_part, _frac_part, _frac_digits);
+            break;
+        case 3:                                                       // Latitude hemisphere (N/S)
+            if (_first_char == 'S') {
+                _staging.latitude_e7 = -_staging.latitude_e7;
+            }
+            break;
+        case 4:                                                       // Longitude dddmm.mmmm
+            _staging.longitude_e7 = coordinate_e7(_int_part, _frac_part, _frac_digits);
+            break;
+        case 5:                                                       // Longitude hemisphere (E/W)
+            if (_first_char == 'W') {
+                _staging.longitude_e7 = -_staging.longitude_e7;
+            }
+            break;
+        case 6:                                                       // Fix status (0 = no fix, 1 = GPS fix, 2 = DGPS fix)
+            _staging.fix = _int_part;
+            break;
+        case 7:                                                       // Satellites in use
+            _staging.satellites = _int_part;
+            break;
+        case 8:                                                       // HDOP
+            _staging.hdop_x100 = _int_part * 100 + scale_fraction(_frac_part, _frac_digits, 2);
+            break;
+        case 9:                                                       // Altitude (m)
+            _staging.altitude_dm = _int_part * 10 + scale_fraction(_frac_part, _frac_digits, 1);
+            if (_negative) {
+                _staging.altitude_dm = -_staging.altitude_dm;
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+// "PMTK001" or "ttGGA" where tt is one of the accepted talkers
+nmea_sentence_t NMEAParser::sentence_type() const {
+    uint8_t talker = 0;
+
+    if (strcmp(_address, "PMTK001") == 0) {
+        return NMEA_PMTK_ACK;
+    }
+
+    if (_address_length != 5 || strcmp(&_address[2], "GGA") != 0 || _address[0] != 'G') {
+        return NMEA_NONE;
+    }
+
+    switch (_address[1]) {
+        case 'P': talker = NMEA_TALKER_GP; break;
+        case 'N': talker = NMEA_TALKER_GN; break;
+        case 'L': talker = NMEA_TALKER_GL; break;
+        case 'A': talker = NMEA_TALKER_GA; break;
+        default:  break;
+    }
+
+    return (_talkers & talker) ? NMEA_GGA : NMEA_NONE;
+}
+
+// Publish the staging data only if the checksum matches and the sentence is complete
+nmea_sentence_t NMEAParser::end_sentence(){
+    nmea_sentence_t ret = NMEA_NONE;
+
+    if (_received_checksum != _checksum) {
+        _checksum_errors++;
+    } else if (_sentence == NMEA_GGA && _field >= NMEA_GGA_LAST_FIELD) {
+        _gga = _staging;
+        ret = NMEA_GGA;
+    } else if (_sentence == NMEA_PMTK_ACK && _field >= NMEA_ACK_LAST_FIELD) {
+        _ack = _staging_ack;
+        ret = NMEA_PMTK_ACK;
+    }
+
+    reset();
+    return ret;
+}
+
+int8_t NMEAParser::hex_value(char c){
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+// PRIVATE FUNCTIONS END ===============================================================
@@ -0,0 +1,125 @@
+/* File for the NMEA parser class declarations and macros */
+
+// LIBRARIES ------------------------------------------------------------------------------------
+#include "mbed.h"
+
+// LIBRARY GUARD --------------------------------------------------------------------------------
+#ifndef NMEA_PARSER_H
+#define NMEA_PARSER_H
+
+// ==============================================================================================
+// MACROS
+// ==============================================================================================
+#define NMEA_MAX_SENTENCE    82               // Longest sentence allowed by NMEA 0183 ('$' to '\n' included)
+#define NMEA_ADDRESS_LENGTH  7                // Longest address parsed: "PMTK001" (GGA ones are talker ID + formatter, e.g. "GPGGA")
+#define NMEA_COORD_DECIMALS  6                // Decimals of the minutes kept when converting ddmm.mmmmmm
+#define NMEA_GGA_LAST_FIELD  9                // Altitude, the last GGA field a sentence must reach to be accepted
+#define NMEA_ACK_LAST_FIELD  2                // Flag, the last $PMTK001 field
+
+// $PMTK001 flags
+#define PMTK_ACK_INVALID     0                // Invalid command
+#define PMTK_ACK_UNSUPPORTED 1                // Unsupported command
+#define PMTK_ACK_FAILED      2                // Valid command, action failed
+#define PMTK_ACK_SUCCESS     3                // Valid command, action succeeded
+
+// Talker IDs, combined in the mask given to the constructor
+#define NMEA_TALKER_GP       (1 << 0)         // GPS
+#define NMEA_TALKER_GN       (1 << 1)         // Multi-constellation solution
+#define NMEA_TALKER_GL       (1 << 2)         // GLONASS
+#define NMEA_TALKER_GA       (1 << 3)         // Galileo
+// MACROS END ===================================================================================
+
+// ==============================================================================================
+// TYPES
+// ==============================================================================================
+typedef enum {
+    NMEA_NONE = 0,                            // Nothing complete yet (or dropped)
+    NMEA_GGA,                                 // Fix data, see gga()
+    NMEA_PMTK_ACK                             // $PMTK001 acknowledge of a command, see ack()
+} nmea_sentence_t;
+
+typedef struct {
+    uint32_t time_ms;                         // UTC time of day in ms
+    int32_t latitude_e7;                      // Degrees x 1e7, negative for South
+    int32_t longitude_e7;                     // Degrees x 1e7, negative for West
+    uint8_t fix;                              // 0 = no fix, 1 = GPS fix, 2 = DGPS fix
+    uint8_t satellites;                       // Satellites used in the solution
+    uint16_t hdop_x100;                       // Horizontal dilution of precision x 100
+    int32_t altitude_dm;                      // Altitude above mean sea level in dm
+} nmea_gga_t;
+
+typedef struct {
+    uint16_t command;                         // Command being acknowledged, e.g. 220 for $PMTK220
+    uint8_t flag;                             // PMTK_ACK_* result
+} nmea_ack_t;
+// TYPES END ====================================================================================
+
+// ==============================================================================================
+// NMEA PARSER CLASS
+// ==============================================================================================
+class NMEAParser {
+public:
+    // Constructor ------------------------------------------------------------------------------
+    NMEAParser(uint8_t talkers = NMEA_TALKER_GP);                 // Only GGA sentences from these talkers (and $PMTK001) are parsed
+
+    // Public functions -------------------------------------------------------------------------
+    nmea_sentence_t feed(char c);                                 // Feed one byte, returns the type of the valid sentence it completed (if any)
+    const nmea_gga_t &gga() const;                                // Last GGA sentence that passed the checksum
+    const nmea_ack_t &ack() const;                                // Last $PMTK001 sentence that passed the checksum
+    uint32_t checksum_errors() const;                             // Sentences dropped because of a bad or missing checksum
+    void reset();                                                 // Drop the sentence being parsed
+
+    // Conversions ------------------------------------------------------------------------------
+    static int32_t coordinate_e7(uint32_t ddmm, uint32_t frac, uint8_t frac_digits);   // ddmm.mmmmmm to degrees x 1e7, rounded
+    static uint32_t scale_fraction(uint32_t frac, uint8_t frac_digits, uint8_t digits); // Fraction brought to 'digits' decimals
+
+private:
+    // Parser states ----------------------------------------------------------------------------
+    enum state_t {
+        WAIT_START,                                               // Waiting for '$'
+        ADDRESS,                                                  // Reading "GPGGA", "GNGGA", "PMTK001"...
+        FIELDS,                                                   // Reading comma separated fields
+        CHECKSUM_HI,                                              // First hex digit after '*'
+        CHECKSUM_LO,                                              // Second hex digit after '*'
+        WAIT_END                                                  // Waiting for '\r' or '\n'
+    };
+
+    // Private functions ------------------------------------------------------------------------
+    void start_field();
+    void accumulate(char c);
+    void end_field();
+    nmea_sentence_t end_sentence();
+    nmea_sentence_t sentence_type() const;
+    static int8_t hex_value(char c);
+
+    uint8_t _talkers;                                             // NMEA_TALKER_* mask
+
+    // Sentence state ---------------------------------------------------------------------------
+    state_t _state;
+    uint8_t _length;                                              // Characters received since '$'
+    uint8_t _checksum;                                            // Running XOR between '$' and '*'
+    uint8_t _received_checksum;                                   // Checksum sent by the receiver after '*'
+    char _address[NMEA_ADDRESS_LENGTH + 1];
+    uint8_t _address_length;
+    uint8_t _field;                                               // Index of the field being parsed, 0 is the address
+    nmea_sentence_t _sentence;                                    // Type given by the address
+
+    // Field accumulator ------------------------------------------------------------------------
+    uint32_t _int_part;                                           // Digits before the '.'
+    uint32_t _frac_part;                                          // Digits after the '.' (at most NMEA_COORD_DECIMALS)
+    uint8_t _frac_digits;
+    uint8_t _field_length;
+    bool _in_fraction;
+    bool _negative;
+    char _first_char;
+
+    // Results ----------------------------------------------------------------------------------
+    nmea_gga_t _staging;                                          // Filled while parsing, copied to _gga once the checksum matches
+    nmea_ack_t _staging_ack;
+    nmea_gga_t _gga;
+    nmea_ack_t _ack;
+    uint32_t _checksum_errors;
+};
+// NMEA PARSER CLASS END ========================================================================
+
+#endif
@@ -0,0 +1,104 @@
+/* File for the compile-time sensor registry template */
+
+// LIBRARIES ------------------------------------------------------------------------------------
+#include "mbed.h"
+
+// LIBRARY GUARD --------------------------------------------------------------------------------
+#ifndef SENSOR_REGISTRY_H
+#define SENSOR_REGISTRY_H
+
+// ==============================================================================================
+// NO SENSOR
+// ==============================================================================================
+// Stands in the list for a sensor compiled out: no code, no payload block, no presence bit
+struct NoSensor {
+    static constexpr uint8_t PRESENCE = 0;
+    static constexpr size_t MAX_SIZE = 0;
+
+    static void init() {}
+    template <typename Sample> static void start(Sample &) {}
+    template <typename Sample> static bool collect(Sample &, Kernel::Clock::time_point) { return true; }
+    template <typename Sample> static size_t encode(const Sample &, uint8_t *, uint8_t &) { return 0; }
+    static void sent() {}
+};
+// NO SENSOR END ================================================================================
+
+// ==============================================================================================
+// SENSOR REGISTRY CLASS
+// ==============================================================================================
+// Every sensor is a struct of static hooks:
+//   PRESENCE    its bit in the presence byte that starts the payload
+//   MAX_SIZE    largest block it adds to the payload
+//   init()      once, from main()
+//   start()     starts a conversion (sensor thread)
+//   collect()   true once its result is in the sample, or given up (sensor thread)
+//   encode()    writes its block, ORs its flags into the status byte and returns the block
+//               size (event queue, no I/O)
+//   sent()      the uplink with the last block encoded was accepted by the stack
+// The registry unrolls the type list at compile time into direct calls in list order, which is
+// the acquisition order and the payload order. No virtual call nor table is involved, and a
+// NoSensor in the list leaves nothing behind.
+template <typename Sample, typename... Sensors>
+class SensorRegistry;
+
+template <typename Sample>
+class SensorRegistry<Sample> {
+public:
+    static constexpr uint8_t COUNT = 0;
+    static constexpr uint8_t PRESENCE = 0;
+    static constexpr size_t MAX_SIZE = 0;
+    static constexpr uint32_t ALL = 0;
+
+    static void init() {}
+    static void start(Sample &) {}
+    static void collect(Sample &, Kernel::Clock::time_point, uint32_t &) {}
+    static size_t encode(const Sample &, uint8_t *, uint8_t &) { return 0; }
+    static void sent() {}
+};
+
+template <typename Sample, typename First, typename... Rest>
+class SensorRegistry<Sample, First, Rest...> {
+    typedef SensorRegistry<Sample, Rest...> Next;
+
+public:
+    static constexpr uint8_t COUNT = 1 + Next::COUNT;
+    static constexpr uint8_t PRESENCE = First::PRESENCE | Next::PRESENCE;   // Sensors compiled in
+    static constexpr size_t MAX_SIZE = First::MAX_SIZE + Next::MAX_SIZE;
+    static constexpr uint32_t ALL = (1UL << COUNT) - 1;                     // collect() mask with every sensor pending
+
+    static_assert((First::PRESENCE & Next::PRESENCE) == 0, "Two sensors share a presence bit");
+    static_assert(COUNT <= 32, "One pending bit per sensor");
+
+    static void init(){
+        First::init();
+        Next::init();
+    }
+
+    static void start(Sample &sample){
+        First::start(sample);
+        Next::start(sample);
+    }
+
+    static void collect(Sample &sample, Kernel::Clock::time_point now, uint32_t &pending){  // Clears the bit of every sensor done
+        if ((pending & BIT) && First::collect(sample, now)) {
+            pending &= ~BIT;
+        }
+        Next::collect(sample, now, pending);
+    }
+
+    static size_t encode(const Sample &sample, uint8_t *buffer, uint8_t &status){
+        size_t size = First::encode(sample, buffer, status);
+        return size + Next::encode(sample, buffer + size, status);
+    }
+
+    static void sent(){
+        First::sent();
+        Next::sent();
+    }
+
+private:
+    static constexpr uint32_t BIT = 1UL << Next::COUNT;
+};
+// SENSOR REGISTRY CLASS END ====================================================================
+
+#endif
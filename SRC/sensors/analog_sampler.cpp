@@ -0,0 +1,252 @@
+/* File for the oversampled analog acquisition (soil moisture and phototransistor) definitions */
+
+// LIBRARIES ---------------------------------------------------------------------------------------------------------------
+#include "mbed.h"
+#include "analog_sampler.h"
+#include <string.h>
+#if ANALOG_SAMPLER_DMA
+#include "pinmap.h"
+#include "PeripheralPins.h"
+#endif
+
+#if ANALOG_SAMPLER_DMA
+// CHANNELS ----------------------------------------------------------------------------------------------------------------
+static const uint32_t ADC_CHANNEL_MAP[] = {                         // Channel number from the pinmap to HAL channel
+    ADC_CHANNEL_0,  ADC_CHANNEL_1,  ADC_CHANNEL_2,  ADC_CHANNEL_3,
+    ADC_CHANNEL_4,  ADC_CHANNEL_5,  ADC_CHANNEL_6,  ADC_CHANNEL_7,
+    ADC_CHANNEL_8,  ADC_CHANNEL_9,  ADC_CHANNEL_10, ADC_CHANNEL_11,
+    ADC_CHANNEL_12, ADC_CHANNEL_13, ADC_CHANNEL_14, ADC_CHANNEL_15,
+};
+
+AnalogSampler *AnalogSampler::_instance = NULL;
+
+// CONSTRUCTOR -------------------------------------------------------------------------------------------------------------
+AnalogSampler::AnalogSampler(PinName channel0, PinName channel1) : _done(false), _sleep_locked(false) {
+    _pins[0] = channel0;
+    _pins[1] = channel1;
+    _index[0] = 0;
+    _index[1] = 1;
+    memset(_buffer, 0, sizeof(_buffer));
+    memset(&_adc, 0, sizeof(_adc));
+    memset(&_dma, 0, sizeof(_dma));
+    memset(&_tim, 0, sizeof(_tim));
+}
+#else
+// CONSTRUCTOR -------------------------------------------------------------------------------------------------------------
+AnalogSampler::AnalogSampler(PinName channel0, PinName channel1) : _done(false), _in0(channel0), _in1(channel1) {
+    _index[0] = 0;
+    _index[1] = 1;
+    memset(_buffer, 0, sizeof(_buffer));
+}
+#endif
+
+// =========================================================================================================================
+// PUBLIC FUNCTIONS
+// =========================================================================================================================
+#if ANALOG_SAMPLER_DMA
+bool AnalogSampler::init(){
+    uint8_t channels[ANALOG_CHANNELS];
+    ADC_ChannelConfTypeDef channel_config;
+    TIM_MasterConfigTypeDef master_config;
+
+    _instance = this;
+    __HAL_RCC_ADC1_CLK_ENABLE();
+    __HAL_RCC_DMA1_CLK_ENABLE();
+    __HAL_RCC_TIM6_CLK_ENABLE();
+
+    for (uint8_t i = 0; i < ANALOG_CHANNELS; i++) {
+        uint32_t function = pinmap_function(_pins[i], PinMap_ADC);
+
+        if (function == (uint32_t)NC) {
+            return false;                                           // Not an ADC pin
+        }
+        pinmap_pinout(_pins[i], PinMap_ADC);                        // Analog mode
+        channels[i] = STM_PIN_CHANNEL(function);
+    }
+    _index[0] = (channels[0] > channels[1]) ? 1 : 0;                // The ADC scans from the lowest channel number
+    _index[1] = 1 - _index[0];
+
+    // ADC: one TIM6 trigger converts the whole sequence, every channel oversampled in hardware
+    _adc.Instance = ADC1;
+    _adc.Init.OversamplingMode = ENABLE;
+    _adc.Init.Oversample.Ratio = ADC_OVERSAMPLING_RATIO_16;
+    _adc.Init.Oversample.RightBitShift = ADC_RIGHTBITSHIFT_NONE;    // 16 x 4095 = 65520, the scale of AnalogIn::read_u16()
+    _adc.Init.Oversample.TriggeredMode = ADC_TRIGGEREDMODE_SINGLE_TRIGGER;
+    _adc.Init.ClockPrescaler = ADC_CLOCK_SYNC_PCLK_DIV2;
+    _adc.Init.Resolution = ADC_RESOLUTION_12B;
+    _adc.Init.SamplingTime = ADC_SAMPLETIME_39CYCLES_5;             // 3.25 us per conversion, 104 us per frame at 32 MHz
+    _adc.Init.ScanConvMode = ADC_SCAN_DIRECTION_FORWARD;
+    _adc.Init.DataAlign = ADC_DATAALIGN_RIGHT;
+    _adc.Init.ContinuousConvMode = DISABLE;
+    _adc.Init.DiscontinuousConvMode = DISABLE;
+    _adc.Init.ExternalTrigConv = ADC_EXTERNALTRIGCONV_T6_TRGO;
+    _adc.Init.ExternalTrigConvEdge = ADC_EXTERNALTRIGCONVEDGE_RISING;
+    _adc.Init.DMAContinuousRequests = DISABLE;                      // One buffer per burst
+    _adc.Init.EOCSelection = ADC_EOC_SEQ_CONV;
+    _adc.Init.Overrun = ADC_OVR_DATA_OVERWRITTEN;
+    _adc.Init.LowPowerAutoWait = DISABLE;
+    _adc.Init.LowPowerFrequencyMode = DISABLE;
+    _adc.Init.LowPowerAutoPowerOff = DISABLE;
+    if (HAL_ADC_Init(&_adc) != HAL_OK || HAL_ADCEx_Calibration_Start(&_adc, ADC_SINGLE_ENDED) != HAL_OK) {
+        return false;
+    }
+
+    memset(&channel_config, 0, sizeof(channel_config));
+    channel_config.Rank = ADC_RANK_CHANNEL_NUMBER;
+    for (uint8_t i = 0; i < ANALOG_CHANNELS; i++) {
+        channel_config.Channel = ADC_CHANNEL_MAP[channels[i]];
+        if (HAL_ADC_ConfigChannel(&_adc, &channel_config) != HAL_OK) {
+            return false;
+        }
+    }
+
+    // DMA: ADC data register to the burst buffer, interrupt at the end only
+    _dma.Instance = DMA1_Channel1;
+    _dma.Init.Request = DMA_REQUEST_0;                              // ADC
+    _dma.Init.Direction = DMA_PERIPH_TO_MEMORY;
+    _dma.Init.PeriphInc = DMA_PINC_DISABLE;
+    _dma.Init.MemInc = DMA_MINC_ENABLE;
+    _dma.Init.PeriphDataAlignment = DMA_PDATAALIGN_HALFWORD;
+    _dma.Init.MemDataAlignment = DMA_MDATAALIGN_HALFWORD;
+    _dma.Init.Mode = DMA_NORMAL;
+    _dma.Init.Priority = DMA_PRIORITY_LOW;
+    if (HAL_DMA_Init(&_dma) != HAL_OK) {
+        return false;
+    }
+    __HAL_LINKDMA(&_adc, DMA_Handle, _dma);
+    NVIC_SetVector(DMA1_Channel1_IRQn, (uint32_t)&AnalogSampler::dma_irq);
+    NVIC_EnableIRQ(DMA1_Channel1_IRQn);
+
+    // TIM6: 1 us ticks, update event as ADC trigger every frame
+    _tim.Instance = TIM6;
+    _tim.Init.Prescaler = timer_clock() / 1000000 - 1;
+    _tim.Init.CounterMode = TIM_COUNTERMODE_UP;
+    _tim.Init.Period = 1000000 / ANALOG_FRAME_RATE_HZ - 1;
+    _tim.Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
+    if (HAL_TIM_Base_Init(&_tim) != HAL_OK) {
+        return false;
+    }
+    master_config.MasterOutputTrigger = TIM_TRGO_UPDATE;
+    master_config.MasterSlaveMode = TIM_MASTERSLAVEMODE_DISABLE;
+    return HAL_TIMEx_MasterConfigSynchronization(&_tim, &master_config) == HAL_OK;
+}
+
+void AnalogSampler::start_burst(){
+    _done = false;
+    {
+        CriticalSectionLock lock;
+
+        if (!_sleep_locked) {
+            sleep_manager_lock_deep_sleep();                        // Stop mode would halt the timer and the ADC
+            _sleep_locked = true;
+        }
+    }
+    HAL_ADC_Start_DMA(&_adc, (uint32_t *)_buffer, ANALOG_FRAMES * ANALOG_CHANNELS);  // Armed, waits for the first trigger
+    __HAL_TIM_SET_COUNTER(&_tim, 0);
+    HAL_TIM_Base_Start(&_tim);
+}
+
+std::chrono::microseconds AnalogSampler::burst_time() const {
+    return std::chrono::microseconds(1000000UL * ANALOG_FRAMES / ANALOG_FRAME_RATE_HZ);
+}
+#else
+bool AnalogSampler::init(){
+    return true;
+}
+
+// Fallback: the frames are taken back to back by the CPU, the burst is done when this returns
+void AnalogSampler::start_burst(){
+    for (uint16_t frame = 0; frame < ANALOG_FRAMES; frame++) {
+        _buffer[frame * ANALOG_CHANNELS] = _in0.read_u16();
+        _buffer[frame * ANALOG_CHANNELS + 1] = _in1.read_u16();
+    }
+    _done = true;
+}
+
+std::chrono::microseconds AnalogSampler::burst_time() const {
+    return std::chrono::microseconds(0);
+}
+#endif
+
+bool AnalogSampler::burst_ready() const {
+    return _done;
+}
+
+bool AnalogSampler::read(analog_reading_t *readings){
+    bool complete = _done;
+
+    stop_burst();
+    for (uint8_t i = 0; i < ANALOG_CHANNELS; i++) {
+        uint32_t sum = 0;
+        uint64_t squares = 0;
+
+        if (!complete) {
+            readings[i].mean = 0;
+            readings[i].variance = 0;
+            continue;
+        }
+
+        for (uint16_t frame = 0; frame < ANALOG_FRAMES; frame++) {
+            sum += _buffer[frame * ANALOG_CHANNELS + _index[i]];
+        }
+        uint32_t mean = (sum + ANALOG_FRAMES / 2) / ANALOG_FRAMES;
+
+        for (uint16_t frame = 0; frame < ANALOG_FRAMES; frame++) {   // Second pass, no cancellation between two large sums
+            int32_t deviation = (int32_t)_buffer[frame * ANALOG_CHANNELS + _index[i]] - (int32_t)mean;
+            squares += (uint64_t)((int64_t)deviation * deviation);
+        }
+
+        readings[i].mean = (mean > UINT16_MAX) ? UINT16_MAX : (uint16_t)mean;
+        readings[i].variance = (uint32_t)(squares / ANALOG_FRAMES);
+    }
+    return complete;
+}
+// PUBLIC FUNCTIONS END ====================================================================================================
+
+// =========================================================================================================================
+// PRIVATE FUNCTIONS
+// =========================================================================================================================
+#if ANALOG_SAMPLER_DMA
+void AnalogSampler::stop_burst(){
+    HAL_TIM_Base_Stop(&_tim);                                       // No more triggers, also when the burst timed out
+    HAL_ADC_Stop_DMA(&_adc);
+
+    CriticalSectionLock lock;
+    if (_sleep_locked) {
+        sleep_manager_unlock_deep_sleep();
+        _sleep_locked = false;
+    }
+}
+
+// Only the transfer-complete interrupt is of interest, the frames themselves never reach the CPU
+void AnalogSampler::dma_irq(){
+    AnalogSampler *sampler = _instance;
+    bool complete = __HAL_DMA_GET_FLAG(&sampler->_dma, DMA_FLAG_TC1) != 0;   // Cleared by the HAL handler
+
+    HAL_DMA_IRQHandler(&sampler->_dma);
+    if (!complete) {
+        return;
+    }
+
+    HAL_TIM_Base_Stop(&sampler->_tim);
+    sampler->_done = true;
+    if (sampler->_sleep_locked) {
+        sleep_manager_unlock_deep_sleep();
+        sampler->_sleep_locked = false;
+    }
+}
+
+// Timers run at twice the APB1 clock when APB1 is divided
+uint32_t AnalogSampler::timer_clock(){
+    uint32_t clock = HAL_RCC_GetPCLK1Freq();
+
+    if ((RCC->CFGR & RCC_CFGR_PPRE1) != RCC_CFGR_PPRE1_DIV1) {
+        clock *= 2;
+    }
+    return clock;
+}
+#else
+void AnalogSampler::stop_burst(){
+}
+#endif
+// PRIVATE FUNCTIONS END ===================================================================================================
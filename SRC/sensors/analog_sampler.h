@@ -0,0 +1,81 @@
+/* File for the oversampled analog acquisition (soil moisture and phototransistor) declarations and macros */
+
+// LIBRARIES ------------------------------------------------------------------------------------
+#include "mbed.h"
+
+// LIBRARY GUARD --------------------------------------------------------------------------------
+#ifndef ANALOG_SAMPLER_H
+#define ANALOG_SAMPLER_H
+
+// ==============================================================================================
+// MACROS
+// ==============================================================================================
+#define ANALOG_CHANNELS            2                  // In the order given to the constructor
+#define ANALOG_FRAMES              32                 // Oversampled conversions of every channel averaged per burst
+#define ANALOG_FRAME_RATE_HZ       4000               // TIM6 trigger rate: 32 frames in 8 ms
+#define ANALOG_HW_RATIO            16                 // ADC hardware oversampler: 16 x 12 bit summed into 16 bit, no CPU involved
+
+// DMA and timer triggered on the STM32L0 (DISCO_L072CZ_LRWAN1), AnalogIn polling elsewhere
+#if defined(TARGET_STM32L0) && !defined(ANALOG_SAMPLER_POLLING)
+#define ANALOG_SAMPLER_DMA         1
+#else
+#define ANALOG_SAMPLER_DMA         0
+#endif
+// MACROS END ===================================================================================
+
+// ==============================================================================================
+// TYPES
+// ==============================================================================================
+typedef struct {
+    uint16_t mean;                            // Full scale 65535, like AnalogIn::read_u16()
+    uint32_t variance;                        // Of the ANALOG_FRAMES values, in counts^2
+} analog_reading_t;
+// TYPES END ====================================================================================
+
+// ==============================================================================================
+// ANALOG SAMPLER CLASS
+// ==============================================================================================
+// A burst of ANALOG_FRAMES frames, every frame one conversion of each channel. On the STM32L0
+// TIM6 triggers the frames, the ADC hardware oversampler sums ANALOG_HW_RATIO conversions per
+// channel and DMA moves the results, so the CPU only sees the transfer-complete interrupt
+// whatever the ratio. read() then averages the frames and gives their variance, so a noisy
+// probe shows up as such instead of as a jittering value.
+class AnalogSampler {
+public:
+    // Constructor ------------------------------------------------------------------------------
+    AnalogSampler(PinName channel0, PinName channel1);
+
+    // Public functions -------------------------------------------------------------------------
+    bool init();                                                  // ADC calibration, DMA and timer setup
+    void start_burst();
+    bool burst_ready() const;
+    bool read(analog_reading_t *readings);                        // ANALOG_CHANNELS readings, false if the burst did not complete
+    std::chrono::microseconds burst_time() const;
+
+private:
+    // Private functions ------------------------------------------------------------------------
+    void stop_burst();
+#if ANALOG_SAMPLER_DMA
+    static void dma_irq();
+    static uint32_t timer_clock();
+#endif
+
+    // Burst buffer and hardware ----------------------------------------------------------------
+    uint16_t _buffer[ANALOG_FRAMES * ANALOG_CHANNELS];            // Frame after frame
+    uint8_t _index[ANALOG_CHANNELS];                              // Position of each channel in a frame, the ADC scans by channel number
+    volatile bool _done;
+#if ANALOG_SAMPLER_DMA
+    volatile bool _sleep_locked;                                  // Deep sleep held off during the burst
+    PinName _pins[ANALOG_CHANNELS];
+    ADC_HandleTypeDef _adc;
+    DMA_HandleTypeDef _dma;
+    TIM_HandleTypeDef _tim;
+    static AnalogSampler *_instance;                              // For the DMA interrupt, there is one ADC
+#else
+    AnalogIn _in0;
+    AnalogIn _in1;
+#endif
+};
+// ANALOG SAMPLER CLASS END =====================================================================
+
+#endif
@@ -0,0 +1,194 @@
+/* File for the I2C transaction scheduler definitions */
+
+// LIBRARIES ---------------------------------------------------------------------------------------------------------------
+#include "mbed.h"
+#include "i2c_scheduler.h"
+#include <string.h>
+
+// CONSTRUCTOR -------------------------------------------------------------------------------------------------------------
+I2CScheduler::I2CScheduler(I2C &i2c) : _i2c(i2c), _thread(osPriorityAboveNormal, I2C_SCHEDULER_STACK_SIZE), _event(0),
+                                       _clients(0), _turn(0) {
+    memset(_head, 0, sizeof(_head));
+    memset(_tail, 0, sizeof(_tail));
+    memset(_stats, 0, sizeof(_stats));
+}
+
+// =========================================================================================================================
+// PUBLIC FUNCTIONS
+// =========================================================================================================================
+void I2CScheduler::start(){
+    _clock.start();
+#if DEVICE_I2C_ASYNCH
+    _i2c.set_dma_usage(DMA_USAGE_OPPORTUNISTIC);
+#endif
+    _thread.start(callback(this, &I2CScheduler::bus_routine));
+}
+
+uint8_t I2CScheduler::add_client(){
+    MBED_ASSERT(_clients < I2C_SCHEDULER_MAX_CLIENTS);
+    return _clients++;
+}
+
+void I2CScheduler::submit(uint8_t client, i2c_transaction_t *transaction){
+    transaction->client = client;
+    transaction->result = 0;
+    transaction->next = NULL;
+    transaction->queued_us = now_us();
+
+    {
+        CriticalSectionLock lock;
+
+        if (_tail[client] != NULL) {
+            _tail[client]->next = transaction;
+        } else {
+            _head[client] = transaction;
+        }
+        _tail[client] = transaction;
+    }
+    _flags.set(I2C_FLAG_SUBMITTED);
+}
+
+int I2CScheduler::write(uint8_t client, int address, const char *data, int length, uint8_t retries){
+    return transfer(client, address, data, length, NULL, 0, retries);
+}
+
+int I2CScheduler::read(uint8_t client, int address, char *data, int length, uint8_t retries){
+    return transfer(client, address, NULL, 0, data, length, retries);
+}
+
+int I2CScheduler::write_read(uint8_t client, int address, const char *tx, int tx_length, char *rx, int rx_length, uint8_t retries){
+    return transfer(client, address, tx, tx_length, rx, rx_length, retries);
+}
+
+bool I2CScheduler::get_stats(uint8_t client, i2c_stats_t *stats) const {
+    if (client >= _clients) {
+        return false;
+    }
+    CriticalSectionLock lock;                                       // Updated by the bus thread
+    *stats = _stats[client];
+    return true;
+}
+// PUBLIC FUNCTIONS END ====================================================================================================
+
+// =========================================================================================================================
+// PRIVATE FUNCTIONS
+// =========================================================================================================================
+// Submits and sleeps until done, the bus keeps serving the other clients meanwhile. Thread context only
+int I2CScheduler::transfer(uint8_t client, int address, const char *tx, int tx_length, char *rx, int rx_length, uint8_t retries){
+    Semaphore finished(0);
+    i2c_transaction_t transaction;
+
+    memset(&transaction, 0, sizeof(transaction));
+    transaction.address = address;
+    transaction.tx = tx;
+    transaction.tx_length = tx_length;
+    transaction.rx = rx;
+    transaction.rx_length = rx_length;
+    transaction.retries = retries;
+    transaction.done = release;
+    transaction.context = &finished;
+
+    submit(client, &transaction);
+    finished.acquire();                                             // Every transaction completes, if only by I2C_SCHEDULER_TIMEOUT
+    return transaction.result;
+}
+
+void I2CScheduler::bus_routine(){
+    while (true) {
+        _flags.wait_any(I2C_FLAG_SUBMITTED);
+
+        i2c_transaction_t *transaction;
+        while ((transaction = pick_next()) != NULL) {
+            int result;
+
+            transaction->started_us = now_us();
+            while ((result = execute(transaction)) != 0 && transaction->retries > 0) {
+                transaction->retries--;
+                _stats[transaction->client].retries++;
+            }
+            finish(transaction, result);
+        }
+    }
+}
+
+int I2CScheduler::execute(i2c_transaction_t *transaction){
+#if DEVICE_I2C_ASYNCH
+    _flags.clear(I2C_FLAG_TRANSFER_DONE);
+    if (_i2c.transfer(transaction->address, transaction->tx, transaction->tx_length, transaction->rx, transaction->rx_length,
+                      callback(this, &I2CScheduler::transfer_done), I2C_EVENT_ALL) != 0) {
+        return I2C_EVENT_ERROR;                                     // Bus still busy
+    }
+    if (_flags.wait_any_for(I2C_FLAG_TRANSFER_DONE, I2C_SCHEDULER_TIMEOUT) & osFlagsError) {
+        _i2c.abort_transfer();
+        return I2C_EVENT_ERROR;
+    }
+    return _event & I2C_SCHEDULER_ERRORS;
+#else
+    int result = 0;
+
+    if (transaction->tx_length > 0) {
+        result = _i2c.write(transaction->address, transaction->tx, transaction->tx_length, transaction->rx_length > 0);
+    }
+    if (result == 0 && transaction->rx_length > 0) {
+        result = _i2c.read(transaction->address, transaction->rx, transaction->rx_length);
+    }
+    return (result != 0) ? I2C_EVENT_ERROR : 0;
+#endif
+}
+
+// Accounts the transaction, takes it off its queue and hands it back to its client
+void I2CScheduler::finish(i2c_transaction_t *transaction, int result){
+    uint32_t now = now_us();
+    uint32_t wait_us = transaction->started_us - transaction->queued_us;
+
+    {
+        CriticalSectionLock lock;
+        i2c_stats_t &stats = _stats[transaction->client];
+
+        stats.transactions++;
+        stats.errors += (result != 0) ? 1 : 0;
+        stats.bytes += transaction->tx_length + transaction->rx_length;
+        stats.wait_us_total += wait_us;
+        stats.wait_us_max = (wait_us > stats.wait_us_max) ? wait_us : stats.wait_us_max;
+        stats.bus_us_total += now - transaction->started_us;
+
+        _head[transaction->client] = transaction->next;
+        if (_head[transaction->client] == NULL) {
+            _tail[transaction->client] = NULL;
+        }
+    }
+
+    transaction->result = result;
+    if (transaction->done != NULL) {
+        transaction->done(transaction);                             // The descriptor can be gone after this
+    }
+}
+
+// Round robin: the first client after the last one served with something queued
+i2c_transaction_t *I2CScheduler::pick_next(){
+    CriticalSectionLock lock;
+
+    for (uint8_t i = 1; i <= _clients; i++) {
+        uint8_t client = (_turn + i) % _clients;
+
+        if (_head[client] != NULL) {
+            _turn = client;
+            return _head[client];
+        }
+    }
+    return NULL;
+}
+
+void I2CScheduler::transfer_done(int event){
+    _event = event;
+    _flags.set(I2C_FLAG_TRANSFER_DONE);
+}
+
+uint32_t I2CScheduler::now_us() const {
+    return (uint32_t)_clock.elapsed_time().count();                 // Wraps after 71 minutes, only differences are used (LPTIM ticks on the target)
+}
+
+void I2CScheduler::release(i2c_transaction_t *transaction){
+    static_cast<Semaphore *>(transaction->context)->release();
+}
+// PRIVATE FUNCTIONS END ===================================================================================================
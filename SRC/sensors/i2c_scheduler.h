@@ -0,0 +1,114 @@
+/* File for the I2C transaction scheduler declarations and macros */
+
+// LIBRARIES ------------------------------------------------------------------------------------
+#include "mbed.h"
+
+// LIBRARY GUARD --------------------------------------------------------------------------------
+#ifndef I2C_SCHEDULER_H
+#define I2C_SCHEDULER_H
+
+// ==============================================================================================
+// MACROS
+// ==============================================================================================
+#define I2C_SCHEDULER_MAX_CLIENTS  4                  // One per driver sharing the bus
+#define I2C_SCHEDULER_RETRIES      2                  // Default extra attempts of the blocking helpers after a NACK or bus error
+#define I2C_SCHEDULER_ERRORS       (I2C_EVENT_ERROR | I2C_EVENT_ERROR_NO_SLAVE | I2C_EVENT_TRANSFER_EARLY_NACK)
+#define I2C_SCHEDULER_TIMEOUT      50ms               // A transfer not completed by then is aborted, longer than a 192-byte FIFO burst at 100 kHz
+#define I2C_SCHEDULER_STACK_SIZE   1024
+
+// Bus thread flags
+#define I2C_FLAG_SUBMITTED         (1UL << 0)
+#define I2C_FLAG_TRANSFER_DONE     (1UL << 1)
+// MACROS END ===================================================================================
+
+// ==============================================================================================
+// TYPES
+// ==============================================================================================
+typedef struct i2c_transaction i2c_transaction_t;
+typedef void (*i2c_done_t)(i2c_transaction_t *transaction);
+
+struct i2c_transaction {
+    // Filled by the caller, must stay valid until done() ---------------------------------------
+    int address;                              // 8-bit address, as for mbed::I2C
+    const char *tx;                           // Written first (register address, command, ...)
+    int tx_length;
+    char *rx;                                 // Then read after a repeated start
+    int rx_length;
+    uint8_t retries;                          // Attempts left after a failure
+    i2c_done_t done;                          // Called from the bus thread, keep it short
+    void *context;
+
+    // Filled by the scheduler ------------------------------------------------------------------
+    int result;                               // 0, or the I2C_EVENT_* error flags
+    uint8_t client;
+    uint32_t queued_us;
+    uint32_t started_us;
+    i2c_transaction_t *next;
+};
+
+typedef struct {
+    uint32_t transactions;                    // Completed, successful or not
+    uint32_t errors;                          // Failed after every retry
+    uint32_t retries;
+    uint32_t bytes;
+    uint32_t wait_us_total;                   // Queued until started: the cost of sharing the bus
+    uint32_t wait_us_max;
+    uint32_t bus_us_total;                    // Started until completed, retries included
+} i2c_stats_t;
+// TYPES END ====================================================================================
+
+// ==============================================================================================
+// I2C SCHEDULER CLASS
+// ==============================================================================================
+// Every access to the bus goes through here as a transaction descriptor: a write, a read, or
+// a write then a read with a repeated start. Each client (driver) has its own FIFO and the bus
+// thread takes one transaction from each client in turn, so a long FIFO burst of one sensor
+// can only delay the others by one transaction. With I2C_ASYNCH the transfers run on
+// I2C::transfer (DMA when the target has it) and the bus thread sleeps until the completion
+// interrupt; otherwise it makes the blocking calls itself. Either way the callers only wait
+// for their own transactions, and retries and timing are accounted in one place.
+class I2CScheduler {
+public:
+    // Constructor ------------------------------------------------------------------------------
+    I2CScheduler(I2C &i2c);
+
+    // Public functions -------------------------------------------------------------------------
+    void start();                                                 // Starts the bus thread, before any driver is used
+    uint8_t add_client();                                         // Called once by each driver
+    void submit(uint8_t client, i2c_transaction_t *transaction);  // Returns straight away (ISR safe), done() is called when finished
+
+    // Blocking helpers, 0 on success like mbed::I2C. retries is 0 for the accesses where a NACK is
+    // an answer (a conversion not done yet) rather than a failure: the caller polls again anyway
+    int write(uint8_t client, int address, const char *data, int length, uint8_t retries = I2C_SCHEDULER_RETRIES);
+    int read(uint8_t client, int address, char *data, int length, uint8_t retries = I2C_SCHEDULER_RETRIES);
+    int write_read(uint8_t client, int address, const char *tx, int tx_length, char *rx, int rx_length,
+                   uint8_t retries = I2C_SCHEDULER_RETRIES);
+
+    bool get_stats(uint8_t client, i2c_stats_t *stats) const;
+
+private:
+    // Private functions ------------------------------------------------------------------------
+    int transfer(uint8_t client, int address, const char *tx, int tx_length, char *rx, int rx_length, uint8_t retries);
+    void bus_routine();
+    int execute(i2c_transaction_t *transaction);                  // One attempt, returns 0 or the I2C_EVENT_* errors
+    void finish(i2c_transaction_t *transaction, int result);
+    i2c_transaction_t *pick_next();
+    void transfer_done(int event);                                // I2C::transfer callback, interrupt context
+    uint32_t now_us() const;
+    static void release(i2c_transaction_t *transaction);
+
+    // Bus thread and queues --------------------------------------------------------------------
+    I2C &_i2c;
+    Thread _thread;
+    EventFlags _flags;
+    LowPowerTimer _clock;                                         // For the stats only: a Timer would hold the deep sleep lock for good
+    i2c_transaction_t *_head[I2C_SCHEDULER_MAX_CLIENTS];
+    i2c_transaction_t *_tail[I2C_SCHEDULER_MAX_CLIENTS];
+    i2c_stats_t _stats[I2C_SCHEDULER_MAX_CLIENTS];
+    volatile int _event;                                          // Result of the last I2C::transfer
+    uint8_t _clients;
+    uint8_t _turn;                                                // Client served last
+};
+// I2C SCHEDULER CLASS END ======================================================================
+
+#endif
@@ -3,33 +3,281 @@
 // LIBRARIES ------------------------------------------------------------------------------------------------------------
 #include "mbed.h"
 #include "mma8451.h"
+#include <string.h>
 
-// CONSTRUCTORS ---------------------------------------------------------------------------------------------------------
-MMA8451Q::MMA8451Q(I2C& i2c_bus) : _i2c(i2c_bus) {}                                                 // I2C communication
-
-// FUNCTION TO WRITE TO REGISTER ========================================================================================
-void MMA8451Q::write_register_mma8451(char reg, char value){         // WRITE function receives the Control Register 1 and the ax direction
-    char data[2] = {reg, value};
-    _i2c.write(MMA8451_I2C_ADDRESS, data, 2);                      // We write in the MMA8451 direction the command to get, for example, ax
-}
+namespace reg = mma8451_reg;                                       // Register map
 
-// FUNCTION TO READ A REGISTER ==========================================================================================
-char MMA8451Q::read_register_mma8451(char reg){                      // READ function does only get as a parameter the register to be read
-    char data;
-    _i2c.write(MMA8451_I2C_ADDRESS, &reg, 1, true);                // Send register address from, for example, ax
-    _i2c.read(MMA8451_I2C_ADDRESS, &data, 1);                      // Read data returned from the register
-    return data;
+// CONSTRUCTORS ---------------------------------------------------------------------------------------------------------
+MMA8451Q::MMA8451Q(I2CScheduler& i2c_bus) : _device(i2c_bus), _fast_read(false), _fifo_enabled(false),
+                                            _capture(NULL), _capture_length(0), _capture_count(0), _capture_axis(0),
+                                            _capture_restarts(0) {  // I2C communication
+    clear_sums(&_reported);
+    clear_sums(&_recent);
 }
 
 // FUNCTION TO READ 14-BIT AXIS VALUE (X, Y, Z) =========================================================================
-int16_t MMA8451Q::read_axis(char msb_reg){                                  // This function receives as a parameter only the MSB acceleration register
-    char msb = read_register_mma8451(msb_reg);                    // The MSB register for each component is read
-    char lsb = read_register_mma8451(msb_reg + 1);                // The same with the LSB register which is actually 6 bit long, having bits 0 and 1, the most significant, empty
-    return (int16_t)((msb << 8) | lsb) >> 2;                      // Combine MSB (8-bit) and LSB (6-bit), and shift by 2 for 14-bit value
+int16_t MMA8451Q::read_axis(uint8_t axis){                            // MSB and LSB in one burst, so both come from the same sample
+    uint16_t value = 0;
+
+    switch (axis) {
+        case 0:  _device.read<reg::OUT_X>(&value); break;
+        case 1:  _device.read<reg::OUT_Y>(&value); break;
+        default: _device.read<reg::OUT_Z>(&value); break;
+    }
+    return (int16_t)value >> 2;                                   // The LSB register is 6 bit long, shift by 2 for the 14-bit value
 }
 
 // FUNCTION TO INITIALIZE THE ACCELEROMETER WITH FREEFALL DETECTION =====================================================
 void MMA8451Q::init_mma8451() {
-    char data = read_register_mma8451(CTRL_REG1);                 // Initialize the MMA8451Q accelerometer by setting it to active mode, read the state of Control Register 1 (0x2A)
-    write_register_mma8451(CTRL_REG1, data | 0x01);
+    active_mma8451();                                             // Initialize the MMA8451Q accelerometer by setting it to active mode
+}
+
+// FUNCTION TO READ THE THREE AXES AT ONCE ==============================================================================
+bool MMA8451Q::read_xyz(mma8451_xyz_t *xyz){                          // One 6-byte burst (3 with F_READ) instead of six single-register transactions
+    char data[MMA8451_XYZ_BYTES];
+
+    if (_fast_read) {
+        if (!_device.read_block<reg::OUT_X>(data, MMA8451_XYZ_FAST_BYTES)) {   // The address skips the LSB registers
+            return false;
+        }
+        xyz->x = (int16_t)((int8_t)data[0]) * 64;                 // 8-bit sample scaled to the 14-bit range
+        xyz->y = (int16_t)((int8_t)data[1]) * 64;
+        xyz->z = (int16_t)((int8_t)data[2]) * 64;
+        return true;
+    }
+
+    if (!_device.read_range<reg::OUT_XYZ>(data)) {
+        return false;
+    }
+    xyz->x = (int16_t)reg::OUT_XYZ::get<reg::OUT_X>(data) >> 2;   // MSB and LSB from the same sample, shifted for the 14-bit value
+    xyz->y = (int16_t)reg::OUT_XYZ::get<reg::OUT_Y>(data) >> 2;
+    xyz->z = (int16_t)reg::OUT_XYZ::get<reg::OUT_Z>(data) >> 2;
+    return true;
+}
+
+// FUNCTION TO ENABLE OR DISABLE THE FAST READ MODE =====================================================================
+void MMA8451Q::set_fast_read(bool enable){                            // F_READ can only be changed in standby
+    standby_mma8451();
+    _device.modify<reg::CTRL_REG1_F_READ>(enable);
+    active_mma8451();
+    _fast_read = enable;
+}
+
+// FUNCTIONS TO SWITCH BETWEEN STANDBY AND ACTIVE MODES =================================================================
+void MMA8451Q::standby_mma8451(){
+    _device.modify<reg::CTRL_REG1_ACTIVE>(0);
+}
+
+void MMA8451Q::active_mma8451(){
+    _device.modify<reg::CTRL_REG1_ACTIVE>(1);
+}
+
+// FUNCTION TO SELECT THE OUTPUT DATA RATE ==============================================================================
+void MMA8451Q::set_data_rate(mma8451_odr_t odr){                      // DR can only be changed in standby
+    standby_mma8451();
+    _device.modify<reg::CTRL_REG1_DR>(odr);
+    active_mma8451();
+}
+
+// FUNCTION TO SET UP THE FIFO AND ITS WATERMARK INTERRUPT ==============================================================
+void MMA8451Q::init_fifo(uint8_t mode, uint8_t watermark, bool int1){
+    standby_mma8451();
+    _device.write<reg::F_SETUP>(reg::F_SETUP_F_MODE::of(F_MODE_DISABLED));   // The mode can only go from disabled to another one
+    _device.write<reg::F_SETUP>(reg::F_SETUP_F_MODE::of(mode) | reg::F_SETUP_F_WMRK::of(watermark));
+
+    route_interrupt(SRC_FIFO, mode != F_MODE_DISABLED, int1);
+    active_mma8451();
+
+    _fifo_enabled = (mode != F_MODE_DISABLED);
+    clear_sums(&_reported);                                       // Start a clean window
+    clear_sums(&_recent);
+}
+
+// FUNCTION TO EMPTY THE FIFO ===========================================================================================
+// With the FIFO enabled the address wraps from OUT_Z_LSB back to OUT_X_MSB, so the whole FIFO
+// (192 bytes at most) comes out in one transaction. Reading it also clears the watermark interrupt
+uint8_t MMA8451Q::drain_fifo(){
+    if (!_fifo_enabled) {                                         // F_STATUS would be the plain STATUS register
+        return 0;
+    }
+
+    char data[MMA8451_FIFO_SIZE * MMA8451_XYZ_BYTES];
+    uint8_t status = 0;
+    uint8_t bytes_per_sample = _fast_read ? MMA8451_XYZ_FAST_BYTES : MMA8451_XYZ_BYTES;
+
+    if (!_device.read<reg::F_STATUS>(&status)) {
+        return 0;
+    }
+    uint8_t count = reg::F_STATUS_CNT::get(status);
+
+    if (reg::F_STATUS_OVF::get(status)) {
+        _recent.overflow = true;
+        if (_capture != NULL && _capture_count > 0 && _capture_count < _capture_length) {
+            _capture_count = 0;                                   // Samples lost in the middle: start again from the ones in the FIFO, consecutive in F_MODE_CIRCULAR
+            _capture_restarts++;
+        }
+    }
+    if (count == 0 || count > MMA8451_FIFO_SIZE || !_device.read_block<reg::OUT_X>(data, count * bytes_per_sample)) {
+        return 0;
+    }
+
+    for (uint8_t i = 0; i < count; i++) {
+        const char *sample = &data[i * bytes_per_sample];
+        int16_t xyz[3];
+
+        for (uint8_t axis = 0; axis < 3; axis++) {
+            if (_fast_read) {
+                xyz[axis] = (int16_t)((int8_t)sample[axis]) * 64;
+            } else {
+                xyz[axis] = (int16_t)reg::OUT_X::decode(&sample[2 * axis]) >> 2;
+            }
+        }
+        add_sample(xyz);
+
+        if (_capture != NULL && _capture_count < _capture_length) {
+            _capture[_capture_count++] = xyz[_capture_axis];
+        }
+    }
+    return count;
+}
+
+// FUNCTIONS FOR THE STATISTICS WINDOW =================================================================================
+// The window is only closed once its uplink is sent: until then every call reports it again,
+// with the samples drained in between added, so a retried uplink still covers the whole period
+void MMA8451Q::get_window(mma8451_window_t *window){
+    mma8451_sums_t &sums = _reported;
+
+    sums.count += _recent.count;                                  // add_sample() keeps the total below UINT16_MAX
+    sums.overflow |= _recent.overflow;
+    for (uint8_t axis = 0; axis < 3; axis++) {
+        sums.sum[axis] += _recent.sum[axis];
+        sums.sum_squares[axis] += _recent.sum_squares[axis];
+        sums.min[axis] = _recent.min[axis] < sums.min[axis] ? _recent.min[axis] : sums.min[axis];
+        sums.max[axis] = _recent.max[axis] > sums.max[axis] ? _recent.max[axis] : sums.max[axis];
+    }
+    clear_sums(&_recent);
+
+    memset(window, 0, sizeof(*window));
+    window->samples = sums.count;
+    window->overflow = sums.overflow;
+
+    for (uint8_t axis = 0; axis < 3 && sums.count > 0; axis++) {
+        int64_t mean = sums.sum[axis] / sums.count;
+        int64_t variance = (sums.sum_squares[axis] * sums.count - sums.sum[axis] * sums.sum[axis]) / ((int64_t)sums.count * sums.count);   // Fits in 64 bits for 14-bit samples
+        int32_t above = sums.max[axis] - mean;
+        int32_t below = mean - sums.min[axis];
+
+        window->mean[axis] = (int16_t)mean;
+        window->rms[axis] = (uint16_t)isqrt(variance > 0 ? variance : 0);
+        window->peak[axis] = (uint16_t)(above > below ? above : below);
+        window->peak_to_peak[axis] = (uint16_t)(sums.max[axis] - sums.min[axis]);
+    }
+}
+
+void MMA8451Q::close_window(){
+    clear_sums(&_reported);
+}
+
+void MMA8451Q::clear_sums(mma8451_sums_t *sums){
+    sums->count = 0;
+    sums->overflow = false;
+    for (uint8_t axis = 0; axis < 3; axis++) {
+        sums->sum[axis] = 0;
+        sums->sum_squares[axis] = 0;
+        sums->min[axis] = INT16_MAX;
+        sums->max[axis] = INT16_MIN;
+    }
+}
+
+// FUNCTION TO ADD A SAMPLE TO THE WINDOW ===============================================================================
+void MMA8451Q::add_sample(const int16_t *xyz){
+    if (_reported.count + _recent.count >= UINT16_MAX) {          // Window never closed, stop before the count wraps
+        return;
+    }
+
+    _recent.count++;
+    for (uint8_t axis = 0; axis < 3; axis++) {
+        _recent.sum[axis] += xyz[axis];
+        _recent.sum_squares[axis] += (int32_t)xyz[axis] * xyz[axis];
+        _recent.min[axis] = xyz[axis] < _recent.min[axis] ? xyz[axis] : _recent.min[axis];
+        _recent.max[axis] = xyz[axis] > _recent.max[axis] ? xyz[axis] : _recent.max[axis];
+    }
+}
+
+// FUNCTION FOR THE INTEGER SQUARE ROOT =================================================================================
+uint32_t MMA8451Q::isqrt(uint64_t value){                             // Bit by bit, no float needed for the RMS
+    uint64_t root = 0;
+    uint64_t bit = (uint64_t)1 << 62;
+
+    while (bit > value) {
+        bit >>= 2;
+    }
+    while (bit != 0) {
+        if (value >= root + bit) {
+            value -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return (uint32_t)root;
+}
+
+// FUNCTION TO SET UP THE FREEFALL/MOTION DETECTOR ======================================================================
+void MMA8451Q::init_motion(uint8_t threshold, uint8_t count, bool freefall, bool int1){
+    standby_mma8451();
+    _device.write<reg::FF_MT_CFG>(reg::FF_MT_CFG_ELE::of(1) | reg::FF_MT_CFG_EFE::of(0x07) | reg::FF_MT_CFG_OAE::of(!freefall));
+    _device.write<reg::FF_MT_THS>(reg::FF_MT_THS_THS::of(threshold));   // Debounce counter cleared when the condition goes away
+    _device.write<reg::FF_MT_COUNT>(count);
+    route_interrupt(SRC_FF_MT, true, int1);
+    active_mma8451();
+}
+
+// FUNCTION TO SET UP THE TRANSIENT DETECTOR ============================================================================
+void MMA8451Q::init_transient(uint8_t threshold, uint8_t count, bool int1){
+    standby_mma8451();
+    _device.write<reg::TRANSIENT_CFG>(reg::TRANSIENT_CFG_ELE::of(1) | reg::TRANSIENT_CFG_EFE::of(0x07));
+    _device.write<reg::TRANSIENT_THS>(reg::TRANSIENT_THS_THS::of(threshold));
+    _device.write<reg::TRANSIENT_COUNT>(count);
+    route_interrupt(SRC_TRANS, true, int1);
+    active_mma8451();
+}
+
+// FUNCTION TO READ AND CLEAR THE INTERRUPT SOURCES =====================================================================
+uint8_t MMA8451Q::read_events(mma8451_events_t *events){             // The FIFO source is cleared by drain_fifo(), not here
+    memset(events, 0, sizeof(*events));
+    _device.read<reg::INT_SOURCE>(&events->int_source);
+
+    if (events->int_source & SRC_FF_MT) {
+        _device.read<reg::FF_MT_SRC>(&events->ff_mt_src);
+    }
+    if (events->int_source & SRC_TRANS) {
+        _device.read<reg::TRANSIENT_SRC>(&events->transient_src);
+    }
+    return events->int_source;
+}
+
+// FUNCTION TO ENABLE AN INTERRUPT AND CHOOSE ITS PIN ===================================================================
+void MMA8451Q::route_interrupt(uint8_t source, bool enable, bool int1){   // Must be called in standby
+    _device.modify<reg::CTRL_REG3_IPOL>(1);                       // Active high: rising edge on the MCU side
+    _device.update<reg::CTRL_REG5>(source, int1 ? source : 0);
+    _device.update<reg::CTRL_REG4>(source, enable ? source : 0);
+}
+
+// FUNCTION TO CAPTURE RAW SAMPLES ======================================================================================
+void MMA8451Q::start_capture(int16_t *buffer, uint16_t length, uint8_t axis){   // Filled by drain_fifo(), consecutive samples at the ODR
+    _capture = buffer;
+    _capture_length = length;
+    _capture_count = 0;
+    _capture_axis = axis < 3 ? axis : 2;
+    _capture_restarts = 0;
+}
+
+bool MMA8451Q::capture_complete() const {
+    return _capture != NULL && _capture_count >= _capture_length;
+}
+
+uint8_t MMA8451Q::capture_restarts() const {
+    return _capture_restarts;
 }
\ No newline at end of file
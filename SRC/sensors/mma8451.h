@@ -2,6 +2,7 @@
 
 // LIBRARIES ------------------------------------------------------------------------------------
 #include "mbed.h"
+#include "regmap.h"
 
 // LIBRARY GUARD --------------------------------------------------------------------------------
 #ifndef MMA8451_H
@@ -9,10 +10,102 @@
 
 // MMA8451 MACROS -------------------------------------------------------------------------------
 #define MMA8451_I2C_ADDRESS (0x1D << 1)                           // MMA8451Q I2C Address: 7-bit address shifted because of mBed 8-bit format
-#define CTRL_REG1 0x2A                                            // MMA8451Q Control Register 1 to allow writing                                          // Interrupt pin routing register
-#define OUT_X_MSB 0x01                                            // Register for X-axis MSB
-#define OUT_Y_MSB 0x03                                            // Register for Y-axis MSB
-#define OUT_Z_MSB 0x05                                            // Register for Z-axis MSB
+
+// FIFO modes (F_SETUP F_MODE) ------------------------------------------------------------------
+#define F_MODE_DISABLED 0                                         // FIFO off
+#define F_MODE_CIRCULAR 1                                         // Oldest sample overwritten when full
+#define F_MODE_FILL 2                                             // Stops accepting samples when full
+#define MMA8451_FIFO_SIZE 32                                      // Samples
+
+// Interrupt sources: INT_SOURCE bits, and the same bits enable (CTRL_REG4) and route (CTRL_REG5) them
+#define SRC_FF_MT 0x04                                            // Freefall/motion detector
+#define SRC_TRANS 0x20                                            // Transient detector
+#define SRC_FIFO 0x40                                             // FIFO watermark or overflow
+
+// Burst read -----------------------------------------------------------------------------------
+#define MMA8451_XYZ_BYTES      6                                  // OUT_X_MSB to OUT_Z_LSB in one auto-increment read
+#define MMA8451_XYZ_FAST_BYTES 3                                  // OUT_X_MSB, OUT_Y_MSB, OUT_Z_MSB with F_READ
+
+// MMA8451 REGISTER MAP -------------------------------------------------------------------------
+namespace mma8451_reg {
+typedef Register<0x00, 1, REG_READ_ONLY> F_STATUS;                // FIFO status when the FIFO is enabled (replaces STATUS)
+typedef Field<F_STATUS, 7> F_STATUS_OVF;                          // Samples were lost since the last drain
+typedef Field<F_STATUS, 6> F_STATUS_WMRK;                         // Watermark reached
+typedef Field<F_STATUS, 0, 6> F_STATUS_CNT;                       // Samples waiting in the FIFO
+typedef Register<0x01, 2, REG_READ_ONLY> OUT_X;                   // MSB, then LSB with the 14-bit sample left aligned
+typedef Register<0x03, 2, REG_READ_ONLY> OUT_Y;
+typedef Register<0x05, 2, REG_READ_ONLY> OUT_Z;
+typedef RegisterRange<OUT_X, OUT_Z> OUT_XYZ;                      // MMA8451_XYZ_BYTES of the same sample
+typedef Register<0x09> F_SETUP;                                   // FIFO mode and watermark
+typedef Field<F_SETUP, 6, 2> F_SETUP_F_MODE;                      // F_MODE_*
+typedef Field<F_SETUP, 0, 6> F_SETUP_F_WMRK;
+typedef Register<0x0C, 1, REG_READ_ONLY> INT_SOURCE;              // Which interrupt is pending, SRC_* bits
+typedef Register<0x15> FF_MT_CFG;                                 // Freefall/motion detector configuration
+typedef Field<FF_MT_CFG, 7> FF_MT_CFG_ELE;                        // Latch the event until FF_MT_SRC is read
+typedef Field<FF_MT_CFG, 6> FF_MT_CFG_OAE;                        // Motion (any axis above the threshold), freefall (all below) when clear
+typedef Field<FF_MT_CFG, 3, 3> FF_MT_CFG_EFE;                     // Event enabled on X, Y and Z
+typedef Register<0x16, 1, REG_READ_ONLY> FF_MT_SRC;               // Freefall/motion event source, reading it clears the event
+typedef Register<0x17> FF_MT_THS;                                 // Freefall/motion threshold, 0.063 g/LSB
+typedef Field<FF_MT_THS, 0, 7> FF_MT_THS_THS;
+typedef Register<0x18> FF_MT_COUNT;                               // Freefall/motion debounce, in samples
+typedef Register<0x1D> TRANSIENT_CFG;                             // Transient (high-pass filtered) detector configuration
+typedef Field<TRANSIENT_CFG, 4> TRANSIENT_CFG_ELE;                // Latch the event until TRANSIENT_SRC is read
+typedef Field<TRANSIENT_CFG, 1, 3> TRANSIENT_CFG_EFE;             // Event enabled on X, Y and Z (high-pass filter in use)
+typedef Register<0x1E, 1, REG_READ_ONLY> TRANSIENT_SRC;           // Transient event source, reading it clears the event
+typedef Register<0x1F> TRANSIENT_THS;                             // Transient threshold, 0.063 g/LSB
+typedef Field<TRANSIENT_THS, 0, 7> TRANSIENT_THS_THS;
+typedef Register<0x20> TRANSIENT_COUNT;                           // Transient debounce, in samples
+typedef Register<0x2A> CTRL_REG1;
+typedef Field<CTRL_REG1, 0> CTRL_REG1_ACTIVE;                     // Active mode (0 = standby, where the configuration can be changed)
+typedef Field<CTRL_REG1, 1> CTRL_REG1_F_READ;                     // Fast read: auto-increment skips the LSB registers, 8-bit samples
+typedef Field<CTRL_REG1, 3, 3> CTRL_REG1_DR;                      // Output data rate, mma8451_odr_t
+typedef Register<0x2C> CTRL_REG3;                                 // Interrupt polarity and driver
+typedef Field<CTRL_REG3, 1> CTRL_REG3_IPOL;                       // Interrupt pins active high
+typedef Register<0x2D> CTRL_REG4;                                 // Interrupt enable register, SRC_* bits
+typedef Register<0x2E> CTRL_REG5;                                 // Interrupt pin routing register, SRC_* bits set for INT1
+}
+
+// MMA8451 TYPES --------------------------------------------------------------------------------
+typedef struct {
+    int16_t x;                                                    // 14-bit counts (F_READ: 8-bit sample scaled to the same range)
+    int16_t y;
+    int16_t z;
+} mma8451_xyz_t;
+
+typedef enum {
+    MMA8451_ODR_800HZ = 0,                                        // CTRL_REG1 DR values
+    MMA8451_ODR_400HZ,
+    MMA8451_ODR_200HZ,
+    MMA8451_ODR_100HZ,
+    MMA8451_ODR_50HZ,
+    MMA8451_ODR_12_5HZ,
+    MMA8451_ODR_6_25HZ,
+    MMA8451_ODR_1_56HZ
+} mma8451_odr_t;
+
+typedef struct {
+    uint16_t samples;                                             // Samples in the window
+    bool overflow;                                                // The FIFO overflowed, some samples of the window were lost
+    int16_t mean[3];                                              // X, Y, Z in 14-bit counts
+    uint16_t rms[3];                                              // RMS around the mean (the vibration, without gravity)
+    uint16_t peak[3];                                             // Largest distance from the mean
+    uint16_t peak_to_peak[3];                                     // Maximum - minimum
+} mma8451_window_t;
+
+typedef struct {
+    uint16_t count;
+    bool overflow;
+    int64_t sum[3];
+    int64_t sum_squares[3];
+    int16_t min[3];
+    int16_t max[3];
+} mma8451_sums_t;                                                 // Window accumulators
+
+typedef struct {
+    uint8_t int_source;                                           // INT_SOURCE: SRC_FIFO, SRC_FF_MT, SRC_TRANS...
+    uint8_t ff_mt_src;                                            // FF_MT_SRC if SRC_FF_MT was set: EA and the axes/directions involved
+    uint8_t transient_src;                                        // TRANSIENT_SRC if SRC_TRANS was set
+} mma8451_events_t;
 
 // ==============================================================================================
 // MMA8451Q CLASS
@@ -20,19 +113,49 @@
 class MMA8451Q {
 public:
     // Constructor ------------------------------------------------------------------------------
-    MMA8451Q(I2C& i2c_bus);
+    MMA8451Q(I2CScheduler& i2c_bus);
 
     // Public functions -------------------------------------------------------------------------
     void init_mma8451();                                          // Function to initialize the accelerometer
-    int16_t read_axis(char msb_reg);                              // Function to read a 14-bit axis value (X, Y, Z)
+    int16_t read_axis(uint8_t axis);                              // Function to read a 14-bit axis value (0 = X, 1 = Y, 2 = Z)
+    bool read_xyz(mma8451_xyz_t *xyz);                            // Read the three axes of the same sample in one I2C transaction
+    void set_fast_read(bool enable);                              // F_READ mode: half the bytes on the bus, 8-bit resolution
+    void set_data_rate(mma8451_odr_t odr);
+    void init_fifo(uint8_t mode, uint8_t watermark, bool int1);   // F_MODE_*, watermark interrupt routed to INT1 or INT2 (active high)
+    uint8_t drain_fifo();                                         // Burst read every sample in the FIFO into the window statistics, returns how many
+    void get_window(mma8451_window_t *window);                    // Statistics of the open window, which stays open: a retry reports it again, with the newer samples
+    void close_window();                                          // The last window reported was sent, the samples drained since then start the next one
+    void init_motion(uint8_t threshold, uint8_t count, bool freefall, bool int1);  // FF_MT detector: threshold in 0.063 g, debounce in samples
+    void init_transient(uint8_t threshold, uint8_t count, bool int1);  // Transient detector: same units, gravity removed by the high-pass filter
+    uint8_t read_events(mma8451_events_t *events);                // Pending interrupt sources, clears the latched detector events
+    void start_capture(int16_t *buffer, uint16_t length, uint8_t axis);  // Copy the next FIFO samples of one axis (0 = X) into buffer
+    bool capture_complete() const;
+    uint8_t capture_restarts() const;                             // Captures thrown away by a FIFO overflow since start_capture()
 
 private:
     // Private functions ------------------------------------------------------------------------
-    void write_register_mma8451(char reg, char value);
-    char read_register_mma8451(char reg);
+    void standby_mma8451();
+    void active_mma8451();
+    void add_sample(const int16_t *xyz);
+    static void clear_sums(mma8451_sums_t *sums);
+    void route_interrupt(uint8_t source, bool enable, bool int1);
+    static uint32_t isqrt(uint64_t value);
+
+    // Registers on the I2C bus -----------------------------------------------------------------
+    RegisterDevice<MMA8451_I2C_ADDRESS> _device;
+    bool _fast_read;                                              // CTRL_REG1_F_READ is set
+    bool _fifo_enabled;                                           // F_SETUP mode is not F_MODE_DISABLED
+
+    // Window accumulators ----------------------------------------------------------------------
+    mma8451_sums_t _reported;                                     // Up to the last get_window()
+    mma8451_sums_t _recent;                                       // Drained since then
 
-    // Reference to the I2C bus -----------------------------------------------------------------
-    I2C& _i2c;
+    // Raw capture ------------------------------------------------------------------------------
+    int16_t *_capture;                                            // NULL when no capture is running
+    uint16_t _capture_length;
+    uint16_t _capture_count;
+    uint8_t _capture_axis;
+    uint8_t _capture_restarts;
 };
 // MMA8451Q CLASS END ===========================================================================
 
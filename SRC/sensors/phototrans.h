@@ -1,13 +0,0 @@
-/* File for the phototransistor function declarations and macros */
-
-// LIBRARIES ------------------------------------------------------------------------------------
-#include "mbed.h"
-
-// LIBRARY GUARD --------------------------------------------------------------------------------
-#ifndef PHOTOTRANS_H
-#define PHOTOTRANS_H
-
-// PHOTOTRANSISTOR MACROS -----------------------------------------------------------------------
-#define PHTRANS_PIN PA_4
-
-#endif
\ No newline at end of file
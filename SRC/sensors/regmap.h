@@ -0,0 +1,219 @@
+/* File for the compile-time register map templates shared by the I2C sensor drivers */
+
+// LIBRARIES ------------------------------------------------------------------------------------
+#include "mbed.h"
+#include "i2c_scheduler.h"
+#include <string.h>
+
+// LIBRARY GUARD --------------------------------------------------------------------------------
+#ifndef REGMAP_H
+#define REGMAP_H
+
+// ==============================================================================================
+// TYPES
+// ==============================================================================================
+typedef enum {
+    REG_READ_ONLY  = 0x01,
+    REG_WRITE_ONLY = 0x02,
+    REG_READ_WRITE = 0x03
+} reg_access_t;
+
+typedef enum {
+    REG_BIG_ENDIAN,                           // MSB at the lowest address (MMA8451Q, Si7021)
+    REG_LITTLE_ENDIAN                         // LSB at the lowest address (TCS34725)
+} reg_endian_t;
+
+template <uint8_t WIDTH> struct RegisterValue;                  // Smallest integer holding WIDTH bytes
+template <> struct RegisterValue<1> { typedef uint8_t type; };
+template <> struct RegisterValue<2> { typedef uint16_t type; };
+template <> struct RegisterValue<3> { typedef uint32_t type; };
+template <> struct RegisterValue<4> { typedef uint32_t type; };
+// TYPES END ====================================================================================
+
+// ==============================================================================================
+// REGISTER, FIELD AND RANGE
+// ==============================================================================================
+// A register is a type: everything about it is known at compile time, so an access through
+// RegisterDevice compiles down to the same buffer and I2CScheduler call that would be written by
+// hand. WRITE_ADDRESS is for the sensors that read and write a register with different commands
+template <uint8_t ADDRESS, uint8_t WIDTH = 1, reg_access_t ACCESS = REG_READ_WRITE, reg_endian_t ENDIAN = REG_BIG_ENDIAN,
+          uint8_t WRITE_ADDRESS = ADDRESS>
+struct Register {
+    typedef typename RegisterValue<WIDTH>::type value_t;
+
+    static constexpr uint8_t address = ADDRESS;
+    static constexpr uint8_t write_address = WRITE_ADDRESS;
+    static constexpr uint8_t width = WIDTH;                     // Bytes
+    static constexpr bool readable = (ACCESS & REG_READ_ONLY) != 0;
+    static constexpr bool writable = (ACCESS & REG_WRITE_ONLY) != 0;
+
+    static constexpr value_t decode(const char *data){          // Bus byte order to value
+        value_t value = 0;
+
+        for (uint8_t i = 0; i < WIDTH; i++) {
+            value = (value << 8) | (uint8_t)data[(ENDIAN == REG_BIG_ENDIAN) ? i : WIDTH - 1 - i];
+        }
+        return value;
+    }
+
+    static void encode(value_t value, char *data){              // Value to bus byte order
+        for (uint8_t i = 0; i < WIDTH; i++) {
+            data[(ENDIAN == REG_BIG_ENDIAN) ? WIDTH - 1 - i : i] = (char)(value & 0xFF);
+            value = (value_t)(value >> 8);
+        }
+    }
+};
+
+// BITS contiguous bits of a register, starting at bit SHIFT
+template <typename REG, uint8_t SHIFT, uint8_t BITS = 1>
+struct Field {
+    typedef REG reg;
+    typedef typename REG::value_t value_t;
+
+    static_assert(BITS > 0 && SHIFT + BITS <= 8 * REG::width, "Field outside its register");
+
+    static constexpr value_t mask = (value_t)(((1ULL << BITS) - 1) << SHIFT);
+
+    static constexpr value_t of(value_t field){                 // The field alone, in register position
+        return (value_t)((field << SHIFT) & mask);
+    }
+    static constexpr value_t get(value_t value){
+        return (value_t)((value & mask) >> SHIFT);
+    }
+    static constexpr value_t set(value_t value, value_t field){
+        return (value_t)((value & ~mask) | of(field));
+    }
+};
+
+// Consecutive registers from FIRST to LAST, moved in one auto-increment transaction
+template <typename FIRST, typename LAST>
+struct RegisterRange {
+    static_assert(LAST::address >= FIRST::address, "Range backwards");
+
+    static constexpr uint8_t address = FIRST::address;
+    static constexpr uint8_t length = LAST::address + LAST::width - FIRST::address;   // Bytes
+
+    template <typename REG>
+    static constexpr uint8_t offset(){
+        static_assert(REG::address >= FIRST::address && REG::address + REG::width <= FIRST::address + length, "Register outside the range");
+        return REG::address - FIRST::address;
+    }
+    template <typename REG>
+    static constexpr typename REG::value_t get(const char *data){
+        return REG::decode(data + offset<REG>());
+    }
+    template <typename REG>
+    static void put(typename REG::value_t value, char *data){
+        REG::encode(value, data + offset<REG>());
+    }
+};
+
+// Register pointer byte sent before the data, the register address itself for most sensors.
+// Sensors with a command byte (the TCS34725) provide their own
+struct PlainPointer {
+    static constexpr char read(uint8_t address, bool){
+        return (char)address;
+    }
+    static constexpr char write(uint8_t address, bool){
+        return (char)address;
+    }
+};
+// REGISTER, FIELD AND RANGE END ================================================================
+
+// ==============================================================================================
+// REGISTER DEVICE CLASS
+// ==============================================================================================
+// One I2CScheduler client at I2C_ADDRESS (8-bit, as for mbed::I2C). Every access is one
+// transaction: the pointer byte (POINTER::read/write of the register address, with burst set
+// for more than one byte) and the data, written in the same transfer or read after a repeated
+// start. Blocking, thread context only, true on success. BUS is only replaced by the host tests,
+// with a mock that records the transactions
+template <int I2C_ADDRESS, typename POINTER = PlainPointer, typename BUS = I2CScheduler>
+class RegisterDevice {
+public:
+    // Constructor ------------------------------------------------------------------------------
+    RegisterDevice(BUS &bus) : _bus(bus), _client(bus.add_client()) {}
+
+    // Public functions -------------------------------------------------------------------------
+    template <typename REG>
+    bool read(typename REG::value_t *value){
+        static_assert(REG::readable, "Write only register");
+        const char pointer = POINTER::read(REG::address, REG::width > 1);
+        char data[REG::width];
+
+        if (_bus.write_read(_client, I2C_ADDRESS, &pointer, 1, data, REG::width) != 0) {
+            return false;
+        }
+        *value = REG::decode(data);
+        return true;
+    }
+
+    template <typename REG>
+    bool write(typename REG::value_t value){
+        static_assert(REG::writable, "Read only register");
+        char data[1 + REG::width];
+
+        data[0] = POINTER::write(REG::write_address, REG::width > 1);
+        REG::encode(value, &data[1]);
+        return _bus.write(_client, I2C_ADDRESS, data, 1 + REG::width) == 0;
+    }
+
+    // Read-modify-write of the bits in mask, the write is left out when they already hold bits
+    template <typename REG>
+    bool update(typename REG::value_t mask, typename REG::value_t bits){
+        typename REG::value_t value;
+
+        if (!read<REG>(&value)) {
+            return false;
+        }
+        typename REG::value_t updated = (value & ~mask) | (bits & mask);
+        return updated == value || write<REG>(updated);
+    }
+
+    template <typename FIELD>
+    bool modify(typename FIELD::value_t field){
+        return update<typename FIELD::reg>(FIELD::mask, FIELD::of(field));
+    }
+
+    template <typename RANGE>
+    bool read_range(char *data){                                  // RANGE::length bytes, decoded with RANGE::get()
+        const char pointer = POINTER::read(RANGE::address, true);
+
+        return _bus.write_read(_client, I2C_ADDRESS, &pointer, 1, data, RANGE::length) == 0;
+    }
+
+    template <typename RANGE>
+    bool write_range(const char *data){                           // RANGE::length bytes, encoded with RANGE::put()
+        char buffer[1 + RANGE::length];
+
+        buffer[0] = POINTER::write(RANGE::address, true);
+        memcpy(&buffer[1], data, RANGE::length);
+        return _bus.write(_client, I2C_ADDRESS, buffer, 1 + RANGE::length) == 0;
+    }
+
+    // Burst of a length only known at run time, from REG on (FIFO, register wrap-around)
+    template <typename REG>
+    bool read_block(char *data, int length){
+        static_assert(REG::readable, "Write only register");
+        const char pointer = POINTER::read(REG::address, true);
+
+        return _bus.write_read(_client, I2C_ADDRESS, &pointer, 1, data, length) == 0;
+    }
+
+    bool command(char code){                                      // A lone command byte, sent as is
+        return _bus.write(_client, I2C_ADDRESS, &code, 1) == 0;
+    }
+
+    // A read without pointer, the device decides what comes out. retries = 0 when a NACK means "not ready"
+    bool receive(char *data, int length, uint8_t retries = I2C_SCHEDULER_RETRIES){
+        return _bus.read(_client, I2C_ADDRESS, data, length, retries) == 0;
+    }
+
+private:
+    // Reference to the I2C bus -----------------------------------------------------------------
+    BUS &_bus;
+    uint8_t _client;
+};
+// REGISTER DEVICE CLASS END ====================================================================
+
+#endif
@@ -4,14 +4,70 @@
 #include "mbed.h"
 #include "si7021.h"
 
+namespace reg = si7021_reg;                                 // Register map
+
 // CONSTRUCTOR -------------------------------------------------------------------------------------------------------------
-Si7021::Si7021(I2C& i2c_bus) : _i2c(i2c_bus) {}
+Si7021::Si7021(I2CScheduler& i2c_bus) : _device(i2c_bus), _resolution(SI7021_RES_RH12_T14) {}
 
 // FUNCTION TO READ 16-BIT DATA FROM SENSOR Si7021 =========================================================================
 uint16_t Si7021::read_register_si7021(char command) {
-    char data[2];                                           // Data buffer of 16-bit size
-    _i2c.write(SI7021_ADDR, &command, 1);                    // Send command to start measurement
-    _i2c.read(SI7021_ADDR, data, 2);                         // Read the data after waiting
+    uint16_t value = 0;
+    if (!_device.command(command) || !read_checked(&value)) {   // Send command to start measurement, then read the data after waiting
+        return 0;                                           // 0 is the value if the reading is not successful
+    }
+    return value;
+}
+
+// FUNCTIONS FOR THE NO HOLD MASTER MEASUREMENTS ===========================================================================
+bool Si7021::start_measurement() {
+    return _device.command(reg::RH_NO_HOLD::address);       // The RH conversion measures the temperature too
+}
+
+bool Si7021::read_measurement(uint16_t *humidity, uint16_t *temperature) {
+    if (!read_checked(humidity)) {                          // NACK: still converting, the bus is free in the meantime
+        return false;
+    }
+
+    return _device.read<reg::TEMP_FROM_RH>(temperature);    // No second conversion, and no CRC for this one
+}
+
+// FUNCTIONS FOR THE RESOLUTION ============================================================================================
+bool Si7021::set_resolution(si7021_resolution_t resolution) {
+    if (!_device.update<reg::USER_REG1>(reg::USER_REG1_RES1::mask | reg::USER_REG1_RES0::mask, resolution)) {   // Keep the heater and reserved bits
+        return false;
+    }
+    _resolution = resolution;
+    return true;
+}
+
+std::chrono::milliseconds Si7021::conversion_time() const {
+    switch (_resolution) {
+        case SI7021_RES_RH8_T12:  return 7ms;              // 3.1 + 3.8
+        case SI7021_RES_RH10_T13: return 11ms;             // 4.5 + 6.2
+        case SI7021_RES_RH11_T11: return 10ms;             // 7 + 2.4
+        default:                  return 23ms;             // 12 + 10.8
+    }
+}
+
+// PRIVATE FUNCTIONS =======================================================================================================
+bool Si7021::read_checked(uint16_t *value) {
+    char data[3];
+
+    if (!_device.receive(data, 3, 0) || crc8(data, 2) != (uint8_t)data[2]) {     // No retry: a NACK is the conversion still running
+        return false;
+    }
+    *value = reg::RH_NO_HOLD::decode(data);
+    return true;
+}
+
+uint8_t Si7021::crc8(const char *data, uint8_t length) {
+    uint8_t crc = 0x00;
 
-    return (data[0] << 8) | data[1];                        // Combine the two bytes (0 is the value if the reading is not successful)
-}
\ No newline at end of file
+    for (uint8_t i = 0; i < length; i++) {
+        crc ^= (uint8_t)data[i];
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x80) ? (crc << 1) ^ SI7021_CRC_POLYNOMIAL : crc << 1;
+        }
+    }
+    return crc;
+}
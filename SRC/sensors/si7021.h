@@ -2,15 +2,38 @@
 
 // LIBRARIES ------------------------------------------------------------------------------------
 #include "mbed.h"
+#include "regmap.h"
 
 // LIBRARY GUARD --------------------------------------------------------------------------------
 #ifndef SI7021_H
 #define SI7021_H
 
 // Si7021 MACROS --------------------------------------------------------------------------------
-#define SI7021_ADDR 0x40 << 1                               // Si7021 I2C Address: 7-bit I2C address SHIFTED BY 1 BIT
-#define CMD_MEASURE_HUMIDITY 0xE5                           // Si7021 Command: Measure Relative Humidity, Hold Master Mode
-#define CMD_MEASURE_TEMP 0xE3                               // Si7021 Command: Measure Temperature, Hold Master Mode
+#define SI7021_ADDR (0x40 << 1)                             // Si7021 I2C Address: 7-bit I2C address SHIFTED BY 1 BIT
+#define SI7021_CRC_POLYNOMIAL 0x31                          // x^8 + x^5 + x^4 + 1, initialised to 0
+#define SI7021_POLL_PERIOD 2ms                              // The sensor NACKs its address until the conversion is done
+
+// Si7021 REGISTERS ----------------------------------------------------------------------------
+// The Si7021 has commands rather than registers: the measurements are 16-bit big-endian results
+// of their command, the user register is read and written with two different commands
+namespace si7021_reg {
+typedef Register<0xE5, 2, REG_READ_ONLY> RH_HOLD;           // Measure Relative Humidity, Hold Master Mode
+typedef Register<0xE3, 2, REG_READ_ONLY> TEMP_HOLD;         // Measure Temperature, Hold Master Mode
+typedef Register<0xF5, 2, REG_READ_ONLY> RH_NO_HOLD;        // Measure Relative Humidity (and Temperature), No Hold Master Mode
+typedef Register<0xF3, 2, REG_READ_ONLY> TEMP_NO_HOLD;      // Measure Temperature, No Hold Master Mode
+typedef Register<0xE0, 2, REG_READ_ONLY> TEMP_FROM_RH;      // Temperature measured for the previous RH measurement, no CRC
+typedef Register<0xE7, 1, REG_READ_WRITE, REG_BIG_ENDIAN, 0xE6> USER_REG1;   // RH/T User Register 1, written with 0xE6
+typedef Field<USER_REG1, 7> USER_REG1_RES1;                 // Resolution, split over bits 7 and 0
+typedef Field<USER_REG1, 0> USER_REG1_RES0;
+}
+
+// Si7021 TYPES ---------------------------------------------------------------------------------
+typedef enum {
+    SI7021_RES_RH12_T14 = 0x00,                             // Reset default, RH + T conversion 23 ms
+    SI7021_RES_RH8_T12  = 0x01,                             // 7 ms
+    SI7021_RES_RH10_T13 = 0x80,                             // 11 ms
+    SI7021_RES_RH11_T11 = 0x81                              // 10 ms
+} si7021_resolution_t;                                      // User register 1 RES bits
 
 // ==============================================================================================
 // Si7021 CLASS
@@ -18,14 +41,23 @@
 class Si7021 {
 public:
     // Constructor ------------------------------------------------------------------------------
-    Si7021(I2C& i2c_bus);
+    Si7021(I2CScheduler& i2c_bus);
 
     // Public functions -------------------------------------------------------------------------
-    uint16_t read_register_si7021(char command);            // Function to read a 16-bit register
+    uint16_t read_register_si7021(char command);            // Function to read a 16-bit register, 0 if the reading or its CRC failed
+    bool start_measurement();                               // Starts an RH + T conversion and releases the bus
+    bool read_measurement(uint16_t *humidity, uint16_t *temperature);  // False while the conversion is still running or on a CRC error
+    bool set_resolution(si7021_resolution_t resolution);
+    std::chrono::milliseconds conversion_time() const;      // RH + T at the current resolution, maximum from the datasheet
 
 private:
+    // Private functions ------------------------------------------------------------------------
+    bool read_checked(uint16_t *value);                     // MSB, LSB and CRC of a measurement
+    static uint8_t crc8(const char *data, uint8_t length);
+
     // Reference to the I2C bus -----------------------------------------------------------------
-    I2C& _i2c;
+    RegisterDevice<SI7021_ADDR> _device;
+    si7021_resolution_t _resolution;
 };
 // Si7021 CLASS END =============================================================================
 
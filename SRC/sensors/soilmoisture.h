@@ -1,13 +0,0 @@
-/* File for the soil moisture function declarations and macros */
-
-// LIBRARIES ------------------------------------------------------------------------------------
-#include "mbed.h"
-
-// LIBRARY GUARD --------------------------------------------------------------------------------
-#ifndef SOILMOISTURE_H
-#define SOILMOISTURE_H
-
-// MOISTURE MACROS -------------------------------------------------------------------------------
-#define MOISTURE_PIN PA_0
-
-#endif
\ No newline at end of file
@@ -4,31 +4,241 @@
 #include "mbed.h"
 #include "tcs34725.h"
 
-// CONSTRUCTORS ---------------------------------------------------------------------------------------------------------
-TCS34725::TCS34725(I2C& i2c_bus) : _i2c(i2c_bus) {}                                                            // I2C communication
+namespace reg = tcs34725_reg;                                               // Register map
+
+// AUTORANGE TABLE ---------------------------------------------------------------------------------------------------------
+// Ordered by sensitivity (gain x cycles). The gain goes up first: for the same counts the
+// shortest integration keeps the LED on and the bus busy for the least time
+typedef struct {
+    uint8_t again;
+    uint8_t atime;
+} tcs34725_range_t;
 
-// FUNCTION TO WRITE TO A REGISTER ==============================================================
-void TCS34725::write_register(uint8_t reg, uint8_t value){
-    char data[2] = {static_cast<char>(TCS34725_COMMAND_BIT | reg), static_cast<char>(value)};  // Command to write to the specific register, which is achieved by combining bit by bit TCS34725_COMMAND_BIT and 'reg' using the bitwise OR (|) operator
-    _i2c.write(TCS34725_ADDRESS, data, 2);
+static const tcs34725_range_t RANGES[] = {
+    {0x00, 0xFC},                                                           // 1x, 9.6ms
+    {0x01, 0xFC},                                                           // 4x, 9.6ms
+    {0x02, 0xFC},                                                           // 16x, 9.6ms
+    {0x03, 0xFC},                                                           // 60x, 9.6ms
+    {0x03, 0xF6},                                                           // 60x, 24ms
+    {0x03, 0xD6},                                                           // 60x, 100.8ms, dark
+};
+static const uint8_t RANGE_COUNT = sizeof(RANGES) / sizeof(RANGES[0]);
+static const uint8_t GAINS[] = {1, 4, 16, 60};                              // Indexed by AGAIN
+
+static uint32_t full_scale(uint8_t atime){                                  // 1024 counts per cycle, up to the 16-bit register
+    uint32_t cycles = 256 - atime;
+    return (cycles * 1024 < 65535) ? cycles * 1024 : 65535;
 }
 
+// CONSTRUCTORS ---------------------------------------------------------------------------------------------------------
+TCS34725::TCS34725(I2CScheduler& i2c_bus) : _device(i2c_bus), _atime(TCS34725_DEFAULT_ATIME),
+                                            _again(TCS34725_DEFAULT_AGAIN), _range(TCS34725_AUTORANGE_FIRST), _autorange(false),
+                                            _powered(false), _autonomous(false), _auto_again(0), _auto_atime(0) {}                        // I2C communication
+
 // FUNCTION TO INITIALIZE THE TCS34725 ==========================================================
 void TCS34725::tcs34725_init(){
-    write_register(TCS34725_ENABLE, TCS34725_ATIME);                        // Power on the device
+    _device.write<reg::ENABLE_REG>(reg::ENABLE_PON::mask);                  // Power on the device
     ThisThread::sleep_for(3ms);                                             // Wait 3ms for power ON
 
-    write_register(TCS34725_ENABLE, TCS34725_ATIME | TCS34725_ENABLE_AEN);  // Enable the RGBC ADC
+    _device.write<reg::ENABLE_REG>(reg::ENABLE_PON::mask | reg::ENABLE_AEN::mask);   // Enable the RGBC ADC
+
+    _device.write<reg::ATIME>(_atime);                                      // Integration time: 24ms (for good accuracy) - 2.4 x (256 - ATIME), where 0xF6 is 246
+    _device.write<reg::CONTROL>(reg::CONTROL_AGAIN::of(_again));            // Gain control: 4x - BOTH INTEGRATION TIME AND GAIN ARE SET FOR BRIGHT AMBIENT LIGHT CONDITIONS, unless autoranging
+
+    _device.write<reg::ENABLE_REG>(0x00);                                   // Sleep (about 2.5 uA) until the first measurement
+    _powered = false;
+}
+
+// FUNCTION TO READ THE FOUR CHANNELS AT ONCE ===================================================
+bool TCS34725::read_all(tcs34725_rgbc_t *rgbc){
+    char data[reg::RGBC::length];
+
+    if(!_device.read_range<reg::RGBC>(data)){                               // Reading CDATAL latches the other data registers until BDATAH
+        return false;
+    }
+    rgbc->clear = reg::RGBC::get<reg::CDATA>(data);
+    rgbc->red   = reg::RGBC::get<reg::RDATA>(data);
+    rgbc->green = reg::RGBC::get<reg::GDATA>(data);
+    rgbc->blue  = reg::RGBC::get<reg::BDATA>(data);
+    return true;
+}
+
+// FUNCTIONS TO MEASURE WITHOUT A FIXED DELAY ===================================================
+void TCS34725::start_measurement(){
+    if(!_powered){
+        _device.write<reg::ENABLE_REG>(reg::ENABLE_PON::mask);
+        ThisThread::sleep_for(3ms);                                         // Oscillator warm-up (2.4ms) before AEN
+        _powered = true;
+    }
+    _device.write<reg::ENABLE_REG>(reg::ENABLE_PON::mask);                  // Dropping AEN aborts the current cycle and clears AVALID, AIEN/WEN pause autonomous sampling
+    _device.write<reg::ATIME>(_atime);                                      // The autonomous range may be loaded
+    _device.write<reg::CONTROL>(reg::CONTROL_AGAIN::of(_again));
+    _device.write<reg::ENABLE_REG>(reg::ENABLE_PON::mask | reg::ENABLE_AEN::mask);
+    _started = Kernel::Clock::now();
+}
+
+bool TCS34725::measurement_ready(){
+    uint8_t status = 0;
+
+    if(!_device.read<reg::STATUS>(&status)){
+        return false;
+    }
+    return reg::STATUS_AVALID::get(status) != 0;
+}
+
+bool TCS34725::wait_measurement(){
+    std::chrono::microseconds cycle = integration_time();
+    Kernel::Clock::time_point deadline = _started + std::chrono::duration_cast<Kernel::Clock::duration>(cycle + cycle / 2);
+
+    ThisThread::sleep_until(_started + std::chrono::duration_cast<Kernel::Clock::duration>(cycle));  // Nothing to poll before that
+    while(!measurement_ready()){
+        if(Kernel::Clock::now() >= deadline){
+            return false;
+        }
+        ThisThread::sleep_for(TCS34725_POLL_PERIOD);
+    }
+    return true;
+}
+
+void TCS34725::finish_measurement(){
+    if(_autonomous){
+        resume_autonomous();
+    } else {
+        _device.write<reg::ENABLE_REG>(0x00);                               // PON = 0 until the next on-demand read
+        _powered = false;
+    }
+}
+
+std::chrono::microseconds TCS34725::integration_time() const {
+    return std::chrono::microseconds(TCS34725_INIT_TIME_US + TCS34725_CYCLE_US * (256 - _atime));
+}
+
+// FUNCTIONS FOR THE AUTOMATIC GAIN AND INTEGRATION TIME ========================================
+bool TCS34725::read_normalised(tcs34725_light_t *light){
+    tcs34725_rgbc_t rgbc;
+    uint32_t cycles = 256 - _atime;
+    uint64_t divider = (uint64_t)GAINS[_again & 0x03] * cycles * TCS34725_CYCLE_US;   // gain x us
+
+    if(!read_all(&rgbc)){
+        return false;
+    }
+
+    light->clear = (uint32_t)(((uint64_t)rgbc.clear << 8) * 1000 / divider);
+    light->red   = (uint32_t)(((uint64_t)rgbc.red << 8) * 1000 / divider);
+    light->green = (uint32_t)(((uint64_t)rgbc.green << 8) * 1000 / divider);
+    light->blue  = (uint32_t)(((uint64_t)rgbc.blue << 8) * 1000 / divider);
+    light->gain = GAINS[_again & 0x03];
+    light->atime = _atime;
+    light->saturated = rgbc.clear >= full_scale(_atime);
+
+    if(_autorange){
+        set_range(select_range(rgbc.clear));
+    }
+    return true;
+}
+
+void TCS34725::set_autorange(bool enable){
+    _autorange = enable;
+    if(enable){
+        set_range(_range);
+    }
+}
+
+void TCS34725::set_range(uint8_t index){
+    if(index >= RANGE_COUNT){
+        index = RANGE_COUNT - 1;
+    }
+    _range = index;
+    _atime = RANGES[index].atime;                                           // Written by start_measurement()
+    _again = RANGES[index].again;
+}
+
+uint8_t TCS34725::range() const {
+    return _range;
+}
+
+// The light level is the clear count of the current range divided by its sensitivity. Pick the
+// first (shortest) range that reaches the minimum counts, or the one below if it would saturate
+uint8_t TCS34725::select_range(uint16_t clear) const {
+    uint32_t sensitivity = GAINS[RANGES[_range].again] * (256 - RANGES[_range].atime);
+
+    if(clear >= full_scale(RANGES[_range].atime)){                          // Saturated, the real level is unknown: step down
+        return (_range > 0) ? _range - 1 : 0;
+    }
+    if(clear == 0){
+        return RANGE_COUNT - 1;
+    }
+
+    for(uint8_t i = 0; i < RANGE_COUNT; i++){
+        uint64_t predicted = (uint64_t)clear * GAINS[RANGES[i].again] * (256 - RANGES[i].atime) / sensitivity;
+
+        if(predicted >= TCS34725_AUTORANGE_MIN_COUNTS){
+            if(predicted > full_scale(RANGES[i].atime) * TCS34725_AUTORANGE_MAX_PERCENT / 100 && i > 0){
+                return i - 1;                                               // Fewer counts than wanted, but not saturated
+            }
+            return i;
+        }
+    }
+    return RANGE_COUNT - 1;
+}
+
+// FUNCTIONS FOR THE AUTONOMOUS SAMPLING ========================================================
+// One integration every WTIME: with WLONG and WTIME = 0 that is one every 7.4 s at about 65 uA
+// in between. PERS (0 to 15) filters single out of band cycles: 0 every cycle, 1-3 that many,
+// then 5, 10, 15 ... 60
+void TCS34725::start_autonomous(uint8_t again, uint8_t atime, uint8_t wtime, bool wlong, uint8_t persistence){
+    _auto_again = again & 0x03;
+    _auto_atime = atime;
+    _autonomous = true;
+
+    if(!_powered){
+        _device.write<reg::ENABLE_REG>(reg::ENABLE_PON::mask);
+        ThisThread::sleep_for(3ms);
+        _powered = true;
+    }
+    _device.write<reg::WTIME>(wtime);
+    _device.write<reg::CONFIG>(reg::CONFIG_WLONG::of(wlong));
+    _device.write<reg::PERS>(reg::PERS_APERS::of(persistence));
+    resume_autonomous();
+}
+
+void TCS34725::stop_autonomous(){
+    _autonomous = false;
+    _device.write<reg::ENABLE_REG>(0x00);
+    _powered = false;
+}
+
+bool TCS34725::set_thresholds(uint16_t low, uint16_t high){
+    char data[reg::THRESHOLDS::length];
+
+    reg::THRESHOLDS::put<reg::AILT>(low, data);
+    reg::THRESHOLDS::put<reg::AIHT>(high, data);
+    return _device.write_range<reg::THRESHOLDS>(data);                     // AILTL, AILTH, AIHTL, AIHTH in one write
+}
+
+bool TCS34725::interrupt_pending(){
+    uint8_t status = 0;
+
+    if(!_device.read<reg::STATUS>(&status)){
+        return false;
+    }
+    return reg::STATUS_AINT::get(status) != 0;
+}
+
+bool TCS34725::clear_interrupt(){
+    return _device.command(TCS34725_CLEAR_INT);
+}
 
-    write_register(TCS34725_ATIME, 0xF6);                                   // Integration time: 24ms (for good accuracy) - 2.4 x (256 - ATIME), where 0xF6 is 246
-    write_register(TCS34725_AGAIN, 0x01);                                   // Gain control: 4x - BOTH INTEGRATION TIME AND GAIN ARE SET FOR BRIGHT AMBIENT LIGHT CONDITIONS
+bool TCS34725::read_clear(uint16_t *clear){
+    return _device.read<reg::CDATA>(clear);
 }
 
-// FUNCTION TO READ FROM A 16-BIT REGISTER ======================================================
-uint16_t TCS34725::read_channel(uint8_t reg){
-    char data[2];                                                           // Command to be read, 16-bit size
-    char cmd = TCS34725_COMMAND_BIT | reg;                                  // Command to be written (which will be values of the measurements)
-    _i2c.write(TCS34725_ADDRESS, &cmd, 1);                                   // Write the command
-    _i2c.read(TCS34725_ADDRESS, data, 2);                                    // Read two bytes
-    return (data[1] << 8) | data[0];                                        // Combine into 16-bit value
+// Back to the autonomous range after an on-demand read. The interrupt raised by the LED lit
+// cycle (if any) is cleared, the thresholds apply again from the next cycle
+void TCS34725::resume_autonomous(){
+    _device.write<reg::ENABLE_REG>(reg::ENABLE_PON::mask);
+    _device.write<reg::ATIME>(_auto_atime);
+    _device.write<reg::CONTROL>(reg::CONTROL_AGAIN::of(_auto_again));
+    clear_interrupt();
+    _device.write<reg::ENABLE_REG>(reg::ENABLE_PON::mask | reg::ENABLE_AEN::mask | reg::ENABLE_WEN::mask | reg::ENABLE_AIEN::mask);
 }
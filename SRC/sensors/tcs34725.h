@@ -2,23 +2,82 @@
 
 // LIBRARIES ------------------------------------------------------------------------------------
 #include "mbed.h"
+#include "regmap.h"
 
 // LIBRARY GUARD --------------------------------------------------------------------------------
 #ifndef TCS34725_H
-#define TCS34735_H
+#define TCS34725_H
 
 // MACROS ---------------------------------------------------------------------------------------
-#define LED_PIN PH_1                                                        // White LED connected to PA_5 (adjust if necessary)
 #define TCS34725_ADDRESS (0x29 << 1)                                        // 7-bit I2C address shifted
 #define TCS34725_COMMAND_BIT 0x80                                           // Indicate that the following byte will be a command
-#define TCS34725_ENABLE 0x00                                                // Enables states and interrupts
-#define TCS34725_ATIME 0x01                                                 // RGBC time 
-#define TCS34725_ENABLE_AEN 0x02                                            // ADC enable
-#define TCS34725_AGAIN 0x0F                                                 // Gain control
-#define TCS34725_CDATAL 0x14                                                // Clear data low byte
-#define TCS34725_RDATAL 0x16                                                // Red data low byte
-#define TCS34725_GDATAL 0x18                                                // Green data low byte
-#define TCS34725_BDATAL 0x1A                                                // Blue data low byte
+#define TCS34725_COMMAND_AUTO_INC 0x20                                      // Command type: auto-increment the register address on every byte read
+#define TCS34725_CLEAR_INT 0xE6                                             // Special function command: clear the clear channel interrupt
+#define TCS34725_DEFAULT_ATIME 0xF6                                         // 24ms: 2.4ms x (256 - ATIME)
+#define TCS34725_DEFAULT_AGAIN 0x01                                         // 4x
+#define TCS34725_CYCLE_US 2400                                              // One ATIME integration cycle
+#define TCS34725_INIT_TIME_US 2400                                          // Initialisation before the first integration after AEN
+#define TCS34725_POLL_PERIOD 2ms
+#define TCS34725_AUTORANGE_MIN_COUNTS 1000                                  // Clear counts wanted from a reading, about 10 bits of resolution
+#define TCS34725_AUTORANGE_MAX_PERCENT 80                                   // Clear counts allowed, in % of the full scale
+#define TCS34725_AUTORANGE_FIRST 2                                          // Range used before the first reading
+
+// REGISTER MAP ---------------------------------------------------------------------------------
+// Every access starts with a command byte: TCS34725_COMMAND_BIT, the auto-increment type for
+// more than one byte, and the register address
+struct TCS34725Pointer {
+    static constexpr char read(uint8_t address, bool burst){
+        return (char)(TCS34725_COMMAND_BIT | (burst ? TCS34725_COMMAND_AUTO_INC : 0) | address);
+    }
+    static constexpr char write(uint8_t address, bool burst){
+        return read(address, burst);
+    }
+};
+
+namespace tcs34725_reg {
+typedef Register<0x00> ENABLE_REG;                                          // ENABLE, enables states and interrupts (ENABLE is taken by the STM32 HAL)
+typedef Field<ENABLE_REG, 0> ENABLE_PON;                                    // Power on (internal oscillator)
+typedef Field<ENABLE_REG, 1> ENABLE_AEN;                                    // ADC enable
+typedef Field<ENABLE_REG, 3> ENABLE_WEN;                                    // Wait state between integration cycles
+typedef Field<ENABLE_REG, 4> ENABLE_AIEN;                                   // Clear channel threshold interrupt
+typedef Register<0x01> ATIME;                                               // RGBC time: 2.4ms x (256 - ATIME)
+typedef Register<0x03> WTIME;                                               // Wait time: 2.4ms x (256 - WTIME), x12 with CONFIG.WLONG
+typedef Register<0x04, 2, REG_READ_WRITE, REG_LITTLE_ENDIAN> AILT;          // Clear channel low threshold
+typedef Register<0x06, 2, REG_READ_WRITE, REG_LITTLE_ENDIAN> AIHT;          // Clear channel high threshold
+typedef RegisterRange<AILT, AIHT> THRESHOLDS;
+typedef Register<0x0C> PERS;                                                // Consecutive out of band cycles before the interrupt
+typedef Field<PERS, 0, 4> PERS_APERS;
+typedef Register<0x0D> CONFIG;
+typedef Field<CONFIG, 1> CONFIG_WLONG;
+typedef Register<0x0F> CONTROL;                                             // Gain control
+typedef Field<CONTROL, 0, 2> CONTROL_AGAIN;                                 // 1x, 4x, 16x, 60x
+typedef Register<0x13, 1, REG_READ_ONLY> STATUS;                            // Device status
+typedef Field<STATUS, 0> STATUS_AVALID;                                     // An integration cycle completed since AEN was set
+typedef Field<STATUS, 4> STATUS_AINT;                                       // Clear channel interrupt
+typedef Register<0x14, 2, REG_READ_ONLY, REG_LITTLE_ENDIAN> CDATA;          // Clear data, reading the low byte latches the other channels
+typedef Register<0x16, 2, REG_READ_ONLY, REG_LITTLE_ENDIAN> RDATA;
+typedef Register<0x18, 2, REG_READ_ONLY, REG_LITTLE_ENDIAN> GDATA;
+typedef Register<0x1A, 2, REG_READ_ONLY, REG_LITTLE_ENDIAN> BDATA;
+typedef RegisterRange<CDATA, BDATA> RGBC;                                   // The four channels of the same cycle
+}
+
+// TYPES ----------------------------------------------------------------------------------------
+typedef struct {
+    uint16_t clear;
+    uint16_t red;
+    uint16_t green;
+    uint16_t blue;
+} tcs34725_rgbc_t;
+
+typedef struct {
+    uint32_t clear;                                                         // Counts per ms per gain, Q8 (x 256)
+    uint32_t red;
+    uint32_t green;
+    uint32_t blue;
+    uint8_t gain;                                                           // Range the reading was taken with
+    uint8_t atime;
+    bool saturated;                                                         // Clear channel at the full scale, the values are a lower bound
+} tcs34725_light_t;
 
 // ==============================================================================================
 // TCS34725 CLASS
@@ -26,19 +85,59 @@
 class TCS34725 {
 public:
     // Constructor ------------------------------------------------------------------------------
-    TCS34725(I2C& i2c_bus);
+    TCS34725(I2CScheduler& i2c_bus);
 
     // Public functions -------------------------------------------------------------------------
     void tcs34725_init();                                          // Function to initialize the accelerometer
-    uint16_t read_channel(uint8_t reg);                              // Function to read a 14-bit axis value (X, Y, Z)
+    template <typename CHANNEL> uint16_t read_channel();             // One channel (tcs34725_reg::CDATA ... BDATA), 0 if the read failed
+    bool read_all(tcs34725_rgbc_t *rgbc);                            // The four channels of the same integration cycle, in one transaction
+    void start_measurement();                                        // Restarts the RGBC cycle, returns straight away
+    bool measurement_ready();                                        // STATUS.AVALID
+    bool wait_measurement();                                         // Polls AVALID until the integration time plus 50%, false on timeout
+    void finish_measurement();                                       // Powers down, or goes back to autonomous sampling
+    std::chrono::microseconds integration_time() const;
+    bool read_normalised(tcs34725_light_t *light);                   // read_all() scaled by the gain and integration time, then autoranges
+    void set_autorange(bool enable);
+    void set_range(uint8_t index);                                   // Entry of the autorange table, applied from the next start_measurement()
+    uint8_t range() const;
+
+    void start_autonomous(uint8_t again, uint8_t atime, uint8_t wtime, bool wlong, uint8_t persistence);  // Samples on its own, interrupts on the thresholds
+    void stop_autonomous();                                          // Powers down
+    bool set_thresholds(uint16_t low, uint16_t high);                // Clear counts at the autonomous gain and ATIME, interrupt outside [low, high]
+    bool interrupt_pending();                                        // STATUS.AINT
+    bool clear_interrupt();
+    bool read_clear(uint16_t *clear);                                // Last autonomous cycle
 
 private:
     // Private functions ------------------------------------------------------------------------
-    void write_register(uint8_t reg, uint8_t value);
+    uint8_t select_range(uint16_t clear) const;
+    void resume_autonomous();
+
+    // Registers on the I2C bus -----------------------------------------------------------------
+    RegisterDevice<TCS34725_ADDRESS, TCS34725Pointer> _device;
+
+    // Measurement state ------------------------------------------------------------------------
+    uint8_t _atime;
+    uint8_t _again;
+    uint8_t _range;
+    bool _autorange;
+    bool _powered;                                                  // PON set
 
-    // Reference to the I2C bus -----------------------------------------------------------------
-    I2C& _i2c;
+    // Autonomous sampling ----------------------------------------------------------------------
+    bool _autonomous;
+    uint8_t _auto_again;
+    uint8_t _auto_atime;
+    Kernel::Clock::time_point _started;
 };
+
+// TEMPLATE FUNCTIONS ---------------------------------------------------------------------------
+template <typename CHANNEL>
+uint16_t TCS34725::read_channel(){
+    uint16_t value = 0;
+
+    _device.read<CHANNEL>(&value);                                  // Auto-increment: low and high byte of the same cycle
+    return value;
+}
 // TCS34725 CLASS END ===========================================================================
 
 
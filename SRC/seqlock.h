@@ -0,0 +1,61 @@
+/* File for the sequence lock template used to share data between threads without blocking the writer */
+
+// LIBRARIES ------------------------------------------------------------------------------------
+#include "mbed.h"
+
+// LIBRARY GUARD --------------------------------------------------------------------------------
+#ifndef SEQLOCK_H
+#define SEQLOCK_H
+
+// ==============================================================================================
+// SEQLOCK CLASS
+// ==============================================================================================
+// One writer publishes a whole T, any number of readers copy it. The writer never waits: it
+// makes the sequence odd, copies the value and makes it even again. A reader retries until it
+// has copied the value between two equal, even sequence numbers, so it can never see half of
+// an update. Readers must not run in ISR context nor at a higher priority than the writer.
+template <typename T>
+class SeqLock {
+public:
+    // Constructor ------------------------------------------------------------------------------
+    SeqLock() : _sequence(0), _value() {}
+
+    // Public functions -------------------------------------------------------------------------
+    void write(const T &value){                                   // Single writer only
+        uint32_t sequence = _sequence;
+
+        core_util_atomic_store_u32(&_sequence, sequence + 1);     // Odd: update in progress
+        _value = value;
+        core_util_atomic_store_u32(&_sequence, sequence + 2);     // Even: update done
+    }
+
+    uint32_t read(T &value) const {                               // Returns the sequence of the copy, 0 if nothing was ever written
+        uint32_t before, after;
+
+        while (true) {
+            before = core_util_atomic_load_u32(&_sequence);
+            if (before & 1) {                                     // The writer is in the middle of an update, let it finish
+                ThisThread::yield();
+                continue;
+            }
+
+            value = _value;
+
+            after = core_util_atomic_load_u32(&_sequence);
+            if (after == before) {
+                return before;
+            }
+        }
+    }
+
+    uint32_t sequence() const {                                   // Changes every time a new value is published
+        return core_util_atomic_load_u32(&_sequence);
+    }
+
+private:
+    volatile uint32_t _sequence;
+    T _value;
+};
+// SEQLOCK CLASS END ============================================================================
+
+#endif
@@ -0,0 +1,206 @@
+/* File for the vibration spectrum (fixed-point FFT) class definitions */
+
+// LIBRARIES ---------------------------------------------------------------------------
+#include "spectrum.h"
+#include <string.h>
+
+// TWIDDLES ----------------------------------------------------------------------------
+// First quarter of sin(2 pi i / SPECTRUM_MAX_POINTS) in Q15, the rest comes from symmetry
+static const int16_t SIN_QUARTER[SPECTRUM_MAX_POINTS / 4 + 1] = {
+        0,   804,  1608,  2410,  3212,  4011,  4808,  5602,
+     6393,  7179,  7962,  8739,  9512, 10278, 11039, 11793,
+    12539, 13279, 14010, 14732, 15446, 16151, 16846, 17530,
+    18204, 18868, 19519, 20159, 20787, 21403, 22005, 22594,
+    23170, 23731, 24279, 24811, 25329, 25832, 26319, 26790,
+    27245, 27683, 28105, 28510, 28898, 29268, 29621, 29956,
+    30273, 30571, 30852, 31113, 31356, 31580, 31785, 31971,
+    32137, 32285, 32412, 32521, 32609, 32678, 32728, 32757,
+    32767,
+};
+
+// CONSTRUCTOR -------------------------------------------------------------------------
+Spectrum::Spectrum() : _shift(0) {
+    memset(_re, 0, sizeof(_re));
+    memset(_im, 0, sizeof(_im));
+    memset(_magnitude, 0, sizeof(_magnitude));
+}
+
+// =====================================================================================
+// PUBLIC FUNCTIONS
+// =====================================================================================
+uint8_t Spectrum::analyse(const int16_t *samples, uint16_t points, spectrum_peak_t *peaks, uint8_t max_peaks){
+    uint8_t found = 0;
+
+    if (points < SPECTRUM_MIN_POINTS || points > SPECTRUM_MAX_POINTS || (points & (points - 1)) != 0) {
+        return 0;
+    }
+
+    load(samples, points);
+    fft_complex(points / 2);
+    split_real(points);
+
+    // Keep the strongest local maxima, sorted by insertion (max_peaks is a handful)
+    for (uint16_t k = 1; k < points / 2; k++) {
+        uint16_t magnitude = _magnitude[k];
+
+        if (magnitude == 0 || magnitude < _magnitude[k - 1] || magnitude <= _magnitude[k + 1]) {
+            continue;
+        }
+
+        uint8_t i = (found < max_peaks) ? found++ : max_peaks;
+        while (i > 0 && peaks[i - 1].amplitude < magnitude) {
+            if (i < max_peaks) {
+                peaks[i] = peaks[i - 1];
+            }
+            i--;
+        }
+        if (i < max_peaks) {
+            peaks[i].bin = (uint8_t)k;
+            peaks[i].amplitude = magnitude;
+        }
+    }
+    return found;
+}
+
+const uint16_t *Spectrum::magnitudes() const {
+    return _magnitude;
+}
+// PUBLIC FUNCTIONS END ================================================================
+
+// =====================================================================================
+// PRIVATE FUNCTIONS
+// =====================================================================================
+// Remove the mean, apply the Hann window and scale the block up to SPECTRUM_HEADROOM, then
+// pack even samples as real and odd samples as imaginary parts in bit-reversed order
+void Spectrum::load(const int16_t *samples, uint16_t points){
+    int32_t sum = 0;
+    int32_t largest = 0;
+    uint16_t half = points / 2;
+    uint8_t bits = 0;
+
+    for (uint16_t n = 0; n < points; n++) {
+        sum += samples[n];
+    }
+    int32_t mean = sum / points;
+
+    for (uint16_t n = 0; n < points; n++) {
+        int32_t value = samples[n] - mean;
+        if (value < 0) {
+            value = -value;
+        }
+        largest = (value > largest) ? value : largest;
+    }
+
+    _shift = 0;
+    while (largest != 0 && (largest << (_shift + 1)) <= SPECTRUM_HEADROOM) {
+        _shift++;
+    }
+
+    while ((1U << bits) < half) {
+        bits++;
+    }
+
+    for (uint16_t n = 0; n < points; n++) {
+        uint16_t index = (uint16_t)(n * (SPECTRUM_MAX_POINTS / points));
+        int32_t window = (32768 - cos_q15(index)) >> 1;           // Hann: (1 - cos(2 pi n / N)) / 2 in Q15
+        int32_t value = ((samples[n] - mean) * (1 << _shift) * window) >> 15;
+        uint16_t pair = n >> 1;
+        uint16_t reversed = 0;
+
+        for (uint8_t b = 0; b < bits; b++) {
+            reversed |= ((pair >> b) & 1) << (bits - 1 - b);
+        }
+
+        if (n & 1) {
+            _im[reversed] = (int16_t)value;
+        } else {
+            _re[reversed] = (int16_t)value;
+        }
+    }
+}
+
+// In-place radix-2 decimation in time on bit-reversed input, every stage scaled by 1/2
+void Spectrum::fft_complex(uint16_t points){
+    for (uint16_t length = 2; length <= points; length <<= 1) {
+        uint16_t half = length / 2;
+        uint16_t step = SPECTRUM_MAX_POINTS / length;
+
+        for (uint16_t start = 0; start < points; start += length) {
+            for (uint16_t j = 0; j < half; j++) {
+                int32_t c = cos_q15(j * step);                        // W = cos - i sin
+                int32_t s = sin_q15(j * step);
+                uint16_t a = start + j;
+                uint16_t b = a + half;
+                int32_t tr = (_re[b] * c + _im[b] * s) >> 15;
+                int32_t ti = (_im[b] * c - _re[b] * s) >> 15;
+
+                _re[b] = (int16_t)((_re[a] - tr) >> 1);
+                _im[b] = (int16_t)((_im[a] - ti) >> 1);
+                _re[a] = (int16_t)((_re[a] + tr) >> 1);
+                _im[a] = (int16_t)((_im[a] + ti) >> 1);
+            }
+        }
+    }
+}
+
+// X[k] = E[k] + W^k O[k], with E and O the spectra of the even and odd samples recovered from
+// Z[k] and conj(Z[N/2 - k]). The result is X[k] / N, for a sinusoid of amplitude A that is
+// A / 4 (one-sided spectrum and Hann window gain), turned back into input counts here
+void Spectrum::split_real(uint16_t points){
+    uint16_t half = points / 2;
+
+    for (uint16_t k = 0; k <= half; k++) {
+        uint16_t a = (k == half) ? 0 : k;
+        uint16_t b = (k == 0) ? 0 : half - k;
+        int32_t even_re = (_re[a] + _re[b]) >> 1;
+        int32_t even_im = (_im[a] - _im[b]) >> 1;
+        int32_t odd_re = (_im[a] + _im[b]) >> 1;
+        int32_t odd_im = (_re[b] - _re[a]) >> 1;
+        uint16_t index = (uint16_t)(k * (SPECTRUM_MAX_POINTS / points));
+        int32_t c = cos_q15(index);
+        int32_t s = sin_q15(index);
+        int32_t re = (even_re + ((odd_re * c + odd_im * s) >> 15)) >> 1;
+        int32_t im = (even_im + ((odd_im * c - odd_re * s) >> 15)) >> 1;
+        uint32_t magnitude = isqrt((uint32_t)(re * re) + (uint32_t)(im * im));
+
+        magnitude = (magnitude << 2) >> _shift;                        // Undo the block scaling too
+        _magnitude[k] = (magnitude > UINT16_MAX) ? UINT16_MAX : (uint16_t)magnitude;
+    }
+}
+
+int16_t Spectrum::sin_q15(uint16_t index){
+    index %= SPECTRUM_MAX_POINTS;
+
+    if (index <= SPECTRUM_MAX_POINTS / 4) {
+        return SIN_QUARTER[index];
+    } else if (index <= SPECTRUM_MAX_POINTS / 2) {
+        return SIN_QUARTER[SPECTRUM_MAX_POINTS / 2 - index];
+    } else if (index <= 3 * SPECTRUM_MAX_POINTS / 4) {
+        return -SIN_QUARTER[index - SPECTRUM_MAX_POINTS / 2];
+    }
+    return -SIN_QUARTER[SPECTRUM_MAX_POINTS - index];
+}
+
+int16_t Spectrum::cos_q15(uint16_t index){
+    return sin_q15(index + SPECTRUM_MAX_POINTS / 4);
+}
+
+uint32_t Spectrum::isqrt(uint32_t value){
+    uint32_t root = 0;
+    uint32_t bit = 1UL << 30;
+
+    while (bit > value) {
+        bit >>= 2;
+    }
+    while (bit != 0) {
+        if (value >= root + bit) {
+            value -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return root;
+}
+// PRIVATE FUNCTIONS END ===============================================================
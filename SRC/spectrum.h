@@ -0,0 +1,61 @@
+/* File for the vibration spectrum (fixed-point FFT) class declarations and macros */
+
+// LIBRARIES ------------------------------------------------------------------------------------
+#include <stdint.h>
+
+// LIBRARY GUARD --------------------------------------------------------------------------------
+#ifndef SPECTRUM_H
+#define SPECTRUM_H
+
+// ==============================================================================================
+// MACROS
+// ==============================================================================================
+#define SPECTRUM_MAX_POINTS  256              // Largest capture, also the size of the twiddle circle
+#define SPECTRUM_MIN_POINTS  16
+#define SPECTRUM_HEADROOM    16383            // Largest input after scaling, so no butterfly can overflow
+// MACROS END ===================================================================================
+
+// ==============================================================================================
+// TYPES
+// ==============================================================================================
+typedef struct {
+    uint8_t bin;                              // Frequency = bin * ODR / points
+    uint16_t amplitude;                       // Sinusoid amplitude in input counts
+} spectrum_peak_t;
+// TYPES END ====================================================================================
+
+// ==============================================================================================
+// SPECTRUM CLASS
+// ==============================================================================================
+// Real-input FFT in Q15: the N real samples are packed as N/2 complex ones, transformed by a
+// radix-2 kernel scaled by 1/2 at every stage and split back into the N/2 + 1 bins of the real
+// spectrum. The mean is removed, a Hann window applied and the block is scaled up to use the
+// whole 16-bit range before the transform (block floating point), so small vibrations keep
+// their resolution. No float and no platform dependency: it runs the same on the host.
+class Spectrum {
+public:
+    // Constructor ------------------------------------------------------------------------------
+    Spectrum();
+
+    // Public functions -------------------------------------------------------------------------
+    uint8_t analyse(const int16_t *samples, uint16_t points, spectrum_peak_t *peaks, uint8_t max_peaks);  // Strongest local maxima (DC excluded), strongest first. points must be a power of 2
+    const uint16_t *magnitudes() const;                           // Amplitude of every bin 0..points/2 of the last analysis
+
+private:
+    // Private functions ------------------------------------------------------------------------
+    void load(const int16_t *samples, uint16_t points);
+    void fft_complex(uint16_t points);
+    void split_real(uint16_t points);
+    static int16_t sin_q15(uint16_t index);                       // sin(2 pi index / SPECTRUM_MAX_POINTS)
+    static int16_t cos_q15(uint16_t index);
+    static uint32_t isqrt(uint32_t value);
+
+    // Work buffers -----------------------------------------------------------------------------
+    int16_t _re[SPECTRUM_MAX_POINTS / 2];
+    int16_t _im[SPECTRUM_MAX_POINTS / 2];
+    uint16_t _magnitude[SPECTRUM_MAX_POINTS / 2 + 1];
+    uint8_t _shift;                                               // Block scaling applied to the input
+};
+// SPECTRUM CLASS END ===========================================================================
+
+#endif
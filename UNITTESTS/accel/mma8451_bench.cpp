@@ -0,0 +1,236 @@
+/* Host benchmark of the MMA8451Q bus traffic on the simulated I2C bus: transactions, bytes and
+   bus time for one minute of samples at ACCEL_DATA_RATE, from six single-register reads per
+   sample (before the burst reads) down to the FIFO drained in one burst, with and without F_READ */
+
+// LIBRARIES ---------------------------------------------------------------------------
+#include "mbed.h"
+#include "mma8451.h"
+#include "mma8451_device.h"
+#include "unittest.h"
+
+// MACROS ------------------------------------------------------------------------------
+#define DATA_RATE          MMA8451_ODR_50HZ                           // ACCEL_DATA_RATE of main.cpp
+#define PERIOD_US          20000
+#define SAMPLES            3000                                       // One minute, the uplink period
+#define FIFO_WATERMARK     25                                         // ACCEL_FIFO_WATERMARK
+#define DRAIN_PERIOD_US    500000                                     // ACCEL_DRAIN_PERIOD
+#define BUS_FREQUENCY      100000                                     // mbed::I2C default, main.cpp keeps it
+
+// TYPES -------------------------------------------------------------------------------
+typedef enum {
+    READ_SINGLE_REGISTERS = 0,                                        // Six one-byte transactions per sample
+    READ_AXES,                                                        // read_axis() x 3, MSB and LSB in one transaction
+    READ_XYZ,                                                         // read_xyz(), one 6-byte burst
+    READ_XYZ_FAST,                                                    // read_xyz() with F_READ, 3 bytes
+    DRAIN_FIFO,                                                       // drain_fifo() every DRAIN_PERIOD_US, F_STATUS then one burst
+    DRAIN_FIFO_FAST,                                                  // Same with F_READ
+    READ_MODES
+} read_mode_t;
+
+typedef struct {
+    uint64_t samples;                                                 // Samples the firmware got
+    size_t transactions;
+    uint64_t bytes;                                                   // On the wire: addresses, pointers and data
+    uint64_t bus_us;
+    size_t wrong;                                                     // Samples (or window figures) different from the device's
+} traffic_t;
+
+namespace single {                                                    // The registers one at a time
+typedef Register<0x01, 1, REG_READ_ONLY> OUT_X_MSB;
+typedef Register<0x02, 1, REG_READ_ONLY> OUT_X_LSB;
+typedef Register<0x03, 1, REG_READ_ONLY> OUT_Y_MSB;
+typedef Register<0x04, 1, REG_READ_ONLY> OUT_Y_LSB;
+typedef Register<0x05, 1, REG_READ_ONLY> OUT_Z_MSB;
+typedef Register<0x06, 1, REG_READ_ONLY> OUT_Z_LSB;
+}
+
+// =====================================================================================
+// HELPERS
+// =====================================================================================
+// Every sample different, full 14-bit range on X, gravity on Z
+static void signal(uint64_t index, int16_t *xyz){
+    xyz[0] = (int16_t)((index * 97) % 8192) - 4096;
+    xyz[1] = (int16_t)(-xyz[0] / 2);
+    xyz[2] = (int16_t)(4096 + index % 64);
+}
+
+static int16_t quantise(int16_t value, bool fast){                    // What F_READ leaves of a sample
+    return fast ? (int16_t)((value >> 6) * 64) : value;
+}
+
+static bool same(const int16_t *a, const mma8451_xyz_t &b){
+    return a[0] == b.x && a[1] == b.y && a[2] == b.z;
+}
+
+static traffic_t traffic(uint64_t samples, size_t wrong){
+    traffic_t result = {samples, sim::i2c_bus().log.size(), 0, 0, wrong};
+
+    for (size_t i = 0; i < sim::i2c_bus().log.size(); i++) {
+        const sim::I2CRecord &record = sim::i2c_bus().log[i];
+
+        result.bytes += (record.tx.empty() ? 0 : 1 + record.tx.size()) + (record.rx_length > 0 ? 1 + record.rx_length : 0);
+        result.bus_us += record.end_us - record.start_us;
+    }
+    return result;
+}
+
+// Window statistics of samples [0, count) as drain_fifo() should have accumulated them
+static bool window_matches(const Mma8451Device &device, uint64_t count, bool fast, const mma8451_window_t &window){
+    int64_t sum[3] = {0, 0, 0};
+    int16_t low[3] = {INT16_MAX, INT16_MAX, INT16_MAX};
+    int16_t high[3] = {INT16_MIN, INT16_MIN, INT16_MIN};
+
+    for (uint64_t i = 0; i < count; i++) {
+        int16_t xyz[3];
+
+        device.sample(i, xyz);
+        for (int axis = 0; axis < 3; axis++) {
+            int16_t value = quantise(xyz[axis], fast);
+
+            sum[axis] += value;
+            low[axis] = std::min(low[axis], value);
+            high[axis] = std::max(high[axis], value);
+        }
+    }
+    for (int axis = 0; axis < 3; axis++) {
+        if (window.mean[axis] != sum[axis] / (int64_t)count || window.peak_to_peak[axis] != high[axis] - low[axis]) {
+            return false;
+        }
+    }
+    return window.samples == count && !window.overflow;
+}
+
+// One minute of samples read one by one, just after each is made
+static traffic_t polled(read_mode_t mode){
+    I2C i2c(PB_9, PB_8);
+    I2CScheduler scheduler(i2c);
+    Mma8451Device device(signal);
+    MMA8451Q accelerometer(scheduler);
+    RegisterDevice<MMA8451_I2C_ADDRESS> raw(scheduler);
+    bool fast = (mode == READ_XYZ_FAST);
+    size_t wrong = 0;
+    uint64_t last = UINT64_MAX;
+
+    sim::reset();
+    sim::i2c_bus().frequency(BUS_FREQUENCY);
+    device.attach();
+    scheduler.start();
+    accelerometer.set_data_rate(DATA_RATE);
+    accelerometer.set_fast_read(fast);
+    sim::i2c_bus().clear_log();
+
+    uint64_t start_us = sim::now_us();
+    for (uint64_t n = 0; n < SAMPLES; n++) {
+        int16_t expected[3];
+        mma8451_xyz_t xyz = {0, 0, 0};
+
+        sim::advance_to(start_us + (n + 1) * PERIOD_US + 100);
+        switch (mode) {
+            case READ_SINGLE_REGISTERS: {
+                uint8_t bytes[6] = {0, 0, 0, 0, 0, 0};
+
+                raw.read<single::OUT_X_MSB>(&bytes[0]);
+                raw.read<single::OUT_X_LSB>(&bytes[1]);
+                raw.read<single::OUT_Y_MSB>(&bytes[2]);
+                raw.read<single::OUT_Y_LSB>(&bytes[3]);
+                raw.read<single::OUT_Z_MSB>(&bytes[4]);
+                raw.read<single::OUT_Z_LSB>(&bytes[5]);
+                xyz.x = (int16_t)((bytes[0] << 8) | bytes[1]) >> 2;
+                xyz.y = (int16_t)((bytes[2] << 8) | bytes[3]) >> 2;
+                xyz.z = (int16_t)((bytes[4] << 8) | bytes[5]) >> 2;
+                break;
+            }
+            case READ_AXES:
+                xyz.x = accelerometer.read_axis(0);
+                xyz.y = accelerometer.read_axis(1);
+                xyz.z = accelerometer.read_axis(2);
+                break;
+            default:
+                accelerometer.read_xyz(&xyz);
+                break;
+        }
+
+        uint64_t index = device.samples_made() - 1;
+        device.sample(index, expected);
+        for (int axis = 0; axis < 3; axis++) {
+            expected[axis] = quantise(expected[axis], fast);
+        }
+        wrong += (!same(expected, xyz) || index == last) ? 1 : 0;
+        last = index;
+    }
+    return traffic(SAMPLES, wrong);
+}
+
+// One minute of samples from the FIFO, drained as the firmware does without an interrupt pin
+static traffic_t drained(bool fast){
+    I2C i2c(PB_9, PB_8);
+    I2CScheduler scheduler(i2c);
+    Mma8451Device device(signal);
+    MMA8451Q accelerometer(scheduler);
+    mma8451_window_t window;
+    uint64_t samples = 0;
+
+    sim::reset();
+    sim::i2c_bus().frequency(BUS_FREQUENCY);
+    device.attach();
+    scheduler.start();
+    accelerometer.set_data_rate(DATA_RATE);
+    accelerometer.set_fast_read(fast);
+    accelerometer.init_fifo(F_MODE_CIRCULAR, FIFO_WATERMARK, true);
+    sim::i2c_bus().clear_log();
+
+    uint64_t start_us = sim::now_us();
+    for (uint64_t n = 1; n <= (uint64_t)SAMPLES * PERIOD_US / DRAIN_PERIOD_US; n++) {
+        sim::advance_to(start_us + n * DRAIN_PERIOD_US + 100);
+        samples += accelerometer.drain_fifo();
+    }
+    accelerometer.get_window(&window);
+
+    bool right = samples == device.samples_made() && device.samples_lost == 0 && window_matches(device, samples, fast, window);
+    return traffic(samples, right ? 0 : 1);
+}
+// HELPERS END =========================================================================
+
+// =====================================================================================
+// TESTS
+// =====================================================================================
+TEST(Mma8451Bench, BusTraffic){
+    const char *names[READ_MODES] = {"6 single registers", "read_axis() x 3", "read_xyz()", "read_xyz(), F_READ",
+                                     "drain_fifo()", "drain_fifo(), F_READ"};
+    traffic_t result[READ_MODES];
+
+    for (int mode = 0; mode < READ_MODES; mode++) {
+        if (mode == DRAIN_FIFO || mode == DRAIN_FIFO_FAST) {
+            result[mode] = drained(mode == DRAIN_FIFO_FAST);
+        } else {
+            result[mode] = polled((read_mode_t)mode);
+        }
+    }
+
+    printf("\nMMA8451Q bus traffic, %d samples at 50 Hz (one uplink period), I2C at %d kHz\n", SAMPLES, BUS_FREQUENCY / 1000);
+    printf("                        samples  transactions  per sample   bytes   bus ms  bus us/sample  bus load  wrong\n");
+    for (int mode = 0; mode < READ_MODES; mode++) {
+        const traffic_t &r = result[mode];
+
+        printf("%-22s %8llu %13zu %11.3f %7llu %8.1f %14.1f %8.3f %% %6zu\n", names[mode], (unsigned long long)r.samples,
+               r.transactions, (double)r.transactions / r.samples, (unsigned long long)r.bytes, r.bus_us / 1000.0,
+               (double)r.bus_us / r.samples, 100.0 * r.bus_us / ((uint64_t)SAMPLES * PERIOD_US), r.wrong);
+    }
+    printf("(drain_fifo() every %d ms, watermark %d: the interrupt path adds one INT_SOURCE read per drain)\n\n",
+           DRAIN_PERIOD_US / 1000, FIFO_WATERMARK);
+
+    for (int mode = 0; mode < READ_MODES; mode++) {
+        EXPECT_EQ(result[mode].samples, (uint64_t)SAMPLES);
+        EXPECT_EQ(result[mode].wrong, (size_t)0);
+        if (mode > 0) {
+            EXPECT_LT(result[mode].bus_us, result[mode - 1].bus_us);
+        }
+    }
+    EXPECT_EQ(result[READ_SINGLE_REGISTERS].transactions, (size_t)6 * SAMPLES);
+    EXPECT_EQ(result[READ_AXES].transactions, (size_t)3 * SAMPLES);
+    EXPECT_EQ(result[READ_XYZ].transactions, (size_t)SAMPLES);
+    EXPECT_EQ(result[READ_XYZ_FAST].transactions, (size_t)SAMPLES);
+    EXPECT_EQ(result[DRAIN_FIFO].transactions, (size_t)2 * SAMPLES * PERIOD_US / DRAIN_PERIOD_US);
+    EXPECT_EQ(result[DRAIN_FIFO_FAST].transactions, result[DRAIN_FIFO].transactions);
+}
+// TESTS END ===========================================================================
@@ -0,0 +1,90 @@
+/* Host test of the MMA8451Q raw capture used by the spectrum: consecutive samples only, a FIFO
+   overflow in the middle of a capture throws it away and starts it again */
+
+// LIBRARIES ---------------------------------------------------------------------------
+#include "mbed.h"
+#include "mma8451.h"
+#include "mma8451_device.h"
+#include "unittest.h"
+#include <algorithm>
+
+// MACROS ------------------------------------------------------------------------------
+#define PERIOD_US          20000                                      // 50 Hz
+#define WATERMARK          25
+#define DRAIN_PERIOD_US    (WATERMARK * PERIOD_US)
+#define POINTS             128                                        // SPECTRUM_POINTS
+
+// =====================================================================================
+// HELPERS
+// =====================================================================================
+static void ramp(uint64_t index, int16_t *xyz){                       // Z is the sample index
+    xyz[0] = 0;
+    xyz[1] = 0;
+    xyz[2] = (int16_t)(index % 8192);
+}
+
+static bool consecutive(const int16_t *samples, uint16_t length){
+    for (uint16_t i = 1; i < length; i++) {
+        if (samples[i] != samples[i - 1] + 1) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Drains every DRAIN_PERIOD_US except for the drains listed, until the capture is complete
+static int drains_to_complete(MMA8451Q &accelerometer, std::vector<int> skipped){
+    for (int drain = 0; drain < 100; drain++) {
+        sim::advance(DRAIN_PERIOD_US);
+        if (std::find(skipped.begin(), skipped.end(), drain) != skipped.end()) {
+            continue;
+        }
+        accelerometer.drain_fifo();
+        if (accelerometer.capture_complete()) {
+            return drain + 1;
+        }
+    }
+    return -1;
+}
+// HELPERS END =========================================================================
+
+// =====================================================================================
+// TESTS
+// =====================================================================================
+TEST(Mma8451Capture, OverflowRestartsTheCapture){
+    I2C i2c(PB_9, PB_8);
+    I2CScheduler scheduler(i2c);
+    Mma8451Device device(ramp);
+    MMA8451Q accelerometer(scheduler);
+    int16_t samples[POINTS];
+
+    sim::reset();
+    device.attach();
+    scheduler.start();
+    accelerometer.set_data_rate(MMA8451_ODR_50HZ);
+    accelerometer.init_fifo(F_MODE_CIRCULAR, WATERMARK, true);
+
+    // Drained on time: POINTS samples in a row, no restart ------------------------------------
+    accelerometer.start_capture(samples, POINTS, 2);
+    EXPECT_GT(drains_to_complete(accelerometer, {}), 0);
+    EXPECT_TRUE(consecutive(samples, POINTS));
+    EXPECT_EQ(accelerometer.capture_restarts(), 0);
+
+    // The sensor thread late by two drains in the middle: the first part is thrown away -------
+    accelerometer.start_capture(samples, POINTS, 2);
+    uint64_t lost = device.samples_lost;
+    int drains = drains_to_complete(accelerometer, {2, 3});
+
+    EXPECT_GT(device.samples_lost, lost);
+    EXPECT_GT(drains, 0);
+    EXPECT_TRUE(consecutive(samples, POINTS));
+    EXPECT_EQ(accelerometer.capture_restarts(), 1);
+
+    // Late before anything was captured: the FIFO content is consecutive, nothing to restart --
+    sim::advance(3 * DRAIN_PERIOD_US);
+    accelerometer.start_capture(samples, POINTS, 2);
+    EXPECT_GT(drains_to_complete(accelerometer, {}), 0);
+    EXPECT_TRUE(consecutive(samples, POINTS));
+    EXPECT_EQ(accelerometer.capture_restarts(), 0);
+}
+// TESTS END ===========================================================================
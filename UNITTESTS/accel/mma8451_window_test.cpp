@@ -0,0 +1,105 @@
+/* Host test of the MMA8451Q window statistics across uplink retries: get_window() reports the
+   open window again with the newer samples, close_window() starts the next one with the samples
+   drained after the window sent */
+
+// LIBRARIES ---------------------------------------------------------------------------
+#include "mbed.h"
+#include "mma8451.h"
+#include "mma8451_device.h"
+#include "unittest.h"
+
+// MACROS ------------------------------------------------------------------------------
+#define PERIOD_US          20000                                      // 50 Hz
+#define WATERMARK          25
+
+// =====================================================================================
+// HELPERS
+// =====================================================================================
+static void ramp(uint64_t index, int16_t *xyz){                       // X is the sample index
+    xyz[0] = (int16_t)index;
+    xyz[1] = 0;
+    xyz[2] = 4096;
+}
+
+static uint64_t drain_for(MMA8451Q &accelerometer, uint64_t duration_us){
+    uint64_t samples = 0;
+
+    for (uint64_t elapsed = 0; elapsed < duration_us; elapsed += WATERMARK * PERIOD_US) {
+        sim::advance(WATERMARK * PERIOD_US);
+        samples += accelerometer.drain_fifo();
+    }
+    return samples;
+}
+// HELPERS END =========================================================================
+
+// =====================================================================================
+// TESTS
+// =====================================================================================
+TEST(Mma8451Window, RetryKeepsTheWholePeriod){
+    I2C i2c(PB_9, PB_8);
+    I2CScheduler scheduler(i2c);
+    Mma8451Device device(ramp);
+    MMA8451Q accelerometer(scheduler);
+    mma8451_window_t first, retry, next;
+
+    sim::reset();
+    device.attach();
+    scheduler.start();
+    accelerometer.set_data_rate(MMA8451_ODR_50HZ);
+    accelerometer.init_fifo(F_MODE_CIRCULAR, WATERMARK, true);
+
+    // Uplink period, then WOULD_BLOCK: the retry 3 s later reports the same window, longer ------
+    uint64_t period = drain_for(accelerometer, 60000000);
+    accelerometer.get_window(&first);
+    uint64_t until_retry = drain_for(accelerometer, 3000000);
+    accelerometer.get_window(&retry);
+
+    EXPECT_EQ(first.samples, period);
+    EXPECT_EQ(retry.samples, period + until_retry);
+    EXPECT_EQ(first.mean[0], (int16_t)((period - 1) / 2));
+    EXPECT_EQ(retry.mean[0], (int16_t)((period + until_retry - 1) / 2));
+    EXPECT_EQ(retry.peak_to_peak[0], period + until_retry - 1);
+    EXPECT_EQ(first.mean[2], 4096);
+
+    // Sent: the samples drained between the report and the close belong to the next window ----
+    uint64_t after_report = drain_for(accelerometer, 1000000);
+    accelerometer.close_window();
+    uint64_t after_close = drain_for(accelerometer, 1000000);
+    accelerometer.get_window(&next);
+
+    uint64_t first_next = period + until_retry;
+    EXPECT_EQ(next.samples, after_report + after_close);
+    EXPECT_EQ(next.mean[0], (int16_t)(first_next + (after_report + after_close - 1) / 2));
+    EXPECT_EQ(next.peak_to_peak[0], after_report + after_close - 1);
+    EXPECT_FALSE(next.overflow);
+    EXPECT_EQ(device.samples_lost, 0u);
+}
+
+TEST(Mma8451Window, OverflowStaysUntilSent){
+    I2C i2c(PB_9, PB_8);
+    I2CScheduler scheduler(i2c);
+    Mma8451Device device(ramp);
+    MMA8451Q accelerometer(scheduler);
+    mma8451_window_t window;
+
+    sim::reset();
+    device.attach();
+    scheduler.start();
+    accelerometer.set_data_rate(MMA8451_ODR_50HZ);
+    accelerometer.init_fifo(F_MODE_CIRCULAR, WATERMARK, true);
+
+    sim::advance(40 * PERIOD_US);                                     // More than the 32 samples the FIFO holds
+    accelerometer.drain_fifo();
+    accelerometer.get_window(&window);
+    EXPECT_TRUE(window.overflow);
+
+    drain_for(accelerometer, 1000000);
+    accelerometer.get_window(&window);
+    EXPECT_TRUE(window.overflow);                                     // Retry: still the same window
+
+    accelerometer.close_window();
+    drain_for(accelerometer, 1000000);
+    accelerometer.get_window(&window);
+    EXPECT_FALSE(window.overflow);
+}
+// TESTS END ===========================================================================
@@ -0,0 +1,248 @@
+/* Host benchmark of one sensor acquisition on the simulated I2C bus, with the Si7021 and
+   TCS34725 drivers on device models: the conversions one after another (the order of the old
+   send_message(), with today's drivers) against the registry pipeline of main.cpp that starts
+   every conversion at once and collects each as it finishes. Per-sensor and end-to-end latency,
+   in bright light (short TCS34725 integration) and in the dark (longest autorange step) */
+
+// LIBRARIES ---------------------------------------------------------------------------
+#include "mbed.h"
+#include "si7021.h"
+#include "tcs34725.h"
+#include "analog_sampler.h"
+#include "sensor_registry.h"
+#include "si7021_device.h"
+#include "tcs34725_device.h"
+#include "unittest.h"
+
+// MACROS ------------------------------------------------------------------------------
+#define ACQ_POLL_PERIOD    2ms                                        // As in main.cpp
+#define ANALOG_BURST_US    (1000000ULL * ANALOG_FRAMES / ANALOG_FRAME_RATE_HZ)   // Timer driven burst, the CPU fallback is shorter
+#define HUMIDITY_CODE      0x6A5C
+#define TEMPERATURE_CODE   0x66C8
+#define BRIGHT_LEVEL       50                                         // Clear counts per cycle at 1x: 16x, 9.6 ms
+#define DARK_LEVEL         0                                          // 60x, 100.8 ms
+#define SETTLING_RUNS      4                                          // Acquisitions for the autorange to settle
+#define UPLINK_PERIOD_US   60000000ULL
+
+// TYPES -------------------------------------------------------------------------------
+typedef struct {
+    uint16_t humidity;
+    uint16_t temperature;
+    bool si7021_failed;
+    tcs34725_light_t colour;
+    bool colour_failed;
+    uint64_t si7021_us;                                               // From the start of the acquisition to the result
+    uint64_t analog_us;
+    uint64_t tcs34725_us;
+    uint64_t total_us;
+    size_t transactions;
+} acquisition_t;
+
+// =====================================================================================
+// HELPERS
+// =====================================================================================
+static Si7021 *si7021;
+static TCS34725 *tcs34725;
+static uint64_t acquisition_start;
+static Kernel::Clock::time_point si7021_started;
+static Kernel::Clock::time_point si7021_deadline;
+static Kernel::Clock::time_point tcs34725_deadline;
+
+static uint64_t elapsed_us(){
+    return sim::now_us() - acquisition_start;
+}
+
+// The hooks of main.cpp, without the payload side ------------------------------------------
+struct ClimateSensor {
+    static constexpr uint8_t PRESENCE = 0x02;
+    static constexpr size_t MAX_SIZE = 4;
+
+    static void init() {}
+    static void start(acquisition_t &){
+        si7021->start_measurement();
+        si7021_started = Kernel::Clock::now();
+        si7021_deadline = si7021_started + 2 * si7021->conversion_time();
+    }
+    static bool collect(acquisition_t &sample, Kernel::Clock::time_point now){
+        if (now < si7021_started + si7021->conversion_time() / 2) {
+            return false;
+        }
+        bool ready = si7021->read_measurement(&sample.humidity, &sample.temperature);
+
+        if (!ready && now < si7021_deadline) {
+            return false;
+        }
+        sample.si7021_failed = !ready;
+        sample.si7021_us = elapsed_us();
+        return true;
+    }
+    static size_t encode(const acquisition_t &, uint8_t *, uint8_t &) { return 0; }
+    static void sent() {}
+};
+
+struct AnalogSensor {                                                 // Waited for in start(): the LED must stay off
+    static constexpr uint8_t PRESENCE = 0x04;
+    static constexpr size_t MAX_SIZE = 4;
+
+    static void init() {}
+    static void start(acquisition_t &sample){
+        ThisThread::sleep_for(std::chrono::duration_cast<Kernel::Clock::duration>(std::chrono::microseconds(ANALOG_BURST_US)));
+        sample.analog_us = elapsed_us();
+    }
+    static bool collect(acquisition_t &, Kernel::Clock::time_point) { return true; }
+    static size_t encode(const acquisition_t &, uint8_t *, uint8_t &) { return 0; }
+    static void sent() {}
+};
+
+struct ColourSensor {
+    static constexpr uint8_t PRESENCE = 0x08;
+    static constexpr size_t MAX_SIZE = 8;
+
+    static void init() {}
+    static void start(acquisition_t &){
+        tcs34725->start_measurement();
+        std::chrono::microseconds integration = tcs34725->integration_time();
+        tcs34725_deadline = Kernel::Clock::now() + std::chrono::duration_cast<Kernel::Clock::duration>(integration + integration / 2);
+    }
+    static bool collect(acquisition_t &sample, Kernel::Clock::time_point now){
+        std::chrono::microseconds integration = tcs34725->integration_time();
+        if (now < tcs34725_deadline - std::chrono::duration_cast<Kernel::Clock::duration>(integration / 2)) {
+            return false;
+        }
+        bool ready = tcs34725->measurement_ready();
+
+        if (!ready && now < tcs34725_deadline) {
+            return false;
+        }
+        sample.colour_failed = !ready || !tcs34725->read_normalised(&sample.colour);
+        tcs34725->finish_measurement();
+        sample.tcs34725_us = elapsed_us();
+        return true;
+    }
+    static size_t encode(const acquisition_t &, uint8_t *, uint8_t &) { return 0; }
+    static void sent() {}
+};
+
+typedef SensorRegistry<acquisition_t, NoSensor, ClimateSensor, AnalogSensor, ColourSensor, NoSensor> Sensors;   // Order of main.cpp
+
+// start_acquisition() and collect_measurements(), the sensor queue replaced by sleeps
+static acquisition_t concurrent(){
+    acquisition_t sample = {};
+    uint32_t pending = Sensors::ALL;
+
+    acquisition_start = sim::now_us();
+    Sensors::start(sample);
+    while (pending != 0) {
+        ThisThread::sleep_for(ACQ_POLL_PERIOD);
+        Sensors::collect(sample, Kernel::Clock::now(), pending);
+    }
+    sample.total_us = elapsed_us();
+    return sample;
+}
+
+// One conversion after the other: each waits for the previous one to be read
+static acquisition_t sequential(){
+    acquisition_t sample = {};
+    Kernel::Clock::time_point deadline;
+
+    acquisition_start = sim::now_us();
+    si7021->start_measurement();
+    deadline = Kernel::Clock::now() + 2 * si7021->conversion_time();
+    do {
+        ThisThread::sleep_for(SI7021_POLL_PERIOD);
+        sample.si7021_failed = !si7021->read_measurement(&sample.humidity, &sample.temperature);
+    } while (sample.si7021_failed && Kernel::Clock::now() < deadline);
+    sample.si7021_us = elapsed_us();
+
+    ThisThread::sleep_for(std::chrono::duration_cast<Kernel::Clock::duration>(std::chrono::microseconds(ANALOG_BURST_US)));
+    sample.analog_us = elapsed_us();
+
+    tcs34725->start_measurement();
+    sample.colour_failed = !tcs34725->wait_measurement() || !tcs34725->read_normalised(&sample.colour);
+    tcs34725->finish_measurement();
+    sample.tcs34725_us = elapsed_us();
+    sample.total_us = elapsed_us();
+    return sample;
+}
+
+// Fresh bus, devices and drivers, a few uplink periods for the autorange, then the one measured
+static acquisition_t measure(acquisition_t (*acquire)(), uint32_t level, uint64_t *si7021_ready_us, uint64_t *tcs34725_ready_us){
+    I2C i2c(PB_9, PB_8);
+    I2CScheduler scheduler(i2c);
+    Si7021Device climate(HUMIDITY_CODE, TEMPERATURE_CODE);
+    Tcs34725Device colour(level);
+    Si7021 si7021_driver(scheduler);
+    TCS34725 tcs34725_driver(scheduler);
+    acquisition_t sample = {};
+
+    si7021 = &si7021_driver;
+    tcs34725 = &tcs34725_driver;
+    sim::reset();
+    climate.attach();
+    colour.attach();
+    scheduler.start();
+    si7021->set_resolution(SI7021_RES_RH12_T14);
+    tcs34725->tcs34725_init();
+    tcs34725->set_autorange(true);
+
+    for (int run = 0; run <= SETTLING_RUNS; run++) {
+        sim::advance_to((run + 1) * UPLINK_PERIOD_US);
+        sim::i2c_bus().clear_log();
+        sample = acquire();
+    }
+    sample.transactions = sim::i2c_bus().log.size();
+    *si7021_ready_us = climate.ready_us() - acquisition_start;
+    *tcs34725_ready_us = colour.ready_us() - acquisition_start;
+    EXPECT_EQ(sample.colour.clear, (uint32_t)(((uint64_t)colour.counts(0) << 8) * 1000 / (sample.colour.gain * (256ULL - sample.colour.atime) * TCS34725_CYCLE_US)));
+    return sample;
+}
+
+static double ms(uint64_t us){
+    return us / 1000.0;
+}
+
+static void compare(const char *light, uint32_t level){
+    uint64_t si7021_ready[2], tcs34725_ready[2];
+    acquisition_t result[2] = {measure(sequential, level, &si7021_ready[0], &tcs34725_ready[0]),
+                               measure(concurrent, level, &si7021_ready[1], &tcs34725_ready[1])};
+    uint64_t poll_us = std::chrono::duration_cast<std::chrono::microseconds>(ACQ_POLL_PERIOD).count();
+
+    printf("\nAcquisition, %s: TCS34725 %ux, %.1f ms cycle; Si7021 RH12/T14; analog burst %.1f ms\n", light, result[1].colour.gain,
+           ms(TCS34725_INIT_TIME_US + (uint64_t)TCS34725_CYCLE_US * (256 - result[1].colour.atime)), ms(ANALOG_BURST_US));
+    printf("                                    sequential   concurrent\n");
+    printf("Si7021 result (ms)                  %10.1f   %10.1f\n", ms(result[0].si7021_us), ms(result[1].si7021_us));
+    printf("Analog burst done (ms)              %10.1f   %10.1f\n", ms(result[0].analog_us), ms(result[1].analog_us));
+    printf("TCS34725 result (ms)                %10.1f   %10.1f\n", ms(result[0].tcs34725_us), ms(result[1].tcs34725_us));
+    printf("End to end (ms)                     %10.1f   %10.1f\n", ms(result[0].total_us), ms(result[1].total_us));
+    printf("I2C transactions                    %10zu   %10zu\n\n", result[0].transactions, result[1].transactions);
+
+    for (int i = 0; i < 2; i++) {
+        EXPECT_FALSE(result[i].si7021_failed);
+        EXPECT_FALSE(result[i].colour_failed);
+        EXPECT_EQ(result[i].humidity, HUMIDITY_CODE);
+        EXPECT_EQ(result[i].temperature, TEMPERATURE_CODE);
+    }
+    EXPECT_EQ(result[0].colour.clear, result[1].colour.clear);
+    EXPECT_EQ(result[0].colour.gain, result[1].colour.gain);
+
+    // Sequential: the sum of the conversions. Concurrent: the slowest one, plus one poll -------
+    EXPECT_GE(result[0].total_us, si7021_ready[0] + ANALOG_BURST_US);
+    EXPECT_LE(result[1].total_us, std::max(si7021_ready[1], tcs34725_ready[1]) + poll_us + 1000);
+    EXPECT_LE(result[1].si7021_us, si7021_ready[1] + poll_us + 1000);
+    EXPECT_LE(result[1].tcs34725_us, tcs34725_ready[1] + poll_us + 1000);
+    EXPECT_LT(result[1].total_us, result[0].total_us);
+    EXPECT_LE(result[1].transactions, result[0].transactions);       // No STATUS polling through a long integration
+}
+// HELPERS END =========================================================================
+
+// =====================================================================================
+// TESTS
+// =====================================================================================
+TEST(AcquisitionBench, Bright){
+    compare("bright", BRIGHT_LEVEL);
+}
+
+TEST(AcquisitionBench, Dark){
+    compare("dark", DARK_LEVEL);
+}
+// TESTS END ===========================================================================
@@ -0,0 +1,236 @@
+/* Host benchmark of Geofence::update() on a few hundred fences (circles and hexagons around one
+   city), checked against a double precision reference: ns per fence and per update, and the
+   share of the evaluations the bounding boxes reject */
+
+// LIBRARIES ---------------------------------------------------------------------------
+#include "mbed.h"
+#include "geofence.h"
+#include "unittest.h"
+#include <chrono>
+#include <math.h>
+#include <random>
+
+// MACROS ------------------------------------------------------------------------------
+#define FENCE_SETS         20                                         // Geofence instances of GEOFENCE_MAX_FENCES each
+#define FENCES             (FENCE_SETS * GEOFENCE_MAX_FENCES)
+#define POSITIONS          2000                                       // Half anywhere in the area, half next to a fence
+#define AREA_E7            1000000                                    // +-0.1 deg around the centre, ~22 x 17 km
+#define CENTRE_LAT_E7      404168000                                  // Madrid
+#define CENTRE_LON_E7      -37038000
+#define RUNS               5                                          // Best of, against scheduling noise
+#define EARTH_RADIUS_M     6371008.8
+#define CIRCLE_MARGIN      0.01                                       // Flat projection: within 1 % of the radius near the edge
+
+// TYPES -------------------------------------------------------------------------------
+typedef struct {
+    bool circle;
+    geo_point_t centre;
+    double radius_m;                                                  // Circle
+    std::vector<geo_point_t> vertices;                                // Polygon
+} reference_fence_t;
+
+// GLOBAL VARIABLES --------------------------------------------------------------------
+static volatile uint32_t sink;                                        // Keeps the results alive
+
+// =====================================================================================
+// HELPERS
+// =====================================================================================
+static double radians(int32_t value_e7){
+    return value_e7 * 1e-7 * M_PI / 180.0;
+}
+
+static double haversine_m(geo_point_t a, geo_point_t b){
+    double dlat = radians(b.latitude_e7) - radians(a.latitude_e7);
+    double dlon = radians(b.longitude_e7) - radians(a.longitude_e7);
+    double h = sin(dlat / 2) * sin(dlat / 2) + cos(radians(a.latitude_e7)) * cos(radians(b.latitude_e7)) * sin(dlon / 2) * sin(dlon / 2);
+
+    return 2 * EARTH_RADIUS_M * asin(sqrt(h));
+}
+
+// Even-odd rule in doubles, with the crossing longitude divided out. Sets *edge when the
+// point is on an edge, where the answer depends on the rounding
+static bool reference_in_polygon(const std::vector<geo_point_t> &v, geo_point_t p, bool *edge){
+    bool inside = false;
+
+    for (size_t i = 0, j = v.size() - 1; i < v.size(); j = i++) {
+        if ((v[i].latitude_e7 > p.latitude_e7) != (v[j].latitude_e7 > p.latitude_e7)) {
+            double crossing = v[j].longitude_e7 + (double)(v[i].longitude_e7 - v[j].longitude_e7)
+                              * (p.latitude_e7 - v[j].latitude_e7) / (v[i].latitude_e7 - v[j].latitude_e7);
+
+            *edge |= fabs(crossing - p.longitude_e7) < 1.0;
+            inside ^= crossing > p.longitude_e7;
+        }
+    }
+    return inside;
+}
+
+static geo_point_t offset(geo_point_t centre, double north_m, double east_m){
+    geo_point_t p;
+
+    p.latitude_e7 = centre.latitude_e7 + (int32_t)lround(north_m / (EARTH_RADIUS_M * M_PI / 180.0) * 1e7);
+    p.longitude_e7 = centre.longitude_e7 + (int32_t)lround(east_m / (EARTH_RADIUS_M * M_PI / 180.0 * cos(radians(centre.latitude_e7))) * 1e7);
+    return p;
+}
+
+// Alternating circles (50 m to 2 km) and star-shaped hexagons (100 m to 2 km)
+static std::vector<reference_fence_t> make_fences(std::mt19937 &random){
+    std::uniform_int_distribution<int32_t> area(-AREA_E7, AREA_E7);
+    std::uniform_real_distribution<double> circle_radius(50, 2000), vertex_radius(100, 2000), jitter(0, 2 * M_PI / GEOFENCE_MAX_VERTICES);
+    std::vector<reference_fence_t> fences(FENCES);
+
+    for (size_t i = 0; i < fences.size(); i++) {
+        reference_fence_t &fence = fences[i];
+
+        fence.circle = (i % 2) == 0;
+        fence.centre.latitude_e7 = CENTRE_LAT_E7 + area(random);
+        fence.centre.longitude_e7 = CENTRE_LON_E7 + area(random);
+        if (fence.circle) {
+            fence.radius_m = round(circle_radius(random));
+            continue;
+        }
+        for (int k = 0; k < GEOFENCE_MAX_VERTICES; k++) {
+            double angle = k * 2 * M_PI / GEOFENCE_MAX_VERTICES + jitter(random);
+            double r = vertex_radius(random);
+
+            fence.vertices.push_back(offset(fence.centre, r * cos(angle), r * sin(angle)));
+        }
+    }
+    return fences;
+}
+
+static std::vector<geo_point_t> make_positions(std::mt19937 &random, const std::vector<reference_fence_t> &fences){
+    std::uniform_int_distribution<int32_t> area(-AREA_E7, AREA_E7);
+    std::uniform_real_distribution<double> near(-2500, 2500);
+    std::vector<geo_point_t> positions(POSITIONS);
+
+    for (size_t i = 0; i < positions.size(); i++) {
+        if (i % 2) {
+            positions[i] = offset(fences[random() % fences.size()].centre, near(random), near(random));
+        } else {
+            positions[i].latitude_e7 = CENTRE_LAT_E7 + area(random);
+            positions[i].longitude_e7 = CENTRE_LON_E7 + area(random);
+        }
+    }
+    return positions;
+}
+
+// Best ns per update() of one set
+static double measure(std::vector<Geofence> &sets, const std::vector<geo_point_t> &positions){
+    double best_ns = 0;
+
+    for (int run = 0; run < RUNS; run++) {
+        uint32_t sum = 0;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        for (size_t i = 0; i < positions.size(); i++) {
+            for (size_t s = 0; s < sets.size(); s++) {
+                sum += sets[s].update(positions[i]);
+            }
+        }
+
+        double elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        double updates = 1.0 * positions.size() * sets.size();
+
+        sink = sink + sum;
+        if (run == 0 || elapsed_ns / updates < best_ns) {
+            best_ns = elapsed_ns / updates;
+        }
+    }
+    return best_ns;
+}
+// HELPERS END =========================================================================
+
+// =====================================================================================
+// TESTS
+// =====================================================================================
+TEST(GeofenceBench, PointInFence){
+    std::mt19937 random(2026);
+    std::vector<reference_fence_t> fences = make_fences(random);
+    std::vector<geo_point_t> positions = make_positions(random, fences);
+    std::vector<Geofence> sets(FENCE_SETS);
+
+    for (size_t i = 0; i < fences.size(); i++) {
+        Geofence &set = sets[i / GEOFENCE_MAX_FENCES];
+        uint8_t id = i % GEOFENCE_MAX_FENCES;
+
+        if (fences[i].circle) {
+            ASSERT_TRUE(set.add_circle(id, fences[i].centre, (uint16_t)fences[i].radius_m));
+        } else {
+            ASSERT_TRUE(set.add_polygon(id, fences[i].vertices.data(), (uint8_t)fences[i].vertices.size()));
+        }
+    }
+
+    // Correctness against the reference ----------------------------------------------
+    size_t inside = 0, in_box = 0, skipped = 0, circle_errors = 0, polygon_errors = 0;
+
+    for (size_t i = 0; i < positions.size(); i++) {
+        for (size_t s = 0; s < sets.size(); s++) {
+            sets[s].update(positions[i]);
+            uint32_t mask = sets[s].inside_mask();
+
+            for (size_t k = 0; k < GEOFENCE_MAX_FENCES; k++) {
+                const reference_fence_t &fence = fences[s * GEOFENCE_MAX_FENCES + k];
+                bool got = (mask >> k) & 1;
+                bool expected;
+
+                if (fence.circle) {
+                    double d = haversine_m(fence.centre, positions[i]);
+
+                    in_box += d < fence.radius_m * 1.5 ? 1 : 0;       // Roughly: the box corners are at 1.41 r
+                    if (fabs(d - fence.radius_m) <= fence.radius_m * CIRCLE_MARGIN + 1.0) {
+                        skipped++;
+                        continue;
+                    }
+                    expected = d < fence.radius_m;
+                    circle_errors += (got != expected) ? 1 : 0;
+                } else {
+                    bool edge = false;
+                    int32_t min_lat = INT32_MAX, max_lat = INT32_MIN, min_lon = INT32_MAX, max_lon = INT32_MIN;
+
+                    for (size_t v = 0; v < fence.vertices.size(); v++) {
+                        min_lat = std::min(min_lat, fence.vertices[v].latitude_e7);
+                        max_lat = std::max(max_lat, fence.vertices[v].latitude_e7);
+                        min_lon = std::min(min_lon, fence.vertices[v].longitude_e7);
+                        max_lon = std::max(max_lon, fence.vertices[v].longitude_e7);
+                    }
+                    in_box += (positions[i].latitude_e7 >= min_lat && positions[i].latitude_e7 <= max_lat
+                               && positions[i].longitude_e7 >= min_lon && positions[i].longitude_e7 <= max_lon) ? 1 : 0;
+                    expected = reference_in_polygon(fence.vertices, positions[i], &edge);
+                    if (edge) {
+                        skipped++;
+                        continue;
+                    }
+                    polygon_errors += (got != expected) ? 1 : 0;
+                }
+                inside += expected ? 1 : 0;
+            }
+        }
+    }
+
+    // Cost -----------------------------------------------------------------------------
+    std::vector<geo_point_t> near_only;
+
+    for (size_t i = 1; i < positions.size(); i += 2) {
+        near_only.push_back(positions[i]);
+    }
+    double update_ns = measure(sets, positions);
+    double near_update_ns = measure(sets, near_only);
+    double evaluations = 1.0 * positions.size() * FENCES;
+
+    printf("\nGeofence update(), %d fences (%d circles, %d hexagons) in %d sets, %d positions, best of %d runs\n",
+           FENCES, FENCES / 2, FENCES / 2, FENCE_SETS, POSITIONS, RUNS);
+    printf("Inside (reference)                  %10.2f %%\n", 100.0 * inside / evaluations);
+    printf("Past the bounding box (approx.)     %10.2f %%\n", 100.0 * in_box / evaluations);
+    printf("Skipped on an edge or in the margin %10zu of %.0f\n", skipped, evaluations);
+    printf("Wrong, circles / polygons           %10zu / %zu\n", circle_errors, polygon_errors);
+    printf("ns per update() of %d fences        %10.1f\n", GEOFENCE_MAX_FENCES, update_ns);
+    printf("ns per fence                        %10.2f\n", update_ns / GEOFENCE_MAX_FENCES);
+    printf("ns per fence, positions near fences %10.2f\n", near_update_ns / GEOFENCE_MAX_FENCES);
+    printf("(host figures: most fences are rejected on the bounding box, the polygon and circle tests are the rest)\n\n");
+
+    EXPECT_EQ(circle_errors, (size_t)0);
+    EXPECT_EQ(polygon_errors, (size_t)0);
+    EXPECT_GT(inside, (size_t)0);
+    EXPECT_LT(skipped, (size_t)(evaluations / 100));
+}
+// TESTS END ===========================================================================
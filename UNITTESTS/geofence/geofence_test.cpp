@@ -0,0 +1,165 @@
+/* Host test of the geofence downlinks and their storage: a downlink only changes the fences in
+   RAM, the flash write is the caller's, from a snapshot, and restore() brings it back. And of
+   evaluate(), which gives the events of an uplink being encoded without changing any state. A
+   refused downlink (radius 0, a point off the globe) leaves the fences as they were */
+
+// LIBRARIES ---------------------------------------------------------------------------
+#include "mbed.h"
+#include "geofence.h"
+#include "kvstore_global_api.h"
+#include "unittest.h"
+
+// MACROS ------------------------------------------------------------------------------
+#define HERE_LAT_E7        404168000                                  // Madrid
+#define HERE_LON_E7        -37038000
+
+// =====================================================================================
+// HELPERS
+// =====================================================================================
+static void put_le32(uint8_t *data, int32_t value){
+    for (int i = 0; i < 4; i++) {
+        data[i] = (uint8_t)((uint32_t)value >> (8 * i));
+    }
+}
+
+static std::vector<uint8_t> circle_downlink(uint8_t id, int32_t latitude_e7, int32_t longitude_e7, uint16_t radius_m){
+    std::vector<uint8_t> data(12);
+
+    data[0] = GEOFENCE_OP_CIRCLE;
+    data[1] = id;
+    put_le32(&data[2], latitude_e7);
+    put_le32(&data[6], longitude_e7);
+    data[10] = radius_m & 0xFF;
+    data[11] = radius_m >> 8;
+    return data;
+}
+static std::vector<uint8_t> triangle_downlink(uint8_t id, const geo_point_t *vertices){
+    std::vector<uint8_t> data(3 + 3 * 8);
+
+    data[0] = GEOFENCE_OP_POLYGON;
+    data[1] = id;
+    data[2] = 3;
+    for (int i = 0; i < 3; i++) {
+        put_le32(&data[3 + i * 8], vertices[i].latitude_e7);
+        put_le32(&data[7 + i * 8], vertices[i].longitude_e7);
+    }
+    return data;
+}
+// HELPERS END =========================================================================
+
+// =====================================================================================
+// TESTS
+// =====================================================================================
+TEST(Geofence, DownlinkDoesNotWriteFlash){
+    Geofence geofence;
+    std::vector<uint8_t> circle = circle_downlink(1, HERE_LAT_E7, HERE_LON_E7, 200);
+    const uint8_t move[3] = {GEOFENCE_OP_MOVE_DISTANCE, 100, 0};
+    const uint8_t invalid[2] = {GEOFENCE_OP_CIRCLE, 1};
+
+    sim::reset();
+    uint32_t writes = sim::kv_writes();
+
+    EXPECT_TRUE(geofence.handle_downlink(circle.data(), circle.size()));
+    EXPECT_TRUE(geofence.handle_downlink(move, sizeof(move)));
+    EXPECT_FALSE(geofence.handle_downlink(invalid, sizeof(invalid)));
+    EXPECT_EQ(geofence.count(), 1u);
+    EXPECT_EQ(sim::kv_writes(), writes);
+}
+
+TEST(Geofence, SnapshotSavedAndRestored){
+    Geofence geofence, restored;
+    geofence_config_t config;
+    std::vector<uint8_t> inner = circle_downlink(1, HERE_LAT_E7, HERE_LON_E7, 200);
+    std::vector<uint8_t> outer = circle_downlink(2, HERE_LAT_E7, HERE_LON_E7, 2000);
+    geo_point_t here = {HERE_LAT_E7, HERE_LON_E7};
+    geo_point_t away = {HERE_LAT_E7 + 100000, HERE_LON_E7};           // ~1.1 km North
+
+    sim::reset();
+    ASSERT_TRUE(geofence.handle_downlink(inner.data(), inner.size()));
+    ASSERT_TRUE(geofence.handle_downlink(outer.data(), outer.size()));
+    geofence.snapshot(&config);
+
+    uint32_t writes = sim::kv_writes();
+    ASSERT_TRUE(Geofence::save(config));
+    EXPECT_EQ(sim::kv_writes() - writes, 1u);
+
+    ASSERT_TRUE(restored.restore());
+    EXPECT_EQ(restored.count(), 2u);
+    restored.update(here);
+    EXPECT_EQ(restored.inside_mask(), 0x3u);
+    restored.update(away);
+    EXPECT_EQ(restored.inside_mask(), 0x2u);
+
+    // A snapshot taken before a change is what a late write puts in flash
+    const uint8_t clear[1] = {GEOFENCE_OP_CLEAR};
+    ASSERT_TRUE(geofence.handle_downlink(clear, sizeof(clear)));
+    ASSERT_TRUE(restored.restore());
+    EXPECT_EQ(restored.count(), 2u);
+    geofence.snapshot(&config);
+    ASSERT_TRUE(Geofence::save(config));
+    ASSERT_TRUE(restored.restore());
+    EXPECT_EQ(restored.count(), 0u);
+}
+
+TEST(Geofence, EvaluateChangesNothing){
+    Geofence geofence;
+    std::vector<uint8_t> circle = circle_downlink(1, HERE_LAT_E7, HERE_LON_E7, 200);
+    geo_point_t here = {HERE_LAT_E7, HERE_LON_E7};
+    geo_point_t away = {HERE_LAT_E7 + 100000, HERE_LON_E7};
+
+    sim::reset();
+    ASSERT_TRUE(geofence.handle_downlink(circle.data(), circle.size()));
+    EXPECT_EQ(geofence.update(away), GEOFENCE_EVENT_FIRST);             // Loaded: where it is, not an event
+    geofence.position_sent(away);
+
+    // An uplink that does not go out is encoded again with the same events ------------------
+    uint8_t events = geofence.evaluate(here);
+    EXPECT_EQ(events, GEOFENCE_EVENT_ENTER | GEOFENCE_EVENT_MOVED);
+    EXPECT_EQ(geofence.evaluate(here), events);
+    EXPECT_EQ(geofence.inside_mask(), 0u);
+
+    // Sent: update() keeps what was reported, position_sent() clears it ----------------------
+    EXPECT_EQ(geofence.update(here), events);
+    EXPECT_EQ(geofence.inside_mask(), 1u);
+    geofence.position_sent(here);
+    EXPECT_EQ(geofence.evaluate(here), 0);
+
+    // Events not sent yet stay pending in what evaluate() reports -----------------------------
+    geofence.update(away);
+    EXPECT_EQ(geofence.evaluate(here), GEOFENCE_EVENT_EXIT | GEOFENCE_EVENT_MOVED | GEOFENCE_EVENT_ENTER);
+}
+TEST(Geofence, RefusedDownlinkChangesNothing){
+    Geofence geofence;
+    geo_point_t here = {HERE_LAT_E7, HERE_LON_E7};
+    geo_point_t triangle[3] = {{HERE_LAT_E7, HERE_LON_E7}, {HERE_LAT_E7 + 100000, HERE_LON_E7}, {HERE_LAT_E7, HERE_LON_E7 + 100000}};
+    std::vector<uint8_t> cleared = circle_downlink(7, HERE_LAT_E7, HERE_LON_E7, 200);
+    const uint8_t clear[1] = {GEOFENCE_OP_CLEAR};
+
+    // The slot of a cleared fence is not brought back by a new id with radius 0 ----------------
+    sim::reset();
+    ASSERT_TRUE(geofence.handle_downlink(cleared.data(), cleared.size()));
+    ASSERT_TRUE(geofence.handle_downlink(clear, sizeof(clear)));
+
+    std::vector<uint8_t> zero = circle_downlink(9, HERE_LAT_E7, HERE_LON_E7, 0);
+    EXPECT_FALSE(geofence.handle_downlink(zero.data(), zero.size()));
+    EXPECT_EQ(geofence.count(), 0u);
+    EXPECT_EQ(geofence.update(here), GEOFENCE_EVENT_FIRST);             // Not entered
+    EXPECT_EQ(geofence.inside_mask(), 0u);
+
+    // Off the globe: refused before any arithmetic on it --------------------------------------
+    std::vector<uint8_t> far_north = circle_downlink(9, INT32_MAX, HERE_LON_E7, 200);
+    std::vector<uint8_t> far_west = circle_downlink(9, HERE_LAT_E7, -GEOFENCE_MAX_LON_E7 - 1, 200);
+    EXPECT_FALSE(geofence.handle_downlink(far_north.data(), far_north.size()));
+    EXPECT_FALSE(geofence.handle_downlink(far_west.data(), far_west.size()));
+
+    triangle[2].latitude_e7 = -GEOFENCE_MAX_LAT_E7 - 1;
+    std::vector<uint8_t> polygon = triangle_downlink(9, triangle);
+    EXPECT_FALSE(geofence.handle_downlink(polygon.data(), polygon.size()));
+    EXPECT_EQ(geofence.count(), 0u);
+
+    // The limits themselves are on the globe ---------------------------------------------------
+    std::vector<uint8_t> pole = circle_downlink(9, GEOFENCE_MAX_LAT_E7, GEOFENCE_MAX_LON_E7, 200);
+    EXPECT_TRUE(geofence.handle_downlink(pole.data(), pole.size()));
+    EXPECT_EQ(geofence.count(), 1u);
+}
+// TESTS END ===========================================================================
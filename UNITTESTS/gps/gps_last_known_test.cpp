@@ -0,0 +1,64 @@
+/* Host test of the last-known-good position kept in KVStore: written on a first fix or a real
+   move only, and no int32 overflow when a move crosses the antimeridian (built with UBSan) */
+
+// LIBRARIES ---------------------------------------------------------------------------
+#include "mbed.h"
+#include "gps_thread.h"
+#include "gps_receiver.h"
+#include "kvstore_global_api.h"
+#include "unittest.h"
+
+// MACROS ------------------------------------------------------------------------------
+#define RUN_TIME_US        (10 * 1000000ULL)
+
+// TYPES -------------------------------------------------------------------------------
+typedef struct {
+    int32_t latitude_e7;
+    int32_t longitude_e7;
+} lkg_record_t;                                                       // Layout of gps_lkg_record_t
+
+// =====================================================================================
+// HELPERS
+// =====================================================================================
+static void deliver_at(uint64_t time_us, const std::string &sentence){
+    sim::schedule(time_us, [sentence]{
+        for (size_t i = 0; i < sentence.size(); i++) {
+            sim::uart().deliver(sentence[i]);
+        }
+    });
+}
+
+static std::string gga(const char *time, const char *longitude, const char *ew){
+    return GpsReceiver::frame(std::string("GPGGA,") + time + ",0000.0000,N," + longitude + "," + ew + ",1,08,0.90,12.0,M,0.0,M,,");
+}
+// HELPERS END =========================================================================
+
+// =====================================================================================
+// TESTS
+// =====================================================================================
+TEST(GpsLastKnown, WritesAcrossTheAntimeridian){
+    lkg_record_t record = {0, 1799999000};                            // Saved by the previous run at 179.9999 E
+    lkg_record_t stored;
+    size_t size = 0;
+
+    sim::reset();
+    kv_set(GPS_LKG_KEY, &record, sizeof(record), 0);
+    uint32_t writes = sim::kv_writes();
+
+    deliver_at(1000000, gga("000001.000", "17959.9940", "W"));         // 179.9999 W: 22 m away, 3.6e9 apart in e7
+    deliver_at(2000000, gga("000002.000", "17959.9940", "W"));         // Same place: nothing to write
+    deliver_at(3000000, gga("000003.000", "17959.9900", "W"));         // 7 m further: below GPS_LKG_MIN_MOVE_E7
+    sim::start_run(RUN_TIME_US);
+    EXPECT_THROW(gps_th_routine(), sim::SimulationEnd);
+
+    ASSERT_EQ(kv_get(GPS_LKG_KEY, &stored, sizeof(stored), &size), MBED_SUCCESS);
+    EXPECT_EQ(sim::kv_writes() - writes, 1u);
+    EXPECT_EQ(stored.longitude_e7, -1799999000);
+    EXPECT_EQ(stored.latitude_e7, 0);
+
+    gps_position_t position;
+    ASSERT_TRUE(get_gps_last_known(&position));
+    EXPECT_FALSE(position.from_flash);
+    EXPECT_EQ(position.longitude_e7, -1799998333);                    // The last fix, written or not
+}
+// TESTS END ===========================================================================
@@ -0,0 +1,111 @@
+/* Host load report of the GPS reception (RX interrupt, ring drain and parser) on the replayed
+   log: UART bytes/s, sentences/s and host CPU time, for the output profile it is built with.
+   Built twice: with the receiver default profile (what was received before $PMTK314 was sent)
+   and with the GGA-only profile of gps_thread.h */
+
+// LIBRARIES ---------------------------------------------------------------------------
+#include "mbed.h"
+#include "gps_thread.h"
+#include "gps_receiver.h"
+#include "unittest.h"
+#include <stdlib.h>
+
+// MACROS ------------------------------------------------------------------------------
+#define RUN_TIME_US        (300 * 1000000ULL)                         // Simulated time, 300 epochs at 1 Hz
+#define PROFILE_FIELDS     6                                          // GLL, RMC, VTG, GGA, GSA, GSV
+#define GGA_INDEX          3
+
+// =====================================================================================
+// HELPERS
+// =====================================================================================
+// Per-sentence rates of GPS_NMEA_OUTPUT, in $PMTK314 field order
+static std::vector<int> output_profile(){
+    std::vector<int> rates;
+    const char *field = GPS_NMEA_OUTPUT;
+
+    while (rates.size() < PROFILE_FIELDS) {
+        rates.push_back(atoi(field));
+        field = strchr(field, ',') + 1;
+    }
+    return rates;
+}
+
+static int profile_index(const std::string &sentence){
+    const char *types[PROFILE_FIELDS] = {"GLL", "RMC", "VTG", "GGA", "GSA", "GSV"};
+
+    for (int i = 0; i < PROFILE_FIELDS; i++) {
+        if (sentence.compare(3, 3, types[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Bytes per second the profile lets through, from the log: a rate of n sends every n-th epoch
+static double expected_bytes_per_s(const std::vector<std::string> &log, const std::vector<int> &rates, double *gga_length){
+    double bytes = 0;
+    size_t epochs = 0, gga_bytes = 0;
+
+    for (size_t i = 0; i < log.size(); i++) {
+        int index = profile_index(log[i]);
+
+        if (index == GGA_INDEX) {
+            epochs++;
+            gga_bytes += log[i].size();
+        }
+        if (index >= 0 && rates[index] > 0) {
+            bytes += (double)log[i].size() / rates[index];
+        }
+    }
+    *gga_length = (double)gga_bytes / epochs;
+    return bytes / epochs;
+}
+// HELPERS END =========================================================================
+
+// =====================================================================================
+// TESTS
+// =====================================================================================
+TEST(GpsLoad, ReplayedLog){
+    std::vector<std::string> log = GpsReceiver::load_log(SN_DATA_DIR "/gps_log.nmea");
+    std::vector<int> rates = output_profile();
+    GpsReceiver::Config config;
+    double gga_length = 0;
+    double expected = expected_bytes_per_s(log, rates, &gga_length);
+    ASSERT_FALSE(log.empty());
+
+    config.cold_start_ms = 0;                                         // Fix from the first epoch
+    sim::reset();
+    GpsReceiver receiver(log, config);
+    receiver.power_on();
+    sim::start_run(RUN_TIME_US);
+    EXPECT_THROW(gps_th_routine(), sim::SimulationEnd);
+
+    double seconds = RUN_TIME_US / 1e6;
+    const sim::UartStats &uart = sim::uart().stats;
+    double bytes_per_s = uart.bytes_to_mcu / seconds;
+    double isr_us_per_s = uart.isr_ns / 1e3 / seconds;
+    double thread_us_per_s = sim::busy_ns() / 1e3 / seconds;
+
+    printf("\nGPS reception load, profile \"%s\", %d baud, %.0f s replayed\n", GPS_NMEA_OUTPUT, GPS_BAUD_RATE, seconds);
+    printf("UART bytes per second               %10.1f (expected %.1f from the log)\n", bytes_per_s, expected);
+    printf("UART line occupancy                 %9.1f %%\n", bytes_per_s * 10 * 100 / GPS_BAUD_RATE);
+    printf("GGA sentences per second            %10.2f\n", receiver.gga_sent_us.size() / seconds);
+    printf("RX interrupts per second            %10.1f\n", uart.isr_calls / seconds);
+    printf("GPS thread wake-ups per second      %10.2f\n", sim::wakeups() / seconds);
+    printf("Host CPU, RX interrupt, us/s        %10.2f\n", isr_us_per_s);
+    printf("Host CPU, GPS thread, us/s          %10.2f\n", thread_us_per_s);
+    printf("Host CPU per byte received, ns      %10.1f\n", (uart.isr_ns + sim::busy_ns()) / (double)uart.bytes_to_mcu);
+    printf("(host figures: compare the two profiles with each other, not with the target)\n\n");
+
+    // The link carries what the profile asks for (the few command ACKs aside) -------------
+    EXPECT_NEAR(bytes_per_s, expected, expected * 0.05);
+    EXPECT_GE(receiver.gga_sent_us.size(), (size_t)(seconds - 1));
+
+    // One interrupt per byte, one thread wake-up per sentence that ends in the ring
+    EXPECT_EQ(uart.isr_calls, uart.bytes_to_mcu);
+    if (rates == std::vector<int>({0, 0, 0, 1, 0, 0})) {
+        EXPECT_LE(bytes_per_s, gga_length * 1.05);
+        EXPECT_LT(sim::wakeups() / seconds, 1.1);
+    }
+}
+// TESTS END ===========================================================================
@@ -0,0 +1,164 @@
+/* Host test of the GPS power state machine (GPS_POWER_SAVE) on a simulated receiver: cold start
+   at boot, standby after each fix, wake-up ahead of the uplinks, hot starts and the fix deadline */
+
+// LIBRARIES ---------------------------------------------------------------------------
+#include "mbed.h"
+#include "gps_thread.h"
+#include "gps_receiver.h"
+#include "unittest.h"
+#include <math.h>
+
+// MACROS ------------------------------------------------------------------------------
+#define RUN_TIME_US        (1201 * 1000000ULL)                        // 20 uplinks, the last one included
+#define COLD_START_MS      45000                                      // Longer than GPS_FIX_DEADLINE
+#define SKY_OFF_US         (300 * 1000000ULL)                         // Indoors for the cycle of the 360 s uplink
+#define SKY_ON_US          (400 * 1000000ULL)
+
+// TYPES -------------------------------------------------------------------------------
+typedef struct {
+    uint64_t time_us;
+    bool fix;                                                         // Snapshot with a fix, within GPS_FIX_VALIDITY
+    double age_s;
+} uplink_t;
+
+// =====================================================================================
+// HELPERS
+// =====================================================================================
+static double seconds(uint64_t time_us){
+    return time_us / 1e6;
+}
+
+static uint64_t us(Kernel::Clock::duration duration){
+    return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+}
+
+// The sender: takes the position for the payload, then reports the uplink as sent
+static void uplink(std::vector<uplink_t> *uplinks){
+    gps_snapshot_t snapshot;
+    uplink_t sent = {sim::now_us(), false, 0};
+
+    if (get_gps_snapshot(&snapshot) && snapshot.fix > 0 && get_gps_fix_age(snapshot) <= GPS_FIX_VALIDITY) {
+        sent.fix = true;
+        sent.age_s = std::chrono::duration<double>(get_gps_fix_age(snapshot)).count();
+    }
+    uplinks->push_back(sent);
+    gps_uplink_sent();
+
+    sim::schedule(sim::now_us() + us(GPS_CYCLE_PERIOD), [uplinks]{ uplink(uplinks); });
+}
+
+// Time from a wake-up to the first fix that followed it, -1 if none did before the next standby
+static double time_to_fix_s(const GpsReceiver &receiver, uint64_t wake_us){
+    for (size_t i = 0; i < receiver.first_fix_us.size(); i++) {
+        if (receiver.first_fix_us[i] >= wake_us) {
+            for (size_t j = 0; j < receiver.standby_us.size(); j++) {
+                if (receiver.standby_us[j] > wake_us && receiver.standby_us[j] < receiver.first_fix_us[i]) {
+                    return -1;
+                }
+            }
+            return seconds(receiver.first_fix_us[i] - wake_us);
+        }
+    }
+    return -1;
+}
+// HELPERS END =========================================================================
+
+// =====================================================================================
+// TESTS
+// =====================================================================================
+TEST(GpsPower, ColdStartThenHotCycles){
+    std::vector<std::string> log = GpsReceiver::load_log(SN_DATA_DIR "/gps_log.nmea");
+    std::vector<uplink_t> uplinks;
+    GpsReceiver::Config config;
+    bool cold_start_fits = GPS_COLD_START_DEADLINE > std::chrono::milliseconds(COLD_START_MS);
+    ASSERT_FALSE(log.empty());
+    ASSERT_TRUE(GPS_POWER_SAVE);
+
+    config.cold_start_ms = COLD_START_MS;
+    config.profile = {0, 0, 0, 1, 0, 0};
+    sim::reset();
+    GpsReceiver receiver(log, config);
+    receiver.power_on();
+    sim::schedule(us(GPS_CYCLE_PERIOD), [&uplinks]{ uplink(&uplinks); });
+    sim::schedule(SKY_OFF_US, [&receiver]{ receiver.set_sky(false); });
+    sim::schedule(SKY_ON_US, [&receiver]{ receiver.set_sky(true); });
+    sim::start_run(RUN_TIME_US);
+    EXPECT_THROW(gps_th_routine(), sim::SimulationEnd);
+
+    gps_power_stats_t stats;
+    get_gps_power_stats(&stats);
+
+    size_t fresh = 0, with_fix = 0;
+    double ttf_sum = 0;
+    size_t hot_cycles = 0;
+    for (size_t i = 0; i < uplinks.size(); i++) {
+        with_fix += uplinks[i].fix ? 1 : 0;
+        fresh += (uplinks[i].fix && uplinks[i].age_s <= std::chrono::duration<double>(GPS_WAKE_LEAD).count()) ? 1 : 0;
+    }
+    for (size_t i = 0; i < receiver.wake_us.size(); i++) {
+        double ttf = time_to_fix_s(receiver, receiver.wake_us[i]);
+
+        if (ttf >= 0 && !receiver.first_fix_us.empty() && receiver.first_fix_us[0] < receiver.wake_us[i]) {
+            ttf_sum += ttf;
+            hot_cycles++;
+        }
+    }
+
+    printf("\nGPS power save, cold start %d ms, cold deadline %lld ms, hot deadline %lld ms, %.0f s simulated\n",
+           COLD_START_MS, (long long)std::chrono::duration_cast<std::chrono::milliseconds>(GPS_COLD_START_DEADLINE).count(),
+           (long long)std::chrono::duration_cast<std::chrono::milliseconds>(GPS_FIX_DEADLINE).count(), seconds(RUN_TIME_US));
+    printf("First fix at                        %10.1f s\n", receiver.first_fix_us.empty() ? -1.0 : seconds(receiver.first_fix_us[0]));
+    printf("Acquisitions (boot included)        %10lu\n", (unsigned long)stats.cycles);
+    printf("Timeouts                            %10lu\n", (unsigned long)stats.timeouts);
+    printf("Hot start time to fix, mean         %10.2f s over %zu cycles\n", hot_cycles ? ttf_sum / hot_cycles : 0.0, hot_cycles);
+    printf("Receiver on time                    %10.1f s (%.1f %%)\n", seconds(receiver.on_time_us()),
+           100.0 * receiver.on_time_us() / RUN_TIME_US);
+    printf("Uplinks with a fix / fresh (<= lead) %9zu / %zu of %zu\n\n", with_fix, fresh, uplinks.size());
+
+    ASSERT_EQ(uplinks.size(), (size_t)20);
+    EXPECT_EQ(stats.cycles, receiver.wake_us.size() + 1);
+
+    if (!cold_start_fits) {
+        // The receiver needs longer than the deadline: every cycle restarts from cold and gives up
+        EXPECT_TRUE(receiver.first_fix_us.empty());
+        EXPECT_GE(stats.timeouts + 1, stats.cycles);
+        EXPECT_EQ(with_fix, (size_t)0);
+        return;
+    }
+
+    // Boot: the cold start is given the time it needs, standby right after the fix ---------
+    ASSERT_FALSE(receiver.first_fix_us.empty());
+    ASSERT_FALSE(receiver.standby_us.empty());
+    EXPECT_NEAR(seconds(receiver.first_fix_us[0]), COLD_START_MS / 1000.0, 1.5);
+    EXPECT_GE(receiver.standby_us[0], receiver.first_fix_us[0]);
+    EXPECT_LT(seconds(receiver.standby_us[0] - receiver.first_fix_us[0]), 0.5);
+
+    // Every wake-up GPS_WAKE_LEAD before an uplink, hot starts within a few epochs ---------
+    for (size_t i = 0; i < receiver.wake_us.size(); i++) {
+        double phase = fmod(seconds(receiver.wake_us[i] + us(GPS_WAKE_LEAD)), seconds(us(GPS_CYCLE_PERIOD)));
+
+        EXPECT_LT(std::min(phase, seconds(us(GPS_CYCLE_PERIOD)) - phase), 0.1);
+    }
+    EXPECT_EQ(hot_cycles, receiver.wake_us.size() - 1);                // All but the indoor one
+    EXPECT_LE(ttf_sum / hot_cycles, config.hot_start_ms / 1000.0 + 1.2);
+    EXPECT_GE(stats.last_time_to_fix_ms, config.hot_start_ms);
+    EXPECT_LE(stats.last_time_to_fix_ms, config.hot_start_ms + 1200);
+
+    // Indoors: the hot deadline applies once a fix was made, then back to standby -----------
+    EXPECT_EQ(stats.timeouts, 1u);
+    bool timeout_standby = false;
+    for (size_t i = 0; i < receiver.standby_us.size(); i++) {
+        double expected = 355.0 + std::chrono::duration<double>(GPS_FIX_DEADLINE).count();
+
+        timeout_standby |= fabs(seconds(receiver.standby_us[i]) - expected) < 0.5;
+    }
+    EXPECT_TRUE(timeout_standby);
+
+    // Every uplink carries a fix taken just before it, except the one of the indoor cycle:
+    // the receiver is still sending GGA without a fix when it goes out
+    EXPECT_EQ(with_fix, uplinks.size() - 1);
+    EXPECT_EQ(fresh, uplinks.size() - 1);
+    EXPECT_FALSE(uplinks[5].fix);
+    EXPECT_LT((double)receiver.on_time_us() / RUN_TIME_US, 0.12);
+}
+// TESTS END ===========================================================================
@@ -0,0 +1,143 @@
+/* Host timing test: GGA reception by the former 500 ms polling loop against the RX interrupt
+   ring of gps_thread.cpp, on the same simulated receiver */
+
+// LIBRARIES ---------------------------------------------------------------------------
+#include "mbed.h"
+#include "gps_thread.h"
+#include "nmea_parser.h"
+#include "gps_receiver.h"
+#include "unittest.h"
+#include <algorithm>
+
+// MACROS ------------------------------------------------------------------------------
+#define RUN_TIME_US        (120 * 1000000ULL)                         // Simulated time of each scenario
+#define POLL_PERIOD        500ms                                      // GPS_THREAD_SLEEP of the polling loop
+#define POLL_PHASES        10                                         // Polling runs, started at every 50 ms of the period
+#define PROBE_PERIOD_US    1000                                       // Resolution of the RX interrupt latency
+
+// TYPES -------------------------------------------------------------------------------
+typedef struct {
+    size_t sentences;                                                 // GGA made available to the application
+    double sentence_mean_ms;                                          // Last byte on the wire to available
+    double sentence_max_ms;
+    double epoch_mean_ms;                                             // Fix computed (start of the epoch) to available
+    double wakeups_per_s;                                             // GPS thread returns from a sleep or a wait
+} reception_t;
+
+// =====================================================================================
+// HELPERS
+// =====================================================================================
+static reception_t summarise(const GpsReceiver &receiver, const std::vector<uint64_t> &available){
+    reception_t result = {};
+    size_t count = std::min(available.size(), receiver.gga_sent_us.size());
+
+    for (size_t i = 0; i < count; i++) {
+        double sentence_ms = (available[i] - receiver.gga_sent_us[i]) / 1000.0;
+
+        result.sentence_mean_ms += sentence_ms / count;
+        result.sentence_max_ms = std::max(result.sentence_max_ms, sentence_ms);
+        result.epoch_mean_ms += (available[i] - receiver.epoch_us[i]) / 1000.0 / count;
+    }
+    result.sentences = available.size();
+    result.wakeups_per_s = sim::wakeups() / (RUN_TIME_US / 1e6);
+    return result;
+}
+
+static GpsReceiver::Config receiver_config(){
+    GpsReceiver::Config config;
+
+    config.cold_start_ms = 0;                                         // Fix from the first epoch, only the reception is compared
+    config.profile = {0, 0, 0, 1, 0, 0};                              // GGA only, as pushed by settingNMEAOutput()
+    return config;
+}
+
+// The GPS thread before the RX interrupt: drain what the serial driver buffered, sleep 500 ms
+static void polling_loop(std::vector<uint64_t> &available, Kernel::Clock::duration phase){
+    UnbufferedSerial serial(GPS_TX, GPS_RX, GPS_BAUD_RATE);
+    NMEAParser nmea(GPS_ACCEPTED_TALKERS);
+    char c;
+
+    ThisThread::sleep_for(phase);                                     // The latency depends on where the epochs fall in the period
+    while (true) {
+        while (serial.read(&c, 1) > 0) {
+            if (nmea.feed(c) == NMEA_GGA) {
+                available.push_back(sim::now_us());
+            }
+        }
+        ThisThread::sleep_for(POLL_PERIOD);
+    }
+}
+
+// The published snapshot is checked every PROBE_PERIOD_US, its timestamp only has ms resolution
+static void probe_snapshot(std::vector<uint64_t> *available, Kernel::Clock::time_point *last){
+    gps_snapshot_t snapshot;
+
+    if (get_gps_snapshot(&snapshot) && snapshot.timestamp != *last) {
+        *last = snapshot.timestamp;
+        available->push_back(sim::now_us());
+    }
+    sim::schedule(sim::now_us() + PROBE_PERIOD_US, [available, last]{ probe_snapshot(available, last); });
+}
+// HELPERS END =========================================================================
+
+// =====================================================================================
+// TESTS
+// =====================================================================================
+TEST(GpsReception, InterruptRingAgainstPolling){
+    std::vector<std::string> log = GpsReceiver::load_log(SN_DATA_DIR "/gps_log.nmea");
+    ASSERT_FALSE(log.empty());
+
+    // Polling loop, averaged over the phases ------------------------------------------
+    reception_t polling = {};
+    for (int phase = 0; phase < POLL_PHASES; phase++) {
+        std::vector<uint64_t> polled;
+        sim::reset();
+        GpsReceiver polled_receiver(log, receiver_config());
+        polled_receiver.power_on();
+        sim::start_run(RUN_TIME_US);
+        EXPECT_THROW(polling_loop(polled, std::chrono::milliseconds(phase * 500 / POLL_PHASES)), sim::SimulationEnd);
+
+        reception_t run = summarise(polled_receiver, polled);
+        EXPECT_GE(run.sentences + 1, polled_receiver.gga_sent_us.size());   // Every sentence gets through
+
+        polling.sentences += run.sentences;
+        polling.sentence_mean_ms += run.sentence_mean_ms / POLL_PHASES;
+        polling.sentence_max_ms = std::max(polling.sentence_max_ms, run.sentence_max_ms);
+        polling.epoch_mean_ms += run.epoch_mean_ms / POLL_PHASES;
+        polling.wakeups_per_s += run.wakeups_per_s / POLL_PHASES;
+    }
+    polling.sentences /= POLL_PHASES;
+
+    // RX interrupt and ring ----------------------------------------------------------
+    std::vector<uint64_t> published;
+    Kernel::Clock::time_point last_snapshot;
+    sim::reset();
+    GpsReceiver receiver(log, receiver_config());
+    receiver.power_on();
+    probe_snapshot(&published, &last_snapshot);
+    sim::start_run(RUN_TIME_US);
+    EXPECT_THROW(gps_th_routine(), sim::SimulationEnd);
+    reception_t interrupt = summarise(receiver, published);
+
+    printf("\nGGA reception, %d baud, 1 Hz, GGA only, %llu s simulated (polling: mean of %d phases)\n", GPS_BAUD_RATE,
+           RUN_TIME_US / 1000000, POLL_PHASES);
+    printf("                                       polling 500 ms   RX interrupt\n");
+    printf("GGA sentences available               %14zu %14zu\n", polling.sentences, interrupt.sentences);
+    printf("End of sentence to available, mean ms %14.1f %14.1f\n", polling.sentence_mean_ms, interrupt.sentence_mean_ms);
+    printf("End of sentence to available, max ms  %14.1f %14.1f\n", polling.sentence_max_ms, interrupt.sentence_max_ms);
+    printf("Fix (epoch start) to available, mean ms %12.1f %14.1f\n", polling.epoch_mean_ms, interrupt.epoch_mean_ms);
+    printf("GPS thread wake-ups per second        %14.2f %14.2f\n", polling.wakeups_per_s, interrupt.wakeups_per_s);
+    printf("(RX interrupt latencies are rounded up to the %d us probe period)\n\n", PROBE_PERIOD_US);
+
+    EXPECT_GE(interrupt.sentences + 1, receiver.gga_sent_us.size());
+
+    // The ring hands a sentence over as soon as its '\n' is in, polling makes it wait for the next turn
+    EXPECT_LE(interrupt.sentence_max_ms, PROBE_PERIOD_US / 1000.0);
+    EXPECT_NEAR(polling.sentence_mean_ms, 250.0, 30.0);
+    EXPECT_LE(polling.sentence_max_ms, 500.0 + 1.0);
+
+    // One wake-up per sentence instead of two per second whatever arrives
+    EXPECT_NEAR(polling.wakeups_per_s, 2.0, 0.05);
+    EXPECT_LT(interrupt.wakeups_per_s, 1.1);
+}
+// TESTS END ===========================================================================
@@ -0,0 +1,95 @@
+/* File for the host test harness: GoogleTest-style macros without the dependency */
+
+// LIBRARIES ------------------------------------------------------------------------------------
+#include <stdio.h>
+#include <math.h>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// LIBRARY GUARD --------------------------------------------------------------------------------
+#ifndef UNITTEST_H
+#define UNITTEST_H
+
+// ==============================================================================================
+// REGISTRY
+// ==============================================================================================
+namespace unittest {
+
+typedef void (*test_function_t)();
+
+struct TestCase {
+    const char *name;
+    test_function_t function;
+};
+
+std::vector<TestCase> &tests();
+void fail(const char *file, int line, const std::string &message);    // Marks the running test as failed
+
+struct Registration {
+    Registration(const char *name, test_function_t function){ tests().push_back(TestCase{name, function}); }
+};
+
+template <typename A, typename B>
+std::string describe(const char *expression, const A &a, const B &b){
+    std::ostringstream text;
+
+    text << expression << " (" << a << " vs " << b << ")";
+    return text.str();
+}
+
+}
+// REGISTRY END =================================================================================
+
+// ==============================================================================================
+// MACROS
+// ==============================================================================================
+#define TEST(suite, name)                                                                        \
+    static void suite##_##name();                                                                \
+    static unittest::Registration suite##_##name##_registration(#suite "." #name, suite##_##name); \
+    static void suite##_##name()
+
+#define UNITTEST_CHECK(condition, message, on_failure)                                           \
+    do {                                                                                         \
+        if (!(condition)) {                                                                      \
+            unittest::fail(__FILE__, __LINE__, message);                                         \
+            on_failure;                                                                          \
+        }                                                                                        \
+    } while (0)
+
+#define UNITTEST_COMPARE(a, op, b, on_failure)                                                   \
+    do {                                                                                         \
+        const auto unittest_a = (a);                                                             \
+        const auto unittest_b = (b);                                                             \
+        UNITTEST_CHECK(unittest_a op unittest_b, unittest::describe(#a " " #op " " #b, unittest_a, unittest_b), on_failure); \
+    } while (0)
+
+#define EXPECT_TRUE(condition)  UNITTEST_CHECK(condition, #condition, (void)0)
+#define EXPECT_FALSE(condition) UNITTEST_CHECK(!(condition), "!(" #condition ")", (void)0)
+#define EXPECT_EQ(a, b)         UNITTEST_COMPARE(a, ==, b, (void)0)
+#define EXPECT_NE(a, b)         UNITTEST_COMPARE(a, !=, b, (void)0)
+#define EXPECT_LT(a, b)         UNITTEST_COMPARE(a, <, b, (void)0)
+#define EXPECT_LE(a, b)         UNITTEST_COMPARE(a, <=, b, (void)0)
+#define EXPECT_GT(a, b)         UNITTEST_COMPARE(a, >, b, (void)0)
+#define EXPECT_GE(a, b)         UNITTEST_COMPARE(a, >=, b, (void)0)
+#define EXPECT_NEAR(a, b, tolerance) UNITTEST_CHECK(fabs((double)(a) - (double)(b)) <= (tolerance), \
+                                                    unittest::describe("|" #a " - " #b "| <= " #tolerance, a, b), (void)0)
+
+#define ASSERT_TRUE(condition)  UNITTEST_CHECK(condition, #condition, return)
+#define ASSERT_FALSE(condition) UNITTEST_CHECK(!(condition), "!(" #condition ")", return)
+#define ASSERT_EQ(a, b)         UNITTEST_COMPARE(a, ==, b, return)
+#define ASSERT_GT(a, b)         UNITTEST_COMPARE(a, >, b, return)
+
+#define EXPECT_THROW(statement, exception)                                                       \
+    do {                                                                                         \
+        bool unittest_thrown = false;                                                            \
+        try {                                                                                    \
+            statement;                                                                           \
+        } catch (exception &) {                                                                  \
+            unittest_thrown = true;                                                              \
+        }                                                                                        \
+        UNITTEST_CHECK(unittest_thrown, #statement " throws " #exception, (void)0);              \
+    } while (0)
+// MACROS END ===================================================================================
+
+#endif
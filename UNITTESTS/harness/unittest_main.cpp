@@ -0,0 +1,37 @@
+/* File for the host test harness runner: every TEST() of the executable, in definition order */
+
+// LIBRARIES ---------------------------------------------------------------------------
+#include "unittest.h"
+
+static int failures_in_test = 0;
+
+namespace unittest {
+
+std::vector<TestCase> &tests(){
+    static std::vector<TestCase> registry;
+    return registry;
+}
+
+void fail(const char *file, int line, const std::string &message){
+    printf("%s:%d: Failure: %s\n", file, line, message.c_str());
+    failures_in_test++;
+}
+
+}
+
+int main(){
+    int failed = 0;
+
+    for (size_t i = 0; i < unittest::tests().size(); i++) {
+        const unittest::TestCase &test = unittest::tests()[i];
+
+        printf("[ RUN      ] %s\n", test.name);
+        failures_in_test = 0;
+        test.function();
+        printf("%s %s\n", failures_in_test == 0 ? "[       OK ]" : "[  FAILED  ]", test.name);
+        failed += (failures_in_test != 0) ? 1 : 0;
+    }
+
+    printf("[==========] %zu tests, %d failed\n", unittest::tests().size(), failed);
+    return failed == 0 ? 0 : 1;
+}
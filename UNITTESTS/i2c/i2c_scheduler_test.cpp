@@ -0,0 +1,231 @@
+/* Host test of the I2C scheduler on the simulated bus: queued transactions back to back with no
+   idle time, round robin between a client bursting its FIFO and one doing single reads, the
+   retries asked by the caller (none for the Si7021 polling read) and no deep sleep lock held */
+
+// LIBRARIES ---------------------------------------------------------------------------
+#include "mbed.h"
+#include "i2c_scheduler.h"
+#include "si7021.h"
+#include "unittest.h"
+
+// MACROS ------------------------------------------------------------------------------
+#define MEMORY_ADDRESS     (0x50 << 1)                                // A device that always answers
+#define ABSENT_ADDRESS     (0x60 << 1)                                // Nothing there: NACK
+#define BURST_LENGTH       192                                        // A full MMA8451Q FIFO
+#define BURSTS             8
+#define SINGLE_READS       4
+#define QUEUED             50                                         // Per client, throughput test
+
+// =====================================================================================
+// HELPERS
+// =====================================================================================
+class MemoryDevice : public sim::I2CDevice {                          // Reads give the byte index
+public:
+    MemoryDevice(int address) : _address(address) { sim::i2c_bus().attach(address, this); }
+    ~MemoryDevice(){ sim::i2c_bus().detach(_address); }
+
+    bool write(const char *, int) override { return true; }
+    bool read(char *data, int length) override {
+        for (int i = 0; i < length; i++) {
+            data[i] = (char)i;
+        }
+        return true;
+    }
+
+private:
+    int _address;
+};
+
+class ConvertingSi7021 : public sim::I2CDevice {                      // Measurement never ready: reads NACK
+public:
+    ConvertingSi7021(){ sim::i2c_bus().attach(SI7021_ADDR, this); }
+    ~ConvertingSi7021(){ sim::i2c_bus().detach(SI7021_ADDR); }
+
+    bool write(const char *, int) override { return true; }
+    bool read(char *, int) override { return false; }
+};
+
+static void count_done(i2c_transaction_t *transaction){
+    static_cast<Semaphore *>(transaction->context)->release();
+}
+
+static void queue_read(I2CScheduler &scheduler, uint8_t client, i2c_transaction_t *transaction, char *rx, int length,
+                       Semaphore *done){
+    memset(transaction, 0, sizeof(*transaction));
+    transaction->address = MEMORY_ADDRESS;
+    transaction->rx = rx;
+    transaction->rx_length = length;
+    transaction->done = count_done;
+    transaction->context = done;
+    scheduler.submit(client, transaction);
+}
+
+static size_t reads_of_length(int length){
+    size_t count = 0;
+
+    for (size_t i = 0; i < sim::i2c_bus().log.size(); i++) {
+        count += (sim::i2c_bus().log[i].rx_length == length) ? 1 : 0;
+    }
+    return count;
+}
+// HELPERS END =========================================================================
+
+// =====================================================================================
+// TESTS
+// =====================================================================================
+TEST(I2CScheduler, NoDeepSleepLock){
+    I2C i2c(PB_9, PB_8);
+    I2CScheduler scheduler(i2c);
+
+    sim::reset();
+    uint32_t locks = sim::deep_sleep_locks();
+    scheduler.start();
+    EXPECT_EQ(sim::deep_sleep_locks(), locks);
+}
+
+TEST(I2CScheduler, QueuedTransactionsBackToBack){
+    I2C i2c(PB_9, PB_8);
+    I2CScheduler scheduler(i2c);
+    MemoryDevice memory(MEMORY_ADDRESS);
+    uint8_t clients[2] = {scheduler.add_client(), scheduler.add_client()};
+    static i2c_transaction_t transactions[2][QUEUED];
+    static char rx[2][QUEUED][16];
+    Semaphore done(0);
+
+    sim::reset();
+    scheduler.start();
+    sim::i2c_bus().clear_log();
+
+    uint64_t start_us = sim::now_us();
+    {
+        CriticalSectionLock lock;                                     // All queued before the bus thread picks one
+
+        for (int i = 0; i < QUEUED; i++) {
+            for (int c = 0; c < 2; c++) {
+                queue_read(scheduler, clients[c], &transactions[c][i], rx[c][i], 16, &done);
+            }
+        }
+    }
+    for (int i = 0; i < 2 * QUEUED; i++) {
+        done.acquire();
+    }
+    uint64_t elapsed_us = sim::now_us() - start_us;
+
+    // The bus never waits for the scheduler: one transfer starts when the last one ends ------
+    const std::vector<sim::I2CRecord> &log = sim::i2c_bus().log;
+    uint64_t bus_us = 0;
+    ASSERT_EQ(log.size(), (size_t)(2 * QUEUED));
+    for (size_t i = 0; i < log.size(); i++) {
+        bus_us += log[i].end_us - log[i].start_us;
+        if (i > 0) {
+            EXPECT_EQ(log[i].start_us, log[i - 1].end_us);
+        }
+    }
+    EXPECT_EQ(elapsed_us, bus_us);
+    EXPECT_EQ(bus_us, 2 * QUEUED * sim::i2c_bus().bus_time_us(0, 16));
+
+    for (int c = 0; c < 2; c++) {
+        i2c_stats_t stats;
+
+        ASSERT_TRUE(scheduler.get_stats(clients[c], &stats));
+        EXPECT_EQ(stats.transactions, (uint32_t)QUEUED);
+        EXPECT_EQ(stats.errors, 0u);
+        EXPECT_EQ(stats.bytes, (uint32_t)(QUEUED * 16));
+        EXPECT_EQ(stats.bus_us_total, (uint32_t)(bus_us / 2));
+        EXPECT_EQ(transactions[c][QUEUED - 1].result, 0);
+        EXPECT_EQ(rx[c][QUEUED - 1][15], 15);
+    }
+}
+
+TEST(I2CScheduler, BurstsDoNotStarveSingleReads){
+    I2C i2c(PB_9, PB_8);
+    I2CScheduler scheduler(i2c);
+    MemoryDevice memory(MEMORY_ADDRESS);
+    uint8_t bursting = scheduler.add_client();
+    uint8_t polling = scheduler.add_client();
+    static i2c_transaction_t bursts[BURSTS], singles[SINGLE_READS];
+    static char burst_rx[BURSTS][BURST_LENGTH], single_rx[SINGLE_READS][1];
+    Semaphore done(0);
+
+    sim::reset();
+    scheduler.start();
+    sim::i2c_bus().clear_log();
+    {
+        CriticalSectionLock lock;
+
+        for (int i = 0; i < BURSTS; i++) {
+            queue_read(scheduler, bursting, &bursts[i], burst_rx[i], BURST_LENGTH, &done);
+        }
+        for (int i = 0; i < SINGLE_READS; i++) {
+            queue_read(scheduler, polling, &singles[i], single_rx[i], 1, &done);
+        }
+    }
+    for (int i = 0; i < BURSTS + SINGLE_READS; i++) {
+        done.acquire();
+    }
+
+    // One of the other client's transactions between two of its own, never a whole FIFO ------
+    const std::vector<sim::I2CRecord> &log = sim::i2c_bus().log;
+    ASSERT_EQ(log.size(), (size_t)(BURSTS + SINGLE_READS));
+    for (size_t i = 0; i + 1 < 2 * SINGLE_READS; i++) {
+        EXPECT_NE(log[i].rx_length, log[i + 1].rx_length);
+    }
+    EXPECT_EQ(reads_of_length(1), (size_t)SINGLE_READS);
+    EXPECT_EQ(reads_of_length(BURST_LENGTH), (size_t)BURSTS);
+
+    uint64_t burst_us = sim::i2c_bus().bus_time_us(0, BURST_LENGTH);
+    uint64_t single_us = sim::i2c_bus().bus_time_us(0, 1);
+    for (int i = 0; i < SINGLE_READS; i++) {
+        uint32_t wait_us = singles[i].started_us - singles[i].queued_us;
+
+        EXPECT_LE(wait_us, (uint32_t)((i + 1) * burst_us + i * single_us));   // Not BURSTS bursts
+    }
+
+    i2c_stats_t stats;
+    ASSERT_TRUE(scheduler.get_stats(polling, &stats));
+    printf("\nSingle reads behind %d bursts of %d bytes: wait max %lu us, one burst is %llu us\n\n", BURSTS, BURST_LENGTH,
+           (unsigned long)stats.wait_us_max, (unsigned long long)burst_us);
+    EXPECT_LT(stats.wait_us_max, (uint32_t)(SINGLE_READS * (burst_us + single_us)));
+}
+
+TEST(I2CScheduler, RetriesAsked){
+    I2C i2c(PB_9, PB_8);
+    I2CScheduler scheduler(i2c);
+    uint8_t client = scheduler.add_client();
+    char data[2];
+    i2c_stats_t stats;
+
+    sim::reset();
+    scheduler.start();
+
+    sim::i2c_bus().clear_log();
+    EXPECT_NE(scheduler.read(client, ABSENT_ADDRESS, data, 2), 0);
+    EXPECT_EQ(sim::i2c_bus().log.size(), (size_t)(1 + I2C_SCHEDULER_RETRIES));
+
+    sim::i2c_bus().clear_log();
+    EXPECT_NE(scheduler.read(client, ABSENT_ADDRESS, data, 2, 0), 0);
+    EXPECT_EQ(sim::i2c_bus().log.size(), (size_t)1);
+
+    ASSERT_TRUE(scheduler.get_stats(client, &stats));
+    EXPECT_EQ(stats.transactions, 2u);
+    EXPECT_EQ(stats.errors, 2u);
+    EXPECT_EQ(stats.retries, (uint32_t)I2C_SCHEDULER_RETRIES);
+}
+
+TEST(I2CScheduler, Si7021PollIsOneTransaction){
+    I2C i2c(PB_9, PB_8);
+    I2CScheduler scheduler(i2c);
+    ConvertingSi7021 device;
+    Si7021 si7021(scheduler);
+    uint16_t humidity, temperature;
+
+    sim::reset();
+    scheduler.start();
+    ASSERT_TRUE(si7021.start_measurement());
+
+    sim::i2c_bus().clear_log();
+    EXPECT_FALSE(si7021.read_measurement(&humidity, &temperature));   // Still converting
+    ASSERT_EQ(sim::i2c_bus().log.size(), (size_t)1);
+    EXPECT_FALSE(sim::i2c_bus().log[0].ack);
+}
+// TESTS END ===========================================================================
@@ -0,0 +1,176 @@
+/* Host benchmark of NMEAParser::coordinate_e7() against the float conversion it replaced
+   (atof, then degrees + minutes / 60.0f): error against an exact decoding, and cost */
+
+// LIBRARIES ---------------------------------------------------------------------------
+#include "mbed.h"
+#include "nmea_parser.h"
+#include "unittest.h"
+#include <chrono>
+#include <random>
+#include <stdlib.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC           1
+#endif
+
+// MACROS ------------------------------------------------------------------------------
+#define COORDINATES        20000                                      // Random ddmm.mmmm / dddmm.mmmmmm values
+#define REPETITIONS        200                                        // Passes per measurement
+#define RUNS               5                                          // Best of, against scheduling noise
+#define METRES_PER_E7      0.0111319                                  // 1e-7 deg of latitude (or of longitude on the equator)
+
+// TYPES -------------------------------------------------------------------------------
+typedef struct {
+    char text[16];                                                    // As sent by the receiver
+    uint32_t ddmm;                                                    // As accumulated by the parser
+    uint32_t frac;
+    uint8_t frac_digits;
+    long double exact_e7;
+} coordinate_t;
+
+typedef struct {
+    double mean_e7;
+    double max_e7;
+} conversion_error_t;
+
+// GLOBAL VARIABLES --------------------------------------------------------------------
+static volatile int64_t sink;                                         // Keeps the results alive
+
+// =====================================================================================
+// HELPERS
+// =====================================================================================
+static uint64_t cycles(){
+#ifdef HAVE_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static std::vector<coordinate_t> coordinates(){
+    std::mt19937 random(2026);
+    std::vector<coordinate_t> result(COORDINATES);
+
+    for (size_t i = 0; i < result.size(); i++) {
+        coordinate_t &c = result[i];
+        uint32_t scale;
+
+        c.frac_digits = (i % 2) ? 6 : 4;                              // MTK default and high precision outputs
+        scale = (c.frac_digits == 6) ? 1000000 : 10000;
+        c.ddmm = (random() % 180) * 100 + random() % 60;
+        c.frac = random() % scale;
+        snprintf(c.text, sizeof(c.text), "%05u.%0*u", (unsigned)c.ddmm, c.frac_digits, (unsigned)c.frac);
+        c.exact_e7 = (c.ddmm / 100) * 1e7L + ((c.ddmm % 100) * (long double)scale + c.frac) * 1e7L / (60.0L * scale);
+    }
+    return result;
+}
+
+// The conversion of parse_GPS_data() before the integer parser
+static float float_degrees(float raw){
+    int degrees = (int)(raw / 100);
+    float minutes = raw - (degrees * 100);
+
+    return degrees + minutes / 60.0f;
+}
+
+// Digits as NMEAParser::accumulate() collects them
+static int32_t integer_from_text(const char *text){
+    uint32_t ddmm = 0, frac = 0;
+    uint8_t frac_digits = 0;
+
+    for (; *text != '.'; text++) {
+        ddmm = ddmm * 10 + (*text - '0');
+    }
+    for (text++; *text != '\0' && frac_digits < NMEA_COORD_DECIMALS; text++, frac_digits++) {
+        frac = frac * 10 + (*text - '0');
+    }
+    return NMEAParser::coordinate_e7(ddmm, frac, frac_digits);
+}
+
+// Best ns and TSC cycles per conversion
+template <typename Convert>
+static void measure(const std::vector<coordinate_t> &input, Convert convert, double *ns, double *tsc){
+    for (int run = 0; run < RUNS; run++) {
+        int64_t sum = 0;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        uint64_t start_cycles = cycles();
+
+        for (int repetition = 0; repetition < REPETITIONS; repetition++) {
+            for (size_t i = 0; i < input.size(); i++) {
+                sum += convert(input[i]);
+            }
+        }
+
+        uint64_t elapsed_cycles = cycles() - start_cycles;
+        double elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        double conversions = 1.0 * REPETITIONS * input.size();
+
+        sink = sink + sum;
+        if (run == 0 || elapsed_ns / conversions < *ns) {
+            *ns = elapsed_ns / conversions;
+            *tsc = elapsed_cycles / conversions;
+        }
+    }
+}
+// HELPERS END =========================================================================
+
+// =====================================================================================
+// TESTS
+// =====================================================================================
+TEST(CoordinateBench, IntegerAgainstFloat){
+    std::vector<coordinate_t> input = coordinates();
+    conversion_error_t integer = {}, single = {};
+    size_t float_worse = 0;
+
+    // Precision ------------------------------------------------------------------------
+    for (size_t i = 0; i < input.size(); i++) {
+        double integer_error = fabsl(NMEAParser::coordinate_e7(input[i].ddmm, input[i].frac, input[i].frac_digits) - input[i].exact_e7);
+        double float_error = fabsl(float_degrees((float)atof(input[i].text)) * 1e7L - input[i].exact_e7);
+
+        integer.mean_e7 += integer_error / input.size();
+        integer.max_e7 = std::max(integer.max_e7, integer_error);
+        single.mean_e7 += float_error / input.size();
+        single.max_e7 = std::max(single.max_e7, float_error);
+        float_worse += (float_error > integer_error) ? 1 : 0;
+    }
+
+    // Cost -----------------------------------------------------------------------------
+    double integer_ns = 0, integer_tsc = 0, float_ns = 0, float_tsc = 0;
+    double integer_text_ns = 0, integer_text_tsc = 0, float_text_ns = 0, float_text_tsc = 0;
+    std::vector<float> raw(input.size());
+
+    for (size_t i = 0; i < input.size(); i++) {
+        raw[i] = (float)atof(input[i].text);
+    }
+    const float *raw_values = raw.data();
+    const coordinate_t *first = input.data();
+
+    measure(input, [](const coordinate_t &c){ return NMEAParser::coordinate_e7(c.ddmm, c.frac, c.frac_digits); },
+            &integer_ns, &integer_tsc);
+    measure(input, [raw_values, first](const coordinate_t &c){ return (int32_t)(float_degrees(raw_values[&c - first]) * 1e7f); },
+            &float_ns, &float_tsc);
+    measure(input, [](const coordinate_t &c){ return integer_from_text(c.text); }, &integer_text_ns, &integer_text_tsc);
+    measure(input, [](const coordinate_t &c){ return (int32_t)(float_degrees((float)atof(c.text)) * 1e7f); },
+            &float_text_ns, &float_text_tsc);
+
+    printf("\nCoordinate conversion, %d random values (half 4, half 6 decimals of minute), best of %d runs\n",
+           COORDINATES, RUNS);
+    printf("                                     coordinate_e7   float (atof, /60.0f)\n");
+    printf("Mean error, 1e-7 deg               %14.3f %14.1f\n", integer.mean_e7, single.mean_e7);
+    printf("Max error, 1e-7 deg                %14.3f %14.1f\n", integer.max_e7, single.max_e7);
+    printf("Max error, m                       %14.4f %14.3f\n", integer.max_e7 * METRES_PER_E7, single.max_e7 * METRES_PER_E7);
+    printf("ns per conversion                  %14.2f %14.2f\n", integer_ns, float_ns);
+    printf("ns per conversion from text        %14.2f %14.2f\n", integer_text_ns, float_text_ns);
+#ifdef HAVE_TSC
+    printf("TSC cycles per conversion          %14.1f %14.1f\n", integer_tsc, float_tsc);
+    printf("TSC cycles per conversion from text %13.1f %14.1f\n", integer_text_tsc, float_text_tsc);
+#endif
+    printf("Float worse than integer on %zu of %d values\n", float_worse, COORDINATES);
+    printf("(host FPU: on the Cortex-M4 of the STM32WL, with no FPU, every float operation is a library call)\n\n");
+
+    // Integer: rounded to the nearest step. Float: 24-bit mantissa on dddmm.mmmm, metres off
+    EXPECT_LE(integer.max_e7, 0.5 + 1e-6);
+    EXPECT_GT(single.max_e7, 10.0);
+    EXPECT_GT(float_worse, (size_t)COORDINATES * 9 / 10);
+}
+// TESTS END ===========================================================================
@@ -0,0 +1,271 @@
+/* Host benchmark of the NMEA parser on the GGA corpus: sentences/s and cycles/sentence of the
+   streaming parser against the former line buffer + strtok/atof one, and a check of every GGA
+   the streaming parser accepts against a reference decoding of the corpus */
+
+// LIBRARIES ---------------------------------------------------------------------------
+#include "mbed.h"
+#include "nmea_parser.h"
+#include "gps_thread.h"
+#include "gps_receiver.h"
+#include "unittest.h"
+#include <chrono>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC           1
+#endif
+
+// MACROS ------------------------------------------------------------------------------
+#define REPETITIONS        300                                        // Corpus passes per measurement
+#define RUNS               5                                          // Best of, against scheduling noise
+#define GPS_BUFFER_SIZE    128                                        // Line buffer of the former read_GPS()
+
+// TYPES -------------------------------------------------------------------------------
+typedef struct {
+    bool accepted;                                                    // GGA the firmware must take
+    int64_t latitude_e7;
+    int64_t longitude_e7;
+    int32_t altitude_dm;
+    uint8_t fix;
+    uint8_t satellites;
+} reference_t;
+
+typedef struct {
+    double ns;                                                        // Per sentence of the corpus
+    double cycles;
+    uint64_t accepted;                                                // GGA taken by the parser in one pass
+} measure_t;
+
+// GLOBAL VARIABLES --------------------------------------------------------------------
+static volatile int64_t sink;                                         // Keeps the parsed values alive
+
+// =====================================================================================
+// FORMER PARSER
+// =====================================================================================
+// parse_GPS_data() and read_GPS() as they were before the streaming parser, minus the globals
+static char line[GPS_BUFFER_SIZE];
+static int line_index = 0;
+static uint8_t fix_status = 0;
+static float latitude = 0.0f, longitude = 0.0f;
+
+static bool parse_GPS_data(char *nmea_data){
+    bool ret = false;
+
+    if (strncmp(nmea_data, "$GPGGA", 6) == 0) {
+        char *token = strtok(nmea_data, ",");
+        int field = 0;
+
+        ret = true;
+
+        while (token != NULL) {
+            field++;
+            if (field == 7) {
+                fix_status = atoi(token);
+            }
+            if (field == 3 && strlen(token) > 0) {
+                float raw_latitude = atof(token);
+                int degrees = (int)(raw_latitude / 100);
+                float minutes = raw_latitude - (degrees * 100);
+
+                latitude = degrees + minutes / 60.0f;
+            }
+            if (field == 4 && *token == 'S') {
+                latitude = -latitude;
+            }
+            if (field == 5 && strlen(token) > 0) {
+                float raw_longitude = atof(token);
+                int degrees = (int)(raw_longitude / 100);
+                float minutes = raw_longitude - (degrees * 100);
+
+                longitude = degrees + minutes / 60.0f;
+            }
+            if (field == 6 && *token == 'W') {
+                longitude = -longitude;
+            }
+            token = strtok(NULL, ",");
+        }
+    }
+    return ret;
+}
+
+static bool former_feed(char c){
+    if (c == '\n') {
+        line[line_index] = '\0';
+        line_index = 0;
+        return parse_GPS_data(line);
+    }
+    line[line_index++] = c;
+    if (line_index >= (int)sizeof(line) - 1) {
+        line_index = 0;
+    }
+    return false;
+}
+// FORMER PARSER END ===================================================================
+
+// =====================================================================================
+// HELPERS
+// =====================================================================================
+static uint64_t cycles(){
+#ifdef HAVE_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static int64_t reference_coordinate(const std::string &value, const std::string &hemisphere){
+    long double raw = strtold(value.c_str(), NULL);
+    long double degrees = (long double)(int64_t)(raw / 100);
+    long double result = (degrees + (raw - degrees * 100) / 60) * 1e7L;
+
+    return (int64_t)llroundl((hemisphere == "S" || hemisphere == "W") ? -result : result);
+}
+
+// Decoded with the standard library, independently of the parser under test
+static reference_t reference(const std::string &sentence){
+    reference_t result = {};
+    size_t star = sentence.find('*');
+    std::vector<std::string> fields;
+    uint8_t checksum = 0;
+
+    if (sentence.empty() || sentence[0] != '$' || star == std::string::npos || star + 3 != sentence.size()) {
+        return result;
+    }
+    for (size_t i = 1; i < star; i++) {
+        checksum ^= (uint8_t)sentence[i];
+    }
+    if (strtoul(sentence.substr(star + 1).c_str(), NULL, 16) != checksum) {
+        return result;
+    }
+
+    std::string body = sentence.substr(1, star - 1) + ",";
+    for (size_t start = 0, comma; (comma = body.find(',', start)) != std::string::npos; start = comma + 1) {
+        fields.push_back(body.substr(start, comma - start));
+    }
+
+    const char *address[] = {"GPGGA", "GNGGA", "GLGGA", "GAGGA"};
+    for (size_t i = 0; i < 4; i++) {
+        result.accepted |= (fields[0] == address[i]);
+    }
+    if (!result.accepted || fields.size() < NMEA_GGA_LAST_FIELD + 1) {
+        result.accepted = false;
+        return result;
+    }
+
+    result.latitude_e7 = fields[2].empty() ? 0 : reference_coordinate(fields[2], fields[3]);
+    result.longitude_e7 = fields[4].empty() ? 0 : reference_coordinate(fields[4], fields[5]);
+    result.fix = atoi(fields[6].c_str());
+    result.satellites = atoi(fields[7].c_str());
+    result.altitude_dm = (int32_t)lround(strtod(fields[9].c_str(), NULL) * 10);
+    return result;
+}
+
+template <typename Parse>
+static measure_t measure(const std::string &stream, size_t sentences, Parse parse){
+    measure_t best = {};
+
+    for (int run = 0; run < RUNS; run++) {
+        uint64_t accepted = 0;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        uint64_t start_cycles = cycles();
+
+        for (int repetition = 0; repetition < REPETITIONS; repetition++) {
+            for (size_t i = 0; i < stream.size(); i++) {
+                accepted += parse(stream[i]) ? 1 : 0;
+            }
+        }
+
+        uint64_t elapsed_cycles = cycles() - start_cycles;
+        double elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        double per_sentence = 1.0 * REPETITIONS * sentences;
+
+        if (run == 0 || elapsed_ns / per_sentence < best.ns) {
+            best.ns = elapsed_ns / per_sentence;
+            best.cycles = elapsed_cycles / per_sentence;
+        }
+        best.accepted = accepted / REPETITIONS;
+    }
+    return best;
+}
+// HELPERS END =========================================================================
+
+// =====================================================================================
+// TESTS
+// =====================================================================================
+TEST(NMEAParserBench, CorpusThroughput){
+    std::vector<std::string> corpus = GpsReceiver::load_log(SN_DATA_DIR "/gga_corpus.nmea");
+    std::vector<reference_t> expected;
+    std::string stream;
+    size_t expected_accepted = 0;
+    ASSERT_FALSE(corpus.empty());
+
+    for (size_t i = 0; i < corpus.size(); i++) {
+        stream += corpus[i];
+        expected.push_back(reference(corpus[i].substr(0, corpus[i].size() - 2)));   // Without the CRLF
+        expected_accepted += expected.back().accepted ? 1 : 0;
+    }
+
+    // Every sentence: accepted exactly when the reference accepts it, with the same fields ------
+    NMEAParser nmea(GPS_ACCEPTED_TALKERS);
+    size_t accepted = 0, mismatches = 0;
+    for (size_t i = 0; i < corpus.size(); i++) {
+        const std::string &sentence = corpus[i];
+        nmea_sentence_t last = NMEA_NONE;
+
+        for (size_t j = 0; j < sentence.size(); j++) {
+            nmea_sentence_t result = nmea.feed(sentence[j]);
+            last = (result != NMEA_NONE) ? result : last;
+        }
+        EXPECT_EQ(last == NMEA_GGA, expected[i].accepted);
+        if (last != NMEA_GGA || !expected[i].accepted) {
+            continue;
+        }
+        accepted++;
+
+        const nmea_gga_t &gga = nmea.gga();
+        bool match = llabs(gga.latitude_e7 - expected[i].latitude_e7) <= 1
+                  && llabs(gga.longitude_e7 - expected[i].longitude_e7) <= 1
+                  && gga.altitude_dm == expected[i].altitude_dm
+                  && gga.fix == expected[i].fix && gga.satellites == expected[i].satellites;
+        if (!match) {
+            printf("Mismatch: %s", corpus[i].c_str());
+            mismatches++;
+        }
+    }
+    EXPECT_EQ(accepted, expected_accepted);
+    EXPECT_EQ(mismatches, 0u);
+    EXPECT_EQ(nmea.checksum_errors(), 50u);                           // 40 corrupted, 10 without checksum
+
+    // Throughput -----------------------------------------------------------------------
+    NMEAParser streaming(GPS_ACCEPTED_TALKERS);
+    measure_t current = measure(stream, corpus.size(), [&streaming](char c){
+        if (streaming.feed(c) == NMEA_GGA) {
+            sink = sink + streaming.gga().latitude_e7;
+            return true;
+        }
+        return false;
+    });
+    measure_t former = measure(stream, corpus.size(), [](char c){
+        if (former_feed(c)) {
+            sink = sink + (int64_t)(latitude * 1e7f) + fix_status;
+            return true;
+        }
+        return false;
+    });
+
+    printf("\nNMEA corpus: %zu sentences, %zu bytes, %zu GGA to accept (best of %d runs x %d passes)\n",
+           corpus.size(), stream.size(), expected_accepted, RUNS, REPETITIONS);
+    printf("                                   streaming     strtok/atof\n");
+    printf("Sentences per second            %12.0f  %12.0f\n", 1e9 / current.ns, 1e9 / former.ns);
+    printf("ns per sentence                 %12.1f  %12.1f\n", current.ns, former.ns);
+#ifdef HAVE_TSC
+    printf("TSC cycles per sentence         %12.0f  %12.0f\n", current.cycles, former.cycles);
+#endif
+    printf("GGA taken per pass              %12llu  %12llu\n", (unsigned long long)current.accepted,
+           (unsigned long long)former.accepted);
+    printf("(strtok/atof takes any $GPGGA line, checksum or not, and no other talker)\n\n");
+
+    EXPECT_EQ(current.accepted, expected_accepted);
+}
+// TESTS END ===========================================================================
@@ -0,0 +1,185 @@
+/* Host tests of the NMEA parser: GGA fields, checksum errors, talker filtering, coordinates */
+
+// LIBRARIES ---------------------------------------------------------------------------
+#include "mbed.h"
+#include "nmea_parser.h"
+#include "gps_receiver.h"
+#include "unittest.h"
+
+// MACROS ------------------------------------------------------------------------------
+#define ALL_TALKERS        (NMEA_TALKER_GP | NMEA_TALKER_GN | NMEA_TALKER_GL | NMEA_TALKER_GA)
+
+// =====================================================================================
+// HELPERS
+// =====================================================================================
+// Feeds the whole text, returns the type of the last sentence completed (NMEA_NONE if none)
+static nmea_sentence_t feed(NMEAParser &nmea, const std::string &text){
+    nmea_sentence_t last = NMEA_NONE;
+
+    for (size_t i = 0; i < text.size(); i++) {
+        nmea_sentence_t sentence = nmea.feed(text[i]);
+
+        if (sentence != NMEA_NONE) {
+            last = sentence;
+        }
+    }
+    return last;
+}
+
+// GGA body with the given coordinates, everything else fixed
+static std::string gga(const char *talker, const char *latitude, const char *ns, const char *longitude, const char *ew){
+    return std::string(talker) + "GGA,123519.250," + latitude + "," + ns + "," + longitude + "," + ew + ",1,08,0.90,545.4,M,46.9,M,,";
+}
+
+static int32_t parse_latitude(const char *latitude, const char *ns = "N"){
+    NMEAParser nmea;
+
+    if (feed(nmea, GpsReceiver::frame(gga("GP", latitude, ns, "00000.000", "E"))) != NMEA_GGA) {
+        return INT32_MIN;
+    }
+    return nmea.gga().latitude_e7;
+}
+// HELPERS END =========================================================================
+
+// =====================================================================================
+// TESTS
+// =====================================================================================
+TEST(NMEAParser, ParsesEveryGGAField){
+    NMEAParser nmea;
+
+    ASSERT_EQ(feed(nmea, "$GPGGA,123519.250,4807.038,N,01131.000,E,1,08,0.9,545.4,M,46.9,M,,*5E\r\n"), NMEA_GGA);
+    EXPECT_EQ(nmea.gga().time_ms, (12 * 3600 + 35 * 60 + 19) * 1000UL + 250);
+    EXPECT_EQ(nmea.gga().latitude_e7, 481173000);                     // 48 deg 07.038'
+    EXPECT_EQ(nmea.gga().longitude_e7, 115166667);                    // 11 deg 31.000', rounded up
+    EXPECT_EQ(nmea.gga().fix, 1);
+    EXPECT_EQ(nmea.gga().satellites, 8);
+    EXPECT_EQ(nmea.gga().hdop_x100, 90);
+    EXPECT_EQ(nmea.gga().altitude_dm, 5454);
+    EXPECT_EQ(nmea.checksum_errors(), 0u);
+}
+
+TEST(NMEAParser, EmptyFieldsWithoutFix){
+    NMEAParser nmea;
+
+    ASSERT_EQ(feed(nmea, GpsReceiver::frame("GPGGA,000012.800,,,,,0,00,99.99,,,,,,")), NMEA_GGA);
+    EXPECT_EQ(nmea.gga().fix, 0);
+    EXPECT_EQ(nmea.gga().latitude_e7, 0);
+    EXPECT_EQ(nmea.gga().longitude_e7, 0);
+    EXPECT_EQ(nmea.gga().altitude_dm, 0);
+    EXPECT_EQ(nmea.gga().hdop_x100, 9999);
+}
+
+TEST(NMEAParser, NegativeCoordinatesAndAltitude){
+    NMEAParser nmea;
+
+    ASSERT_EQ(feed(nmea, GpsReceiver::frame("GPGGA,101500.000,3352.1234,S,15112.5678,W,1,07,1.20,-12.5,M,22.0,M,,")), NMEA_GGA);
+    EXPECT_EQ(nmea.gga().latitude_e7, -338687233);                    // -(33 + 52.1234 / 60) = -33.86872333...
+    EXPECT_EQ(nmea.gga().longitude_e7, -1512094633);                  // -(151 + 12.5678 / 60) = -151.20946333...
+    EXPECT_EQ(nmea.gga().altitude_dm, -125);
+
+    ASSERT_EQ(feed(nmea, GpsReceiver::frame(gga("GP", "0000.0000", "S", "00000.0060", "W"))), NMEA_GGA);
+    EXPECT_EQ(nmea.gga().latitude_e7, 0);                             // No -0 trouble on the equator
+    EXPECT_EQ(nmea.gga().longitude_e7, -1000);                        // 0.006' = 1e-4 deg
+
+    ASSERT_EQ(feed(nmea, GpsReceiver::frame(gga("GP", "8959.999999", "S", "17959.999999", "W"))), NMEA_GGA);
+    EXPECT_EQ(nmea.gga().latitude_e7, -900000000);                    // Largest magnitudes still fit in int32
+    EXPECT_EQ(nmea.gga().longitude_e7, -1800000000);
+}
+
+TEST(NMEAParser, CoordinatesRoundToNearestE7){
+    // 1e-7 deg = 6e-6 min, the result is rounded to the nearest step, halves up
+    EXPECT_EQ(parse_latitude("0000.000002"), 0);                      // 0.33 step
+    EXPECT_EQ(parse_latitude("0000.000003"), 1);                      // 0.5 step
+    EXPECT_EQ(parse_latitude("0000.000004"), 1);                      // 0.67 step
+    EXPECT_EQ(parse_latitude("0000.000009"), 2);                      // 1.5 steps
+    EXPECT_EQ(parse_latitude("0000.000003", "S"), -1);                // Symmetric in the southern hemisphere
+    EXPECT_EQ(parse_latitude("4023.358"), 403893000);                 // Fewer decimals are scaled, not misread
+    EXPECT_EQ(parse_latitude("4023.3580"), 403893000);
+    EXPECT_EQ(parse_latitude("4023.35800"), 403893000);
+    EXPECT_EQ(parse_latitude("4023.3580029"), 403893000);             // Decimals past the 6th are dropped
+    EXPECT_EQ(parse_latitude("4023.3580039"), 403893001);
+    EXPECT_EQ(parse_latitude("4059.999999"), 410000000);              // Carry into the next degree
+}
+
+TEST(NMEAParser, ChecksumErrors){
+    NMEAParser nmea;
+    std::string good = GpsReceiver::frame(gga("GP", "4023.3580", "N", "00337.7220", "W"));
+    std::string wrong = good;
+    std::string corrupted = good;
+    std::string lowercase = good;
+
+    wrong[wrong.size() - 3] = (wrong[wrong.size() - 3] == '0') ? '1' : '0';   // Last checksum digit
+    corrupted[20] = (corrupted[20] == '5') ? '6' : '5';                        // A latitude digit
+
+    for (size_t i = lowercase.size() - 4; i < lowercase.size() - 2; i++) {
+        lowercase[i] = tolower(lowercase[i]);
+    }
+
+    ASSERT_EQ(feed(nmea, good), NMEA_GGA);
+    nmea_gga_t accepted = nmea.gga();
+
+    EXPECT_EQ(feed(nmea, wrong), NMEA_NONE);
+    EXPECT_EQ(nmea.checksum_errors(), 1u);
+    EXPECT_EQ(feed(nmea, corrupted), NMEA_NONE);
+    EXPECT_EQ(nmea.checksum_errors(), 2u);
+    EXPECT_EQ(feed(nmea, good.substr(0, good.size() - 5) + "\r\n"), NMEA_NONE);   // No '*hh' at all
+    EXPECT_EQ(nmea.checksum_errors(), 3u);
+    EXPECT_EQ(feed(nmea, good.substr(0, good.size() - 4) + "G4\r\n"), NMEA_NONE); // Not hex
+    EXPECT_EQ(nmea.checksum_errors(), 4u);
+    EXPECT_EQ(feed(nmea, good.substr(0, good.size() - 2) + "7\r\n"), NMEA_NONE);  // Trailing garbage
+    EXPECT_EQ(nmea.checksum_errors(), 5u);
+    EXPECT_EQ(nmea.gga().latitude_e7, accepted.latitude_e7);          // Nothing of the rejected ones leaked
+
+    EXPECT_EQ(feed(nmea, lowercase), NMEA_GGA);                       // Hex digits in either case
+    EXPECT_EQ(nmea.checksum_errors(), 5u);
+}
+
+TEST(NMEAParser, TruncatedAndBrokenSentences){
+    NMEAParser nmea;
+    std::string good = GpsReceiver::frame(gga("GP", "4023.3580", "N", "00337.7220", "W"));
+
+    // Valid checksum but the sentence ends before the altitude
+    EXPECT_EQ(feed(nmea, GpsReceiver::frame("GPGGA,123519.250,4023.3580,N,00337.7220,W,1,08")), NMEA_NONE);
+
+    // A '$' restarts the parse: the broken head is dropped, the sentence after it is kept
+    EXPECT_EQ(feed(nmea, good.substr(0, 30) + good), NMEA_GGA);
+
+    // Longer than NMEA 0183 allows: the terminator was lost
+    EXPECT_EQ(feed(nmea, "$GPGGA," + std::string(NMEA_MAX_SENTENCE, '1') + good), NMEA_GGA);
+    EXPECT_EQ(feed(nmea, good.substr(0, good.size() - 2) + std::string(NMEA_MAX_SENTENCE, ' ') + "\r\n"), NMEA_NONE);
+    EXPECT_EQ(nmea.checksum_errors(), 1u);                            // Only the one with garbage after '*hh'
+}
+
+TEST(NMEAParser, TalkerFiltering){
+    NMEAParser gps_only;
+    NMEAParser multi(ALL_TALKERS);
+    const char *talkers[] = {"GP", "GN", "GL", "GA", "BD", "GB", "QZ"};
+    const nmea_sentence_t expected_multi[] = {NMEA_GGA, NMEA_GGA, NMEA_GGA, NMEA_GGA, NMEA_NONE, NMEA_NONE, NMEA_NONE};
+
+    for (size_t i = 0; i < sizeof(talkers) / sizeof(talkers[0]); i++) {
+        std::string sentence = GpsReceiver::frame(gga(talkers[i], "4023.3580", "N", "00337.7220", "W"));
+
+        EXPECT_EQ(feed(gps_only, sentence), i == 0 ? NMEA_GGA : NMEA_NONE);
+        EXPECT_EQ(feed(multi, sentence), expected_multi[i]);
+    }
+
+    // Other sentences are dropped at the address, whatever their checksum
+    EXPECT_EQ(feed(multi, GpsReceiver::frame("GPRMC,123519.250,A,4023.3580,N,00337.7220,W,0.02,0.00,171026,,,A")), NMEA_NONE);
+    EXPECT_EQ(feed(multi, "$GPGSA,A,3,04,05,,,,,,,,,,,1.70,0.90,1.40*00\r\n"), NMEA_NONE);
+    EXPECT_EQ(feed(multi, GpsReceiver::frame("GPGGAX,123519.250")), NMEA_NONE);
+    EXPECT_EQ(gps_only.checksum_errors(), 0u);
+    EXPECT_EQ(multi.checksum_errors(), 0u);
+}
+
+TEST(NMEAParser, PMTKAcknowledge){
+    NMEAParser nmea;
+
+    ASSERT_EQ(feed(nmea, "$PMTK001,220,3*30\r\n"), NMEA_PMTK_ACK);
+    EXPECT_EQ(nmea.ack().command, 220);
+    EXPECT_EQ(nmea.ack().flag, PMTK_ACK_SUCCESS);
+
+    ASSERT_EQ(feed(nmea, GpsReceiver::frame("PMTK001,314,1")), NMEA_PMTK_ACK);
+    EXPECT_EQ(nmea.ack().command, 314);
+    EXPECT_EQ(nmea.ack().flag, PMTK_ACK_UNSUPPORTED);
+}
+// TESTS END ===========================================================================
@@ -0,0 +1,135 @@
+/* Host test of the sensor registry: the hooks run in list order, a NoSensor entry (a sensor
+   compiled out) leaves no presence bit, no payload block and no pending acquisition behind, and
+   a sensor only leaves the pending mask once its collect() says it is done */
+
+// LIBRARIES ---------------------------------------------------------------------------
+#include "mbed.h"
+#include "sensor_registry.h"
+#include "unittest.h"
+#include <string>
+
+// TYPES -------------------------------------------------------------------------------
+typedef struct {
+    uint8_t value[2];                                                 // Written by start(), one per test sensor
+} sample_t;
+
+// =====================================================================================
+// HELPERS
+// =====================================================================================
+static std::string calls;                                             // Hooks run, in order
+static int polls_needed[2];                                           // collect() calls before each sensor is done
+
+// A sensor with a presence bit, a block of SIZE bytes and a status flag
+template <int INDEX, uint8_t BIT, size_t SIZE>
+struct TestSensor {
+    static constexpr uint8_t PRESENCE = BIT;
+    static constexpr size_t MAX_SIZE = SIZE;
+
+    static void init(){ calls += "i" + std::to_string(INDEX); }
+    static void start(sample_t &sample){
+        calls += "s" + std::to_string(INDEX);
+        sample.value[INDEX] = 0xA0 + INDEX;
+    }
+    static bool collect(sample_t &, Kernel::Clock::time_point){
+        calls += "c" + std::to_string(INDEX);
+        return --polls_needed[INDEX] <= 0;
+    }
+    static size_t encode(const sample_t &sample, uint8_t *buffer, uint8_t &status){
+        calls += "e" + std::to_string(INDEX);
+        for (size_t i = 0; i < SIZE; i++) {
+            buffer[i] = sample.value[INDEX];
+        }
+        status |= BIT << 4;
+        return SIZE;
+    }
+    static void sent(){ calls += "t" + std::to_string(INDEX); }
+};
+
+typedef TestSensor<0, 0x01, 2> First;
+typedef TestSensor<1, 0x04, 3> Second;
+
+// The firmware list with two sensors compiled out, first and in the middle
+typedef SensorRegistry<sample_t, NoSensor, First, NoSensor, Second> Registry;
+typedef SensorRegistry<sample_t, NoSensor, NoSensor> NothingCompiledIn;
+typedef SensorRegistry<sample_t> Empty;
+
+static_assert(Registry::COUNT == 4, "One pending bit per entry, NoSensor included");
+static_assert(Registry::PRESENCE == 0x05, "Only the sensors compiled in are present");
+static_assert(Registry::MAX_SIZE == 5, "NoSensor adds no payload");
+static_assert(Registry::ALL == 0x0F, "Every entry pending");
+static_assert(NothingCompiledIn::PRESENCE == 0 && NothingCompiledIn::MAX_SIZE == 0, "Nothing compiled in");
+static_assert(Empty::COUNT == 0 && Empty::ALL == 0, "Empty list");
+// HELPERS END =========================================================================
+
+// =====================================================================================
+// TESTS
+// =====================================================================================
+TEST(SensorRegistry, HooksInListOrder){
+    sample_t sample = {};
+    uint8_t buffer[Registry::MAX_SIZE + 1];
+    uint8_t status = 0;
+    uint32_t pending = Registry::ALL;
+
+    calls.clear();
+    polls_needed[0] = polls_needed[1] = 1;
+    memset(buffer, 0xEE, sizeof(buffer));
+
+    Registry::init();
+    Registry::start(sample);
+    Registry::collect(sample, Kernel::Clock::now(), pending);
+    size_t size = Registry::encode(sample, buffer, status);
+    Registry::sent();
+
+    EXPECT_EQ(calls, std::string("i0i1s0s1c0c1e0e1t0t1"));
+    EXPECT_EQ(pending, 0u);
+    ASSERT_EQ(size, (size_t)5);
+    EXPECT_EQ(buffer[0], 0xA0);                                       // First's block, then Second's
+    EXPECT_EQ(buffer[1], 0xA0);
+    EXPECT_EQ(buffer[2], 0xA1);
+    EXPECT_EQ(buffer[4], 0xA1);
+    EXPECT_EQ(buffer[5], 0xEE);                                       // Nothing past MAX_SIZE
+    EXPECT_EQ(status, 0x50);
+}
+
+TEST(SensorRegistry, PendingUntilCollected){
+    sample_t sample = {};
+    uint32_t pending = Registry::ALL;
+
+    calls.clear();
+    polls_needed[0] = 3;                                              // Slow conversion
+    polls_needed[1] = 1;
+
+    // The NoSensor entries and Second are done on the first pass, First two passes later ------
+    Registry::collect(sample, Kernel::Clock::now(), pending);
+    EXPECT_EQ(pending, 1u << 2);                                      // Bits from the end of the list: First is bit 2
+    Registry::collect(sample, Kernel::Clock::now(), pending);
+    EXPECT_EQ(pending, 1u << 2);
+    Registry::collect(sample, Kernel::Clock::now(), pending);
+    EXPECT_EQ(pending, 0u);
+
+    // Done sensors are not asked again ---------------------------------------------------------
+    EXPECT_EQ(calls, std::string("c0c1c0c0"));
+    Registry::collect(sample, Kernel::Clock::now(), pending);
+    EXPECT_EQ(calls, std::string("c0c1c0c0"));
+}
+
+TEST(SensorRegistry, NothingCompiledIn){
+    sample_t sample = {};
+    uint8_t buffer[1] = {0xEE};
+    uint8_t status = 0;
+    uint32_t pending = NothingCompiledIn::ALL;
+
+    calls.clear();
+    NothingCompiledIn::init();
+    NothingCompiledIn::start(sample);
+    NothingCompiledIn::collect(sample, Kernel::Clock::now(), pending);
+    EXPECT_EQ(pending, 0u);
+    EXPECT_EQ(NothingCompiledIn::encode(sample, buffer, status), (size_t)0);
+    EXPECT_EQ(Empty::encode(sample, buffer, status), (size_t)0);
+    NothingCompiledIn::sent();
+
+    EXPECT_EQ(buffer[0], 0xEE);
+    EXPECT_EQ(status, 0);
+    EXPECT_TRUE(calls.empty());
+}
+// TESTS END ===========================================================================
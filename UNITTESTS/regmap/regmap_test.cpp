@@ -0,0 +1,330 @@
+/* Host test of the register map templates: RegisterDevice on a mock of the I2CScheduler that
+   records every call, to check the transactions each access turns into (one per access, pointer
+   byte, byte order, length, retries), the read-modify-write left out when nothing changes, and
+   the register maps of the three drivers */
+
+// LIBRARIES ---------------------------------------------------------------------------
+#include "mbed.h"
+#include "regmap.h"
+#include "mma8451.h"
+#include "si7021.h"
+#include "tcs34725.h"
+#include "unittest.h"
+#include <vector>
+
+// MACROS ------------------------------------------------------------------------------
+#define DEVICE_ADDRESS     (0x50 << 1)
+
+// TYPES -------------------------------------------------------------------------------
+typedef enum {
+    CALL_WRITE,
+    CALL_READ,
+    CALL_WRITE_READ
+} bus_call_kind_t;
+
+typedef struct {
+    bus_call_kind_t kind;
+    uint8_t client;
+    int address;
+    std::vector<uint8_t> tx;                                          // Pointer byte included
+    int rx_length;
+    uint8_t retries;
+} bus_call_t;
+
+// =====================================================================================
+// HELPERS
+// =====================================================================================
+// Same blocking interface as I2CScheduler. Behind it, a register file addressed by the pointer
+// byte (the bits of address_mask, the rest being command bits) with auto-increment, and a
+// device that answers a read without pointer with its reply bytes
+class RecordingBus {
+public:
+    RecordingBus(uint8_t address_mask = 0xFF) : registers(), reply(), failures(0), _address_mask(address_mask), _clients(0) {}
+
+    uint8_t add_client(){ return _clients++; }
+
+    int write(uint8_t client, int address, const char *data, int length, uint8_t retries = I2C_SCHEDULER_RETRIES){
+        record(CALL_WRITE, client, address, data, length, 0, retries);
+        if (failed()) {
+            return -1;
+        }
+        for (int i = 1; i < length; i++) {
+            registers[(uint8_t)((data[0] & _address_mask) + i - 1)] = (uint8_t)data[i];
+        }
+        return 0;
+    }
+
+    int read(uint8_t client, int address, char *data, int length, uint8_t retries = I2C_SCHEDULER_RETRIES){
+        record(CALL_READ, client, address, NULL, 0, length, retries);
+        if (failed()) {
+            return -1;
+        }
+        memcpy(data, reply, length);
+        return 0;
+    }
+
+    int write_read(uint8_t client, int address, const char *tx, int tx_length, char *rx, int rx_length,
+                   uint8_t retries = I2C_SCHEDULER_RETRIES){
+        record(CALL_WRITE_READ, client, address, tx, tx_length, rx_length, retries);
+        if (failed()) {
+            return -1;
+        }
+        for (int i = 0; i < rx_length; i++) {
+            rx[i] = (char)registers[(uint8_t)((tx[0] & _address_mask) + i)];
+        }
+        return 0;
+    }
+
+    uint8_t registers[256];
+    uint8_t reply[8];
+    int failures;                                                     // Calls still to fail (NACK)
+    std::vector<bus_call_t> calls;
+
+private:
+    void record(bus_call_kind_t kind, uint8_t client, int address, const char *tx, int tx_length, int rx_length, uint8_t retries){
+        bus_call_t call = {kind, client, address, std::vector<uint8_t>(tx, tx + tx_length), rx_length, retries};
+
+        calls.push_back(call);
+    }
+
+    bool failed(){
+        if (failures > 0) {
+            failures--;
+            return true;
+        }
+        return false;
+    }
+
+    uint8_t _address_mask;
+    uint8_t _clients;
+};
+
+typedef RegisterDevice<DEVICE_ADDRESS, PlainPointer, RecordingBus> TestDevice;
+
+// A made-up device with every kind of register
+typedef Register<0x10> CONFIG;
+typedef Field<CONFIG, 3, 3> CONFIG_MODE;
+typedef Register<0x11, 1, REG_READ_ONLY> STATUS;
+typedef Register<0x12, 2> WORD_BE;
+typedef Register<0x14, 2, REG_READ_WRITE, REG_LITTLE_ENDIAN> WORD_LE;
+typedef Register<0x16, 3> TRIPLE;
+typedef RegisterRange<WORD_BE, TRIPLE> WORDS;
+
+static_assert(WORDS::length == 7, "WORD_BE to the end of TRIPLE");
+static_assert(WORDS::offset<WORD_LE>() == 2, "Offset from the first register");
+static_assert(CONFIG_MODE::mask == 0x38 && CONFIG_MODE::of(5) == 0x28 && CONFIG_MODE::get(0xEF) == 5, "Field bits");
+static_assert(!STATUS::writable && STATUS::readable, "Access mode");
+
+// The driver maps
+static_assert(mma8451_reg::OUT_XYZ::length == MMA8451_XYZ_BYTES, "One sample in one burst");
+static_assert(mma8451_reg::OUT_XYZ::offset<mma8451_reg::OUT_Z>() == 4, "Z last");
+static_assert(mma8451_reg::F_STATUS_CNT::mask == 0x3F, "FIFO count");
+static_assert(tcs34725_reg::RGBC::length == 8 && tcs34725_reg::THRESHOLDS::length == 4, "TCS34725 bursts");
+static_assert(tcs34725_reg::CONTROL_AGAIN::mask == 0x03, "Gain");
+static_assert(si7021_reg::USER_REG1::address == 0xE7 && si7021_reg::USER_REG1::write_address == 0xE6, "Si7021 user register commands");
+
+static void expect_call(const bus_call_t &call, bus_call_kind_t kind, std::vector<uint8_t> tx, int rx_length){
+    EXPECT_EQ(call.kind, kind);
+    EXPECT_EQ(call.address, DEVICE_ADDRESS);
+    EXPECT_TRUE(call.tx == tx);
+    EXPECT_EQ(call.rx_length, rx_length);
+}
+// HELPERS END =========================================================================
+
+// =====================================================================================
+// TESTS
+// =====================================================================================
+TEST(RegisterMap, ReadAndWriteOneTransactionEach){
+    RecordingBus bus;
+    TestDevice device(bus);
+    uint8_t value;
+
+    bus.registers[0x10] = 0x19;
+    ASSERT_TRUE(device.read<CONFIG>(&value));
+    EXPECT_EQ(value, 0x19);
+    ASSERT_TRUE(device.write<CONFIG>(0x21));
+    EXPECT_EQ(bus.registers[0x10], 0x21);
+
+    ASSERT_EQ(bus.calls.size(), (size_t)2);
+    expect_call(bus.calls[0], CALL_WRITE_READ, {0x10}, 1);            // Pointer, repeated start, data
+    expect_call(bus.calls[1], CALL_WRITE, {0x10, 0x21}, 0);           // Pointer and data in the same transfer
+    EXPECT_EQ(bus.calls[0].retries, I2C_SCHEDULER_RETRIES);
+}
+
+TEST(RegisterMap, ByteOrder){
+    RecordingBus bus;
+    TestDevice device(bus);
+    uint16_t word;
+    uint32_t triple;
+
+    bus.registers[0x12] = 0x12;
+    bus.registers[0x13] = 0x34;
+    ASSERT_TRUE(device.read<WORD_BE>(&word));
+    EXPECT_EQ(word, 0x1234);
+
+    bus.registers[0x14] = 0x12;
+    bus.registers[0x15] = 0x34;
+    ASSERT_TRUE(device.read<WORD_LE>(&word));
+    EXPECT_EQ(word, 0x3412);
+
+    bus.registers[0x16] = 0xAB;
+    bus.registers[0x17] = 0xCD;
+    bus.registers[0x18] = 0xEF;
+    ASSERT_TRUE(device.read<TRIPLE>(&triple));
+    EXPECT_EQ(triple, 0xABCDEFu);
+
+    bus.calls.clear();
+    ASSERT_TRUE(device.write<WORD_BE>(0xBEEF));
+    ASSERT_TRUE(device.write<WORD_LE>(0xBEEF));
+    ASSERT_TRUE(device.write<TRIPLE>(0x010203));
+    ASSERT_EQ(bus.calls.size(), (size_t)3);
+    expect_call(bus.calls[0], CALL_WRITE, {0x12, 0xBE, 0xEF}, 0);
+    expect_call(bus.calls[1], CALL_WRITE, {0x14, 0xEF, 0xBE}, 0);
+    expect_call(bus.calls[2], CALL_WRITE, {0x16, 0x01, 0x02, 0x03}, 0);
+}
+
+TEST(RegisterMap, UpdateWritesOnlyChanges){
+    RecordingBus bus;
+    TestDevice device(bus);
+
+    // Bits already set: the read only ----------------------------------------------------------
+    bus.registers[0x10] = 0xC1;
+    ASSERT_TRUE(device.update<CONFIG>(0x41, 0x41));
+    ASSERT_EQ(bus.calls.size(), (size_t)1);
+    expect_call(bus.calls[0], CALL_WRITE_READ, {0x10}, 1);
+
+    // Read, then the other bits written back as they were ------------------------------------
+    bus.calls.clear();
+    ASSERT_TRUE(device.update<CONFIG>(0x41, 0x40));
+    ASSERT_EQ(bus.calls.size(), (size_t)2);
+    expect_call(bus.calls[0], CALL_WRITE_READ, {0x10}, 1);
+    expect_call(bus.calls[1], CALL_WRITE, {0x10, 0xC0}, 0);
+
+    // A field -----------------------------------------------------------------------------------
+    bus.calls.clear();
+    bus.registers[0x10] = 0xFF;
+    ASSERT_TRUE(device.modify<CONFIG_MODE>(2));
+    ASSERT_EQ(bus.calls.size(), (size_t)2);
+    expect_call(bus.calls[1], CALL_WRITE, {0x10, 0xD7}, 0);
+    ASSERT_TRUE(device.modify<CONFIG_MODE>(2));
+    EXPECT_EQ(bus.calls.size(), (size_t)3);
+}
+
+TEST(RegisterMap, FailedReadWritesNothing){
+    RecordingBus bus;
+    TestDevice device(bus);
+    uint8_t value = 0x5A;
+
+    bus.failures = 1;
+    EXPECT_FALSE(device.update<CONFIG>(0x01, 0x01));
+    EXPECT_EQ(bus.calls.size(), (size_t)1);
+
+    bus.failures = 1;
+    EXPECT_FALSE(device.read<CONFIG>(&value));
+    EXPECT_EQ(value, 0x5A);                                           // Left alone
+    bus.failures = 1;
+    EXPECT_FALSE(device.write<CONFIG>(0x01));
+    EXPECT_EQ(bus.registers[0x10], 0);
+}
+
+TEST(RegisterMap, RangeIsOneBurst){
+    RecordingBus bus;
+    TestDevice device(bus);
+    char data[WORDS::length];
+
+    for (int i = 0; i < WORDS::length; i++) {
+        bus.registers[0x12 + i] = (uint8_t)(0x10 * i);
+    }
+    ASSERT_TRUE(device.read_range<WORDS>(data));
+    EXPECT_EQ(WORDS::get<WORD_BE>(data), 0x0010);
+    EXPECT_EQ(WORDS::get<WORD_LE>(data), 0x3020);
+    EXPECT_EQ(WORDS::get<TRIPLE>(data), 0x405060u);
+
+    WORDS::put<WORD_LE>(0xCAFE, data);
+    ASSERT_TRUE(device.write_range<WORDS>(data));
+    EXPECT_EQ(bus.registers[0x14], 0xFE);
+    EXPECT_EQ(bus.registers[0x15], 0xCA);
+
+    ASSERT_EQ(bus.calls.size(), (size_t)2);
+    expect_call(bus.calls[0], CALL_WRITE_READ, {0x12}, WORDS::length);
+    expect_call(bus.calls[1], CALL_WRITE, {0x12, 0x00, 0x10, 0xFE, 0xCA, 0x40, 0x50, 0x60}, 0);
+
+    // A length only known at run time ----------------------------------------------------------
+    bus.calls.clear();
+    ASSERT_TRUE(device.read_block<STATUS>(data, 5));
+    ASSERT_EQ(bus.calls.size(), (size_t)1);
+    expect_call(bus.calls[0], CALL_WRITE_READ, {0x11}, 5);
+    EXPECT_EQ(data[1], 0x00);
+    EXPECT_EQ((uint8_t)data[4], 0xCA);                                // Written by write_range()
+}
+
+TEST(RegisterMap, CommandAndReceive){
+    RecordingBus bus;
+    TestDevice device(bus);
+    char data[3];
+
+    bus.reply[0] = 0x66;
+    bus.reply[2] = 0x99;
+    ASSERT_TRUE(device.command(0xF5));
+    ASSERT_TRUE(device.receive(data, 3, 0));                          // Polling: a NACK means "not ready"
+    ASSERT_TRUE(device.receive(data, 2));
+
+    ASSERT_EQ(bus.calls.size(), (size_t)3);
+    expect_call(bus.calls[0], CALL_WRITE, {0xF5}, 0);
+    expect_call(bus.calls[1], CALL_READ, {}, 3);
+    expect_call(bus.calls[2], CALL_READ, {}, 2);
+    EXPECT_EQ(bus.calls[1].retries, 0);
+    EXPECT_EQ(bus.calls[2].retries, I2C_SCHEDULER_RETRIES);
+    EXPECT_EQ((uint8_t)data[0], 0x66);
+}
+
+TEST(RegisterMap, OneClientPerDevice){
+    RecordingBus bus;
+    TestDevice first(bus);
+    RegisterDevice<SI7021_ADDR, PlainPointer, RecordingBus> second(bus);
+
+    ASSERT_TRUE(first.command(0x01));
+    ASSERT_TRUE(second.command(0x02));
+    ASSERT_EQ(bus.calls.size(), (size_t)2);
+    EXPECT_NE(bus.calls[0].client, bus.calls[1].client);
+    EXPECT_EQ(bus.calls[1].address, SI7021_ADDR);
+}
+
+TEST(RegisterMap, Tcs34725CommandByte){
+    RecordingBus bus(0x1F);
+    RegisterDevice<TCS34725_ADDRESS, TCS34725Pointer, RecordingBus> device(bus);
+    char rgbc[tcs34725_reg::RGBC::length];
+    uint16_t clear;
+
+    bus.registers[0x14] = 0x34;
+    bus.registers[0x15] = 0x12;
+    bus.registers[0x1B] = 0x0B;
+    ASSERT_TRUE(device.modify<tcs34725_reg::CONTROL_AGAIN>(2));
+    ASSERT_TRUE(device.read<tcs34725_reg::CDATA>(&clear));
+    ASSERT_TRUE(device.read_range<tcs34725_reg::RGBC>(rgbc));
+    EXPECT_EQ(clear, 0x1234);
+    EXPECT_EQ(tcs34725_reg::RGBC::get<tcs34725_reg::BDATA>(rgbc), 0x0B00);
+    EXPECT_EQ(bus.registers[0x0F], 0x02);
+
+    // COMMAND_BIT always, AUTO_INC for more than one byte -------------------------------------
+    ASSERT_EQ(bus.calls.size(), (size_t)4);
+    EXPECT_TRUE(bus.calls[0].tx == std::vector<uint8_t>({0x8F}));
+    EXPECT_TRUE(bus.calls[1].tx == std::vector<uint8_t>({0x8F, 0x02}));
+    EXPECT_TRUE(bus.calls[2].tx == std::vector<uint8_t>({0xB4}));
+    EXPECT_EQ(bus.calls[2].rx_length, 2);
+    EXPECT_TRUE(bus.calls[3].tx == std::vector<uint8_t>({0xB4}));
+    EXPECT_EQ(bus.calls[3].rx_length, 8);
+}
+
+TEST(RegisterMap, Si7021UserRegisterCommands){
+    RecordingBus bus;
+    RegisterDevice<SI7021_ADDR, PlainPointer, RecordingBus> device(bus);
+
+    bus.registers[0xE7] = 0x3A;                                       // Reset value: RH12/T14
+    ASSERT_TRUE(device.modify<si7021_reg::USER_REG1_RES0>(1));
+
+    ASSERT_EQ(bus.calls.size(), (size_t)2);
+    EXPECT_TRUE(bus.calls[0].tx == std::vector<uint8_t>({0xE7}));     // Read with 0xE7, written with 0xE6
+    EXPECT_TRUE(bus.calls[1].tx == std::vector<uint8_t>({0xE6, 0x3B}));
+}
+// TESTS END ===========================================================================
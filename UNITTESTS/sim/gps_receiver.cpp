@@ -0,0 +1,266 @@
+/* File for the simulated MTK3339 GPS receiver definitions */
+
+// LIBRARIES ---------------------------------------------------------------------------
+#include "gps_receiver.h"
+#include <fstream>
+#include <stdio.h>
+#include <stdlib.h>
+
+static const char *const PROFILE_ORDER[] = {"GLL", "RMC", "VTG", "GGA", "GSA", "GSV"};   // $PMTK314 field order
+static const uint8_t PROFILE_FIELDS = sizeof(PROFILE_ORDER) / sizeof(PROFILE_ORDER[0]);
+
+// CONSTRUCTOR -------------------------------------------------------------------------
+GpsReceiver::GpsReceiver(const std::vector<std::string> &log, const Config &config)
+    : _config(config), _profile(config.profile), _baud(config.baud), _mcu_baud(config.baud), _interval_ms(1000), _epoch_count(0),
+      _next_epoch(0), _generation(0), _line_free_us(0), _fix_at_us(0), _awake_since_us(0), _on_time_us(0), _standby(false),
+      _sky(true), _fix_reported(false) {
+    for (size_t i = 0; i < log.size(); i++) {
+        if (_epochs.empty() || sentence_index(log[i]) == 3) {           // Every epoch starts with its GGA
+            _epochs.push_back(std::vector<std::string>());
+        }
+        _epochs.back().push_back(log[i]);
+    }
+}
+
+// =====================================================================================
+// PUBLIC FUNCTIONS
+// =====================================================================================
+void GpsReceiver::power_on(){
+    sim::uart().connect(this);
+    _mcu_baud = sim::uart().baud();
+    _awake_since_us = sim::now_us();
+    _line_free_us = sim::now_us();
+    start_acquisition(_config.cold_start_ms);
+}
+
+void GpsReceiver::set_sky(bool visible){
+    uint64_t earliest = sim::now_us() + (uint64_t)_config.hot_start_ms * 1000;
+
+    if (visible && !_sky && _fix_at_us < earliest) {
+        _fix_at_us = earliest;
+    }
+    _sky = visible;
+}
+
+uint64_t GpsReceiver::on_time_us() const {
+    return _on_time_us + (_standby ? 0 : sim::now_us() - _awake_since_us);
+}
+
+bool GpsReceiver::in_standby() const {
+    return _standby;
+}
+
+std::string GpsReceiver::frame(const std::string &body){
+    uint8_t checksum = 0;
+    char tail[8];
+
+    for (size_t i = 0; i < body.size(); i++) {
+        checksum ^= (uint8_t)body[i];
+    }
+    snprintf(tail, sizeof(tail), "*%02X\r\n", checksum);
+    return "$" + body + tail;
+}
+
+std::vector<std::string> GpsReceiver::load_log(const char *path){
+    std::vector<std::string> sentences;
+    std::ifstream file(path);
+    std::string line;
+
+    while (std::getline(file, line)) {
+        while (!line.empty() && (line.back() == '\r' || line.back() == '\n')) {
+            line.pop_back();
+        }
+        if (!line.empty() && line[0] == '$') {
+            sentences.push_back(line + "\r\n");
+        }
+    }
+    return sentences;
+}
+
+// Bytes from the MCU: a command, or just a wake-up when in standby
+void GpsReceiver::mcu_write(const char *data, size_t length){
+    if (_standby) {
+        _standby = false;                                                // The byte itself is lost
+        _awake_since_us = sim::now_us();
+        _line_free_us = sim::now_us();
+        wake_us.push_back(sim::now_us());
+        start_acquisition(first_fix_us.empty() ? _config.cold_start_ms : _config.hot_start_ms);   // No ephemeris yet: cold again
+        return;
+    }
+    if (_mcu_baud != _baud) {                                            // Framing errors only
+        return;
+    }
+
+    _rx.append(data, length);
+
+    size_t end;
+    while ((end = _rx.find("\r\n")) != std::string::npos) {
+        std::string sentence = _rx.substr(0, end);
+        size_t star = sentence.rfind('*');
+
+        _rx.erase(0, end + 2);
+        if (sentence.empty() || sentence[0] != '$' || star == std::string::npos) {
+            continue;
+        }
+
+        std::string body = sentence.substr(1, star - 1);
+        if (frame(body) == sentence + "\r\n") {
+            commands.push_back(body);
+            command(body);
+        }
+    }
+}
+
+void GpsReceiver::mcu_baud(int baud){
+    _mcu_baud = baud;
+}
+// PUBLIC FUNCTIONS END ================================================================
+
+// =====================================================================================
+// PRIVATE FUNCTIONS
+// =====================================================================================
+void GpsReceiver::command(const std::string &body){
+    char ack[24];
+    int number = (body.compare(0, 4, "PMTK") == 0) ? atoi(body.c_str() + 4) : -1;
+
+    snprintf(ack, sizeof(ack), "PMTK001,%d,3", number);
+
+    switch (number) {
+        case 0:
+        case 300:
+            send(frame(ack));
+            break;
+
+        case 220: {
+            uint32_t interval = (uint32_t)atoi(body.c_str() + 8);
+
+            if (interval >= 100 && interval <= 10000) {
+                _interval_ms = interval;
+            }
+            send(frame(ack));
+            break;
+        }
+
+        case 314: {
+            const char *field = body.c_str() + 8;
+
+            for (uint8_t i = 0; i < PROFILE_FIELDS && *field != '\0'; i++) {
+                _profile[i] = (uint8_t)atoi(field);
+                while (*field != ',' && *field != '\0') {
+                    field++;
+                }
+                if (*field == ',') {
+                    field++;
+                }
+            }
+            send(frame(ack));
+            break;
+        }
+
+        case 251:
+            _baud = atoi(body.c_str() + 8);                             // Not acknowledged
+            break;
+
+        case 161:
+            send(frame(ack));
+            _standby = true;
+            _generation++;
+            _on_time_us += sim::now_us() - _awake_since_us;
+            standby_us.push_back(sim::now_us());
+            break;
+
+        default:
+            break;
+    }
+}
+
+// Queue a sentence on the TX line, one byte every 10 bit times
+void GpsReceiver::send(const std::string &sentence){
+    uint64_t byte_us = 10000000ULL / _baud;
+    bool garbled = (_mcu_baud != _baud);
+    bool gga = sentence_index(sentence) == 3;
+    bool fix = gga && sentence.find(",,,,,0,") == std::string::npos;
+
+    if (_line_free_us < sim::now_us()) {
+        _line_free_us = sim::now_us();
+    }
+
+    for (size_t i = 0; i < sentence.size(); i++) {
+        char c = garbled ? (char)0xFF : sentence[i];
+        bool last = (i + 1 == sentence.size());
+
+        _line_free_us += byte_us;
+        sim::schedule(_line_free_us, [this, c, last, gga, fix]{
+            sim::uart().deliver(c);
+            if (last && gga) {
+                gga_sent_us.push_back(sim::now_us());
+                if (fix) {
+                    fix_gga_sent_us.push_back(sim::now_us());
+                }
+            }
+        });
+    }
+}
+
+void GpsReceiver::start_acquisition(uint32_t time_to_fix_ms){
+    _fix_at_us = sim::now_us() + (uint64_t)time_to_fix_ms * 1000;
+    _fix_reported = false;
+    _generation++;
+    schedule_epoch(sim::now_us() + (uint64_t)_interval_ms * 1000);
+}
+
+void GpsReceiver::schedule_epoch(uint64_t time_us){
+    uint32_t generation = _generation;
+
+    sim::schedule(time_us, [this, generation]{
+        if (generation == _generation && !_standby) {
+            epoch();
+        }
+    });
+}
+
+void GpsReceiver::epoch(){
+    const std::vector<std::string> &sentences = _epochs[_next_epoch++ % _epochs.size()];
+
+    epoch_us.push_back(sim::now_us());
+
+    for (size_t i = 0; i < sentences.size(); i++) {
+        int index = sentence_index(sentences[i]);
+        uint8_t rate = (index >= 0) ? _profile[index] : 0;
+
+        if (rate == 0 || _epoch_count % rate != 0) {
+            continue;
+        }
+
+        if (index == 3 && !has_fix()) {                                 // Same time field, empty position
+            size_t time_end = sentences[i].find(',', 7);
+            send(frame(sentences[i].substr(1, time_end) + ",,,,0,00,,,M,,M,,"));
+        } else {
+            if (index == 3 && !_fix_reported) {
+                first_fix_us.push_back(sim::now_us());
+                _fix_reported = true;
+            }
+            send(sentences[i]);
+        }
+    }
+
+    _epoch_count++;
+    schedule_epoch(sim::now_us() + (uint64_t)_interval_ms * 1000);
+}
+
+bool GpsReceiver::has_fix() const {
+    return _sky && sim::now_us() >= _fix_at_us;
+}
+
+int GpsReceiver::sentence_index(const std::string &sentence) const {
+    if (sentence.size() < 6) {
+        return -1;
+    }
+    for (uint8_t i = 0; i < PROFILE_FIELDS; i++) {
+        if (sentence.compare(3, 3, PROFILE_ORDER[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+// PRIVATE FUNCTIONS END ===============================================================
@@ -0,0 +1,82 @@
+/* File for the simulated MTK3339 GPS receiver declarations */
+
+// LIBRARIES ------------------------------------------------------------------------------------
+#include "sim.h"
+#include <string>
+#include <vector>
+
+// LIBRARY GUARD --------------------------------------------------------------------------------
+#ifndef GPS_RECEIVER_H
+#define GPS_RECEIVER_H
+
+// ==============================================================================================
+// GPS RECEIVER CLASS
+// ==============================================================================================
+// Replays a recorded NMEA log on the simulated UART at the speed of the link, one epoch (the
+// sentences from a GGA to the next one) per fix interval, filtered by the $PMTK314 profile.
+// Until the receiver has a fix the GGA sentences go out with empty position fields. It answers
+// $PMTK000/220/300/314/161 with $PMTK001, follows $PMTK251, goes quiet after $PMTK161,0 and
+// wakes up on the next byte it receives: a hot start, or a new cold one if it never had a fix.
+class GpsReceiver : public sim::UartDevice {
+public:
+    struct Config {
+        int baud = 9600;                                          // Power-on baud rate
+        uint32_t cold_start_ms = 35000;                           // Power-on to first fix
+        uint32_t hot_start_ms = 2000;                             // Wake-up from standby to fix, once a first fix was made
+        std::vector<uint8_t> profile = {0, 1, 1, 1, 1, 5};        // GLL, RMC, VTG, GGA, GSA, GSV rates before any $PMTK314
+    };
+
+    GpsReceiver(const std::vector<std::string> &log, const Config &config);
+
+    void power_on();                                              // Connects to sim::uart() and starts sending at sim::now_us()
+    void set_sky(bool visible);                                   // No fix at all while false (indoors)
+
+    // What happened, in sim::now_us() time -----------------------------------------------------
+    std::vector<uint64_t> gga_sent_us;                            // Last byte of every GGA sentence
+    std::vector<uint64_t> fix_gga_sent_us;                        // Same, GGA sentences with a fix only
+    std::vector<uint64_t> epoch_us;                               // Start of every epoch sent
+    std::vector<uint64_t> standby_us;
+    std::vector<uint64_t> wake_us;
+    std::vector<uint64_t> first_fix_us;                           // First fix of every acquisition
+    std::vector<std::string> commands;                            // Bodies of the commands received, '$' and checksum removed
+    uint64_t on_time_us() const;                                  // Time spent out of standby
+    bool in_standby() const;
+
+    // Sentence helpers -------------------------------------------------------------------------
+    static std::string frame(const std::string &body);            // "$" body "*" checksum CRLF
+    static std::vector<std::string> load_log(const char *path);   // One sentence per line, '#' lines skipped
+
+    // UartDevice -------------------------------------------------------------------------------
+    void mcu_write(const char *data, size_t length) override;
+    void mcu_baud(int baud) override;
+
+private:
+    void command(const std::string &body);
+    void send(const std::string &sentence);
+    void start_acquisition(uint32_t time_to_fix_ms);
+    void schedule_epoch(uint64_t time_us);
+    void epoch();
+    bool has_fix() const;
+    int sentence_index(const std::string &sentence) const;        // Position in the $PMTK314 field order, -1 if not there
+
+    std::vector<std::vector<std::string>> _epochs;
+    Config _config;
+    std::vector<uint8_t> _profile;
+    int _baud;
+    int _mcu_baud;
+    uint32_t _interval_ms;
+    uint32_t _epoch_count;
+    size_t _next_epoch;
+    uint32_t _generation;                                         // Epoch events of an older acquisition are dropped
+    uint64_t _line_free_us;                                       // When the TX line is free for the next byte
+    uint64_t _fix_at_us;
+    uint64_t _awake_since_us;
+    uint64_t _on_time_us;
+    bool _standby;
+    bool _sky;
+    bool _fix_reported;
+    std::string _rx;
+};
+// GPS RECEIVER CLASS END =======================================================================
+
+#endif
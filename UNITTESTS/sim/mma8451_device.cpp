@@ -0,0 +1,193 @@
+/* File for the simulated MMA8451Q accelerometer definitions */
+
+// LIBRARIES ---------------------------------------------------------------------------
+#include "mma8451_device.h"
+#include <string.h>
+
+// MACROS ------------------------------------------------------------------------------
+#define ADDRESS            (0x1D << 1)
+#define F_STATUS           0x00
+#define OUT_X_MSB          0x01
+#define OUT_Z_MSB          0x05
+#define OUT_Z_LSB          0x06
+#define F_SETUP            0x09
+#define INT_SOURCE         0x0C
+#define WHO_AM_I           0x0D
+#define FF_MT_SRC          0x16
+#define TRANSIENT_SRC      0x1E
+#define CTRL_REG1          0x2A
+#define FIFO_SIZE          32
+
+static const uint64_t PERIOD_US[8] = {1250, 2500, 5000, 10000, 20000, 80000, 160000, 640000};   // CTRL_REG1 DR
+
+// CONSTRUCTOR -------------------------------------------------------------------------
+Mma8451Device::Mma8451Device(Signal signal) : samples_lost(0), standby_violations(0), _signal(signal), _pointer(0),
+                                              _active_since_us(0), _samples(0), _overflow(false) {
+    memset(_registers, 0, sizeof(_registers));
+    memset(_last, 0, sizeof(_last));
+    _registers[WHO_AM_I] = 0x1A;
+}
+
+Mma8451Device::~Mma8451Device(){
+    sim::i2c_bus().detach(ADDRESS);
+}
+
+// =====================================================================================
+// PUBLIC FUNCTIONS
+// =====================================================================================
+void Mma8451Device::attach(){
+    sim::i2c_bus().attach(ADDRESS, this);
+}
+
+void Mma8451Device::sample(uint64_t index, int16_t *xyz) const {
+    _signal(index, xyz);
+}
+
+uint64_t Mma8451Device::samples_made() const {
+    return _samples;
+}
+
+uint8_t Mma8451Device::reg(uint8_t address) const {
+    return _registers[address];
+}
+
+// Register pointer, then the registers from there on
+bool Mma8451Device::write(const char *data, int length){
+    catch_up();
+    _pointer = (uint8_t)data[0];
+
+    for (int i = 1; i < length && _pointer < sizeof(_registers); i++, _pointer++) {
+        uint8_t value = (uint8_t)data[i];
+
+        if (_pointer == CTRL_REG1) {
+            if (active() && (value & 0x01) && (value & ~0x01) != (_registers[CTRL_REG1] & ~0x01)) {
+                standby_violations++;                                       // DR and F_READ only change in standby
+                continue;
+            }
+            if (!active() && (value & 0x01)) {
+                _active_since_us = sim::now_us();
+                _samples = 0;
+            }
+        } else if (active() && _pointer != F_SETUP) {
+            standby_violations++;
+            continue;
+        }
+        if (_pointer == F_SETUP && (value >> 6) != (_registers[F_SETUP] >> 6)) {
+            _fifo.clear();
+            _overflow = false;
+        }
+        _registers[_pointer] = value;
+    }
+    return true;
+}
+
+bool Mma8451Device::read(char *data, int length){
+    catch_up();
+
+    for (int i = 0; i < length; i++) {
+        data[i] = (char)read_register(_pointer);
+        _pointer = next_address(_pointer);
+    }
+    return true;
+}
+// PUBLIC FUNCTIONS END ================================================================
+
+// =====================================================================================
+// PRIVATE FUNCTIONS
+// =====================================================================================
+void Mma8451Device::catch_up(){
+    if (!active()) {
+        return;
+    }
+
+    uint64_t due = (sim::now_us() - _active_since_us) / period_us();
+
+    for (; _samples < due; _samples++) {
+        std::array<int16_t, 3> xyz;
+
+        _signal(_samples, xyz.data());
+        memcpy(_last, xyz.data(), sizeof(_last));
+        if (!fifo_enabled()) {
+            continue;
+        }
+        if (_fifo.size() == FIFO_SIZE) {
+            _overflow = true;
+            samples_lost++;
+            if ((_registers[F_SETUP] >> 6) != 1) {                          // Fill mode: the new sample is lost
+                continue;
+            }
+            _fifo.pop_front();                                              // Circular: the oldest one is
+        }
+        _fifo.push_back(xyz);
+    }
+}
+
+uint8_t Mma8451Device::read_register(uint8_t address){
+    if (address >= OUT_X_MSB && address <= OUT_Z_LSB) {
+        const int16_t *xyz = _last;
+        uint8_t axis = (address - OUT_X_MSB) / 2;
+        uint16_t left_aligned;
+
+        if (fifo_enabled() && !_fifo.empty()) {
+            xyz = _fifo.front().data();
+        }
+        left_aligned = (uint16_t)(xyz[axis] * 4);
+        if ((fifo_enabled() && address == (fast_read() ? OUT_Z_MSB : OUT_Z_LSB)) && !_fifo.empty()) {
+            _fifo.pop_front();                                              // Last byte of the sample
+            _overflow = false;
+        }
+        return ((address - OUT_X_MSB) % 2) ? (left_aligned & 0xFC) : (left_aligned >> 8);
+    }
+
+    uint8_t watermark = _registers[F_SETUP] & 0x3F;
+    bool at_watermark = fifo_enabled() && watermark > 0 && _fifo.size() >= watermark;
+
+    switch (address) {
+        case F_STATUS:
+            if (fifo_enabled()) {
+                return (_overflow ? 0x80 : 0) | (at_watermark ? 0x40 : 0) | (uint8_t)_fifo.size();
+            }
+            return 0x08;                                                    // STATUS: ZYXDR
+        case INT_SOURCE:
+            return (_registers[INT_SOURCE] & 0x3F) | ((at_watermark || (fifo_enabled() && _overflow)) ? 0x40 : 0);
+        case FF_MT_SRC:
+        case TRANSIENT_SRC: {
+            uint8_t value = _registers[address];
+
+            _registers[address] = 0;                                        // Reading clears the latched event
+            return value;
+        }
+        default:
+            return address < sizeof(_registers) ? _registers[address] : 0;
+    }
+}
+
+// Auto-increment: the data registers loop on themselves with the FIFO on, F_READ skips the LSBs
+uint8_t Mma8451Device::next_address(uint8_t address) const {
+    if (address >= OUT_X_MSB && address <= OUT_Z_LSB) {
+        uint8_t last = fast_read() ? OUT_Z_MSB : OUT_Z_LSB;
+
+        if (address == last) {
+            return fifo_enabled() ? OUT_X_MSB : address + 1;
+        }
+        return fast_read() ? address + 2 : address + 1;
+    }
+    return address + 1;
+}
+
+bool Mma8451Device::active() const {
+    return _registers[CTRL_REG1] & 0x01;
+}
+
+bool Mma8451Device::fifo_enabled() const {
+    return (_registers[F_SETUP] >> 6) != 0;
+}
+
+bool Mma8451Device::fast_read() const {
+    return _registers[CTRL_REG1] & 0x02;
+}
+
+uint64_t Mma8451Device::period_us() const {
+    return PERIOD_US[(_registers[CTRL_REG1] >> 3) & 0x07];
+}
+// PRIVATE FUNCTIONS END ===============================================================
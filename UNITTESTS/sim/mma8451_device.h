@@ -0,0 +1,61 @@
+/* File for the simulated MMA8451Q accelerometer declarations */
+
+// LIBRARIES ------------------------------------------------------------------------------------
+#include "sim.h"
+#include <array>
+#include <deque>
+#include <functional>
+
+// LIBRARY GUARD --------------------------------------------------------------------------------
+#ifndef MMA8451_DEVICE_H
+#define MMA8451_DEVICE_H
+
+// ==============================================================================================
+// MMA8451 DEVICE CLASS
+// ==============================================================================================
+// Register file of the MMA8451Q on sim::i2c_bus(). While active it makes one sample per output
+// data rate period of the virtual clock, taken from the signal. With the FIFO enabled the data
+// registers pop the oldest sample and the address wraps from the last data register back to
+// OUT_X_MSB, F_STATUS gives the count and the overflow. With F_READ the LSB registers are
+// skipped. Without the FIFO the data registers hold the last sample made.
+class Mma8451Device : public sim::I2CDevice {
+public:
+    typedef std::function<void(uint64_t index, int16_t *xyz)> Signal;   // 14-bit counts of sample index
+
+    Mma8451Device(Signal signal);
+    ~Mma8451Device();
+
+    void attach();                                                // At its address on sim::i2c_bus()
+    void sample(uint64_t index, int16_t *xyz) const;              // What the signal gives for a sample
+    uint64_t samples_made() const;                                // Since the last time it went active
+    uint8_t reg(uint8_t address) const;
+
+    // What happened ----------------------------------------------------------------------------
+    uint64_t samples_lost;                                        // Overwritten (circular) or refused (fill) by a full FIFO
+    uint32_t standby_violations;                                  // Configuration written while active, ignored by the real part
+
+    // I2CDevice --------------------------------------------------------------------------------
+    bool write(const char *data, int length) override;
+    bool read(char *data, int length) override;
+
+private:
+    void catch_up();                                              // Makes the samples due by sim::now_us()
+    uint8_t read_register(uint8_t address);
+    uint8_t next_address(uint8_t address) const;
+    bool active() const;
+    bool fifo_enabled() const;
+    bool fast_read() const;
+    uint64_t period_us() const;
+
+    Signal _signal;
+    uint8_t _registers[0x32];
+    uint8_t _pointer;
+    uint64_t _active_since_us;
+    uint64_t _samples;
+    int16_t _last[3];                                             // Last sample made
+    std::deque<std::array<int16_t, 3>> _fifo;
+    bool _overflow;
+};
+// MMA8451 DEVICE CLASS END =====================================================================
+
+#endif
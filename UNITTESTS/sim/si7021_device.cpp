@@ -0,0 +1,116 @@
+/* File for the simulated Si7021 humidity and temperature sensor definitions */
+
+// LIBRARIES ---------------------------------------------------------------------------
+#include "si7021_device.h"
+
+// MACROS ------------------------------------------------------------------------------
+#define ADDRESS            (0x40 << 1)
+#define MEASURE_RH         0xF5
+#define MEASURE_TEMP       0xF3
+#define TEMP_FROM_RH       0xE0
+#define WRITE_USER_REG1    0xE6
+#define READ_USER_REG1     0xE7
+#define USER_REG1_RESET    0x3A
+
+// CONSTRUCTOR -------------------------------------------------------------------------
+Si7021Device::Si7021Device(uint16_t humidity, uint16_t temperature) : conversions(0), busy_reads(0), _humidity(humidity),
+                                                                      _temperature(temperature), _result(0),
+                                                                      _user_reg1(USER_REG1_RESET), _output(OUTPUT_NONE),
+                                                                      _ready_us(0) {}
+
+Si7021Device::~Si7021Device(){
+    sim::i2c_bus().detach(ADDRESS);
+}
+
+// =====================================================================================
+// PUBLIC FUNCTIONS
+// =====================================================================================
+void Si7021Device::attach(){
+    sim::i2c_bus().attach(ADDRESS, this);
+}
+
+// Typical conversion times of the datasheet, RH then T, by RES1:RES0
+uint64_t Si7021Device::conversion_us() const {
+    switch (_user_reg1 & 0x81) {
+        case 0x01: return 2600 + 2400;                                      // RH 8 bit, T 12 bit
+        case 0x80: return 3700 + 4000;                                      // RH 10 bit, T 13 bit
+        case 0x81: return 5800 + 1500;                                      // RH 11 bit, T 11 bit
+        default:   return 10000 + 7000;                                     // RH 12 bit, T 14 bit
+    }
+}
+
+uint64_t Si7021Device::ready_us() const {
+    return _ready_us;
+}
+
+bool Si7021Device::write(const char *data, int length){
+    switch ((uint8_t)data[0]) {
+        case MEASURE_RH:
+        case MEASURE_TEMP:
+            _result = ((uint8_t)data[0] == MEASURE_RH) ? _humidity : _temperature;
+            _ready_us = sim::now_us() + conversion_us();
+            _output = OUTPUT_MEASUREMENT;
+            conversions++;
+            break;
+        case TEMP_FROM_RH:
+            _output = OUTPUT_TEMP_FROM_RH;
+            break;
+        case WRITE_USER_REG1:
+            if (length > 1) {
+                _user_reg1 = (uint8_t)data[1];
+            }
+            break;
+        case READ_USER_REG1:
+            _output = OUTPUT_USER_REG1;
+            break;
+        default:
+            return false;
+    }
+    return true;
+}
+
+bool Si7021Device::read(char *data, int length){
+    uint8_t bytes[3] = {0, 0, 0};
+
+    switch (_output) {
+        case OUTPUT_MEASUREMENT:
+            if (sim::now_us() < _ready_us) {
+                busy_reads++;
+                return false;                                               // NACK until converted
+            }
+            bytes[0] = (uint8_t)(_result >> 8);
+            bytes[1] = (uint8_t)_result;
+            bytes[2] = crc8(bytes, 2);
+            break;
+        case OUTPUT_TEMP_FROM_RH:
+            bytes[0] = (uint8_t)(_temperature >> 8);
+            bytes[1] = (uint8_t)_temperature;
+            break;
+        case OUTPUT_USER_REG1:
+            bytes[0] = _user_reg1;
+            break;
+        default:
+            return false;
+    }
+    for (int i = 0; i < length; i++) {
+        data[i] = (char)((i < 3) ? bytes[i] : 0xFF);
+    }
+    return true;
+}
+// PUBLIC FUNCTIONS END ================================================================
+
+// =====================================================================================
+// PRIVATE FUNCTIONS
+// =====================================================================================
+uint8_t Si7021Device::crc8(const uint8_t *data, int length){
+    uint8_t crc = 0x00;
+
+    for (int i = 0; i < length; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x31) : (uint8_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+// PRIVATE FUNCTIONS END ===============================================================
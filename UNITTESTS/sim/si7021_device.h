@@ -0,0 +1,53 @@
+/* File for the simulated Si7021 humidity and temperature sensor declarations */
+
+// LIBRARIES ------------------------------------------------------------------------------------
+#include "sim.h"
+
+// LIBRARY GUARD --------------------------------------------------------------------------------
+#ifndef SI7021_DEVICE_H
+#define SI7021_DEVICE_H
+
+// ==============================================================================================
+// Si7021 DEVICE CLASS
+// ==============================================================================================
+// Command interface of the Si7021 on sim::i2c_bus(). A no hold measurement command starts a
+// conversion of the typical datasheet duration for the resolution in the user register; the
+// address is NACKed on reads until it is done, then the result comes with its CRC. 0xE0 gives
+// the temperature of the last RH conversion. Hold master commands are not modelled.
+class Si7021Device : public sim::I2CDevice {
+public:
+    Si7021Device(uint16_t humidity, uint16_t temperature);       // Raw codes returned by every conversion
+    ~Si7021Device();
+
+    void attach();                                                // At its address on sim::i2c_bus()
+    uint64_t conversion_us() const;                               // RH + T at the current resolution
+    uint64_t ready_us() const;                                    // End of the last conversion started
+
+    // What happened ----------------------------------------------------------------------------
+    uint32_t conversions;
+    uint32_t busy_reads;                                          // Reads NACKed because the conversion was running
+
+    // I2CDevice --------------------------------------------------------------------------------
+    bool write(const char *data, int length) override;
+    bool read(char *data, int length) override;
+
+private:
+    typedef enum {
+        OUTPUT_NONE,
+        OUTPUT_MEASUREMENT,                                       // MSB, LSB, CRC once converted
+        OUTPUT_TEMP_FROM_RH,                                      // MSB, LSB
+        OUTPUT_USER_REG1
+    } output_t;
+
+    static uint8_t crc8(const uint8_t *data, int length);
+
+    uint16_t _humidity;
+    uint16_t _temperature;
+    uint16_t _result;                                             // Of the conversion running or done
+    uint8_t _user_reg1;
+    output_t _output;
+    uint64_t _ready_us;
+};
+// Si7021 DEVICE CLASS END ======================================================================
+
+#endif
@@ -0,0 +1,296 @@
+/* File for the host simulation definitions */
+
+// LIBRARIES ---------------------------------------------------------------------------
+#include "sim.h"
+#include "kvstore_global_api.h"
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string.h>
+
+namespace sim {
+
+// GLOBAL VARIABLES --------------------------------------------------------------------
+static std::atomic<uint64_t> clock_us(0);
+static std::mutex events_mutex;
+static std::multimap<uint64_t, std::function<void()>> events;       // Same time: scheduling order
+static bool run_active = false;
+static uint64_t run_end_us = 0;
+static std::atomic<uint32_t> deep_sleep(0);
+static std::atomic<uint64_t> wakeup_count(0);
+static std::atomic<uint64_t> busy_total_ns(0);
+static thread_local std::chrono::steady_clock::time_point resumed_at;
+static thread_local bool resumed = false;                           // resumed_at is the start of the current busy stretch
+static uint32_t kv_write_count = 0;
+
+// =====================================================================================
+// VIRTUAL CLOCK AND EVENTS
+// =====================================================================================
+uint64_t now_us(){
+    return clock_us.load();
+}
+
+static void move_clock(uint64_t time_us){                              // Never backwards, two threads may move it
+    uint64_t current = clock_us.load();
+
+    while (time_us > current && !clock_us.compare_exchange_weak(current, time_us)) {}
+}
+
+bool run_next(uint64_t limit_us){
+    std::function<void()> event;
+
+    {
+        std::lock_guard<std::mutex> lock(events_mutex);
+
+        if (events.empty() || events.begin()->first > limit_us || (run_active && events.begin()->first > run_end_us)) {
+            return false;
+        }
+        move_clock(events.begin()->first);
+        event = events.begin()->second;
+        events.erase(events.begin());
+    }
+
+    event();                                                            // May schedule more
+    return true;
+}
+
+void advance_to(uint64_t time_us){
+    while (run_next(time_us)) {}
+
+    if (run_active && time_us > run_end_us) {
+        move_clock(run_end_us);
+        throw SimulationEnd();
+    }
+    move_clock(time_us);
+}
+
+void advance(uint64_t duration_us){
+    advance_to(now_us() + duration_us);
+}
+
+void schedule(uint64_t time_us, std::function<void()> event){
+    std::lock_guard<std::mutex> lock(events_mutex);
+
+    events.insert(std::make_pair(time_us, event));
+}
+
+void start_run(uint64_t end_us){
+    run_end_us = end_us;
+    run_active = true;
+    resumed_at = std::chrono::steady_clock::now();
+    resumed = true;
+}
+
+bool running(){
+    return run_active;
+}
+
+void reset(){
+    std::lock_guard<std::mutex> lock(events_mutex);
+
+    events.clear();
+    clock_us = 0;
+    run_active = false;
+    run_end_us = 0;
+    wakeup_count = 0;
+    busy_total_ns = 0;
+    resumed = false;
+}
+
+void count_wakeup(){
+    wakeup_count++;
+    resumed_at = std::chrono::steady_clock::now();
+    resumed = true;
+}
+
+void count_block(){
+    if (run_active && resumed) {
+        busy_total_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - resumed_at).count();
+    }
+    resumed = false;
+}
+
+uint64_t busy_ns(){
+    return busy_total_ns.load();
+}
+
+uint64_t wakeups(){
+    return wakeup_count.load();
+}
+
+uint32_t deep_sleep_locks(){
+    return deep_sleep.load();
+}
+
+void lock_deep_sleep(){
+    deep_sleep++;
+}
+
+void unlock_deep_sleep(){
+    deep_sleep--;
+}
+// VIRTUAL CLOCK AND EVENTS END ========================================================
+
+// =====================================================================================
+// UART
+// =====================================================================================
+Uart &uart(){
+    static Uart instance;
+    return instance;
+}
+
+void Uart::connect(UartDevice *device){
+    _device = device;
+    _rx.clear();
+    memset(&stats, 0, sizeof(stats));
+}
+
+void Uart::deliver(char c){
+    _rx.push_back(c);
+    stats.bytes_to_mcu++;
+
+    if (_isr) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        _isr();
+        stats.isr_calls++;
+        stats.isr_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+}
+
+void Uart::attach(std::function<void()> isr){
+    _isr = isr;
+}
+
+bool Uart::readable() const {
+    return !_rx.empty();
+}
+
+size_t Uart::read(char *data, size_t length){
+    size_t count = 0;
+
+    while (count < length && !_rx.empty()) {
+        data[count++] = _rx.front();
+        _rx.pop_front();
+    }
+    return count;
+}
+
+void Uart::write(const char *data, size_t length){
+    stats.bytes_from_mcu += length;
+    if (_device != nullptr) {
+        _device->mcu_write(data, length);
+    }
+}
+
+void Uart::baud(int baud){
+    _baud = baud;
+    if (_device != nullptr) {
+        _device->mcu_baud(baud);
+    }
+}
+
+int Uart::baud() const {
+    return _baud;
+}
+// UART END ============================================================================
+
+// =====================================================================================
+// I2C BUS
+// =====================================================================================
+I2CBus &i2c_bus(){
+    static I2CBus instance;
+    return instance;
+}
+
+void I2CBus::attach(int address, I2CDevice *device){
+    _devices[address] = device;
+}
+
+void I2CBus::detach(int address){
+    _devices.erase(address);
+}
+
+void I2CBus::frequency(int hz){
+    _frequency = hz;
+}
+
+// Start, address and data bytes (9 clocks each with the ACK), repeated start, stop
+uint64_t I2CBus::bus_time_us(int tx_length, int rx_length) const {
+    uint64_t bits = 2;
+
+    if (tx_length > 0) {
+        bits += 9 * (1 + tx_length);
+    }
+    if (rx_length > 0) {
+        bits += 9 * (1 + rx_length) + (tx_length > 0 ? 1 : 0);
+    }
+    return (bits * 1000000 + _frequency - 1) / _frequency;
+}
+
+int I2CBus::transfer(int address, const char *tx, int tx_length, char *rx, int rx_length){
+    std::map<int, I2CDevice *>::iterator device = _devices.find(address);
+    I2CRecord record;
+    bool ack = device != _devices.end();
+
+    record.address = address;
+    record.tx.assign((const uint8_t *)tx, (const uint8_t *)tx + (tx != nullptr ? tx_length : 0));
+    record.rx_length = rx_length;
+    record.start_us = now_us();
+
+    if (ack && tx_length > 0) {
+        ack = device->second->write(tx, tx_length);
+    }
+    if (ack && rx_length > 0) {
+        ack = device->second->read(rx, rx_length);
+    }
+
+    advance(ack ? bus_time_us(tx_length, rx_length) : bus_time_us(1, 0) / 2);   // A NACK ends the transfer after the address byte
+    record.ack = ack;
+    record.end_us = now_us();
+    log.push_back(record);
+    return ack ? 0 : -1;
+}
+
+void I2CBus::clear_log(){
+    log.clear();
+}
+// I2C BUS END =========================================================================
+
+// =====================================================================================
+// KVSTORE
+// =====================================================================================
+std::map<std::string, std::vector<uint8_t>> &kv_store(){
+    static std::map<std::string, std::vector<uint8_t>> store;
+    return store;
+}
+
+uint32_t kv_writes(){
+    return kv_write_count;
+}
+
+}
+// SIM END =============================================================================
+
+int kv_set(const char *key, const void *buffer, size_t size, uint32_t){
+    sim::kv_store()[key].assign((const uint8_t *)buffer, (const uint8_t *)buffer + size);
+    sim::kv_write_count++;
+    return MBED_SUCCESS;
+}
+
+int kv_get(const char *key, void *buffer, size_t buffer_size, size_t *actual_size){
+    std::map<std::string, std::vector<uint8_t>>::iterator entry = sim::kv_store().find(key);
+
+    if (entry == sim::kv_store().end()) {
+        return MBED_ERROR_ITEM_NOT_FOUND;
+    }
+    size_t size = entry->second.size() < buffer_size ? entry->second.size() : buffer_size;
+
+    memcpy(buffer, entry->second.data(), size);
+    *actual_size = size;
+    return MBED_SUCCESS;
+}
+
+int kv_remove(const char *key){
+    return sim::kv_store().erase(key) > 0 ? MBED_SUCCESS : MBED_ERROR_ITEM_NOT_FOUND;
+}
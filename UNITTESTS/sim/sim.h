@@ -0,0 +1,136 @@
+/* File for the host simulation: virtual clock, scheduled events and simulated peripherals */
+
+// LIBRARIES ------------------------------------------------------------------------------------
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+#include <map>
+#include <vector>
+#include <deque>
+#include <string>
+
+// LIBRARY GUARD --------------------------------------------------------------------------------
+#ifndef SIM_H
+#define SIM_H
+
+// ==============================================================================================
+// VIRTUAL CLOCK AND EVENTS
+// ==============================================================================================
+// Every time the firmware sees (Kernel::Clock, LowPowerTimer, ...) is this virtual clock. It only
+// moves when a thread sleeps or waits, or when a simulated peripheral keeps the caller busy
+// (an I2C transfer). Scheduled events (a byte arriving on the UART, an uplink being sent) run in
+// time order from inside those waits, as an interrupt would. Once a scripted run is started, a
+// wait that nothing scheduled can end either times out at once or ends the run.
+namespace sim {
+
+struct SimulationEnd {};                                          // Thrown out of the firmware loop when the run is over
+struct ThreadExit {};                                             // Thrown out of a host thread when its EventFlags go away
+
+uint64_t now_us();
+void advance_to(uint64_t time_us);                                // Runs the events due until then, throws SimulationEnd past the end of a run
+void advance(uint64_t duration_us);
+void schedule(uint64_t time_us, std::function<void()> event);
+bool run_next(uint64_t limit_us);                                 // Runs the next event if due by limit_us, false if there is none
+void start_run(uint64_t end_us);                                  // Scripted run: the caller's thread is the only one, waits are driven by the events
+bool running();
+void reset();                                                     // Clock to 0, no events, no run
+
+void count_wakeup();                                              // A thread came back from a sleep or a wait
+uint64_t wakeups();
+void count_block();                                               // A thread is about to sleep or wait
+uint64_t busy_ns();                                               // Host time the firmware ran between a wake-up and the next block, scripted runs only
+
+uint32_t deep_sleep_locks();                                      // Held by a running (high resolution) Timer, as on the target
+void lock_deep_sleep();
+void unlock_deep_sleep();
+
+// ==============================================================================================
+// UART
+// ==============================================================================================
+// One link between the MCU UnbufferedSerial and a simulated device on the other end
+class UartDevice {
+public:
+    virtual ~UartDevice() {}
+    virtual void mcu_write(const char *data, size_t length) = 0;  // Bytes sent by the firmware
+    virtual void mcu_baud(int baud) = 0;
+};
+
+struct UartStats {
+    uint64_t bytes_to_mcu;                                        // Delivered on the MCU RX pin
+    uint64_t bytes_from_mcu;
+    uint64_t isr_calls;
+    uint64_t isr_ns;                                              // Host time spent in the RX interrupt handler
+};
+
+class Uart {
+public:
+    void connect(UartDevice *device);
+    void deliver(char c);                                         // Device side: one byte on RX, runs the RX interrupt if attached
+
+    // MCU side (UnbufferedSerial) --------------------------------------------------------------
+    void attach(std::function<void()> isr);
+    bool readable() const;
+    size_t read(char *data, size_t length);
+    void write(const char *data, size_t length);
+    void baud(int baud);
+    int baud() const;
+
+    UartStats stats;
+
+private:
+    UartDevice *_device = nullptr;
+    std::deque<char> _rx;                                         // UART data register plus what a buffered driver would hold
+    std::function<void()> _isr;
+    int _baud = 9600;
+};
+
+Uart &uart();
+
+// ==============================================================================================
+// I2C BUS
+// ==============================================================================================
+class I2CDevice {
+public:
+    virtual ~I2CDevice() {}
+    virtual bool write(const char *data, int length) = 0;        // False: NACK on the address
+    virtual bool read(char *data, int length) = 0;
+};
+
+struct I2CRecord {
+    int address;                                                  // 8-bit
+    std::vector<uint8_t> tx;
+    int rx_length;
+    bool ack;
+    uint64_t start_us;
+    uint64_t end_us;
+};
+
+class I2CBus {
+public:
+    void attach(int address, I2CDevice *device);
+    void detach(int address);
+    void frequency(int hz);
+
+    int transfer(int address, const char *tx, int tx_length, char *rx, int rx_length);   // One transaction, 0 on success, moves the clock by its bus time
+    uint64_t bus_time_us(int tx_length, int rx_length) const;
+
+    std::vector<I2CRecord> log;                                   // Every transaction since clear_log()
+    void clear_log();
+
+private:
+    std::map<int, I2CDevice *> _devices;
+    int _frequency = 100000;
+};
+
+I2CBus &i2c_bus();
+
+// ==============================================================================================
+// KVSTORE
+// ==============================================================================================
+std::map<std::string, std::vector<uint8_t>> &kv_store();
+uint32_t kv_writes();
+
+}
+// SIM END ======================================================================================
+
+#endif
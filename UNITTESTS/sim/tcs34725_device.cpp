@@ -0,0 +1,112 @@
+/* File for the simulated TCS34725 colour sensor definitions */
+
+// LIBRARIES ---------------------------------------------------------------------------
+#include "tcs34725_device.h"
+#include <string.h>
+
+// MACROS ------------------------------------------------------------------------------
+#define ADDRESS            (0x29 << 1)
+#define COMMAND_BIT        0x80
+#define SPECIAL_FUNCTION   0x60                                       // TYPE field of the command byte
+#define ENABLE             0x00
+#define ENABLE_PON         0x01
+#define ENABLE_AEN         0x02
+#define ATIME              0x01
+#define CONTROL            0x0F
+#define ID                 0x12
+#define STATUS             0x13
+#define CDATAL             0x14
+#define CYCLE_US           2400
+#define INIT_US            2400
+
+static const uint32_t GAINS[4] = {1, 4, 16, 60};
+static const uint32_t SHARE_PERCENT[4] = {100, 40, 35, 25};           // Clear, red, green, blue
+
+// CONSTRUCTOR -------------------------------------------------------------------------
+Tcs34725Device::Tcs34725Device(uint32_t level) : integrations(0), _level(level), _pointer(0), _ready_us(UINT64_MAX) {
+    memset(_registers, 0, sizeof(_registers));
+    _registers[ATIME] = 0xFF;
+    _registers[ID] = 0x44;
+}
+
+Tcs34725Device::~Tcs34725Device(){
+    sim::i2c_bus().detach(ADDRESS);
+}
+
+// =====================================================================================
+// PUBLIC FUNCTIONS
+// =====================================================================================
+void Tcs34725Device::attach(){
+    sim::i2c_bus().attach(ADDRESS, this);
+}
+
+uint16_t Tcs34725Device::counts(int channel) const {
+    uint32_t cycles = 256 - _registers[ATIME];
+    uint32_t full_scale = (cycles * 1024 < 65535) ? cycles * 1024 : 65535;
+    uint64_t clear = (uint64_t)_level * GAINS[_registers[CONTROL] & 0x03] * cycles;
+
+    clear = (clear < full_scale) ? clear : full_scale;
+    return (uint16_t)(clear * SHARE_PERCENT[channel] / 100);
+}
+
+uint64_t Tcs34725Device::ready_us() const {
+    return _ready_us;
+}
+
+// Command byte (register address, auto-increment or special function), then the registers
+bool Tcs34725Device::write(const char *data, int length){
+    uint8_t command = (uint8_t)data[0];
+
+    if (!(command & COMMAND_BIT)) {
+        return false;
+    }
+    if ((command & SPECIAL_FUNCTION) == SPECIAL_FUNCTION) {
+        return true;                                                        // Interrupt clear, nothing to do
+    }
+    _pointer = command & 0x1F;
+
+    for (int i = 1; i < length && _pointer < sizeof(_registers); i++, _pointer++) {
+        uint8_t value = (uint8_t)data[i];
+
+        if (_pointer == ENABLE) {
+            bool was_running = (_registers[ENABLE] & (ENABLE_PON | ENABLE_AEN)) == (ENABLE_PON | ENABLE_AEN);
+            bool running = (value & (ENABLE_PON | ENABLE_AEN)) == (ENABLE_PON | ENABLE_AEN);
+
+            if (running && !was_running) {
+                _ready_us = sim::now_us() + INIT_US + (uint64_t)CYCLE_US * (256 - _registers[ATIME]);
+                integrations++;
+            } else if (!running) {
+                _ready_us = UINT64_MAX;
+            }
+        }
+        _registers[_pointer] = value;
+    }
+    return true;
+}
+
+bool Tcs34725Device::read(char *data, int length){
+    for (int i = 0; i < length; i++) {
+        data[i] = (char)read_register(_pointer);
+        _pointer = (_pointer + 1) & 0x1F;
+    }
+    return true;
+}
+// PUBLIC FUNCTIONS END ================================================================
+
+// =====================================================================================
+// PRIVATE FUNCTIONS
+// =====================================================================================
+uint8_t Tcs34725Device::read_register(uint8_t address) const {
+    bool valid = sim::now_us() >= _ready_us;
+
+    if (address == STATUS) {
+        return valid ? 0x01 : 0x00;                                         // AVALID
+    }
+    if (address >= CDATAL && address < CDATAL + 8) {
+        uint16_t value = valid ? counts((address - CDATAL) / 2) : 0;
+
+        return ((address - CDATAL) % 2 == 0) ? (uint8_t)value : (uint8_t)(value >> 8);
+    }
+    return _registers[address];
+}
+// PRIVATE FUNCTIONS END ===============================================================
@@ -0,0 +1,43 @@
+/* File for the simulated TCS34725 colour sensor declarations */
+
+// LIBRARIES ------------------------------------------------------------------------------------
+#include "sim.h"
+
+// LIBRARY GUARD --------------------------------------------------------------------------------
+#ifndef TCS34725_DEVICE_H
+#define TCS34725_DEVICE_H
+
+// ==============================================================================================
+// TCS34725 DEVICE CLASS
+// ==============================================================================================
+// Register file of the TCS34725 on sim::i2c_bus(), behind its command byte. Setting AEN (with
+// PON) starts an RGBC cycle: AVALID comes up after the 2.4 ms initialisation and ATIME cycles of
+// 2.4 ms, dropping AEN clears it. The counts are the light level (clear counts per cycle at 1x)
+// times the gain and the cycles, up to the full scale. Wait states and interrupts are not modelled.
+class Tcs34725Device : public sim::I2CDevice {
+public:
+    Tcs34725Device(uint32_t level);
+    ~Tcs34725Device();
+
+    void attach();                                                // At its address on sim::i2c_bus()
+    uint16_t counts(int channel) const;                           // Clear, red, green, blue of a cycle at the current gain and ATIME
+    uint64_t ready_us() const;                                    // End of the cycle started by the last AEN
+
+    // What happened ----------------------------------------------------------------------------
+    uint32_t integrations;                                        // AEN set
+
+    // I2CDevice --------------------------------------------------------------------------------
+    bool write(const char *data, int length) override;
+    bool read(char *data, int length) override;
+
+private:
+    uint8_t read_register(uint8_t address) const;
+
+    uint32_t _level;
+    uint8_t _registers[0x20];
+    uint8_t _pointer;
+    uint64_t _ready_us;
+};
+// TCS34725 DEVICE CLASS END ====================================================================
+
+#endif
@@ -0,0 +1,133 @@
+/* Host benchmark of Spectrum::analyse(): us per analysis for every capture size, and the error of
+   the Q15 magnitudes against a double precision DFT with the same window and scaling */
+
+// LIBRARIES ---------------------------------------------------------------------------
+#include "spectrum.h"
+#include "unittest.h"
+#include <chrono>
+#include <math.h>
+#include <random>
+#include <vector>
+
+// MACROS ------------------------------------------------------------------------------
+#define SIGNALS            64                                         // Random captures per size
+#define REPETITIONS        20                                         // Passes over them per measurement
+#define RUNS               5                                          // Best of, against scheduling noise
+#define GRAVITY            4096
+
+// GLOBAL VARIABLES --------------------------------------------------------------------
+static volatile uint32_t sink;                                        // Keeps the results alive
+
+// =====================================================================================
+// HELPERS
+// =====================================================================================
+// Gravity, three tones at random bins and amplitudes, and sensor noise
+static std::vector<int16_t> capture(std::mt19937 &random, uint16_t points){
+    std::uniform_real_distribution<double> bin(1, points / 2 - 1), amplitude(5, 2000), phase(0, 2 * M_PI);
+    std::normal_distribution<double> noise(0, 4);
+    std::vector<int16_t> samples(points);
+    double f[3], a[3], p[3];
+
+    for (int i = 0; i < 3; i++) {
+        f[i] = bin(random);
+        a[i] = amplitude(random);
+        p[i] = phase(random);
+    }
+    for (uint16_t n = 0; n < points; n++) {
+        double value = GRAVITY + noise(random);
+
+        for (int i = 0; i < 3; i++) {
+            value += a[i] * sin(2 * M_PI * f[i] * n / points + p[i]);
+        }
+        samples[n] = (int16_t)lround(value);
+    }
+    return samples;
+}
+
+// Amplitude of every bin 0..points/2 as analyse() reports it: mean removed, Hann, 4 |X[k]| / N
+static std::vector<double> reference(const std::vector<int16_t> &samples){
+    size_t points = samples.size();
+    double mean = 0;
+    std::vector<double> result(points / 2 + 1);
+
+    for (size_t n = 0; n < points; n++) {
+        mean += samples[n] / (double)points;
+    }
+    for (size_t k = 0; k <= points / 2; k++) {
+        double re = 0, im = 0;
+
+        for (size_t n = 0; n < points; n++) {
+            double value = (samples[n] - mean) * (1 - cos(2 * M_PI * n / points)) / 2;
+
+            re += value * cos(2 * M_PI * k * n / points);
+            im -= value * sin(2 * M_PI * k * n / points);
+        }
+        result[k] = 4 * sqrt(re * re + im * im) / points;
+    }
+    return result;
+}
+// HELPERS END =========================================================================
+
+// =====================================================================================
+// TESTS
+// =====================================================================================
+TEST(SpectrumBench, AnalysePerSize){
+    std::mt19937 random(2026);
+    Spectrum spectrum;
+    spectrum_peak_t peaks[5];
+
+    printf("\nSpectrum::analyse(), %d random captures per size (gravity, 3 tones, noise), best of %d runs\n", SIGNALS, RUNS);
+    printf("points      us per analysis   ns per point   max error, counts   max error, %% of peak\n");
+
+    for (uint16_t points = SPECTRUM_MIN_POINTS; points <= SPECTRUM_MAX_POINTS; points *= 2) {
+        std::vector<std::vector<int16_t>> captures;
+        double max_error = 0, max_relative = 0;
+
+        for (int i = 0; i < SIGNALS; i++) {
+            captures.push_back(capture(random, points));
+        }
+
+        // Precision ------------------------------------------------------------------------
+        for (size_t i = 0; i < captures.size(); i++) {
+            std::vector<double> expected = reference(captures[i]);
+            double strongest = 0, error = 0;
+
+            spectrum.analyse(captures[i].data(), points, peaks, 5);
+            for (uint16_t k = 1; k <= points / 2; k++) {
+                strongest = std::max(strongest, expected[k]);
+                error = std::max(error, fabs(spectrum.magnitudes()[k] - expected[k]));
+            }
+            max_error = std::max(max_error, error);
+            max_relative = std::max(max_relative, error / strongest);
+        }
+
+        // Cost -----------------------------------------------------------------------------
+        double best_us = 0;
+
+        for (int run = 0; run < RUNS; run++) {
+            uint32_t sum = 0;
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+            for (int repetition = 0; repetition < REPETITIONS; repetition++) {
+                for (size_t i = 0; i < captures.size(); i++) {
+                    sum += spectrum.analyse(captures[i].data(), points, peaks, 5);
+                }
+            }
+
+            double elapsed_us = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count() / 1e3;
+            double analyses = 1.0 * REPETITIONS * captures.size();
+
+            sink = sink + sum;
+            if (run == 0 || elapsed_us / analyses < best_us) {
+                best_us = elapsed_us / analyses;
+            }
+        }
+
+        printf("%6u %18.2f %14.2f %19.1f %21.2f\n", points, best_us, best_us * 1000 / points, max_error, 100 * max_relative);
+
+        // Q15 with block scaling: a fraction of a percent of the strongest bin -------------
+        EXPECT_LT(max_relative, 0.025);
+    }
+    printf("(host figures; SPECTRUM_POINTS is 128 in main.cpp)\n\n");
+}
+// TESTS END ===========================================================================
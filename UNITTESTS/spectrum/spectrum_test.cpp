@@ -0,0 +1,121 @@
+/* Host test of the fixed-point spectrum on synthetic sinusoids: the strongest bin and its
+   amplitude in input counts, for every capture size, with gravity and small vibrations */
+
+// LIBRARIES ---------------------------------------------------------------------------
+#include "spectrum.h"
+#include "unittest.h"
+#include <math.h>
+#include <vector>
+
+// MACROS ------------------------------------------------------------------------------
+#define GRAVITY            4096                                       // 1 g in 14-bit counts at 2 g full scale
+#define AMPLITUDE_ERROR    0.03                                       // Relative, for a sinusoid on a bin
+
+// =====================================================================================
+// HELPERS
+// =====================================================================================
+// Sum of sinusoids at (fractional) bins, plus an offset
+static std::vector<int16_t> tones(uint16_t points, int16_t offset, std::vector<std::pair<double, double>> bins_amplitudes){
+    std::vector<int16_t> samples(points);
+
+    for (uint16_t n = 0; n < points; n++) {
+        double value = offset;
+
+        for (size_t i = 0; i < bins_amplitudes.size(); i++) {
+            value += bins_amplitudes[i].second * sin(2 * M_PI * bins_amplitudes[i].first * n / points + 0.3 * (i + 1));
+        }
+        samples[n] = (int16_t)lround(value);
+    }
+    return samples;
+}
+// HELPERS END =========================================================================
+
+// =====================================================================================
+// TESTS
+// =====================================================================================
+TEST(Spectrum, SinusoidOnEveryBin){
+    Spectrum spectrum;
+    spectrum_peak_t peaks[3];
+
+    for (uint16_t bin = 1; bin < 64; bin++) {
+        std::vector<int16_t> samples = tones(128, GRAVITY, {{bin, 1000}});
+
+        ASSERT_EQ(spectrum.analyse(samples.data(), 128, peaks, 3), 1);
+        EXPECT_EQ(peaks[0].bin, bin);
+        EXPECT_NEAR(peaks[0].amplitude, 1000, 1000 * AMPLITUDE_ERROR);
+    }
+}
+
+TEST(Spectrum, EveryCaptureSize){
+    Spectrum spectrum;
+    spectrum_peak_t peaks[1];
+
+    for (uint16_t points = SPECTRUM_MIN_POINTS; points <= SPECTRUM_MAX_POINTS; points *= 2) {
+        uint16_t bin = points / 5;
+        std::vector<int16_t> samples = tones(points, -GRAVITY, {{bin, 2500}});
+
+        ASSERT_EQ(spectrum.analyse(samples.data(), points, peaks, 1), 1);
+        EXPECT_EQ(peaks[0].bin, bin);
+        EXPECT_NEAR(peaks[0].amplitude, 2500, 2500 * AMPLITUDE_ERROR);
+        EXPECT_LT(spectrum.magnitudes()[0], 2500 / 100);              // The offset is removed before the window
+    }
+}
+
+TEST(Spectrum, TwoTonesStrongestFirst){
+    Spectrum spectrum;
+    spectrum_peak_t peaks[5];
+
+    std::vector<int16_t> samples = tones(128, GRAVITY, {{30, 500}, {10, 2000}});
+    uint8_t found = spectrum.analyse(samples.data(), 128, peaks, 5);
+    ASSERT_GT(found, 1);
+    EXPECT_EQ(peaks[0].bin, 10);
+    EXPECT_EQ(peaks[1].bin, 30);
+    EXPECT_NEAR(peaks[0].amplitude, 2000, 2000 * AMPLITUDE_ERROR);
+    EXPECT_NEAR(peaks[1].amplitude, 500, 500 * AMPLITUDE_ERROR);
+    for (uint8_t i = 2; i < found; i++) {
+        EXPECT_LT(peaks[i].amplitude, 2000 / 100);                    // Rounding noise only
+    }
+}
+
+TEST(Spectrum, SmallVibrationKeepsItsResolution){
+    Spectrum spectrum;
+    spectrum_peak_t peaks[1];
+
+    std::vector<int16_t> samples = tones(128, GRAVITY, {{17, 12}});   // 3 mg on top of 1 g, block scaling brings it up
+    ASSERT_GT(spectrum.analyse(samples.data(), 128, peaks, 1), 0);
+    EXPECT_EQ(peaks[0].bin, 17);
+    EXPECT_NEAR(peaks[0].amplitude, 12, 2);
+}
+
+TEST(Spectrum, FrequencyBetweenBins){
+    Spectrum spectrum;
+    spectrum_peak_t peaks[1];
+
+    std::vector<int16_t> samples = tones(128, 0, {{20.3, 1500}});
+    ASSERT_GT(spectrum.analyse(samples.data(), 128, peaks, 1), 0);
+    EXPECT_EQ(peaks[0].bin, 20);
+    EXPECT_GT(peaks[0].amplitude, 1500 * 0.8);                        // Hann scalloping loss stays below 1.5 dB
+    EXPECT_LT(peaks[0].amplitude, 1500);
+}
+
+TEST(Spectrum, FullScaleDoesNotOverflow){
+    Spectrum spectrum;
+    spectrum_peak_t peaks[1];
+
+    std::vector<int16_t> samples = tones(256, 0, {{40, 8191}});       // 14-bit full scale
+    ASSERT_EQ(spectrum.analyse(samples.data(), 256, peaks, 1), 1);
+    EXPECT_EQ(peaks[0].bin, 40);
+    EXPECT_NEAR(peaks[0].amplitude, 8191, 8191 * AMPLITUDE_ERROR);
+}
+
+TEST(Spectrum, RejectsBadSizesAndSilence){
+    Spectrum spectrum;
+    spectrum_peak_t peaks[1];
+    std::vector<int16_t> samples(512, GRAVITY);
+
+    EXPECT_EQ(spectrum.analyse(samples.data(), 100, peaks, 1), 0);
+    EXPECT_EQ(spectrum.analyse(samples.data(), 8, peaks, 1), 0);
+    EXPECT_EQ(spectrum.analyse(samples.data(), 512, peaks, 1), 0);
+    EXPECT_EQ(spectrum.analyse(samples.data(), 128, peaks, 1), 0);    // Constant: nothing but DC
+}
+// TESTS END ===========================================================================
@@ -0,0 +1,14 @@
+/* Host stand-in for the KVStore global API, an in-memory store (see sim::kv_store()) */
+
+// LIBRARIES ------------------------------------------------------------------------------------
+#include "mbed.h"
+
+// LIBRARY GUARD --------------------------------------------------------------------------------
+#ifndef KVSTORE_GLOBAL_API_H
+#define KVSTORE_GLOBAL_API_H
+
+int kv_set(const char *full_name_key, const void *buffer, size_t size, uint32_t create_flags);
+int kv_get(const char *full_name_key, void *buffer, size_t buffer_size, size_t *actual_size);
+int kv_remove(const char *full_name_key);
+
+#endif
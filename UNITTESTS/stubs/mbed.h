@@ -0,0 +1,558 @@
+/* Host stand-in for mbed.h: the part of the Mbed OS API used by the modules under test, on top
+   of the virtual clock and simulated peripherals of sim.h */
+
+// LIBRARIES ------------------------------------------------------------------------------------
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/types.h>
+#include <chrono>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "sim.h"
+
+// LIBRARY GUARD --------------------------------------------------------------------------------
+#ifndef MBED_H
+#define MBED_H
+
+using namespace std::chrono_literals;
+
+// ==============================================================================================
+// PLATFORM
+// ==============================================================================================
+typedef enum {
+    PA_0, PA_4, PA_5, PA_8, PA_9, PA_10, PA_13, PA_14, PB_2, PB_5, PB_6, PB_7, PB_8, PB_9, PH_0, PH_1,
+    NC = -1
+} PinName;
+
+typedef enum {
+    PullNone, PullUp, PullDown
+} PinMode;
+
+#define MBED_ASSERT(expr)            assert(expr)
+#define MBED_SUCCESS                 0
+#define MBED_ERROR_ITEM_NOT_FOUND    (-311)
+
+#define osOK                         0
+#define osWaitForever                0xFFFFFFFFU
+#define osFlagsError                 0x80000000U
+#define osFlagsErrorTimeout          0xFFFFFFFEU
+#define OS_STACK_SIZE                4096
+
+typedef int32_t osStatus;
+typedef enum {
+    osPriorityLow         = 8,
+    osPriorityBelowNormal = 16,
+    osPriorityNormal      = 24,
+    osPriorityAboveNormal = 32,
+    osPriorityHigh        = 40
+} osPriority;
+
+#define DEVICE_I2C_ASYNCH            1
+#define I2C_EVENT_ERROR              (1 << 1)
+#define I2C_EVENT_ERROR_NO_SLAVE     (1 << 2)
+#define I2C_EVENT_TRANSFER_COMPLETE  (1 << 3)
+#define I2C_EVENT_TRANSFER_EARLY_NACK (1 << 4)
+#define I2C_EVENT_ALL                (I2C_EVENT_ERROR | I2C_EVENT_TRANSFER_COMPLETE | I2C_EVENT_ERROR_NO_SLAVE | I2C_EVENT_TRANSFER_EARLY_NACK)
+
+typedef enum {
+    DMA_USAGE_NEVER,
+    DMA_USAGE_OPPORTUNISTIC,
+    DMA_USAGE_ALWAYS
+} DMAUsage;
+
+// Atomics and critical sections ----------------------------------------------------------------
+inline std::recursive_mutex &critical_section_mutex(){            // Stands in for the interrupt mask
+    static std::recursive_mutex mutex;
+    return mutex;
+}
+
+inline void core_util_critical_section_enter(){ critical_section_mutex().lock(); }
+inline void core_util_critical_section_exit(){ critical_section_mutex().unlock(); }
+
+inline uint32_t core_util_atomic_load_u32(const volatile uint32_t *p){ return __atomic_load_n(p, __ATOMIC_SEQ_CST); }
+inline void core_util_atomic_store_u32(volatile uint32_t *p, uint32_t v){ __atomic_store_n(p, v, __ATOMIC_SEQ_CST); }
+inline uint8_t core_util_atomic_load_u8(const volatile uint8_t *p){ return __atomic_load_n(p, __ATOMIC_SEQ_CST); }
+inline void core_util_atomic_store_u8(volatile uint8_t *p, uint8_t v){ __atomic_store_n(p, v, __ATOMIC_SEQ_CST); }
+inline bool core_util_atomic_load_bool(const volatile bool *p){ return __atomic_load_n(p, __ATOMIC_SEQ_CST); }
+inline void core_util_atomic_store_bool(volatile bool *p, bool v){ __atomic_store_n(p, v, __ATOMIC_SEQ_CST); }
+inline uint32_t core_util_atomic_incr_u32(volatile uint32_t *p, uint32_t d){ return __atomic_add_fetch(p, d, __ATOMIC_SEQ_CST); }
+inline uint32_t core_util_atomic_exchange_u32(volatile uint32_t *p, uint32_t v){ return __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST); }
+inline uint32_t core_util_atomic_fetch_or_u32(volatile uint32_t *p, uint32_t v){ return __atomic_fetch_or(p, v, __ATOMIC_SEQ_CST); }
+#define MBED_BARRIER() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+// PLATFORM END =================================================================================
+
+// ==============================================================================================
+// RTOS
+// ==============================================================================================
+namespace rtos {
+
+struct Kernel {
+    struct Clock {                                                // Millisecond ticks of the virtual clock
+        typedef std::chrono::milliseconds duration;
+        typedef duration::rep rep;
+        typedef duration::period period;
+        typedef std::chrono::time_point<Clock> time_point;
+        static constexpr bool is_steady = true;
+
+        static time_point now(){ return time_point(duration(sim::now_us() / 1000)); }
+    };
+};
+
+inline uint64_t to_us(Kernel::Clock::time_point time){
+    return time.time_since_epoch().count() < 0 ? 0 : (uint64_t)time.time_since_epoch().count() * 1000;
+}
+
+namespace ThisThread {
+inline void sleep_for(Kernel::Clock::duration duration){
+    sim::count_block();
+    sim::advance(duration.count() > 0 ? (uint64_t)duration.count() * 1000 : 0);
+    sim::count_wakeup();
+}
+inline void sleep_until(Kernel::Clock::time_point time){
+    sim::count_block();
+    sim::advance_to(to_us(time) > sim::now_us() ? to_us(time) : sim::now_us());
+    sim::count_wakeup();
+}
+inline void yield(){ std::this_thread::yield(); }
+}
+
+// Scripted run: the events are the only thing that can set the flags, so a wait runs them until
+// it is satisfied. Otherwise the flags are set by other host threads (the I2C bus thread)
+class EventFlags {
+public:
+    EventFlags(const char * = nullptr) : _flags(0), _waiters(0), _closing(false) {}
+
+    ~EventFlags(){                                                // Lets a thread still waiting leave with sim::ThreadExit
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        _closing = true;
+        _condition.notify_all();
+        _condition.wait(lock, [this]{ return _waiters == 0; });
+    }
+
+    uint32_t set(uint32_t flags){
+        uint32_t result;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            result = (_flags |= flags);
+        }
+        _condition.notify_all();
+        return result;
+    }
+
+    uint32_t clear(uint32_t flags = 0x7FFFFFFF){
+        std::lock_guard<std::mutex> lock(_mutex);
+        uint32_t result = _flags;
+
+        _flags &= ~flags;
+        return result;
+    }
+
+    uint32_t get() const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _flags;
+    }
+
+    uint32_t wait_any(uint32_t flags, uint32_t millisec = osWaitForever, bool clear = true){ return wait(flags, false, deadline(millisec), clear); }
+    uint32_t wait_all(uint32_t flags, uint32_t millisec = osWaitForever, bool clear = true){ return wait(flags, true, deadline(millisec), clear); }
+    uint32_t wait_any_for(uint32_t flags, Kernel::Clock::duration rel_time, bool clear = true){ return wait(flags, false, sim::now_us() + rel_time.count() * 1000, clear); }
+    uint32_t wait_all_for(uint32_t flags, Kernel::Clock::duration rel_time, bool clear = true){ return wait(flags, true, sim::now_us() + rel_time.count() * 1000, clear); }
+    uint32_t wait_any_until(uint32_t flags, Kernel::Clock::time_point abs_time, bool clear = true){ return wait(flags, false, to_us(abs_time), clear); }
+    uint32_t wait_all_until(uint32_t flags, Kernel::Clock::time_point abs_time, bool clear = true){ return wait(flags, true, to_us(abs_time), clear); }
+
+private:
+    static const uint64_t FOREVER = UINT64_MAX;
+
+    static uint64_t deadline(uint32_t millisec){
+        return millisec == osWaitForever ? FOREVER : sim::now_us() + (uint64_t)millisec * 1000;
+    }
+
+    uint32_t wait(uint32_t flags, bool all, uint64_t deadline_us, bool clear){
+        sim::count_block();
+        std::unique_lock<std::mutex> lock(_mutex);
+        Waiter waiter(*this, lock);
+
+        while (true) {
+            if (_closing) {
+                throw sim::ThreadExit();
+            }
+
+            uint32_t match = _flags & flags;
+            if (all ? match == flags : match != 0) {
+                uint32_t result = _flags;
+
+                if (clear) {
+                    _flags &= ~flags;
+                }
+                sim::count_wakeup();
+                return result;
+            }
+            if (deadline_us != FOREVER && sim::now_us() >= deadline_us) {
+                sim::count_wakeup();
+                return osFlagsErrorTimeout;
+            }
+
+            if (sim::running()) {
+                lock.unlock();
+                if (!sim::run_next(deadline_us)) {
+                    if (deadline_us == FOREVER) {
+                        throw sim::SimulationEnd();                       // Nothing left that could wake this thread up
+                    }
+                    sim::advance_to(deadline_us);
+                }
+                lock.lock();
+            } else if (deadline_us == FOREVER) {
+                _condition.wait(lock);
+            } else if (_condition.wait_for(lock, std::chrono::milliseconds(20)) == std::cv_status::timeout) {
+                lock.unlock();
+                sim::advance_to(deadline_us);                             // Nobody set the flags in time, give up at the virtual deadline
+                lock.lock();
+            }
+        }
+    }
+
+    struct Waiter {                                               // Counts the thread in until it leaves, even by an exception
+        EventFlags &flags;
+        std::unique_lock<std::mutex> &lock;
+
+        Waiter(EventFlags &f, std::unique_lock<std::mutex> &l) : flags(f), lock(l) { flags._waiters++; }
+        ~Waiter(){
+            if (!lock.owns_lock()) {
+                lock.lock();
+            }
+            flags._waiters--;
+            flags._condition.notify_all();
+        }
+    };
+
+    mutable std::mutex _mutex;
+    std::condition_variable _condition;
+    uint32_t _flags;
+    uint32_t _waiters;
+    bool _closing;
+};
+
+class Semaphore {
+public:
+    Semaphore(int32_t count = 0, uint16_t max_count = 0xFFFF) : _count(count), _max(max_count) {}
+
+    void acquire(){
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        while (_count == 0) {
+            if (sim::running()) {
+                lock.unlock();
+                if (!sim::run_next(UINT64_MAX)) {
+                    throw sim::SimulationEnd();
+                }
+                lock.lock();
+            } else {
+                _condition.wait(lock);
+            }
+        }
+        _count--;
+    }
+
+    bool try_acquire(){
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        if (_count == 0) {
+            return false;
+        }
+        _count--;
+        return true;
+    }
+
+    osStatus release(){
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_count < _max) {
+                _count++;
+            }
+        }
+        _condition.notify_all();
+        return osOK;
+    }
+
+private:
+    std::mutex _mutex;
+    std::condition_variable _condition;
+    int32_t _count;
+    uint16_t _max;
+};
+
+class Mutex {                                                     // Recursive, as the RTX one
+public:
+    void lock(){ _mutex.lock(); }
+    void unlock(){ _mutex.unlock(); }
+    bool trylock(){ return _mutex.try_lock(); }
+
+private:
+    std::recursive_mutex _mutex;
+};
+
+}
+// RTOS END =====================================================================================
+
+// ==============================================================================================
+// DRIVERS
+// ==============================================================================================
+namespace mbed {
+
+template <typename F> class Callback;
+
+template <typename R, typename... A>
+class Callback<R(A...)> {
+public:
+    Callback(){}
+    Callback(std::nullptr_t){}
+    Callback(R (*function)(A...)){ if (function != nullptr) { _function = function; } }
+    template <typename T, typename M>
+    Callback(T *object, M method) : _function([object, method](A... args) -> R { return (object->*method)(args...); }) {}
+    template <typename F, typename = typename std::enable_if<!std::is_pointer<F>::value && !std::is_same<F, Callback>::value>::type>
+    Callback(F function) : _function(function) {}
+
+    R operator()(A... args) const { return _function(args...); }
+    R call(A... args) const { return _function(args...); }
+    explicit operator bool() const { return (bool)_function; }
+
+private:
+    std::function<R(A...)> _function;
+};
+
+template <typename R, typename... A>
+Callback<R(A...)> callback(R (*function)(A...)){ return Callback<R(A...)>(function); }
+template <typename T, typename R, typename... A>
+Callback<R(A...)> callback(T *object, R (T::*method)(A...)){ return Callback<R(A...)>(object, method); }
+template <typename T, typename R, typename... A>
+Callback<R(A...)> callback(const T *object, R (T::*method)(A...) const){ return Callback<R(A...)>(object, method); }
+
+typedef Callback<void(int)> event_callback_t;
+
+class CriticalSectionLock {
+public:
+    CriticalSectionLock(){ core_util_critical_section_enter(); }
+    ~CriticalSectionLock(){ core_util_critical_section_exit(); }
+};
+
+// Timers on the virtual clock. The high resolution Timer holds the deep sleep lock while it runs
+class TimerBase {
+public:
+    TimerBase(bool lock_deep_sleep) : _lock_deep_sleep(lock_deep_sleep), _running(false), _start_us(0), _elapsed_us(0) {}
+    ~TimerBase(){ stop(); }
+
+    void start(){
+        if (!_running) {
+            _running = true;
+            _start_us = sim::now_us();
+            if (_lock_deep_sleep) {
+                sim::lock_deep_sleep();
+            }
+        }
+    }
+
+    void stop(){
+        if (_running) {
+            _elapsed_us += sim::now_us() - _start_us;
+            _running = false;
+            if (_lock_deep_sleep) {
+                sim::unlock_deep_sleep();
+            }
+        }
+    }
+
+    void reset(){
+        _start_us = sim::now_us();
+        _elapsed_us = 0;
+    }
+
+    std::chrono::microseconds elapsed_time() const {
+        return std::chrono::microseconds(_elapsed_us + (_running ? sim::now_us() - _start_us : 0));
+    }
+
+private:
+    bool _lock_deep_sleep;
+    bool _running;
+    uint64_t _start_us;
+    uint64_t _elapsed_us;
+};
+
+class Timer : public TimerBase {
+public:
+    Timer() : TimerBase(true) {}
+};
+
+class LowPowerTimer : public TimerBase {
+public:
+    LowPowerTimer() : TimerBase(false) {}
+};
+
+// Same behaviour as the Mbed one: push() overwrites the oldest element when full
+template <typename T, uint32_t BufferSize, typename CounterType = uint32_t>
+class CircularBuffer {
+public:
+    CircularBuffer() : _head(0), _tail(0), _full(false) {}
+
+    void push(const T &data){
+        if (_full) {
+            _tail = incr(_tail);
+        }
+        _pool[_head] = data;
+        _head = incr(_head);
+        _full = (_head == _tail);
+    }
+
+    bool pop(T &data){
+        if (empty()) {
+            return false;
+        }
+        data = _pool[_tail];
+        _tail = incr(_tail);
+        _full = false;
+        return true;
+    }
+
+    CounterType pop(T *dest, CounterType len){
+        CounterType count = 0;
+
+        while (count < len && pop(dest[count])) {
+            count++;
+        }
+        return count;
+    }
+
+    bool empty() const { return _head == _tail && !_full; }
+    bool full() const { return _full; }
+    void reset(){ _head = _tail = 0; _full = false; }
+
+    CounterType size() const {
+        if (_full) {
+            return BufferSize;
+        }
+        return (_head >= _tail) ? _head - _tail : BufferSize + _head - _tail;
+    }
+
+private:
+    static CounterType incr(CounterType index){ return (index + 1) % BufferSize; }
+
+    T _pool[BufferSize];
+    CounterType _head;
+    CounterType _tail;
+    bool _full;
+};
+
+// The UART and I2C drivers talk to the simulated devices of sim::uart() and sim::i2c_bus()
+class SerialBase {
+public:
+    enum Parity { None = 0, Odd, Even, Forced1, Forced0 };
+    enum IrqType { RxIrq = 0, TxIrq };
+
+    void baud(int baudrate){ sim::uart().baud(baudrate); }
+    void format(int = 8, Parity = None, int = 1){}
+    int readable(){ return sim::uart().readable(); }
+
+    void attach(Callback<void()> func, IrqType type = RxIrq){
+        if (type == RxIrq) {
+            sim::uart().attach(func ? std::function<void()>([func]{ func(); }) : std::function<void()>());
+        }
+    }
+};
+
+class UnbufferedSerial : public SerialBase {
+public:
+    UnbufferedSerial(PinName, PinName, int = 9600){}
+
+    ssize_t read(void *buffer, size_t size){ return sim::uart().read((char *)buffer, size); }
+    ssize_t write(const void *buffer, size_t size){ sim::uart().write((const char *)buffer, size); return size; }
+};
+
+class I2C {
+public:
+    I2C(PinName, PinName){}
+
+    void frequency(int hz){ sim::i2c_bus().frequency(hz); }
+    int write(int address, const char *data, int length, bool = false){ return sim::i2c_bus().transfer(address, data, length, nullptr, 0); }
+    int read(int address, char *data, int length, bool = false){ return sim::i2c_bus().transfer(address, nullptr, 0, data, length); }
+
+    int transfer(int address, const char *tx, int tx_length, char *rx, int rx_length, const event_callback_t &callback,
+                 int event = I2C_EVENT_TRANSFER_COMPLETE, bool = false){   // Completes before returning, the callback runs from here
+        int result = sim::i2c_bus().transfer(address, tx, tx_length, rx, rx_length);
+        int done = (result == 0) ? I2C_EVENT_TRANSFER_COMPLETE : I2C_EVENT_ERROR_NO_SLAVE;
+
+        if (callback && (done & event)) {
+            callback(done);
+        }
+        return 0;
+    }
+
+    void abort_transfer(){}
+    int set_dma_usage(DMAUsage){ return 0; }
+    void lock(){}
+    void unlock(){}
+};
+
+class DigitalOut {
+public:
+    DigitalOut(PinName, int value = 0) : _value(value) {}
+    void write(int value){ _value = value; }
+    int read(){ return _value; }
+    DigitalOut &operator=(int value){ _value = value; return *this; }
+    operator int(){ return _value; }
+
+private:
+    int _value;
+};
+
+class AnalogIn {                                                  // Declared by the analog sampler, not simulated
+public:
+    AnalogIn(PinName){}
+    uint16_t read_u16(){ return 0; }
+};
+
+}
+// DRIVERS END ==================================================================================
+
+// ==============================================================================================
+// THREADS
+// ==============================================================================================
+namespace rtos {
+
+class Thread {                                                    // A host thread, joined when the object goes
+public:
+    Thread(osPriority = osPriorityNormal, uint32_t = OS_STACK_SIZE, unsigned char * = nullptr, const char * = nullptr){}
+    ~Thread(){ join(); }
+
+    osStatus start(mbed::Callback<void()> task){
+        _thread = std::thread([task]{
+            try {
+                task();
+            } catch (sim::ThreadExit &) {
+            }
+        });
+        return osOK;
+    }
+
+    osStatus join(){
+        if (_thread.joinable()) {
+            _thread.join();
+        }
+        return osOK;
+    }
+
+private:
+    std::thread _thread;
+};
+
+}
+// THREADS END ==================================================================================
+
+using namespace mbed;
+using namespace rtos;
+
+#endif